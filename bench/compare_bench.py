@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+#
+# Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Compares benchmark results of run_bench.py against a baseline, and flags
+the measurements that are worse than the baseline by more than the
+threshold. Exits with 1 if there are regressions, and with 2 if the two
+results were run with a different configuration.
+
+  python3 bench/compare_bench.py baseline.json bench/results/latest.json --threshold 0.1
+"""
+
+import argparse
+import json
+import sys
+
+# Measurement, and whether higher is better
+MEASUREMENTS = [
+    ("runtime_s", False),
+    ("edges_per_sec", True),
+    ("io_bytes_read", False),
+    ("io_bytes_written", False),
+    ("peak_rss_mb", False),
+]
+
+
+def change(base, cur, higher_is_better):
+    """Relative change, positive when worse."""
+    if base == 0:
+        return 0.0
+    rel = (cur - base) / float(base)
+    return -rel if higher_is_better else rel
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compares GraphChi benchmark results to a baseline.")
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=0.10,
+                        help="relative change that is a regression (default 0.10)")
+    parser.add_argument("--phases", action="store_true", help="also show the timed phases")
+    args = parser.parse_args()
+
+    with open(args.baseline) as f:
+        base = json.load(f)
+    with open(args.current) as f:
+        cur = json.load(f)
+
+    basecfg = dict(base.get("config", {}))
+    curcfg = dict(cur.get("config", {}))
+    basecfg.pop("repeat", None)
+    curcfg.pop("repeat", None)
+    if basecfg != curcfg:
+        print("Configurations differ, results are not comparable:")
+        print("  baseline: %s" % json.dumps(basecfg, sort_keys=True))
+        print("  current:  %s" % json.dumps(curcfg, sort_keys=True))
+        sys.exit(2)
+
+    print("Baseline %s (%s), current %s (%s), threshold %.0f%%" % (
+        base.get("revision", "")[:10], base.get("timestamp", ""),
+        cur.get("revision", "")[:10], cur.get("timestamp", ""), args.threshold * 100))
+
+    regressions = []
+    for app in sorted(base.get("apps", {})):
+        b = base["apps"][app]
+        c = cur.get("apps", {}).get(app)
+        if b.get("status") != "ok":
+            continue
+        if c is None or c.get("status") != "ok":
+            print("%-20s %s in the current results" % (app, "missing" if c is None else c.get("status")))
+            if c is not None and c.get("status") == "failed":
+                regressions.append((app, "status", 0, 0, 0))
+            continue
+        for key, higher_is_better in MEASUREMENTS:
+            bv, cv = b.get(key, 0.0), c.get(key, 0.0)
+            d = change(bv, cv, higher_is_better)
+            flag = ""
+            if d > args.threshold:
+                flag = "REGRESSION"
+                regressions.append((app, key, bv, cv, d))
+            elif d < -args.threshold:
+                flag = "improved"
+            print("%-20s %-18s %16.4g %16.4g %+8.1f%%  %s" % (
+                app, key, bv, cv, (cv - bv) * 100.0 / bv if bv else 0.0, flag))
+        if args.phases:
+            for phase in sorted(b.get("phases", {})):
+                bv = b["phases"][phase]
+                cv = c.get("phases", {}).get(phase)
+                if cv is None:
+                    continue
+                print("%-20s   %-30s %10.4f %10.4f" % (app, phase, bv, cv))
+
+    if regressions:
+        print("%d regression(s):" % len(regressions))
+        for app, key, bv, cv, d in regressions:
+            if key == "status":
+                print("  %s: failed" % app)
+            else:
+                print("  %s %s: %.4g -> %.4g (%.1f%% worse)" % (app, key, bv, cv, d * 100))
+        sys.exit(1)
+    print("No regressions.")
+
+
+if __name__ == "__main__":
+    main()
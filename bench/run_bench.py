@@ -0,0 +1,228 @@
+#!/usr/bin/env python3
+#
+# Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Benchmark suite of GraphChi. Generates synthetic graphs with bin/generate
+(RMAT and a rating matrix, with fixed seeds), runs the benchmark
+applications on them, and writes the results as JSON:
+
+  - runtime of the engine and the wall time of the process,
+  - edges processed per second,
+  - bytes read and written,
+  - peak resident memory of the process and the peak tracked by the engine,
+  - the timed phases of the engine (metrics of type time).
+
+Each run starts from the input file in an empty directory, so sharding is
+included in the wall time but not in the engine runtime. With --repeat,
+the median run is reported.
+
+Usually run with "make bench", see also compare_bench.py.
+
+  python3 bench/run_bench.py --scale 18 --repeat 3 --out bench/results/latest.json
+"""
+
+import argparse
+import json
+import os
+import platform
+import shutil
+import subprocess
+import sys
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# Applications of the suite. "input" is the generated input it runs on.
+APPS = {
+    "pagerank": {
+        "binary": "bin/example_apps/pagerank",
+        "input": "rmat",
+        "args": ["filetype", "edgelist", "niters", "{niters}"],
+    },
+    "connectedcomponents": {
+        "binary": "bin/example_apps/connectedcomponents",
+        "input": "rmat",
+        "args": ["filetype", "edgelist", "niters", "1000", "onlyresult", "1"],
+    },
+    "trianglecounting": {
+        "binary": "bin/example_apps/trianglecounting",
+        "input": "rmat",
+        "args": ["filetype", "edgelist"],
+    },
+    "randomwalks": {
+        "binary": "bin/example_apps/randomwalks",
+        "input": "rmat",
+        "args": ["filetype", "edgelist", "niters", "{niters}"],
+    },
+    "als": {
+        "binary": "bin/example_apps/matrix_factorization/als_edgefactors",
+        "input": "ratings",
+        "args": ["niters", "{niters}"],
+    },
+}
+
+
+def generate_inputs(args, datadir):
+    """Generates the input graphs, unless they exist for the same parameters."""
+    nvertices = 1 << args.scale
+    inputs = {
+        "rmat": ("rmat", args.scale, nvertices * args.edgefactor,
+                 "rmat_s%d_e%d_seed%d.edgelist" % (args.scale, args.edgefactor, args.seed)),
+        "ratings": ("ratings", nvertices, nvertices * args.edgefactor,
+                    "ratings_s%d_e%d_seed%d.mm" % (args.scale, args.edgefactor, args.seed)),
+    }
+    paths = {}
+    for name, (gtype, n, nedges, fname) in inputs.items():
+        path = os.path.join(datadir, fname)
+        if not os.path.exists(path):
+            subprocess.check_call([os.path.join(ROOT, "bin", "generate"), gtype, str(n),
+                                   str(nedges), str(args.seed), path], stdout=subprocess.DEVNULL)
+        paths[name] = path
+    return paths
+
+
+def run_app(name, app, inputpath, args, workdir):
+    """Runs an application once. Returns the measurements of the run."""
+    if os.path.exists(workdir):
+        shutil.rmtree(workdir)
+    os.makedirs(workdir)
+    graph = os.path.join(workdir, os.path.basename(inputpath))
+    shutil.copy(inputpath, graph)
+    metricsfile = os.path.join(workdir, "metrics.json")
+    cmd = [os.path.join(ROOT, app["binary"]), "file", graph, "nshards", str(args.nshards)]
+    cmd += [a.format(niters=args.niters) for a in app["args"]]
+    cmd += ["metrics.reporter", "json", "metrics.reporter.jsonfile", metricsfile]
+    if args.execthreads > 0:
+        cmd += ["execthreads", str(args.execthreads)]
+
+    log = open(os.path.join(workdir, "output.log"), "w")
+    t0 = time.time()
+    proc = subprocess.Popen(cmd, cwd=ROOT, stdout=log, stderr=subprocess.STDOUT, stdin=subprocess.DEVNULL)
+    # wait4 gives the resource usage of this child only
+    _, status, usage = os.wait4(proc.pid, 0)
+    wall = time.time() - t0
+    log.close()
+    proc.returncode = os.waitstatus_to_exitcode(status) if hasattr(os, "waitstatus_to_exitcode") else status
+    if proc.returncode != 0 or not os.path.exists(metricsfile):
+        return {"status": "failed", "returncode": proc.returncode, "log": os.path.join(workdir, "output.log")}
+
+    with open(metricsfile) as f:
+        metrics = json.load(f)["metrics"]
+
+    def value(key, default=0.0):
+        ent = metrics.get(key)
+        return ent["value"] if ent is not None and ent.get("value") is not None else default
+
+    def vector_sum(key):
+        ent = metrics.get(key)
+        return sum(x for x in ent["values"] if x is not None) if ent is not None else 0.0
+
+    runtime = value("runtime")
+    work = value("work")
+    run = {
+        "status": "ok",
+        "wall_s": wall,
+        "runtime_s": runtime,
+        "updates": value("updates"),
+        "edges_processed": work,
+        "edges_per_sec": (work / runtime if runtime > 0 else 0.0),
+        "io_bytes_read": vector_sum("io.disk_bytes_read"),
+        "io_bytes_written": vector_sum("io.disk_bytes_written"),
+        "peak_rss_mb": usage.ru_maxrss / 1024.0,   # Kilobytes on Linux
+        "tracked_peak_mb": value("memory.total_peak_mb"),
+        "phases": dict((k, v["value"]) for k, v in sorted(metrics.items())
+                       if v.get("type") == "time" and v.get("value") is not None),
+    }
+    return run
+
+
+def git_revision():
+    try:
+        return subprocess.check_output(["git", "rev-parse", "HEAD"], cwd=ROOT,
+                                       stderr=subprocess.DEVNULL).decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        return ""
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Runs the GraphChi benchmark suite.")
+    parser.add_argument("--scale", type=int, default=16, help="log2 of the number of vertices (default 16)")
+    parser.add_argument("--edgefactor", type=int, default=16, help="edges per vertex (default 16)")
+    parser.add_argument("--seed", type=int, default=1, help="seed of the generated graphs (default 1)")
+    parser.add_argument("--niters", type=int, default=5, help="iterations of the iterative apps (default 5)")
+    parser.add_argument("--nshards", type=int, default=4, help="number of shards (default 4)")
+    parser.add_argument("--execthreads", type=int, default=0, help="execution threads, 0 for the default")
+    parser.add_argument("--repeat", type=int, default=1, help="runs of each app, the median is reported")
+    parser.add_argument("--apps", default=",".join(sorted(APPS.keys())), help="comma-separated list of apps")
+    parser.add_argument("--workdir", default=os.path.join(ROOT, "bench", "work"), help="graphs and runs")
+    parser.add_argument("--out", default=os.path.join(ROOT, "bench", "results", "latest.json"))
+    args = parser.parse_args()
+
+    if not os.path.exists(os.path.join(ROOT, "bin", "generate")):
+        sys.exit("bin/generate not found, run 'make generate' first.")
+    datadir = os.path.join(args.workdir, "data")
+    os.makedirs(datadir, exist_ok=True)
+    inputs = generate_inputs(args, datadir)
+
+    results = {
+        "schema": 1,
+        "timestamp": time.strftime("%Y-%m-%dT%H:%M:%S"),
+        "host": platform.node(),
+        "revision": git_revision(),
+        "config": {
+            "scale": args.scale, "edgefactor": args.edgefactor, "seed": args.seed,
+            "niters": args.niters, "nshards": args.nshards, "execthreads": args.execthreads,
+            "repeat": args.repeat,
+        },
+        "apps": {},
+    }
+
+    for name in args.apps.split(","):
+        app = APPS.get(name)
+        if app is None:
+            sys.exit("Unknown app: %s (apps: %s)" % (name, ", ".join(sorted(APPS.keys()))))
+        if not os.path.exists(os.path.join(ROOT, app["binary"])):
+            print("%-20s skipped, %s is not built" % (name, app["binary"]))
+            results["apps"][name] = {"status": "missing"}
+            continue
+        runs = []
+        for r in range(args.repeat):
+            run = run_app(name, app, inputs[app["input"]], args, os.path.join(args.workdir, name))
+            if run["status"] != "ok":
+                print("%-20s FAILED, see %s" % (name, run["log"]))
+                runs = [run]
+                break
+            runs.append(run)
+        if runs[0]["status"] != "ok":
+            results["apps"][name] = runs[0]
+            continue
+        median = sorted(runs, key=lambda x: x["runtime_s"])[len(runs) // 2]
+        summary = dict(median)
+        summary["runs"] = [dict((k, v) for k, v in run.items() if k != "phases") for run in runs]
+        results["apps"][name] = summary
+        print("%-20s runtime %8.3f s  %12.0f edges/s  read %8.1f MB  written %8.1f MB  peak rss %7.1f MB" % (
+            name, median["runtime_s"], median["edges_per_sec"], median["io_bytes_read"] / 1e6,
+            median["io_bytes_written"] / 1e6, median["peak_rss_mb"]))
+
+    outdir = os.path.dirname(os.path.abspath(args.out))
+    os.makedirs(outdir, exist_ok=True)
+    with open(args.out, "w") as f:
+        json.dump(results, f, indent=2, sort_keys=True)
+    print("Wrote %s" % args.out)
+
+
+if __name__ == "__main__":
+    main()
@@ -25,118 +25,65 @@
  * @section DESCRIPTION
  *
  * Random walk simulation. From a set of source vertices, a set of 
- * random walks is started. Random walks walk via edges, and we use the
- * dynamic chivectors to support multiple walks in one edge. Each
- * vertex keeps track of the walks that pass by it, thus in the end
- * we have estimate of the "pagerank" of each vertex.
- *
- * Note, this version does not support 'resets' of random walks.
- * TODO: from each vertex, start new random walks with some probability,
- * and also terminate a walk with some probablity.
+ * random walks is started. The walks are kept in memory by the walk
+ * manager of api/random_walks.hpp (DrunkardMob), and advanced when the
+ * interval of their current vertex is loaded. Each vertex keeps track of
+ * the walks that pass by it, thus in the end we have estimate of the
+ * "pagerank" of each vertex.
  *
+ * Options: niters is the length of the walks (hops), walkspersource
+ * the number of walks from each source, resetprob the probability of a
+ * walk to end on each hop, and seed the seed of the random generators.
  */
 
-#define DYNAMICEDATA 1
-
 #include <string>
 
 #include "graphchi_basic_includes.hpp"
-#include "api/dynamicdata/chivector.hpp"
+#include "api/random_walks.hpp"
 #include "util/toplist.hpp"
 
 using namespace graphchi;
 
 /**
  * Type definitions. Remember to create suitable graph shards using the
- * Sharder-program.
+ * Sharder-program. The walks do not use the edge data.
  */
 typedef unsigned int VertexDataType;
-typedef chivector<vid_t>  EdgeDataType;
+typedef vid_t EdgeDataType;
 
- 
-struct RandomWalkProgram : public GraphChiProgram<VertexDataType, EdgeDataType> {
-    
-    int walks_per_source() {
-        return 100;
-    }
-    
-    bool is_source(vid_t v) {
-        return (v % 50 == 0);
-    }
-    
-    /**
-     *  Vertex update function.
-     */
-    void update(graphchi_vertex<VertexDataType, EdgeDataType > &vertex, graphchi_context &gcontext) {
-        if (gcontext.iteration == 0) {
-            
-            if (is_source(vertex.id())) {
-                for(int i=0; i < walks_per_source(); i++) {
-                    /* Get random out edge's vector */
-                    graphchi_edge<EdgeDataType> * outedge = vertex.random_outedge();
-                    if (outedge != NULL) {
-                        chivector<vid_t> * evector = outedge->get_vector();
-                        /* Add a random walk particle, represented by the vertex-id of the source (this vertex) */
-                        evector->add(vertex.id());
-                        gcontext.scheduler->add_task(outedge->vertex_id()); // Schedule destination
-                    }
-                }
-            }
-            vertex.set_data(0);
-        } else {
-            /* Check inbound edges for walks and advance them. */
-            int num_walks = 0;
-            for(int i=0; i < vertex.num_inedges(); i++) {
-                graphchi_edge<EdgeDataType> * edge = vertex.inedge(i);
-                chivector<vid_t> * invector = edge->get_vector();
-                for(int j=0; j < invector->size(); j++) {
-                    /* Get one walk */
-                    vid_t walk = invector->get(j);
-                    /* Move to a random out-edge */
-                    graphchi_edge<EdgeDataType> * outedge = vertex.random_outedge();
-                    if (outedge != NULL) {
-                        chivector<vid_t> * outvector = outedge->get_vector();
-                        /* Add a random walk particle, represented by the vertex-id of the source (this vertex) */
-                        outvector->add(walk);
-                        gcontext.scheduler->add_task(outedge->vertex_id()); // Schedule destination
-                    }
-                    num_walks ++;
-                }
-                /* Remove all walks from the inbound vector */
-                invector->clear();
-            }
-            /* Keep track of the walks passed by via this vertex */
-            vertex.set_data(vertex.get_data() + num_walks);
-        }
-    }
+/**
+ * Collects the endpoints of the walks.
+ */
+class WalkEndpoints : public walk_callback {
+public:
+    volatile size_t nended;
+    volatile size_t total_hops;
     
-    /**
-     * Called before an iteration starts.
-     */
-    void before_iteration(int iteration, graphchi_context &gcontext) {
-    }
+    WalkEndpoints() : nended(0), total_hops(0) {}
     
-    /**
-     * Called after an iteration has finished.
-     */
-    void after_iteration(int iteration, graphchi_context &gcontext) {
+    void endpoint(uint32_t source_idx, vid_t source, vid_t vertex, int hops) {
+        __sync_add_and_fetch(&nended, 1);
+        __sync_add_and_fetch(&total_hops, (size_t) hops);
     }
+};
+ 
+struct RandomWalkProgram : public DrunkardMobProgram<VertexDataType, EdgeDataType> {
     
-    /**
-     * Called before an execution interval is started.
-     */
-    void before_exec_interval(vid_t window_st, vid_t window_en, graphchi_context &gcontext) {
-    }
+    RandomWalkProgram(walk_manager &walks, walk_callback &callback, int walklength, double reset_prob) :
+        DrunkardMobProgram<VertexDataType, EdgeDataType>(walks, callback, walklength, reset_prob) {}
     
     /**
-     * Called after an execution interval has finished.
+     * Keep track of the walks passed by via this vertex.
      */
-    void after_exec_interval(vid_t window_st, vid_t window_en, graphchi_context &gcontext) {
+    void visited(graphchi_vertex<VertexDataType, EdgeDataType> &vertex, size_t nwalks, graphchi_context &gcontext) {
+        vertex.set_data(vertex.get_data() + (VertexDataType) nwalks);
     }
     
 };
 
- 
+bool is_source(vid_t v) {
+    return (v % 50 == 0);
+}
 
 int main(int argc, const char ** argv) {
     /* GraphChi initialization will read the command line
@@ -149,20 +96,32 @@ int main(int argc, const char ** argv) {
     
     /* Basic arguments for application */
     std::string filename = get_option_string("file");  // Base filename
-    int niters           = get_option_int("niters", 4); // Number of iterations
+    int walklength       = get_option_int("niters", 4); // Length of the walks
+    int walkspersource   = get_option_int("walkspersource", 100);
+    double resetprob     = get_option_float("resetprob", 0.0);
     bool scheduler       = true;                       // Whether to use selective scheduling
     
     /* Detect the number of shards or preprocess an input to create them */
-    bool preexisting_shards;
-    int nshards          = convert_if_notexists<vid_t>(filename, get_option_string("nshards", "auto"), preexisting_shards);
+    int nshards          = convert_if_notexists<EdgeDataType>(filename, get_option_string("nshards", "auto"));
     
-    /* Run */
-    RandomWalkProgram program;
-    graphchi_engine<VertexDataType, EdgeDataType> engine(filename, nshards, scheduler, m);
-    if (preexisting_shards) {
-        engine.reinitialize_edge_data(0);
+    /* Start the walks */
+    walk_manager walks(get_option_long("seed", 1));
+    vid_t nvertices = (vid_t) get_num_vertices(filename);
+    for(vid_t v=0; v < nvertices; v++) {
+        if (is_source(v)) walks.add_source(v, walkspersource);
     }
-    engine.run(program, niters);
+    logstream(LOG_INFO) << "Starting " << walks.num_active() << " walks from " << walks.num_sources() << " sources" << std::endl;
+    
+    /* Run. Each iteration advances every walk by at least one hop. */
+    WalkEndpoints endpoints;
+    RandomWalkProgram program(walks, endpoints, walklength, resetprob);
+    graphchi_engine<VertexDataType, EdgeDataType> engine(filename, nshards, scheduler, m);
+    engine.set_enable_deterministic_parallelism(false);
+    engine.set_modifies_inedges(false);
+    engine.set_modifies_outedges(false);
+    engine.set_only_adjacency(true);
+    engine.set_reset_vertexdata(true);
+    engine.run(program, walklength + 1);
     
     /* List top 20 */
     int ntop = 20;
@@ -171,8 +130,12 @@ int main(int argc, const char ** argv) {
     for(int i=0; i < (int) top.size(); i++) {
         std::cout << (i+1) << ". " << top[i].vertex << "\t" << top[i].value << std::endl;
     }
+    std::cout << "Walks ended: " << endpoints.nended << ", mean length: "
+              << (endpoints.nended > 0 ? endpoints.total_hops / (double) endpoints.nended : 0.0) << std::endl;
 
     /* Report execution metrics */
+    m.set("walks", (size_t) endpoints.nended);
+    m.set("walks.hops", walks.num_hops());
     metrics_report(m);
     return 0;
 }
@@ -39,10 +39,11 @@
 
 #include "graphchi_basic_includes.hpp"
 #include "engine/dynamic_graphs/graphchi_dynamicgraph_engine.hpp"
+#include "engine/dynamic_graphs/ingest_server.hpp"
 #include "util/toplist.hpp"
 
 /* HTTP admin tool */
-//#include "httpadmin/chi_httpadmin.hpp"
+#include "httpadmin/chi_httpadmin.hpp"
 //#include "httpadmin/plotter.hpp"
 
 using namespace graphchi;
@@ -258,6 +259,7 @@ void * dynamic_graph_reader(void * info) {
     vid_t from;
     vid_t to;
     char s[1024];
+    std::vector< created_edge<float> > batch;
     
     while(fgets(s, 1024, f) != NULL) {
         FIXLINE(s);
@@ -274,12 +276,12 @@ void * dynamic_graph_reader(void * info) {
             continue;
         }
         
-        bool success=false;
-        while (!success) {
-            success = dyngraph_engine->add_edge(from, to, 0.0f);
+        batch.push_back(created_edge<float>(from, to, 0.0f));
+        if (batch.size() == 1000) {
+            ingested += dyngraph_engine->add_edges(&batch[0], batch.size());
+            for(int i=0; i < (int)batch.size(); i++) dyngraph_engine->add_task(batch[i].src);
+            batch.clear();
         }
-        dyngraph_engine->add_task(from);
-        ingested++;
         
         if (++c % edges_per_sec == 0) {
             std::cout << "Stream speed check...." << std::endl;
@@ -303,6 +305,10 @@ void * dynamic_graph_reader(void * info) {
                 
         
     } 
+    if (!batch.empty()) {
+        ingested += dyngraph_engine->add_edges(&batch[0], batch.size());
+        for(int i=0; i < (int)batch.size(); i++) dyngraph_engine->add_task(batch[i].src);
+    }
     fclose(f);
     dyngraph_engine->finish_after_iters(10);
     return NULL;
@@ -323,28 +329,37 @@ int main(int argc, const char ** argv) {
     /* Process input file (the base graph) - if not already preprocessed */
     int nshards             = convert_if_notexists<EdgeDataType>(filename, get_option_string("nshards", "auto"));
     
-    /* Streaming input graph - must be in edge-list format */
-    streaming_graph_file = get_option_string_interactive("streaming_graph_file", 
-                                                         "Pathname to graph file to stream edges from");
+    /* Edges are streamed either from a file or by clients of the ingest server */
+    bool use_server = get_option_string("ingest_socket", "") != "" || get_option_int("ingest_port", 0) > 0;
+    if (use_server) {
+        niters = get_option_int("niters", niters);
+    } else {
+        /* Streaming input graph - must be in edge-list format */
+        streaming_graph_file = get_option_string_interactive("streaming_graph_file", 
+                                                             "Pathname to graph file to stream edges from");
+    }
     
     /* Create the engine object */
     dyngraph_engine = new graphchi_dynamicgraph_engine<float, float>(filename, nshards, scheduler, m); 
     dyngraph_engine->set_modifies_inedges(false); // Improves I/O performance.
     
-    /* Start streaming thread */
-    pthread_t strthread;
-    int ret = pthread_create(&strthread, NULL, dynamic_graph_reader, NULL);
-    assert(ret>=0);
-    
-    /* Start HTTP admin */
-   /* start_httpadmin< graphchi_dynamicgraph_engine<float, float> >(dyngraph_engine);
-    register_http_request_handler(new IntervalTopRequest());
-    
+    /* Start streaming thread or the ingest server */
+    ingest_server<float, float> * server = NULL;
+    if (use_server) {
+        server = new ingest_server<float, float>(dyngraph_engine, m, scheduler);
+        if (!server->start()) {
+            logstream(LOG_FATAL) << "Could not start the ingest server." << std::endl;
+        }
+    } else {
+        pthread_t strthread;
+        int ret = pthread_create(&strthread, NULL, dynamic_graph_reader, NULL);
+        assert(ret>=0);
+    }
     
-    pthread_t plotterthr;
-    ret = pthread_create(&plotterthr, NULL, plotter_thread, NULL);
-    assert(ret>=0);
-    */
+    /* Start HTTP admin (port 3333), which also serves the live metrics at /metrics */
+    if (get_option_int("httpadmin", 0) == 1) {
+        start_httpadmin< graphchi_dynamicgraph_engine<float, float> >(dyngraph_engine);
+    }
     
     /* Run the engine */
     PagerankProgram program;
@@ -352,6 +367,11 @@ int main(int argc, const char ** argv) {
     
     
     running = false;
+    if (server != NULL) {
+        dyngraph_engine->close_ingest();
+        server->stop();
+        delete server;
+    }
     
     /* Output top ranked vertices */
     std::vector< vertex_value<float> > top = get_top_vertices<float>(filename, ntop);
@@ -124,17 +124,15 @@ bool operator!=(const SCCinfo &a, const SCCinfo &b) {
 typedef SCCinfo VertexDataType;
 typedef bidirectional_label EdgeDataType;
 
-static inline bool VARIABLE_IS_NOT_USED is_deleted_edge_value(bidirectional_label val);
-static inline bool VARIABLE_IS_NOT_USED is_deleted_edge_value(bidirectional_label val) {
-    return 0xffffffffu == val.smaller_one;
-}
-
+/* Removed edges are also labeled, so that the other endpoint sees
+   the removal already on the same iteration. */
 static void VARIABLE_IS_NOT_USED remove_edgev(graphchi_edge<bidirectional_label> * e);
 static void VARIABLE_IS_NOT_USED remove_edgev(graphchi_edge<bidirectional_label> * e) {
     bidirectional_label deletedlabel;
     deletedlabel.smaller_one = 0xffffffffu;
     deletedlabel.larger_one = 0xffffffffu;
     e->set_data(deletedlabel);
+    e->deleted = true;
 }
 
 bool first_iteration = true;
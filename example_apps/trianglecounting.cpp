@@ -40,7 +40,12 @@
  * order of their degree. This turns out to be a very important optimization on big graphs. 
  *
  * This algorithm also utilizes the dynamic graph engine, and deletes edges after they have been
- * accounted for. 
+ * accounted for.
+ *
+ * The adjacency lists of the pivots are stored in one arena, and the number of pivots of a
+ * phase is chosen by their degrees so that the lists fit in the option pivot_membudget_mb
+ * (by default half of membudget_mb). The lists are intersected with the SSE2 merge or galloping
+ * search of util/intersection.hpp, or by probing a bitmap when a vertex has many pivot neighbors.
  */
 
 
@@ -60,6 +65,7 @@
 #include "engine/dynamic_graphs/graphchi_dynamicgraph_engine.hpp"
 #include "engine/auxdata/degree_data.hpp"
 #include "preprocessing/util/orderbydegree.hpp"
+#include "util/intersection.hpp"
 
 using namespace graphchi;
 
@@ -88,82 +94,98 @@ class OutputVertexCallback : public VCallback<VertexDataType> {
   * Code for intersection size computation and 
   * pivot management.
   */
-int grabbed_edges = 0;
-
-
-// Linear search
-inline bool findadj_linear(vid_t * datachunk, size_t n, vid_t target) {
-    for(int i=0; i<(int)n; i++) {
-        if (datachunk[i] == target) return true;
-        else if (datachunk[i] > target) return false;
-    }
-    return false;
-}
+size_t grabbed_edges = 0;
 
-// Binary search
-inline bool findadj(vid_t * datachunk, size_t n, vid_t target) {
-    if (n<32) return findadj_linear(datachunk, n, target);
-    register size_t lo = 0;
-    register size_t hi = n;
-    register size_t m = lo + (hi-lo)/2;
-    while(hi>lo) {
-        vid_t eto = datachunk[m];
-        if (target == eto) {
-            return true;
-        }
-        if (target > eto) {
-            lo = m+1;
-        } else {
-            hi = m;
-        }
-        m = lo + (hi-lo)/2;
-    }
-    return false;
-}
 
-
-
-struct dense_adj {
-    int count;
-    vid_t * adjlist;
-    
-    dense_adj() { adjlist = NULL; }
-    dense_adj(int _count, vid_t * _adjlist) : count(_count), adjlist(_adjlist) {
-    }
-};
-
-
-
-// This is used for keeping in-memory
+/**
+  * Adjacency lists of the pivots, kept in memory in one arena: the list
+  * of pivot p is arena[offsets[p - pivot_st]] .. + counts[p - pivot_st].
+  * The lists are appended by the threads that grab them, with an atomic
+  * bump of arena_used. The arena is reserved when the pivot range is
+  * extended, by the degrees of the new pivots (an upper bound of their
+  * lists), so grabbing never reallocates. The pivot range is extended only
+  * as far as the reservation fits in the pivot memory budget.
+  */
 class adjlist_container {
-    std::vector<dense_adj> adjs;
-    mutex m;
+    vid_t * arena;
+    size_t arena_capacity;
+    size_t reserved;
+    volatile size_t arena_used;
+    std::vector<size_t> offsets;
+    std::vector<int> counts;
+    size_t budget_edges;
+    
 public:
     vid_t pivot_st, pivot_en;
     
-    adjlist_container() {
+    /**
+      * @param budget_bytes memory for the adjacency lists of the pivots
+      */
+    adjlist_container(size_t budget_bytes) {
         pivot_st = 0;
         pivot_en = 0;
+        arena = NULL;
+        arena_capacity = 0;
+        reserved = 0;
+        arena_used = 0;
+        budget_edges = budget_bytes / sizeof(vid_t);
+    }
+    
+    ~adjlist_container() {
+        memory_tracker::instance().untrack(arena);
+        free(arena);
     }
     
+    /**
+      * Drops the lists of the pivots. The arena is kept for the next pivots.
+      */
     void clear() {
-        for(std::vector<dense_adj>::iterator it=adjs.begin(); it != adjs.end(); ++it) {
-            if (it->adjlist != NULL) {
-                free(it->adjlist);
-                it->adjlist = NULL;
-            }
-        }
-        adjs.clear();
+        offsets.clear();
+        counts.clear();
+        arena_used = 0;
+        reserved = 0;
         pivot_st = pivot_en;
     }
     
     /** 
-      * Extend the interval of pivot vertices to en.
+      * Extends the interval of pivot vertices towards en, as far as their
+      * adjacency lists fit in the budget. At least one pivot is taken, so
+      * that the computation progresses even if a list is larger than the
+      * budget.
+      * @param basefilename graph, for the degrees of the vertices
+      * @return the new end of the pivot interval (exclusive)
       */
-    void extend_pivotrange(vid_t en) {
-        assert(en>=pivot_en);
-        pivot_en = en; 
-        adjs.resize(pivot_en - pivot_st);
+    vid_t extend_pivotrange(std::string basefilename, vid_t en) {
+        assert(en >= pivot_en);
+        if (en == pivot_en) return pivot_en;
+        
+        /* Degrees of the preprocessed graph. The engine keeps its own copy,
+           and as edges are only removed, these are upper bounds. */
+        std::vector<degree> degs(en - pivot_en);
+        int f = open(filename_degree_data(basefilename).c_str(), O_RDONLY);
+        assert(f >= 0);
+        preada_trunc(f, &degs[0], degs.size() * sizeof(degree), pivot_en * sizeof(degree));
+        close(f);
+        
+        vid_t newen = pivot_en;
+        for(size_t i=0; i < degs.size(); i++) {
+            size_t bound = degs[i].indegree + degs[i].outdegree;
+            if (reserved + bound > budget_edges && newen > pivot_st) break;
+            reserved += bound;
+            newen++;
+        }
+        
+        if (reserved > arena_capacity) {
+            memory_tracker::instance().untrack(arena);
+            arena = (vid_t *) realloc(arena, reserved * sizeof(vid_t));
+            assert(arena != NULL);
+            arena_capacity = reserved;
+            memory_tracker::instance().track(MEM_OTHER, arena, arena_capacity * sizeof(vid_t));
+        }
+        pivot_en = newen;
+        offsets.resize(pivot_en - pivot_st, 0);
+        counts.resize(pivot_en - pivot_st, 0);
+        return pivot_en;
     }
     
     /**
@@ -184,86 +206,35 @@ public:
                 lastvid = v.edge(i)->vertex_id();
             }
             
-            // Allocate the in-memory adjacency list, using the
+            // Take the room for the list from the arena, using the
             // knowledge of the number of edges.
-            dense_adj dadj = dense_adj(actcount, (vid_t*) calloc(sizeof(vid_t), actcount));
-            actcount = 0;
+            size_t offset = __sync_fetch_and_add(&arena_used, (size_t) actcount);
+            assert(offset + actcount <= arena_capacity);
+            vid_t * adjlist = arena + offset;
+            int k = 0;
             lastvid = 0;
             for(int i=0; i<ncount; i++) {
                 if (v.edge(i)->vertexid > v.id() && v.edge(i)->vertexid != lastvid) {  // Need to store only ids larger than me
-                    dadj.adjlist[actcount++] = v.edge(i)->vertex_id();
+                    adjlist[k++] = v.edge(i)->vertex_id();
                 }
                 lastvid = v.edge(i)->vertex_id();
             }
-            assert(dadj.count == actcount);
-            adjs[v.id() - pivot_st] = dadj;
-            assert(v.id() - pivot_st < adjs.size());
-            __sync_add_and_fetch(&grabbed_edges, actcount);
+            assert(k == actcount);
+            assert(v.id() - pivot_st < offsets.size());
+            offsets[v.id() - pivot_st] = offset;
+            counts[v.id() - pivot_st] = actcount;
+            __sync_add_and_fetch(&grabbed_edges, (size_t) actcount);
             return actcount;
         }
         return 0;
     }
     
     int acount(vid_t pivot) {
-        return adjs[pivot - pivot_st].count;
+        return counts[pivot - pivot_st];
     }
     
-    
-    /** 
-      * Compute size of the relevant intersection of v and a pivot
-      */
-    int intersection_size(graphchi_vertex<uint32_t, uint32_t> &v, vid_t pivot, int start_i) {
-        assert(is_pivot(pivot));
-        int count = 0;
-        if (pivot > v.id()) {
-            dense_adj &dadj = adjs[pivot - pivot_st];
-            int vc = v.num_edges();
-             
-            /**
-              * If the adjacency list sizes are not too different, use
-              * 'merge'-type of operation to compute size intersection.
-              */
-            if (dadj.count < 32 * (vc - start_i)) { // TODO: do real profiling to find best cutoff value
-                // Do merge-style of check
-                assert(v.edge(start_i)->vertex_id() == pivot);
-                int i1 = 0;
-                int i2 = start_i+1;
-                int nedges = v.num_edges(); 
-                
-                while (i1 < dadj.count && i2 < nedges) {
-                    vid_t dst = v.edge(i2)->vertexid;
-                    vid_t a = dadj.adjlist[i1];
-                    if (a == dst) {
-                        /* Add one to edge between v and the match */
-                        v.edge(i2)->set_data(v.edge(i2)->get_data() + 1);
-                        count++;
-                        i1++; i2++;
-                        
-                    } else {
-                        i1 += a < dst;
-                        i2 += a > dst;
-                    }  
-                }
-            } else {
-                /**
-                  * Otherwise, use linear/binary search.
-                  */
-                vid_t lastvid = 0;
-                for(int i=start_i+1; i < vc; i++) {
-                    vid_t nb = v.edge(i)->vertexid;
-                    if (nb > pivot && nb != lastvid) {
-                        int match = findadj(dadj.adjlist, dadj.count, nb);
-                        count += match;
-                        if (match > 0) {
-                            /* Add one to edge between v and the match */
-                            v.edge(i)->set_data(v.edge(i)->get_data() + 1);
-                        }
-                    }
-                    lastvid = nb;
-                }
-            }
-        }        
-        return count;
+    const vid_t * adjlist(vid_t pivot) {
+        return arena + offsets[pivot - pivot_st];
     }
     
     inline bool is_pivot(vid_t vid) {
@@ -271,8 +242,43 @@ public:
     }
 };
 
+
+/**
+  * Adds one to the edges of v to the common neighbors of v and a pivot.
+  * nbrs are the distinct neighbors of v (with larger id than v), and
+  * nbr_edge[i] is the index of the first edge of v to nbrs[i].
+  */
+struct triangle_match {
+    graphchi_vertex<uint32_t, uint32_t> &v;
+    const int * nbr_edge;
+    
+    triangle_match(graphchi_vertex<uint32_t, uint32_t> &v, const int * nbr_edge) : v(v), nbr_edge(nbr_edge) {}
+    
+    inline void operator()(size_t i, size_t j) {
+        graphchi_edge<uint32_t> * e = v.edge(nbr_edge[i]);
+        e->set_data(e->get_data() + 1);
+    }
+};
+
 adjlist_container * adjcontainer;
 
+/**
+  * Scratch space of the updates of a thread: the distinct neighbors of
+  * a vertex, their first edges and their bitmap. Allocated once per thread
+  * and reused, so that the updates do not allocate.
+  */
+struct triangle_scratch {
+    std::vector<vid_t> nbrs;
+    std::vector<int> nbr_edge;
+    sorted_id_bitmap bitmap;
+};
+
+static triangle_scratch & thread_scratch() {
+    static __thread triangle_scratch * scratch = NULL;
+    if (scratch == NULL) scratch = new triangle_scratch();
+    return *scratch;
+}
+
 
 
 /**
@@ -295,37 +301,64 @@ struct TriangleCountingProgram : public GraphChiProgram<VertexDataType, EdgeData
 
             v.sort_edges_indirect();
             
-            vid_t lastvid = 0;
+            /* Distinct neighbors with larger id, and their first edges (handles reciprocal edges a->b, b<-a) */
+            int nedges = v.num_edges();
+            triangle_scratch &scratch = thread_scratch();
+            std::vector<vid_t> &nbrs = scratch.nbrs;
+            std::vector<int> &nbr_edge = scratch.nbr_edge;
+            nbrs.clear();
+            nbr_edge.clear();
+            nbrs.reserve(nedges);
+            nbr_edge.reserve(nedges);
+            int npivots = 0;
+            for(int i=0; i < nedges; i++) {
+                vid_t nb = v.edge(i)->vertexid;
+                if (nb > v.id() && (nbrs.empty() || nb != nbrs.back())) {
+                    nbrs.push_back(nb);
+                    nbr_edge.push_back(i);
+                    npivots += adjcontainer->is_pivot(nb);
+                }
+            }
+            if (npivots == 0) return;
+            triangle_match match(v, &nbr_edge[0]);
+            
+            /* If the list is intersected with many pivots, probe a bitmap of it instead of merging */
+            sorted_id_bitmap &bitmap = scratch.bitmap;
+            bool use_bitmap = npivots >= 16 &&
+                sorted_id_bitmap::bytes_for(&nbrs[0], nbrs.size()) <= nbrs.size() * sizeof(vid_t);
+            if (use_bitmap) bitmap.build(&nbrs[0], nbrs.size());
             
             /**
-              * Iterate through the edges, and if an edge is from a 
+              * Iterate through the neighbors, and if a neighbor is a 
               * pivot vertex, compute intersection of the relevant
               * adjacency lists.
               */
-            for(int i=0; i<v.num_edges(); i++) {
-                graphchi_edge<uint32_t> * e = v.edge(i);
-                if (e->vertexid > v.id() && e->vertexid >= adjcontainer->pivot_st) {
-                    assert(!is_deleted_edge_value(e->get_data()));
-                    if (e->vertexid != lastvid) {  // Handles reciprocal edges (a->b, b<-a)
-                        if (adjcontainer->is_pivot(e->vertexid)) {
-                            uint32_t pivot_triangle_count = adjcontainer->intersection_size(v, e->vertexid, i);
-                            newcounts += pivot_triangle_count;
-                            
-                            /* Write the number of triangles into edge between this vertex and pivot */
-                            if (pivot_triangle_count == 0 && e->get_data() == 0) {
-                                /* ... or remove the edge, if the count is zero. */
-                                v.remove_edge(i); 
-                            } else {
-                                
-                                e->set_data(e->get_data() + pivot_triangle_count);
-                            }
-                        } else {
-                            break;
-                        }
-                    }
-                    lastvid = e->vertexid;
-                }  
-                assert(newcounts >= 0);
+            for(size_t k=0; k < nbrs.size(); k++) {
+                vid_t pivot = nbrs[k];
+                if (pivot < adjcontainer->pivot_st) continue;
+                if (!adjcontainer->is_pivot(pivot)) break;
+                graphchi_edge<uint32_t> * e = v.edge(nbr_edge[k]);
+                assert(!e->is_deleted());
+                
+                const vid_t * padj = adjcontainer->adjlist(pivot);
+                size_t pcount = adjcontainer->acount(pivot);
+                size_t rest = nbrs.size() - k - 1;
+                uint32_t pivot_triangle_count;
+                if (use_bitmap && pcount < rest) {
+                    pivot_triangle_count = (uint32_t) bitmap.intersect(k + 1, padj, pcount, match);
+                } else {
+                    triangle_match rest_match(v, &nbr_edge[k + 1]);
+                    pivot_triangle_count = (uint32_t) intersect(&nbrs[k + 1], rest, padj, pcount, rest_match);
+                }
+                newcounts += pivot_triangle_count;
+                
+                /* Write the number of triangles into edge between this vertex and pivot */
+                if (pivot_triangle_count == 0 && e->get_data() == 0) {
+                    /* ... or remove the edge, if the count is zero. */
+                    v.remove_edge(nbr_edge[k]); 
+                } else {
+                    e->set_data(e->get_data() + pivot_triangle_count);
+                }
             }
             
             if (newcounts > 0) {
@@ -395,20 +428,21 @@ struct TriangleCountingProgram : public GraphChiProgram<VertexDataType, EdgeData
      */
     void before_exec_interval(vid_t window_st, vid_t window_en, graphchi_context &gcontext) {        
         if (gcontext.iteration % 2 == 0) {
-            if (adjcontainer->pivot_st <= window_en) {
-                size_t max_grab_edges = get_option_long("membudget_mb", 1024) * 1024 * 1024 / 8;
-                if (grabbed_edges < max_grab_edges * 0.8) {
-                    logstream(LOG_DEBUG) << "Window init, grabbed: " << grabbed_edges << " edges" << std::endl;
-                    for(vid_t vid=window_st; vid <= window_en; vid++) {
-                        gcontext.scheduler->add_task(vid, true);
-                    }
-                    adjcontainer->extend_pivotrange(window_en + 1);
-                    if (window_en == gcontext.nvertices) {
-                        // Last iteration needed for collecting last triangle counts
-                        gcontext.set_last_iteration(gcontext.iteration + 3);                    
-                    }
-                } else {
-                    std::cout << "Too many edges, already grabbed: " << grabbed_edges << std::endl;
+            /* Pivots are taken from this window only if the previous windows
+               were taken as a whole, up to the memory budget of the pivots. */
+            vid_t pivot_en = adjcontainer->pivot_en;
+            if (window_st <= pivot_en && pivot_en <= window_en) {
+                logstream(LOG_DEBUG) << "Window init, grabbed: " << grabbed_edges << " edges" << std::endl;
+                for(vid_t vid=window_st; vid <= window_en; vid++) {
+                    gcontext.scheduler->add_task(vid, true);
+                }
+                pivot_en = adjcontainer->extend_pivotrange(gcontext.filename, window_en + 1);
+                if (pivot_en == window_en + 1 && window_en == gcontext.nvertices) {
+                    // Last iteration needed for collecting last triangle counts
+                    gcontext.set_last_iteration(gcontext.iteration + 3);                    
+                }
+                if (pivot_en <= window_en) {
+                    logstream(LOG_DEBUG) << "Pivot memory budget full at vertex " << pivot_en << std::endl;
                 }
             }
         }
@@ -453,10 +487,11 @@ int main(int argc, const char ** argv) {
     nshards = order_by_degree<EdgeDataType>(filename, nshards, m);
     
     
-    /* Initialize adjacency container */
-    adjcontainer = new adjlist_container();
-    
-    // TODO: ordering by degree.
+    /* Initialize adjacency container. The adjacency lists of the pivots are kept
+       in memory, by default within half of the memory budget of the engine. */
+    int membudget_mb = std::min(get_option_int("membudget_mb", 1024), 1024);
+    size_t pivot_membudget_mb = get_option_long("pivot_membudget_mb", membudget_mb / 2);
+    adjcontainer = new adjlist_container(pivot_membudget_mb * 1024 * 1024);
     
     /* Run */
     TriangleCountingProgram program;
@@ -466,7 +501,7 @@ int main(int argc, const char ** argv) {
     
     // Low memory budget is required to prevent swapping as triangle counting
     // uses more memory than standard GraphChi apps.
-    engine.set_membudget_mb(std::min(get_option_int("membudget_mb", 1024), 1024)); 
+    engine.set_membudget_mb(membudget_mb); 
     engine.run(program, niters);
     
     /* Report execution metrics */
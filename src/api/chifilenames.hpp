@@ -81,6 +81,20 @@ namespace graphchi {
         return ss.str();
     }
     
+    static std::string VARIABLE_IS_NOT_USED filename_sharding_report(std::string basefilename, int nshards) {
+        std::stringstream ss;
+        ss << basefilename;
+        ss << "." << nshards << ".shardstats.json";
+        return ss.str();
+    }
+    
+    
+    /**
+     * I/O profile of the graph, see io/io_autotune.hpp
+     */
+    static std::string VARIABLE_IS_NOT_USED filename_iotune_profile(std::string basefilename) {
+        return basefilename + ".iotune";
+    }
     
     static std::string VARIABLE_IS_NOT_USED get_part_str(int p, int nshards) {
         char partstr[32];
@@ -152,6 +166,10 @@ namespace graphchi {
         return adjfilename + "idx";
     }
     
+    static std::string filename_shard_deletions(std::string edata_shardname) {
+        return edata_shardname + ".deleted";
+    }
+    
     /**
      * Configuration file name
      */
@@ -30,21 +30,123 @@
 #ifndef DEF_GRAPHCHI_CHIVECTOR
 #define DEF_GRAPHCHI_CHIVECTOR
 
-#include <vector>
+#include <assert.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include <algorithm>
+#include <vector>
+
+#include "util/memory_tracker.hpp"
+#include "util/pthread_tools.hpp"
 
 namespace graphchi {
 
     
 #define MINCAPACITY 2
     
+    /* Size of the first arena chunk of a thread; the chunks double up to the maximum */
+#define EXTENSION_POOL_MINCHUNK 4096
+#define EXTENSION_POOL_MAXCHUNK (1024 * 1024)
+    
+    /**
+     * Process-wide statistics of the extension pools. Pools add their
+     * counts when they are released, and the engine reports them as metrics.
+     */
+    struct extension_pool_stats {
+        volatile size_t allocations;
+        volatile size_t bytes;        // Bytes handed out to chivectors
+        volatile size_t arena_bytes;  // Bytes allocated for the arena chunks
+        volatile size_t pools;
+    };
+    
+    static extension_pool_stats & get_extension_pool_stats();
+    static extension_pool_stats & get_extension_pool_stats() {
+        static extension_pool_stats stats = {0, 0, 0, 0};
+        return stats;
+    }
 
 /**
-  * Pool the extension parts of chi-vectors
+  * Pool the extension parts of chi-vectors. Each data block of
+  * chivectors owns one pool, and the pool is released in bulk when the block
+  * has been written. Each OpenMP thread allocates from its own arena, so
+  * allocation is just a pointer bump under an uncontended lock. Threads
+  * outside of parallel regions (such as the ingest and builder threads)
+  * share one extra arena.
   */
 template <typename T>
 class extension_pool {
-        
+    
+    struct arena {
+        std::vector<uint8_t *> chunks;
+        uint8_t * ptr;
+        size_t left;
+        size_t chunksize;
+        size_t allocations;
+        size_t bytes;
+        size_t arena_bytes;
+        spinlock lock;
+        arena() : ptr(NULL), left(0), chunksize(EXTENSION_POOL_MINCHUNK), allocations(0), bytes(0), arena_bytes(0) {}
+    };
+    
+    std::vector<arena> arenas;
+    
+public:
+    extension_pool() : arenas(omp_get_max_threads() + 1) {}
+    
+    ~extension_pool() {
+        extension_pool_stats &stats = get_extension_pool_stats();
+        size_t allocations = 0, bytes = 0, arena_bytes = 0;
+        for(int i=0; i < (int)arenas.size(); i++) {
+            for(int j=0; j < (int)arenas[i].chunks.size(); j++) {
+                free(arenas[i].chunks[j]);
+            }
+            allocations += arenas[i].allocations;
+            bytes += arenas[i].bytes;
+            arena_bytes += arenas[i].arena_bytes;
+        }
+        __sync_add_and_fetch(&stats.allocations, allocations);
+        __sync_add_and_fetch(&stats.bytes, bytes);
+        __sync_add_and_fetch(&stats.arena_bytes, arena_bytes);
+        __sync_add_and_fetch(&stats.pools, 1);
+        memory_tracker::instance().released(MEM_CHIVECTOR, arena_bytes);
+    }
+    
+    /**
+     * Allocates space for n elements from the arena of the calling thread.
+     * The space is valid until the pool is destroyed.
+     */
+    T * allocate(int n) {
+        /* omp_get_thread_num() is 0 in any thread outside of a parallel region,
+           and thread numbers of other teams may collide, so the arena is locked. */
+        int nworkers = (int)arenas.size() - 1;
+        arena &a = (omp_in_parallel() ? arenas[omp_get_thread_num() % nworkers] : arenas[nworkers]);
+        a.lock.lock();
+        size_t len = ((n * sizeof(T) + 7) / 8) * 8;
+        if (a.left < len) {
+            size_t chunklen = std::max(a.chunksize, len);
+            a.ptr = (uint8_t *) malloc(chunklen);
+            assert(a.ptr != NULL);
+            a.chunks.push_back(a.ptr);
+            a.left = chunklen;
+            a.arena_bytes += chunklen;
+            memory_tracker::instance().allocated(MEM_CHIVECTOR, chunklen);
+            a.chunksize = std::min(a.chunksize * 2, (size_t) EXTENSION_POOL_MAXCHUNK);
+        }
+        T * res = (T *) a.ptr;
+        a.ptr += len;
+        a.left -= len;
+        a.allocations++;
+        a.bytes += len;
+        a.lock.unlock();
+        return res;
+    }
+    
+private:
+    // Disable copying
+    extension_pool(const extension_pool&);
+    extension_pool& operator=(const extension_pool&);
 };
     
     
@@ -52,29 +154,37 @@ template <typename T>
 class chivector {
 
     uint16_t nsize;
-    uint16_t ncapacity;
+    uint16_t ncapacity;  // Capacity of the slot in the data block
+    uint16_t extcapacity;
+    bool modified;
     T * data;
-    std::vector<T> * extensions;  // TODO: use a more memory efficient system?
+    T * extensions;  // Elements after the first ncapacity ones
+    extension_pool<T> * pool;  // If NULL, extensions are allocated with malloc
     
 public:
     typedef T element_type_t;
     typedef uint32_t sizeword_t;
     chivector() {
         extensions = NULL;
+        extcapacity = 0;
+        pool = NULL;
+        modified = false;
     }
     
-    chivector(uint16_t sz, uint16_t cap, T * dataptr) : data(dataptr) {
+    chivector(uint16_t sz, uint16_t cap, T * dataptr, extension_pool<T> * pool=NULL) : data(dataptr), pool(pool) {
         nsize = sz;
         ncapacity = cap;
         assert(cap >= nsize);
         extensions = NULL;
+        extcapacity = 0;
+        modified = false;
     }
     
     ~chivector() {
-        if (extensions != NULL) {
-            delete extensions;
-            extensions = NULL;
+        if (extensions != NULL && pool == NULL) {
+            free(extensions);
         }
+        extensions = NULL;
     }
     
     void write(T * dest) {
@@ -88,23 +198,53 @@ public:
         return nsize;
     }
     
+    /**
+     * Size class for n elements: the smallest power of two
+     * (at least MINCAPACITY) that holds them.
+     */
+    static uint16_t size_class(int n) {
+        int c = MINCAPACITY;
+        while(c < n) c *= 2;
+        return (uint16_t) std::min(c, 0xffff);
+    }
+    
+    /**
+     * Capacity of the slot when the block is laid out again: the current
+     * slot if the vector still fits and does not waste most of it, otherwise
+     * the size class of the vector.
+     */
     uint16_t capacity() {
-        return nsize > MINCAPACITY ? nsize : MINCAPACITY;
+        if (fits_slot() && ncapacity <= 4 * (int)size_class(nsize)) return ncapacity;
+        return size_class(nsize);
+    }
+    
+    /**
+     * Returns true if the values are in the slot of the data block.
+     */
+    bool fits_slot() {
+        return nsize <= ncapacity;
+    }
+    
+    bool is_modified() {
+        return modified;
     }
     
     void add(T val) {
+        modified = true;
         nsize ++;
         if (nsize > ncapacity) {
-            if (extensions == NULL) extensions = new std::vector<T>();
-            extensions->push_back(val);
+            int extidx = nsize - 1 - ncapacity;
+            if (extidx >= extcapacity) grow_extensions();
+            extensions[extidx] = val;
         } else {
             data[nsize - 1] = val;
         }
     }
     //idx should already exist in the array
     void set(int idx, T val){
+        modified = true;
 	if (idx >= ncapacity) {
-            (*extensions)[idx - (int)ncapacity] = val;
+            extensions[idx - (int)ncapacity] = val;
         } else {
             data[idx] = val;
         }
@@ -114,7 +254,7 @@ public:
     
     T get(int idx) {
         if (idx >= ncapacity) {
-            return (* extensions)[idx - (int)ncapacity];
+            return extensions[idx - (int)ncapacity];
         } else {
             return data[idx];
         }
@@ -130,11 +270,29 @@ public:
     }
     
     void clear() {
+        modified = true;
         nsize = 0;
     }
     
     // TODO: iterators
     
+private:
+    /* Doubles the extension space. With a pool, the old space is simply left to the arena. */
+    void grow_extensions() {
+        int newcap = (extcapacity == 0 ? MINCAPACITY * 2 : extcapacity * 2);
+        newcap = std::min(newcap, 0xffff);
+        assert(newcap > extcapacity);
+        if (pool != NULL) {
+            T * newext = pool->allocate(newcap);
+            if (extensions != NULL) memcpy(newext, extensions, extcapacity * sizeof(T));
+            extensions = newext;
+        } else {
+            extensions = (T *) realloc(extensions, newcap * sizeof(T));
+            assert(extensions != NULL);
+        }
+        extcapacity = (uint16_t) newcap;
+    }
+    
 };
     
 }
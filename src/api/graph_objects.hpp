@@ -59,8 +59,19 @@ namespace graphchi {
         vid_t vertexid; // Source or Target vertex id. Clear from context.
         EdgeDataType * data_ptr;
         
-        graphchi_edge() {}
+#ifdef SUPPORT_DELETIONS
+        bool deleted;
+#endif
+        
+        graphchi_edge() {
+#ifdef SUPPORT_DELETIONS
+            deleted = false;
+#endif
+        }
         graphchi_edge(vid_t _vertexid, EdgeDataType * edata_ptr) : vertexid(_vertexid), data_ptr(edata_ptr) {
+#ifdef SUPPORT_DELETIONS
+            deleted = false;
+#endif
         }
         
 #ifndef DYNAMICEDATA
@@ -84,6 +95,14 @@ namespace graphchi {
             return vertexid;
         }
         
+#ifdef SUPPORT_DELETIONS
+        /**
+          * Returns true if the edge has been removed with this edge object.
+          */
+        bool is_deleted() {
+            return deleted;
+        }
+#endif
  
     }  __attribute__((packed));
     
@@ -95,48 +114,22 @@ namespace graphchi {
     
 #ifdef SUPPORT_DELETIONS
     
+#ifdef DYNAMICEDATA
+#error "Edge deletions are not supported with dynamic edge data."
+#endif
+    
     /*
-     * Hacky support for edge deletions.
-     * Edges are deleted by setting the value of the edge to a special
-     * value that denotes it was deleted.
-     * In the future, a better system could be designed.
+     * Support for edge deletions.
+     * Removing an edge only flags it. After the update, the engine records
+     * the flagged edges in the deletion bitmap of the shard that stores them
+     * (see shards/deletionbitmap.hpp), and deleted edges are not loaded anymore.
+     * An application can overload remove_edgev for its edge type, for example
+     * to also label the edge so that the other endpoint sees the removal
+     * on the same iteration.
      */
-    
-    // This is hacky...
-    static inline bool VARIABLE_IS_NOT_USED is_deleted_edge_value(int val);
-    static inline bool VARIABLE_IS_NOT_USED is_deleted_edge_value(bool val) {
-        return val;
-    }
-    
-    static inline bool VARIABLE_IS_NOT_USED is_deleted_edge_value(int val);
-    static inline bool VARIABLE_IS_NOT_USED is_deleted_edge_value(int val) {
-        return 0xffffffff == (unsigned int)val;
-    }
-    
-    static inline bool VARIABLE_IS_NOT_USED is_deleted_edge_value(vid_t val);
-    static inline bool VARIABLE_IS_NOT_USED is_deleted_edge_value(vid_t val) {
-        return 0xffffffffu == val;
-    }
-    
-    
-    static inline bool VARIABLE_IS_NOT_USED is_deleted_edge_value(float val);
-    static inline bool VARIABLE_IS_NOT_USED is_deleted_edge_value(float val) {
-        return !(val < 0 || val > 0);
-    }
-    
-    static void VARIABLE_IS_NOT_USED remove_edgev(graphchi_edge<bool> * e);
-    static void VARIABLE_IS_NOT_USED remove_edgev(graphchi_edge<bool> * e) {
-        e->set_data(true);
-    }
-    
-    static void VARIABLE_IS_NOT_USED remove_edgev(graphchi_edge<vid_t> * e);
-    static void VARIABLE_IS_NOT_USED remove_edgev(graphchi_edge<vid_t> * e) {
-        e->set_data(0xffffffff);
-    }
-    
-    static void VARIABLE_IS_NOT_USED remove_edgev(graphchi_edge<int> * e);
-    static void VARIABLE_IS_NOT_USED remove_edgev(graphchi_edge<int> * e) {
-        e->set_data(0xffffffff);
+    template <typename ET>
+    static void VARIABLE_IS_NOT_USED remove_edgev(graphchi_edge<ET> * e) {
+        e->deleted = true;
     }
     
 #endif  
@@ -166,14 +159,16 @@ namespace graphchi {
         bool parallel_safe;
         
 #ifdef SUPPORT_DELETIONS
-        int deleted_inc;
-        int deleted_outc;
+        volatile int deleted_inc;
+        volatile int deleted_outc;
+        bool edges_removed;  // Set if the update removed any edges
 #endif
         
         
         internal_graphchi_vertex() : inc(0), outc(0) {
 #ifdef SUPPORT_DELETIONS
             deleted_outc = deleted_inc = 0;
+            edges_removed = false;
 #endif
             dataptr = NULL;
         }
@@ -193,6 +188,7 @@ namespace graphchi {
 #ifdef SUPPORT_DELETIONS
             deleted_inc = 0;
             deleted_outc = 0;
+            edges_removed = false;
 #endif
         }
         
@@ -220,12 +216,6 @@ namespace graphchi {
         // Optimization: as only memshard (not streaming shard) creates inedgers,
         // we do not need atomic instructions here!
         inline void add_inedge(vid_t src, EdgeDataType * ptr, bool special_edge) {
-#ifdef SUPPORT_DELETIONS
-            if (inedges_ptr != NULL && is_deleted_edge_value(*ptr)) {
-                deleted_inc++;
-                return;
-            }
-#endif
             int i = __sync_add_and_fetch(&inc, 1);
             if (inedges_ptr != NULL)
                 inedges_ptr[i - 1] = graphchi_edge<EdgeDataType>(src, ptr);
@@ -238,17 +228,21 @@ namespace graphchi {
         }
         
         inline void add_outedge(vid_t dst, EdgeDataType * ptr, bool special_edge) {
-#ifdef SUPPORT_DELETIONS
-            if (outedges_ptr != NULL && is_deleted_edge_value(*ptr)) {
-                deleted_outc++;
-                return;
-            }
-#endif
             int i = __sync_add_and_fetch(&outc, 1);
             if (outedges_ptr != NULL) outedges_ptr[i - 1] = graphchi_edge<EdgeDataType>(dst, ptr);
             assert(dst != vertexid);
         }
         
+#ifdef SUPPORT_DELETIONS
+        /* Called by the shards for edges that are in the deletion bitmap */
+        inline void add_deleted_inedge() {
+            __sync_add_and_fetch(&deleted_inc, 1);
+        }
+        
+        inline void add_deleted_outedge() {
+            __sync_add_and_fetch(&deleted_outc, 1);
+        }
+#endif
         
     };
     
@@ -346,14 +340,17 @@ namespace graphchi {
 #ifdef SUPPORT_DELETIONS
         void VARIABLE_IS_NOT_USED remove_edge(int i) {
             remove_edgev(edge(i));
+            this->edges_removed = true;
         }
         
         void VARIABLE_IS_NOT_USED remove_inedge(int i) {
             remove_edgev(inedge(i));
+            this->edges_removed = true;
         }
         
         void VARIABLE_IS_NOT_USED remove_outedge(int i) {
             remove_edgev(outedge(i));
+            this->edges_removed = true;
         }
         
         void VARIABLE_IS_NOT_USED remove_alledges() {
@@ -39,6 +39,7 @@
 
 #include "graphchi_types.hpp"
 #include "api/ischeduler.hpp"
+#include "api/progress.hpp"
 
 namespace graphchi {
     
@@ -57,7 +58,11 @@ namespace graphchi {
         std::string filename;
         double last_deltasum;
         
-        graphchi_context() : scheduler(NULL), iteration(0), last_iteration(-1) {
+        /* Progress of the run and the estimated time to finish, see progress.hpp.
+           Read without locks. NULL if the engine does not track progress. */
+        engine_progress * progress;
+        
+        graphchi_context() : scheduler(NULL), iteration(0), last_iteration(-1), progress(NULL) {
             gettimeofday(&start, NULL);
             last_deltasum = 0.0;
         }
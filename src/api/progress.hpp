@@ -0,0 +1,300 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Progress of an engine run: intervals and sub-intervals done, edges
+ * processed, moving averages of the throughput of each phase, and the
+ * estimated time to finish the iteration and the run.
+ *
+ * The engine thread is the only writer. Each field is a single aligned
+ * word written with atomic operations, so readers (update functions through
+ * graphchi_context::progress, the HTTP admin, the live metrics) never take
+ * a lock; they may see fields of two consecutive updates, which only
+ * matters for the estimates.
+ *
+ * The fraction done of an iteration is counted in intervals, and within
+ * the current interval in vertices. As the sharder balances the intervals
+ * by the number of edges, this follows the edges, which dominate the work.
+ */
+
+#ifndef DEF_GRAPHCHI_PROGRESS
+#define DEF_GRAPHCHI_PROGRESS
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+#define PROGRESS_SMOOTHING 0.3  // Weight of the latest sub-interval in the moving averages
+
+namespace graphchi {
+
+    enum progress_phase {
+        PHASE_LOAD, PHASE_UPDATES, PHASE_SAVE, PHASE_COMMIT,
+        PHASE_NPHASES
+    };
+
+    class engine_progress {
+
+        /* Doubles are stored as their bits, so that they are written atomically */
+        volatile uint64_t start_time_bits;
+        volatile uint64_t iter_start_time_bits;
+        volatile uint64_t iter_time_sum_bits;      // Time of the finished iterations
+        volatile uint64_t iter_fraction_bits;
+        volatile uint64_t throughput_bits[PHASE_NPHASES];   // Edges per second, moving average
+        volatile uint64_t overall_throughput_bits;
+
+        volatile int iteration;
+        volatile int niterations;
+        volatile int iterations_done;
+        volatile int intervals_done;
+        volatile int nintervals;
+        volatile size_t edges_total;
+        volatile size_t edges_iteration;
+        volatile size_t nedges;
+        volatile size_t subintervals_done;
+
+        static inline uint64_t bits(double x) {
+            uint64_t b;
+            memcpy(&b, &x, sizeof(b));
+            return b;
+        }
+
+        static inline double value(uint64_t b) {
+            double x;
+            memcpy(&x, &b, sizeof(x));
+            return x;
+        }
+
+        static inline void store(volatile uint64_t * target, double x) {
+            __sync_lock_test_and_set(target, bits(x));
+        }
+
+        static inline double load(const volatile uint64_t * source) {
+            return value(*source);
+        }
+
+        static double now() {
+            timeval tv;
+            gettimeofday(&tv, NULL);
+            return tv.tv_sec + tv.tv_usec * 1e-6;
+        }
+
+    public:
+
+        engine_progress() {
+            reset(0, 0, 0);
+        }
+
+        static const char * phase_name(int phase) {
+            switch(phase) {
+                case PHASE_LOAD: return "load";
+                case PHASE_UPDATES: return "updates";
+                case PHASE_SAVE: return "save";
+                case PHASE_COMMIT: return "commit";
+            }
+            return "unknown";
+        }
+
+        /* Writer: the engine */
+
+        void reset(int _niterations, int _nintervals, size_t _nedges) {
+            store(&start_time_bits, now());
+            store(&iter_start_time_bits, now());
+            store(&iter_time_sum_bits, 0.0);
+            store(&iter_fraction_bits, 0.0);
+            store(&overall_throughput_bits, 0.0);
+            for(int p=0; p < PHASE_NPHASES; p++) store(&throughput_bits[p], 0.0);
+            iteration = 0;
+            niterations = _niterations;
+            iterations_done = 0;
+            intervals_done = 0;
+            nintervals = _nintervals;
+            edges_total = 0;
+            edges_iteration = 0;
+            nedges = _nedges;
+            subintervals_done = 0;
+        }
+
+        void begin_iteration(int iter, int _niterations, int _nintervals, size_t _nedges) {
+            iteration = iter;
+            niterations = _niterations;
+            nintervals = _nintervals;
+            nedges = _nedges;
+            intervals_done = 0;
+            edges_iteration = 0;
+            store(&iter_fraction_bits, 0.0);
+            store(&iter_start_time_bits, now());
+        }
+
+        /**
+         * Records the end of a sub-interval.
+         * @param interval_fraction fraction of the vertices of the current interval done
+         * @param edges edges of the updated vertices of the sub-interval
+         */
+        void subinterval_done(double interval_fraction, size_t edges) {
+            __sync_add_and_fetch(&edges_total, edges);
+            __sync_add_and_fetch(&edges_iteration, edges);
+            __sync_add_and_fetch(&subintervals_done, 1);
+            if (nintervals > 0) {
+                store(&iter_fraction_bits, std::min(1.0, (intervals_done + interval_fraction) / nintervals));
+            }
+            double elapsed = now() - load(&start_time_bits);
+            if (elapsed > 0) store(&overall_throughput_bits, edges_total / elapsed);
+        }
+
+        void interval_done() {
+            __sync_add_and_fetch(&intervals_done, 1);
+            if (nintervals > 0) store(&iter_fraction_bits, std::min(1.0, intervals_done / (double) nintervals));
+        }
+
+        void end_iteration() {
+            store(&iter_time_sum_bits, load(&iter_time_sum_bits) + (now() - load(&iter_start_time_bits)));
+            store(&iter_fraction_bits, 1.0);
+            __sync_add_and_fetch(&iterations_done, 1);
+        }
+
+        /**
+         * Records the time a phase took on the edges of a sub-interval.
+         */
+        void record_phase(int phase, size_t edges, double seconds) {
+            if (seconds <= 0 || edges == 0) return;
+            double rate = edges / seconds;
+            double prev = load(&throughput_bits[phase]);
+            store(&throughput_bits[phase], (prev == 0.0 ? rate : PROGRESS_SMOOTHING * rate + (1 - PROGRESS_SMOOTHING) * prev));
+        }
+
+        /* Readers */
+
+        int get_iteration() const { return iteration; }
+        int get_num_iterations() const { return niterations; }
+        int get_intervals_done() const { return intervals_done; }
+        int get_num_intervals() const { return nintervals; }
+        size_t get_edges_processed() const { return edges_total; }
+        size_t get_edges_iteration() const { return edges_iteration; }
+        size_t get_subintervals_done() const { return subintervals_done; }
+
+        double elapsed() const {
+            return now() - load(&start_time_bits);
+        }
+
+        /**
+         * Fraction of the current iteration done, 0..1.
+         */
+        double iteration_fraction() const {
+            return load(&iter_fraction_bits);
+        }
+
+        /**
+         * Fraction of the whole run done, 0..1.
+         */
+        double run_fraction() const {
+            if (niterations <= 0) return 0;
+            return std::min(1.0, (iterations_done + (iterations_done > iteration ? 0.0 : iteration_fraction())) / niterations);
+        }
+
+        /**
+         * Edges per second of a phase, moving average over the sub-intervals.
+         */
+        double phase_throughput(int phase) const {
+            return load(&throughput_bits[phase]);
+        }
+
+        double throughput() const {
+            return load(&overall_throughput_bits);
+        }
+
+        /**
+         * Seconds to finish the current iteration, or -1 if not known yet.
+         */
+        double eta_iteration() const {
+            double f = iteration_fraction();
+            if (f <= 0) return -1;
+            if (f >= 1) return 0;
+            double t = now() - load(&iter_start_time_bits);
+            return t * (1 - f) / f;
+        }
+
+        /**
+         * Seconds to finish the run, or -1 if not known yet. The iterations
+         * left are estimated by the mean of the finished ones, or by the
+         * current one if none has finished.
+         */
+        double eta_run() const {
+            double eta_iter = eta_iteration();
+            if (eta_iter < 0) return -1;
+            int done = iterations_done;
+            double per_iter;
+            if (done > 0) {
+                per_iter = load(&iter_time_sum_bits) / done;
+            } else {
+                per_iter = (now() - load(&iter_start_time_bits)) + eta_iter;
+            }
+            int left = niterations - iteration - 1;
+            if (done > iteration) left = niterations - done;  // Between iterations
+            return (done > iteration ? 0 : eta_iter) + std::max(0, left) * per_iter;
+        }
+
+        std::string to_json() const {
+            std::stringstream json;
+            json << "{";
+            json << "\"iteration\": " << iteration << ", ";
+            json << "\"numIterations\": " << niterations << ", ";
+            json << "\"intervalsDone\": " << intervals_done << ", ";
+            json << "\"numIntervals\": " << nintervals << ", ";
+            json << "\"subintervalsDone\": " << subintervals_done << ", ";
+            json << "\"edgesProcessed\": " << edges_total << ", ";
+            json << "\"edgesIteration\": " << edges_iteration << ", ";
+            json << "\"iterationFraction\": " << iteration_fraction() << ", ";
+            json << "\"runFraction\": " << run_fraction() << ", ";
+            json << "\"edgesPerSec\": " << throughput() << ", ";
+            json << "\"phaseEdgesPerSec\": {";
+            for(int p=0; p < PHASE_NPHASES; p++) {
+                json << (p > 0 ? ", " : "") << "\"" << phase_name(p) << "\": " << phase_throughput(p);
+            }
+            json << "}, ";
+            json << "\"etaIteration\": " << eta_iteration() << ", ";
+            json << "\"etaRun\": " << eta_run();
+            json << "}";
+            return json.str();
+        }
+
+        /**
+         * Compact one-line summary for the log.
+         */
+        std::string summary() const {
+            char buf[512];
+            snprintf(buf, sizeof(buf), "iteration %d/%d %.1f%% (run %.1f%%), %.3g edges/s (load %.3g, updates %.3g, commit %.3g), ETA iteration %.1fs, run %.1fs",
+                     iteration, niterations - 1, iteration_fraction() * 100, run_fraction() * 100, throughput(),
+                     phase_throughput(PHASE_LOAD), phase_throughput(PHASE_UPDATES), phase_throughput(PHASE_COMMIT),
+                     eta_iteration(), eta_run());
+            return std::string(buf);
+        }
+    };
+
+}
+
+#endif
@@ -0,0 +1,465 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Random walks in the style of DrunkardMob: the walks are kept in memory,
+ * not in the edges, and advanced when the interval of their current vertex
+ * is loaded by the engine. The graph itself stays on the disk.
+ *
+ * A walk is one 64-bit word: the index of its source (32 bits), the number
+ * of hops taken (16 bits), and the offset of its current vertex in its
+ * bucket (16 bits). A bucket holds the walks whose current vertex is in a
+ * block of 2^WALK_BUCKET_BITS consecutive vertices, so that the walks of an
+ * interval are found in the buckets of its blocks.
+ *
+ * Before an interval is executed, its walks are taken from the buckets and
+ * grouped by vertex. The update of a vertex moves each of its walks to a
+ * random out-neighbor, with the fast random generator of the thread, into a
+ * buffer of the thread. The buffers are flushed into the buckets when full
+ * and after the interval. A walk that moves to a later interval is advanced
+ * again on the same iteration, others on the next one, so each iteration
+ * advances every walk by at least one hop.
+ *
+ * DrunkardMobProgram is the GraphChi program that does this. Applications
+ * start the walks from their sources, and get the walks through a
+ * walk_callback: each visit of a vertex, and the endpoint of each walk. A
+ * walk ends after the maximum number of hops, at a vertex without
+ * out-edges, or with the reset probability on each hop (for personalized
+ * PageRank).
+ */
+
+#ifndef DEF_GRAPHCHI_RANDOM_WALKS
+#define DEF_GRAPHCHI_RANDOM_WALKS
+
+#include <assert.h>
+#include <stdint.h>
+#include <omp.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "graphchi_types.hpp"
+#include "api/graph_objects.hpp"
+#include "api/graphchi_context.hpp"
+#include "api/graphchi_program.hpp"
+#include "logger/logger.hpp"
+#include "util/memory_tracker.hpp"
+#include "util/pthread_tools.hpp"
+
+#define WALK_BUCKET_BITS 16
+#define WALK_HOP_BITS 16
+#define WALK_MAX_HOPS ((1 << WALK_HOP_BITS) - 1)
+#define WALK_BUFFER_SIZE 65536  // Walks buffered by a thread before flushing to the buckets
+
+namespace graphchi {
+
+    typedef uint64_t walk_t;
+
+    static inline walk_t make_walk(uint32_t source_idx, uint32_t hop, vid_t vertex) {
+        return ((walk_t) source_idx << 32) | ((walk_t) hop << WALK_BUCKET_BITS) |
+               (vertex & ((1 << WALK_BUCKET_BITS) - 1));
+    }
+
+    static inline uint32_t walk_source(walk_t w) {
+        return (uint32_t) (w >> 32);
+    }
+
+    static inline uint32_t walk_hop(walk_t w) {
+        return (uint32_t) (w >> WALK_BUCKET_BITS) & WALK_MAX_HOPS;
+    }
+
+    static inline vid_t walk_vertex(walk_t w, size_t bucket) {
+        return (vid_t) ((bucket << WALK_BUCKET_BITS) | (w & ((1 << WALK_BUCKET_BITS) - 1)));
+    }
+
+    /**
+     * Xorshift64* generator, one for each thread. Much faster than random(),
+     * which takes a lock.
+     */
+    class walk_rng {
+        uint64_t state;
+
+    public:
+        walk_rng(uint64_t seed = 1) {
+            set_seed(seed);
+        }
+
+        void set_seed(uint64_t seed) {
+            /* Splitmix64 step, so that consecutive seeds give unrelated streams */
+            uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            state = (z ^ (z >> 31)) | 1;
+        }
+
+        inline uint64_t next() {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            return state * 0x2545F4914F6CDD1DULL;
+        }
+
+        /**
+         * Uniform in 0..n-1.
+         */
+        inline uint32_t next_int(uint32_t n) {
+            return (uint32_t) (((next() >> 32) * n) >> 32);
+        }
+
+        /**
+         * Uniform in [0, 1).
+         */
+        inline double next_double() {
+            return (next() >> 11) * (1.0 / 9007199254740992.0);
+        }
+    };
+
+    /**
+     * Receives the walks. Called from several threads in parallel.
+     */
+    class walk_callback {
+    public:
+        virtual ~walk_callback() {}
+
+        /**
+         * A walk arrived at vertex on its hop-th hop (hop >= 1).
+         */
+        virtual void visit(uint32_t source_idx, vid_t source, vid_t vertex, int hop) {
+        }
+
+        /**
+         * A walk ended at vertex after the given number of hops.
+         */
+        virtual void endpoint(uint32_t source_idx, vid_t source, vid_t vertex, int hops) = 0;
+    };
+
+    /**
+     * The walks, in buckets by their current vertex.
+     */
+    class walk_manager {
+
+        struct thread_state {
+            walk_rng rng;
+            std::vector<std::pair<uint32_t, walk_t> > buffer;   // (bucket, walk)
+            size_t hops;
+            char padding[64];
+        };
+
+        std::vector<vid_t> sources;
+        std::vector<std::vector<walk_t> > buckets;
+        mutex * bucket_locks;
+        size_t nbuckets;
+        std::vector<thread_state> threads;
+        volatile size_t nactive;
+        size_t tracked_bytes;
+
+        /* Walks of the current interval, by vertex */
+        vid_t cur_st, cur_en;
+        std::vector<size_t> cur_index;
+        std::vector<walk_t> cur_walks;
+
+        void flush(thread_state &ts) {
+            std::vector<std::pair<uint32_t, walk_t> > &buf = ts.buffer;
+            if (buf.empty()) return;
+            std::sort(buf.begin(), buf.end());
+            size_t i = 0;
+            while (i < buf.size()) {
+                uint32_t b = buf[i].first;
+                size_t j = i;
+                while (j < buf.size() && buf[j].first == b) j++;
+                bucket_locks[b].lock();
+                std::vector<walk_t> &bucket = buckets[b];
+                for(size_t k=i; k < j; k++) bucket.push_back(buf[k].second);
+                bucket_locks[b].unlock();
+                i = j;
+            }
+            buf.clear();
+        }
+
+        void track_memory() {
+            size_t bytes = cur_index.capacity() * sizeof(size_t) + cur_walks.capacity() * sizeof(walk_t);
+            for(size_t b=0; b < buckets.size(); b++) bytes += buckets[b].capacity() * sizeof(walk_t);
+            for(size_t t=0; t < threads.size(); t++) bytes += threads[t].buffer.capacity() * sizeof(std::pair<uint32_t, walk_t>);
+            if (bytes > tracked_bytes) memory_tracker::instance().allocated(MEM_OTHER, bytes - tracked_bytes);
+            else memory_tracker::instance().released(MEM_OTHER, tracked_bytes - bytes);
+            tracked_bytes = bytes;
+        }
+
+    public:
+
+        walk_manager(uint64_t seed = 1) : bucket_locks(NULL), nbuckets(0), nactive(0), tracked_bytes(0), cur_st(0), cur_en(0) {
+            threads.resize(omp_get_max_threads());
+            for(size_t t=0; t < threads.size(); t++) {
+                threads[t].rng.set_seed(seed * 1000003 + t);
+                threads[t].hops = 0;
+            }
+        }
+
+        ~walk_manager() {
+            memory_tracker::instance().released(MEM_OTHER, tracked_bytes);
+            delete [] bucket_locks;
+        }
+
+        /**
+         * Starts walks from a source. Not thread-safe, call before the engine runs.
+         * @return index of the source
+         */
+        uint32_t add_source(vid_t source, int nwalks) {
+            uint32_t idx = (uint32_t) sources.size();
+            sources.push_back(source);
+            size_t b = source >> WALK_BUCKET_BITS;
+            if (b >= buckets.size()) buckets.resize(b + 1);
+            for(int i=0; i < nwalks; i++) {
+                buckets[b].push_back(make_walk(idx, 0, source));
+            }
+            nactive += nwalks;
+            return idx;
+        }
+
+        vid_t get_source(uint32_t source_idx) const {
+            return sources[source_idx];
+        }
+
+        size_t num_sources() const {
+            return sources.size();
+        }
+
+        /**
+         * Prepares the buckets for the graph. Called when the engine starts.
+         */
+        void initialize(vid_t nvertices, int nthreads) {
+            if (nbuckets == 0) {
+                nbuckets = std::max(buckets.size(), (size_t) (nvertices >> WALK_BUCKET_BITS) + 1);
+                buckets.resize(nbuckets);
+                bucket_locks = new mutex[nbuckets];
+            }
+            if (nthreads > (int) threads.size()) {
+                size_t old = threads.size();
+                threads.resize(nthreads);
+                for(size_t t=old; t < threads.size(); t++) {
+                    threads[t].rng.set_seed(threads[0].rng.next() + t);
+                    threads[t].hops = 0;
+                }
+            }
+            track_memory();
+        }
+
+        /**
+         * Takes the walks of an interval from the buckets, and groups them by vertex.
+         */
+        void begin_interval(vid_t st, vid_t en) {
+            assert(nbuckets > 0);
+            cur_st = st;
+            cur_en = en;
+            cur_index.assign((size_t) (en - st) + 2, 0);
+            size_t bst = st >> WALK_BUCKET_BITS;
+            size_t ben = std::min((size_t) (en >> WALK_BUCKET_BITS), nbuckets - 1);
+
+            /* Count the walks of each vertex */
+            for(size_t b=bst; b <= ben; b++) {
+                std::vector<walk_t> &bucket = buckets[b];
+                for(size_t i=0; i < bucket.size(); i++) {
+                    vid_t v = walk_vertex(bucket[i], b);
+                    if (v >= st && v <= en) cur_index[v - st + 1]++;
+                }
+            }
+            for(size_t i=1; i < cur_index.size(); i++) cur_index[i] += cur_index[i - 1];
+            cur_walks.resize(cur_index.back());
+
+            /* Place them, and keep the walks of the other intervals in the buckets */
+            std::vector<size_t> pos(cur_index.begin(), cur_index.end() - 1);
+            for(size_t b=bst; b <= ben; b++) {
+                std::vector<walk_t> &bucket = buckets[b];
+                size_t kept = 0;
+                for(size_t i=0; i < bucket.size(); i++) {
+                    vid_t v = walk_vertex(bucket[i], b);
+                    if (v >= st && v <= en) {
+                        cur_walks[pos[v - st]++] = bucket[i];
+                    } else {
+                        bucket[kept++] = bucket[i];
+                    }
+                }
+                if (kept == 0) {
+                    std::vector<walk_t>().swap(bucket);  // Release the memory
+                } else {
+                    bucket.resize(kept);
+                }
+            }
+            track_memory();
+        }
+
+        /**
+         * Walks at a vertex of the current interval.
+         */
+        inline const walk_t * walks_at(vid_t v, size_t &n) const {
+            if (v < cur_st || v > cur_en) {
+                n = 0;
+                return NULL;
+            }
+            size_t i = cur_index[v - cur_st];
+            n = cur_index[v - cur_st + 1] - i;
+            return n > 0 ? &cur_walks[i] : NULL;
+        }
+
+        inline bool has_walks(vid_t v) const {
+            return v >= cur_st && v <= cur_en && cur_index[v - cur_st + 1] > cur_index[v - cur_st];
+        }
+
+        /**
+         * Moves a walk one hop to dst. Called from the update functions; each
+         * thread uses its own buffer.
+         */
+        inline void move(int thread, walk_t w, vid_t dst) {
+            thread_state &ts = threads[thread];
+            ts.buffer.push_back(std::pair<uint32_t, walk_t>((uint32_t) (dst >> WALK_BUCKET_BITS),
+                                                            make_walk(walk_source(w), walk_hop(w) + 1, dst)));
+            ts.hops++;
+            if (ts.buffer.size() >= WALK_BUFFER_SIZE) flush(ts);
+        }
+
+        inline void ended() {
+            __sync_sub_and_fetch(&nactive, 1);
+        }
+
+        inline walk_rng &rng(int thread) {
+            return threads[thread].rng;
+        }
+
+        inline int num_threads() const {
+            return (int) threads.size();
+        }
+
+        /**
+         * Flushes the buffers of the threads, and releases the walks of the interval.
+         */
+        void end_interval() {
+            for(size_t t=0; t < threads.size(); t++) flush(threads[t]);
+            std::vector<walk_t>().swap(cur_walks);
+            cur_index.clear();
+            cur_st = 1;
+            cur_en = 0;
+            track_memory();
+        }
+
+        size_t num_active() const {
+            return nactive;
+        }
+
+        size_t num_hops() const {
+            size_t n = 0;
+            for(size_t t=0; t < threads.size(); t++) n += threads[t].hops;
+            return n;
+        }
+    };
+
+    /**
+     * GraphChi program that advances the walks of a walk_manager. Run it
+     * with selective scheduling and with deterministic parallelism disabled
+     * (the walks do not use the edge data). The engine does not need to load
+     * the edge data, see graphchi_engine::set_only_adjacency().
+     */
+    template <typename VertexDataType, typename EdgeDataType>
+    class DrunkardMobProgram : public GraphChiProgram<VertexDataType, EdgeDataType> {
+
+    protected:
+        walk_manager &walks;
+        walk_callback &callback;
+        int maxhops;
+        double reset_prob;
+
+    public:
+
+        /**
+         * @param maxhops walks end after this many hops
+         * @param reset_prob probability of a walk to end on each hop
+         */
+        DrunkardMobProgram(walk_manager &walks, walk_callback &callback, int maxhops, double reset_prob = 0.0) :
+            walks(walks), callback(callback), maxhops(maxhops), reset_prob(reset_prob) {
+            assert(maxhops > 0 && maxhops <= WALK_MAX_HOPS);
+        }
+
+        /**
+         * Called for each vertex with the number of walks that arrived at it
+         * (excluding the walks that start from it). Applications can keep
+         * counts in the vertex data.
+         */
+        virtual void visited(graphchi_vertex<VertexDataType, EdgeDataType> &vertex, size_t nwalks, graphchi_context &gcontext) {
+        }
+
+        void update(graphchi_vertex<VertexDataType, EdgeDataType> &vertex, graphchi_context &gcontext) {
+            size_t n;
+            const walk_t * vwalks = walks.walks_at(vertex.id(), n);
+            if (n == 0) return;
+
+            int thread = omp_get_thread_num();
+            assert(thread < walks.num_threads());
+            walk_rng &rng = walks.rng(thread);
+            int outc = vertex.num_outedges();
+            size_t arrived = 0;
+
+            for(size_t i=0; i < n; i++) {
+                walk_t w = vwalks[i];
+                uint32_t src = walk_source(w);
+                int hop = (int) walk_hop(w);
+                if (hop > 0) {
+                    arrived++;
+                    callback.visit(src, walks.get_source(src), vertex.id(), hop);
+                }
+                if (hop >= maxhops || outc == 0 || (reset_prob > 0 && hop > 0 && rng.next_double() < reset_prob)) {
+                    callback.endpoint(src, walks.get_source(src), vertex.id(), hop);
+                    walks.ended();
+                    continue;
+                }
+                vid_t dst = vertex.outedge(rng.next_int(outc))->vertex_id();
+                walks.move(thread, w, dst);
+                if (gcontext.scheduler != NULL) gcontext.scheduler->add_task(dst, true);
+            }
+            if (arrived > 0) visited(vertex, arrived, gcontext);
+        }
+
+        void before_iteration(int iteration, graphchi_context &gcontext) {
+            if (iteration == 0) {
+                walks.initialize(gcontext.nvertices, gcontext.execthreads);
+            }
+        }
+
+        void after_iteration(int iteration, graphchi_context &gcontext) {
+            logstream(LOG_INFO) << "Random walks: " << walks.num_active() << " active, "
+                << walks.num_hops() << " hops" << std::endl;
+            if (walks.num_active() == 0) {
+                gcontext.set_last_iteration(iteration);
+            }
+        }
+
+        void before_exec_interval(vid_t window_st, vid_t window_en, graphchi_context &gcontext) {
+            walks.begin_interval(window_st, window_en);
+        }
+
+        void after_exec_interval(vid_t window_st, vid_t window_en, graphchi_context &gcontext) {
+            walks.end_interval();
+        }
+    };
+
+}
+
+#endif
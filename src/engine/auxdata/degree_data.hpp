@@ -74,7 +74,7 @@ namespace graphchi {
             filename = filename_degree_data(base_filename);
             modified = false;
             if (!use_mmap) {
-                filedesc = iomgr->open_session(filename.c_str(), false);
+                filedesc = iomgr->open_session(filename.c_str(), false, false, io_tag(IO_DEGREE), MEM_DEGREE_CHUNK);
             } else {
                 mmap_length = get_filesize(filename);
                 filedesc = open(filename.c_str(), O_RDWR);
@@ -159,7 +159,7 @@ namespace graphchi {
             vdblock db(blockid);
             
             std::string blockfname = blockfilename(blockid);
-            db.fd = iomgr->open_session(blockfname, false, true);
+            db.fd = iomgr->open_session(blockfname, false, true, io_tag(IO_VERTEXDATA), MEM_VERTEX_CHUNK);
             int realsize = get_block_uncompressed_size(blockfname, -1);
             assert(realsize > 0);
             
@@ -170,13 +170,16 @@ namespace graphchi {
         }
         
         void write_block(vdblock &block) {
+            if (!block.dblock->is_dirty()) return;
             int realsize;
-            uint8_t * outdata;
-            block.dblock->write(&outdata, realsize);
+            bool allocated;
+            uint8_t * outdata = block.dblock->encode(realsize, allocated);
             std::string blockfname = blockfilename(block.blockid);
             iomgr->managed_pwritea_now(block.fd, &outdata, realsize, 0); /* Need to write whole block in the compressed regime */
-            write_block_uncompressed_size(blockfname, realsize);
-            free(outdata);
+            if (allocated) {
+                write_block_uncompressed_size(blockfname, realsize);
+                free(outdata);
+            }
         }
         
     public:
@@ -74,7 +74,7 @@ namespace graphchi {
 
         virtual void open_file() {
             if (!use_mmap) {
-                filedesc = iomgr->open_session(filename.c_str(), false);
+                filedesc = iomgr->open_session(filename.c_str(), false, false, io_tag(IO_VERTEXDATA), MEM_VERTEX_CHUNK);
             } else {
                 mmap_length = get_filesize(filename);
                 filedesc = open(filename.c_str(), O_RDWR);
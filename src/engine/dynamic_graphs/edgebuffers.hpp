@@ -46,8 +46,9 @@ namespace graphchi {
         EdgeDataType data;
         bool accounted_for_outc;
         bool accounted_for_inc;
+        bool deleted;
         created_edge(vid_t src, vid_t dst, EdgeDataType _data) : src(src), dst(dst), data(_data), accounted_for_outc(false),
-        accounted_for_inc(false) {}
+        accounted_for_inc(false), deleted(false) {}
     };
     
 #define EDGE_BUFFER_CHUNKSIZE 65536
@@ -87,17 +88,35 @@ namespace graphchi {
             return &bufs[i / EDGE_BUFFER_CHUNKSIZE][i % EDGE_BUFFER_CHUNKSIZE];
         }
         
+        /**
+         * Returns the buffered edge with value at dataptr, or NULL if
+         * the value is not in this buffer.
+         */
+        created_edge<ET> * find_by_data(ET * dataptr) {
+            for(int i=0; i < (int) bufs.size(); i++) {
+                created_edge<ET> * chunk = bufs[i];
+                if ((void*)dataptr >= (void*)chunk && (void*)dataptr < (void*)(chunk + EDGE_BUFFER_CHUNKSIZE)) {
+                    created_edge<ET> * e = chunk + ((char*)dataptr - (char*)chunk) / sizeof(created_edge<ET>);
+                    return (&e->data == dataptr && (unsigned int)(i * EDGE_BUFFER_CHUNKSIZE + (e - chunk)) < count ? e : NULL);
+                }
+            }
+            return NULL;
+        }
+        
         void add(vid_t src, vid_t dst, ET data) {
             add(created_edge<ET>(src, dst, data));
         }
         
         void add(created_edge<ET> cedge) {
-            int idx = count++;
+            int idx = count;
             int bufidx = idx / EDGE_BUFFER_CHUNKSIZE;
             if (bufidx == (int) bufs.size()) {
                 bufs.push_back((created_edge<ET>*)calloc(sizeof(created_edge<ET>), EDGE_BUFFER_CHUNKSIZE));
             }
             bufs[bufidx][idx % EDGE_BUFFER_CHUNKSIZE] = cedge;
+            /* Publish the edge only after it has been stored */
+            __sync_synchronize();
+            count = idx + 1;
         }
         
     private:
@@ -32,12 +32,18 @@
 #define GRAPHCHI_DYNAMICGRAPHENGINE_DEF
 
 #include <stdlib.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <deque>
 #include <vector>
 
 #include "engine/graphchi_engine.hpp"
 #include "engine/dynamic_graphs/edgebuffers.hpp"
+#include "engine/dynamic_graphs/shard_policy.hpp"
 #include "logger/logger.hpp"
+#include "metrics/trace.hpp"
 
+#define INGEST_MARK_USECS 10000
 
 namespace graphchi {
     
@@ -56,7 +62,41 @@ namespace graphchi {
             _m.set("engine", "dynamicgraphs");
             added_edges = 0;
             last_commit = 0;
-            maxshardsize = 200 * 1024 * 1024;
+            maxshardsize = get_option_long("maxshardsize_mb", 200) * 1024 * 1024;
+            policy = new shard_policy(sizeof(EdgeDataType) + sizeof(vid_t), this->blocksize, maxshardsize);
+            max_vertex_id = 0;
+            ingest_rate_edges = 0;
+            last_ingest_rate = 0;
+            gettimeofday(&ingest_rate_time, NULL);
+            ingest_closed = false;
+            max_edge_buffer = 0;
+            next_generation = NULL;
+            delta_memshards_interval = -1;
+            lsm_edges_written = 0;
+            lsm_max_delta_runs = get_option_int("lsm_max_delta_runs", 8);
+            lsm_write_amplification = get_option_float("lsm_write_amplification", 10.0f);
+            commit_buffer_fraction = get_option_float("commit_buffer_fraction", 0.8f);
+            commit_deleted_fraction = get_option_float("commit_deleted_fraction", 0.1f);
+            compact_deleted_fraction = get_option_float("compact_deleted_fraction", 0.2f);
+            commit_maxwindow = (vid_t) get_option_long("commit_maxwindow", 4000000);
+#ifdef SUPPORT_DELETIONS
+            background_commit = false; // Deletions recorded while a compaction is being built would be lost
+#else
+            background_commit = get_option_int("background_commit", 1) == 1;
+#endif
+        }
+        
+        virtual ~graphchi_dynamicgraph_engine() {
+            if (next_generation != NULL) {
+                if (background_commit) pthread_join(next_generation->thread, NULL);
+                release_generation(next_generation);
+            }
+            for(int i=0; i < (int)delta_memshards.size(); i++) delete delta_memshards[i];
+            for(int p=0; p < (int)delta_shards.size(); p++) {
+                for(int k=0; k < (int)delta_shards[p].size(); k++) delete delta_shards[p][k];
+            }
+            for(int i=0; i < (int)buffer_locks.size(); i++) delete buffer_locks[i];
+            delete policy;
         }
         
     protected:
@@ -65,7 +105,6 @@ namespace graphchi {
          * Bookkeeping of buffered and deleted edges.
          */
         std::vector< std::vector< edge_buffer * > > new_edge_buffers;
-        std::vector<int> deletecounts;
         std::vector<std::string> shard_suffices;
         
         vid_t max_vertex_id;
@@ -78,10 +117,156 @@ namespace graphchi {
         size_t orig_edges;
         
         /**
-         * Concurrency control
+         * Tiered (LSM-style) shard storage. Each shard consists of a base run
+         * and a list of delta runs, oldest first. A delta run is a small shard
+         * with the same file format, holding edges committed after the base run
+         * was written. Delta runs are read like the base run: with a sliding
+         * shard for other intervals and with a memory shard for the
+         * execution interval. Runs are merged into a new base run by compaction.
+         */
+        std::vector< std::vector<std::string> > delta_suffices;
+        std::vector< std::vector<typename base_engine::slidingshard_t *> > delta_shards;
+        std::vector<typename base_engine::memshard_t *> delta_memshards;
+        int delta_memshards_interval;
+        size_t lsm_edges_written;
+        
+        /**
+         * Commit and compaction policy, see should_compact(). Splits and
+         * merges of shards are decided by the shard policy.
+         */
+        shard_policy * policy;
+        int lsm_max_delta_runs;
+        double lsm_write_amplification;
+        double commit_buffer_fraction;
+        double commit_deleted_fraction;
+        double compact_deleted_fraction;
+        vid_t commit_maxwindow;
+        
+        /**
+         * Concurrency control.
+         * Edges are added under the read side of ingest_lock, and appended
+         * to the buffers of a destination shard under buffer_locks[shard].
+         * The engine takes the write side when it reads or replaces the buffers.
+         * Ingest threads blocked by a full buffer wait on ingest_cond.
          */
         mutex schedulerlock;
         mutex shardlock;
+        rwlock ingest_lock;
+        std::vector<mutex *> buffer_locks;
+        mutex ingest_cond_lock;
+        conditional ingest_cond;
+        
+        bool ingest_closed;
+        
+        /* For the ingest rate metric */
+        size_t ingest_rate_edges;
+        double last_ingest_rate;
+        timeval ingest_rate_time;
+        
+        /**
+         * Arrival times of the buffered edges, for the ingest lag and commit
+         * latency metrics. A mark records the value of added_edges after a batch
+         * and when the batch arrived; batches arriving within INGEST_MARK_USECS
+         * of the previous mark share it. Marks are retired when last_commit
+         * passes them. As commits can leave some shards in the buffers, the
+         * latencies are approximate.
+         */
+        struct ingest_mark {
+            size_t edges;
+            timeval time;
+        };
+        std::deque<ingest_mark> ingest_marks;
+        mutex ingest_marks_lock;
+        
+        /**
+         * Background commit. A commit freezes the buffers of the shards that
+         * will be rewritten, and a separate thread builds the next generation
+         * of those shards (files with a new suffix). Meanwhile the engine keeps
+         * computing on the current generation and the buffers, and switches
+         * to the new generation at the first iteration boundary after the build
+         * has finished.
+         * If the program modifies edges, the builder only writes the adjacency,
+         * and the edge values are copied to the new generation at the switch.
+         * A frozen shard either gets a new delta run, or is compacted.
+         */
+        struct edata_run {
+            size_t newidx;
+            size_t oldidx;      // Edge index in the source run
+            size_t len;
+            int source;         // Index to old_edata, or -1 if values come from the frozen buffers
+        };
+        
+        struct generation_part {
+            std::vector<std::string> old_edata;  // Base run first, then the delta runs
+            std::string new_edata;
+            std::vector<edata_run> runs;
+            std::vector<EdgeDataType *> bufvalues;
+        };
+        
+        struct shard_generation {
+            int iter;
+            vid_t max_vertex_id;
+            std::vector<std::pair<vid_t, vid_t> > intervals;
+            std::vector<std::string> suffices;
+            std::vector< std::vector<std::string> > deltasuffices;
+            std::vector< std::vector< edge_buffer * > > buffers;  // Empty for shards that are not rewritten
+            std::vector<bool> compact;
+            std::vector<int> nparts;          // See shard_policy::plan()
+            std::vector<size_t> shardedges;   // Edges in the base and delta runs
+            size_t nedges;
+            bool values_at_switch;
+            
+            /* Output of the build */
+            std::vector<std::pair<vid_t, vid_t> > newranges;
+            std::vector<std::string> newsuffices;
+            std::vector< std::vector<std::string> > newdeltasuffices;
+            std::vector<generation_part> parts;
+            bool rangeschanged;
+            size_t edges_written;
+            int ncompactions;
+            int ndeltaruns;
+            int nsplits;
+            int nmerges;
+            volatile bool finished;
+            pthread_t thread;
+        };
+        
+        /**
+         * Output of a run being written.
+         */
+        struct run_writer {
+            std::string adjfile;
+            std::string edatafile;
+            int f;
+            int idxf;
+            char * buf;
+            char * bufptr;
+            char * ebuf;
+            char * ebufptr;
+            size_t adjpos;
+            size_t tot_edatabytes;
+            size_t edgecounter;
+            size_t last_index_output;
+            size_t pending_zeros;
+            bool values_at_switch;
+        };
+        
+        /**
+         * Out-edge of a vertex being compacted, and where its value comes from.
+         */
+        struct merged_edge {
+            vid_t dst;
+            int source;
+            size_t oldidx;
+            EdgeDataType * ptr;
+            
+            bool operator<(const merged_edge &other) const {
+                return dst < other.dst;
+            }
+        };
+        
+        shard_generation * next_generation;
+        bool background_commit;
         
         /** 
          * Preloading will interfere with the operation.
@@ -96,25 +281,35 @@ namespace graphchi {
         virtual degree_data * create_degree_handler() {
             /* FIXME: This is bad software design - we should not have a filename dependency here. */
             std::string orig_degree_file = filename_degree_data(this->base_filename);
-            std::string dynsuffix = ".dynamic";
-            std::string dynamic_degree_file = filename_degree_data(this->base_filename + dynsuffix);
+            std::string dynamic_degree_file = filename_degree_data(dynamic_degree_basefilename());
             cp(orig_degree_file, dynamic_degree_file);
-            return new degree_data(this->base_filename + dynsuffix, this->iomgr);
+            return new degree_data(dynamic_degree_basefilename(), this->iomgr);
         }
+        
+        std::string dynamic_degree_basefilename() {
+            return this->base_filename + ".dynamic";
+        }
+        
+    public:
+        
         virtual size_t num_edges() {
             shardlock.lock();
             size_t ne = 0;
             for(int i=0; i < this->nshards; i++) {
                 ne += this->sliding_shards[i]->num_edges();
+                for(int k=0; k < (int) delta_shards[i].size(); k++)
+                    ne += delta_shards[i][k]->num_edges();
                 for(int j=0; j < (int) new_edge_buffers[i].size(); j++)
                     ne += new_edge_buffers[i][j]->size();
+                if (next_generation != NULL) {
+                    for(int j=0; j < (int) next_generation->buffers[i].size(); j++)
+                        ne += next_generation->buffers[i][j]->size();
+                }
             }
             shardlock.unlock();
             return ne;
         }
         
-    public:
-        
         size_t num_edges_safe() {
             return added_edges + orig_edges;
         }
@@ -123,6 +318,20 @@ namespace graphchi {
             return added_edges - last_commit;
         }
         
+        /**
+         * Number of edges in the shards that are marked in the deletion
+         * bitmaps, and not yet dropped by a compaction.
+         */
+        size_t num_deleted_edges() {
+            shardlock.lock();
+            size_t ndeleted = 0;
+            for(int p=0; p < this->nshards; p++) {
+                ndeleted += deleted_edges(p);
+            }
+            shardlock.unlock();
+            return ndeleted;
+        }
+        
     protected:
         void init_buffers() {
             max_edge_buffer = get_option_long("max_edgebuffer_mb", 1000) * 1024 * 1024 / sizeof(created_edge<EdgeDataType>);
@@ -158,6 +367,10 @@ namespace graphchi {
             std::cout << "TRANSFERRED " << i << " EDGES OVER." << std::endl;
             
             new_edge_buffers = tmp_new_edge_buffers;
+            
+            for(int j=0; j < (int)buffer_locks.size(); j++) delete buffer_locks[j];
+            buffer_locks.clear();
+            for(int j=0; j < this->nshards; j++) buffer_locks.push_back(new mutex());
         }
         
         
@@ -202,19 +415,87 @@ namespace graphchi {
         }
         
         
+        std::string shard_adj_filename(std::string suffix) {
+            return filename_shard_adj(this->base_filename, 0, 0) + ".dyngraph" + suffix;
+        }
+        
+        std::string shard_edata_filename(std::string suffix) {
+            return filename_shard_edata<EdgeDataType>(this->base_filename, 0, 0) + ".dyngraph" + suffix;
+        }
+        
+        typename base_engine::slidingshard_t * create_sliding_shard(std::string suffix, int p) {
+            typename base_engine::slidingshard_t * shard = new typename base_engine::slidingshard_t(this->iomgr, shard_edata_filename(suffix),
+                                                                                                    shard_adj_filename(suffix),
+                                                                                                    this->intervals[p].first,
+                                                                                                    this->intervals[p].second,
+                                                                                                    this->blocksize,
+                                                                                                    this->m,
+                                                                                                    !this->modifies_outedges,
+                                                                                                    false);
+            shard->set_shard_id(p);
+            shard->set_adj_readsize(this->adj_readsize);
+            return shard;
+        }
+        
         virtual typename base_engine::memshard_t * create_memshard(vid_t interval_st, vid_t interval_en) {
             int p = this->exec_interval;
-            std::string adj_filename = filename_shard_adj(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[p];          
-            std::string edata_filename = filename_shard_edata<EdgeDataType>(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[p];
+            
+            /* Memory shards for the delta runs of the interval */
+            finish_delta_memshards();
+            for(int q=0; q < this->nshards; q++) {
+                for(int k=0; k < (int)delta_shards[q].size(); k++) {
+                    if (q == p || this->randomization) delta_shards[q][k]->flush();
+                    if (this->randomization) delta_shards[q][k]->set_offset(0, 0, 0);
+                }
+            }
+            this->iomgr->wait_for_writes();
+            for(int k=0; k < (int)delta_suffices[p].size(); k++) {
+                typename base_engine::memshard_t * dm = new typename base_engine::memshard_t(this->iomgr,
+                                                                                            shard_edata_filename(delta_suffices[p][k]),
+                                                                                            shard_adj_filename(delta_suffices[p][k]),
+                                                                                            interval_st,
+                                                                                            interval_en,
+                                                                                            base_engine::blocksize,
+                                                                                            this->m);
+                dm->only_adjacency = this->only_adjacency;
+                dm->set_disable_async_writes(this->randomization);
+                dm->set_shard_id(p);
+#ifdef SUPPORT_DELETIONS
+                dm->set_deletion_bitmap(delta_shards[p][k]->get_deletion_bitmap());
+#endif
+                delta_memshards.push_back(dm);
+            }
+            delta_memshards_interval = p;
+            
             return new typename base_engine::memshard_t(this->iomgr,
-                                                        edata_filename,
-                                                        adj_filename,  
+                                                        shard_edata_filename(shard_suffices[p]),
+                                                        shard_adj_filename(shard_suffices[p]),
                                                         interval_st, 
                                                         interval_en,
                                                         base_engine::blocksize,
                                                         this->m);
         }
         
+        /**
+         * Commits the memory shards of the delta runs of the previous execution
+         * interval, and continues their sliding shards after the interval.
+         */
+        void finish_delta_memshards() {
+            for(int k=0; k < (int)delta_memshards.size(); k++) {
+                typename base_engine::memshard_t * dm = delta_memshards[k];
+                if (dm->loaded()) {
+                    dm->commit(this->modifies_inedges, this->modifies_outedges & !this->disable_outedges);
+                    if (!this->randomization) {
+                        delta_shards[delta_memshards_interval][k]->set_offset(dm->offset_for_stream_cont(), dm->offset_vid_for_stream_cont(),
+                                                                              dm->edata_ptr_for_stream_cont());
+                    }
+                }
+                delete dm;
+            }
+            delta_memshards.clear();
+            delta_memshards_interval = -1;
+        }
+        
         
         /**
          * Initialize streaming shards in the start of each iteration.
@@ -224,36 +505,22 @@ namespace graphchi {
             shardlock.lock();
             if (this->sliding_shards.empty()) {
                 for(int p=0; p < this->nshards; p++) {
-                    std::string adj_filename = filename_shard_adj(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[p];          
-                    std::string edata_filename = filename_shard_edata<EdgeDataType>(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[p];
-                    
-                    this->sliding_shards.push_back(
-                                                   new typename base_engine::slidingshard_t(this->iomgr, edata_filename, 
-                                                                                            adj_filename,
-                                                                                            this->intervals[p].first, 
-                                                                                            this->intervals[p].second, 
-                                                                                            this->blocksize, 
-                                                                                            this->m, 
-                                                                                            !this->modifies_outedges, 
-                                                                                            false));
+                    this->sliding_shards.push_back(create_sliding_shard(shard_suffices[p], p));
                 }
             } else {
                 for(int p=0; p < this->nshards; p++) {
                     if (this->sliding_shards[p] == NULL) {
-                        std::string adj_filename = filename_shard_adj(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[p];          
-                        std::string edata_filename = filename_shard_edata<EdgeDataType>(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[p];
-                        
-                        this->sliding_shards[p] =  new typename base_engine::slidingshard_t(this->iomgr, edata_filename, 
-                                                                                            adj_filename,
-                                                                                            this->intervals[p].first, 
-                                                                                            this->intervals[p].second, 
-                                                                                            this->blocksize, 
-                                                                                            this->m, 
-                                                                                            !this->modifies_outedges, 
-                                                                                            false);
+                        this->sliding_shards[p] = create_sliding_shard(shard_suffices[p], p);
                     }
                 }
             }
+            /* New delta runs are appended to the end of the list */
+            delta_shards.resize(this->nshards);
+            for(int p=0; p < this->nshards; p++) {
+                for(int k=(int)delta_shards[p].size(); k < (int)delta_suffices[p].size(); k++) {
+                    delta_shards[p].push_back(create_sliding_shard(delta_suffices[p][k], p));
+                }
+            }
             shardlock.unlock();
             edges_in_shards = num_edges();
             if (orig_edges == 0) orig_edges = edges_in_shards;
@@ -263,15 +530,17 @@ namespace graphchi {
             logstream(LOG_INFO) << "Preparing clean slate..." << std::endl;
             for(int shard=0; shard < this->nshards; shard++) {
                 shard_suffices.push_back(get_part_str(shard, this->nshards));
+                delta_suffices.push_back(std::vector<std::string>());
                 
                 std::string edata_filename = filename_shard_edata<EdgeDataType>(this->base_filename, shard, this->nshards);
                 std::string adj_filename = filename_shard_adj(this->base_filename, shard, this->nshards);
-                std::string dest_adj = filename_shard_adj(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[shard];          
-                std::string dest_edata = filename_shard_edata<EdgeDataType>(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[shard];
+                std::string dest_adj = shard_adj_filename(shard_suffices[shard]);
+                std::string dest_edata = shard_edata_filename(shard_suffices[shard]);
                 
                 cpedata(edata_filename, dest_edata, true);
                 cp(adj_filename, dest_adj);
                 cp(filename_shard_adjidx(adj_filename), filename_shard_adjidx(dest_adj));
+                remove(filename_shard_deletions(dest_edata).c_str());
 
             }
         }
@@ -285,33 +554,79 @@ namespace graphchi {
             return this->nshards - 1; // Last shard
         }
         
-    public:       
-        bool add_edge(vid_t src, vid_t dst, EdgeDataType edata) {
-            if (src == dst) {
-                logstream(LOG_WARNING) << "WARNING : tried to add self-edge!" << std::endl;
-                return true;
+        /**
+         * Blocks until edges can be added: the first iteration has to be finished,
+         * and the buffers must be under 120% of max_edgebuffer_mb.
+         */
+        void wait_for_ingest_capacity() {
+            if (this->iter >= 1 && num_buffered_edges() <= 1.2 * max_edge_buffer) return;
+            metrics_entry me = this->m.start_time();
+            ingest_cond_lock.lock();
+            while (!ingest_closed && (this->iter < 1 || num_buffered_edges() > 1.2 * max_edge_buffer)) {
+                if (this->iter < 1) {
+                    logstream(LOG_DEBUG) << "Tried to add edges before first iteration has passed, waiting." << std::endl;
+                } else {
+                    logstream(LOG_INFO) << "Over 20% of max buffer... waiting for commit." << std::endl;
+                }
+                ingest_cond.timedwait(ingest_cond_lock, 1);
             }
-            if (this->iter < 1) {
-                logstream(LOG_WARNING) << "Tried to add edge before first iteration has passed" << std::endl;
-                usleep(1000000);
-                return false;
+            ingest_cond_lock.unlock();
+            this->m.stop_time(me, "ingest_backpressure_wait");
+        }
+        
+        /**
+         * Records the arrival of edges up to added_edges == total.
+         */
+        void add_ingest_mark(size_t total) {
+            ingest_mark mark;
+            mark.edges = total;
+            gettimeofday(&mark.time, NULL);
+            ingest_marks_lock.lock();
+            if (!ingest_marks.empty()) {
+                ingest_mark &last = ingest_marks.back();
+                if ((mark.time.tv_sec - last.time.tv_sec) * 1000000L + (mark.time.tv_usec - last.time.tv_usec) < INGEST_MARK_USECS) {
+                    last.edges = std::max(last.edges, total);
+                    ingest_marks_lock.unlock();
+                    return;
+                }
             }
-            if (added_edges - last_commit > 1.2 * max_edge_buffer) {
-                logstream(LOG_INFO) << "Over 20% of max buffer... hold on...." << std::endl;
-                usleep(1000000); // Sleep 1 sec
-                return false;
+            ingest_marks.push_back(mark);
+            ingest_marks_lock.unlock();
+        }
+        
+        /**
+         * Retires the marks of committed edges and records the time from their
+         * arrival to the commit.
+         */
+        void retire_ingest_marks() {
+            timeval now;
+            gettimeofday(&now, NULL);
+            ingest_marks_lock.lock();
+            while (!ingest_marks.empty() && ingest_marks.front().edges <= last_commit) {
+                timeval t = ingest_marks.front().time;
+                ingest_marks.pop_front();
+                this->m.add("ingest.commit_latency", now.tv_sec - t.tv_sec + ((double)(now.tv_usec - t.tv_usec)) / 1.0E6, TIME);
             }
+            ingest_marks_lock.unlock();
+        }
+        
+        /**
+         * Wakes up ingest threads waiting for buffer space.
+         */
+        void notify_ingest() {
+            ingest_cond_lock.lock();
+            ingest_cond.broadcast();
+            ingest_cond_lock.unlock();
+        }
+        
+        /**
+         * Grows the degree file and scheduler if the batch has new vertices.
+         */
+        void ensure_max_vertex(vid_t batch_max) {
+            if (batch_max <= max_vertex_id) return;
             this->modification_lock.lock();
-            added_edges++;
-            int shard = get_shard_for(dst);
-            int srcshard = get_shard_for(src);
-            /* Maintain max vertex id */
-            vid_t prev_max_id = max_vertex_id;
-            max_vertex_id = std::max(max_vertex_id, dst);
-            max_vertex_id = std::max(max_vertex_id, src);
-            
-            // Extend degree and vertex data files
-            if (max_vertex_id>prev_max_id) {
+            if (batch_max > max_vertex_id) {
+                max_vertex_id = batch_max;
                 this->degree_handler->ensure_size(this->max_vertex_id); // Expand the file
                 
                 // Expand scheduler
@@ -321,10 +636,118 @@ namespace graphchi {
                     schedulerlock.unlock();
                 }
             }
-            
-            // Add edge to buffers
-            new_edge_buffers[shard][srcshard]->add(src, dst, edata);            
             this->modification_lock.unlock();
+        }
+        
+    public:
+        /**
+         * Adds a batch of edges. The batch is first staged by destination and
+         * source shard in the calling thread, and then appended to the edge buffers
+         * of each shard while holding only that shard's lock. Blocks while the
+         * buffers are full. Self-edges are ignored.
+         * @return number of edges added
+         */
+        size_t add_edges(const created_edge<EdgeDataType> * edges, size_t n) {
+            if (n == 0) return 0;
+            wait_for_ingest_capacity();
+            if (ingest_closed) return 0;
+            
+            vid_t batch_max = 0;
+            for(size_t i=0; i < n; i++) {
+                batch_max = std::max(batch_max, std::max(edges[i].src, edges[i].dst));
+            }
+            ensure_max_vertex(batch_max);
+            
+            ingest_lock.readlock();
+            int nsh = this->nshards;
+            
+            /* Stage: counting sort of the edges by (shard, srcshard) */
+            std::vector<int> keys(n);
+            std::vector<size_t> offsets(nsh * nsh + 1, 0);
+            for(size_t i=0; i < n; i++) {
+                if (edges[i].src == edges[i].dst) {
+                    keys[i] = -1;
+                    continue;
+                }
+                keys[i] = get_shard_for(edges[i].dst) * nsh + get_shard_for(edges[i].src);
+                offsets[keys[i] + 1]++;
+            }
+            for(int k=0; k < nsh * nsh; k++) offsets[k + 1] += offsets[k];
+            size_t nadd = offsets[nsh * nsh];
+            std::vector<const created_edge<EdgeDataType> *> staged(nadd);
+            std::vector<size_t> pos(offsets.begin(), offsets.end() - 1);
+            for(size_t i=0; i < n; i++) {
+                if (keys[i] >= 0) staged[pos[keys[i]]++] = &edges[i];
+            }
+            
+            /* Publish */
+            for(int shard=0; shard < nsh; shard++) {
+                if (offsets[shard * nsh] == offsets[(shard + 1) * nsh]) continue;
+                buffer_locks[shard]->lock();
+                for(int srcshard=0; srcshard < nsh; srcshard++) {
+                    int k = shard * nsh + srcshard;
+                    edge_buffer &buf = *new_edge_buffers[shard][srcshard];
+                    for(size_t j=offsets[k]; j < offsets[k + 1]; j++) {
+                        buf.add(staged[j]->src, staged[j]->dst, staged[j]->data);
+                    }
+                }
+                buffer_locks[shard]->unlock();
+            }
+            size_t total = __sync_add_and_fetch(&added_edges, nadd);
+            ingest_lock.rdunlock();
+            if (nadd > 0) add_ingest_mark(total);
+            
+            if (nadd < n) {
+                logstream(LOG_WARNING) << "WARNING : tried to add " << (n - nadd) << " self-edges!" << std::endl;
+            }
+            return nadd;
+        }
+        
+        /**
+         * Stops accepting edges, and releases the threads waiting for buffer
+         * space. Call when the engine has finished and no commits will follow.
+         */
+        void close_ingest() {
+            ingest_cond_lock.lock();
+            ingest_closed = true;
+            ingest_cond.broadcast();
+            ingest_cond_lock.unlock();
+        }
+        
+        bool is_ingest_closed() {
+            return ingest_closed;
+        }
+        
+        /**
+         * Buffered edges relative to max_edgebuffer_mb. Ingest blocks over 1.2.
+         */
+        double buffer_occupancy() {
+            return max_edge_buffer == 0 ? 0.0 : num_buffered_edges() * 1.0 / max_edge_buffer;
+        }
+        
+        /**
+         * Age of the oldest edge that has not been committed, in seconds.
+         */
+        double ingest_lag() {
+            timeval now;
+            gettimeofday(&now, NULL);
+            double lag = 0.0;
+            ingest_marks_lock.lock();
+            if (!ingest_marks.empty()) {
+                timeval t = ingest_marks.front().time;
+                lag = now.tv_sec - t.tv_sec + ((double)(now.tv_usec - t.tv_usec)) / 1.0E6;
+            }
+            ingest_marks_lock.unlock();
+            return lag;
+        }
+        
+        bool add_edge(vid_t src, vid_t dst, EdgeDataType edata) {
+            if (src == dst) {
+                logstream(LOG_WARNING) << "WARNING : tried to add self-edge!" << std::endl;
+                return true;
+            }
+            created_edge<EdgeDataType> e(src, dst, edata);
+            add_edges(&e, 1);
             return true;
         }
         
@@ -338,17 +761,33 @@ namespace graphchi {
        
     protected:
         void incorporate_buffered_edges(int window, vid_t window_st, vid_t window_en, std::vector<svertex_t> & vertices) {
+            int ncreated = incorporate_buffered_edges(new_edge_buffers, window, window_st, window_en, vertices);
+            if (next_generation != NULL) {
+                ncreated += incorporate_buffered_edges(next_generation->buffers, window, window_st, window_en, vertices);
+            }
+            logstream(LOG_INFO) << "::: Used " << ncreated << " buffered edges." << std::endl;
+        }
+        
+        int incorporate_buffered_edges(std::vector< std::vector< edge_buffer * > > &buffers, int window, vid_t window_st, vid_t window_en,
+                                       std::vector<svertex_t> & vertices) {
             // Lock acquired
             int ncreated = 0;
             // First outedges
             for(int shard=0; shard<this->nshards; shard++) {
-                edge_buffer &buffer_for_window = *new_edge_buffers[shard][window];
+                if (buffers[shard].empty()) continue;
+                edge_buffer &buffer_for_window = *buffers[shard][window];
                 for(unsigned int ebi=0; ebi<buffer_for_window.size(); ebi++) {
                     created_edge<EdgeDataType> * edge = buffer_for_window[ebi];
-                    if (edge->src >= window_st && edge->src <= window_en) {
+                    // Edges added after the window was sized are picked up on the next iteration
+                    if (edge->src >= window_st && edge->src <= window_en && edge->accounted_for_outc) {
                         if (vertices[edge->src-window_st].scheduled) {
-                            if (vertices[edge->src-window_st].scheduled)
-                                vertices[edge->src-window_st].add_outedge(edge->dst, &edge->data, false);
+#ifdef SUPPORT_DELETIONS
+                            if (edge->deleted) {
+                                vertices[edge->src-window_st].add_deleted_outedge();
+                                continue;
+                            }
+#endif
+                            vertices[edge->src-window_st].add_outedge(edge->dst, &edge->data, false);
                             ncreated++;
                         }
                     }
@@ -356,27 +795,34 @@ namespace graphchi {
             }
             
             // Then inedges
+            if (buffers[window].empty()) return ncreated;
             for(int w=0; w<this->nshards; w++) {
-                edge_buffer &buffer_for_window = *new_edge_buffers[window][w];
+                edge_buffer &buffer_for_window = *buffers[window][w];
                 for(unsigned int ebi=0; ebi<buffer_for_window.size(); ebi++) {
                     created_edge<EdgeDataType> * edge = buffer_for_window[ebi];
-                    if (edge->dst >= window_st && edge->dst <= window_en) {
+                    if (edge->dst >= window_st && edge->dst <= window_en && edge->accounted_for_inc) {
                         if (vertices[edge->dst - window_st].scheduled) {
-                            if (vertices[edge->dst-window_st].scheduled)
-                                vertices[edge->dst - window_st].add_inedge(edge->src, &edge->data, false);
+#ifdef SUPPORT_DELETIONS
+                            if (edge->deleted) {
+                                vertices[edge->dst - window_st].add_deleted_inedge();
+                                continue;
+                            }
+#endif
+                            vertices[edge->dst - window_st].add_inedge(edge->src, &edge->data, false);
                             ncreated++;
                         }
                     }
                 }
             }
-            logstream(LOG_INFO) << "::: Used " << ncreated << " buffered edges." << std::endl;
+            return ncreated;
         }
         
-        bool incorporate_new_edge_degrees(int window, vid_t window_st, vid_t window_en) {
+        bool incorporate_new_edge_degrees(std::vector< std::vector< edge_buffer * > > &buffers, int window, vid_t window_st, vid_t window_en) {
             bool modified = false;
             // First outedges
             for(int shard=0; shard < this->nshards; shard++) {
-                edge_buffer &buffer_for_window = *new_edge_buffers[shard][window];
+                if (buffers[shard].empty()) continue;
+                edge_buffer &buffer_for_window = *buffers[shard][window];
                 for(unsigned int ebi=0; ebi<buffer_for_window.size(); ebi++) {
                     created_edge<EdgeDataType> * edge = buffer_for_window[ebi];
                     if (edge->src >= window_st && edge->src <= window_en) {
@@ -393,8 +839,9 @@ namespace graphchi {
             }
             
             // Then inedges
+            if (buffers[window].empty()) return modified;
             for(int w=0; w < this->nshards; w++) {
-                edge_buffer &buffer_for_window = *new_edge_buffers[window][w];
+                edge_buffer &buffer_for_window = *buffers[window][w];
                 for(unsigned int ebi=0; ebi<buffer_for_window.size(); ebi++) {
                     created_edge<EdgeDataType> * edge = buffer_for_window[ebi];
                     if (edge->dst >= window_st && edge->dst <= window_en) {
@@ -437,14 +884,24 @@ namespace graphchi {
         virtual vid_t determine_next_window(vid_t iinterval, vid_t fromvid, vid_t maxvid, size_t membudget) {
             /* Load degrees */
             this->degree_handler->load(fromvid, maxvid);
-            if (incorporate_new_edge_degrees(iinterval, fromvid, maxvid)) {
+            /* The edge buffers must not grow while they are scanned */
+            ingest_lock.writelock();
+            bool modified = incorporate_new_edge_degrees(new_edge_buffers, iinterval, fromvid, maxvid);
+            ingest_lock.wrunlock();
+            if (modified) {
                 this->degree_handler->save();
             }
-            
+            return last_vertex_in_budget(this->degree_handler, fromvid, maxvid, membudget);
+        }
+        
+        /**
+         * Degrees of [fromvid, maxvid] must be loaded.
+         */
+        vid_t last_vertex_in_budget(degree_data * degrees, vid_t fromvid, vid_t maxvid, size_t membudget) {
             size_t memreq = 0;
             int max_interval = maxvid - fromvid;
             for(int i=0; i < max_interval; i++) {
-                degree deg = this->degree_handler->get_degree(fromvid + i);
+                degree deg = degrees->get_degree(fromvid + i);
                 int inc = deg.indegree;
                 int outc = deg.outdegree;
                 
@@ -463,20 +920,107 @@ namespace graphchi {
             state = "load-edges";
 
             this->base_engine::load_before_updates(vertices);
+            load_delta_runs(vertices);
             
-#ifdef SUPPORT_DELETIONS
-            for(unsigned int i=0; i < (unsigned int)vertices.size(); i++) {
-                deletecounts[this->exec_interval] += vertices[i].deleted_inc;
+            state = "execute-updates";
+        }
+        
+        
+        /**
+         * Adds the edges of the delta runs to the vertices. The degrees
+         * include the delta runs, so the edges have room in the vertices.
+         */
+        void load_delta_runs(std::vector<svertex_t> &vertices) {
+            std::vector< std::pair<int, int> > runs;
+            for(int p=0; p < this->nshards; p++) {
+                for(int k=0; k < (int)delta_shards[p].size(); k++) {
+                    if (p == this->exec_interval || !this->disable_outedges) {
+                        runs.push_back(std::pair<int, int>(p, k));
+                    }
+                }
             }
-        #endif
+            if (runs.empty()) return;
+            metrics_entry me = this->m.start_time();
             
-            state = "execute-updates";
+#pragma omp parallel for schedule(dynamic, 1)
+            for(int i=0; i < (int)runs.size(); i++) {
+                int p = runs[i].first;
+                int k = runs[i].second;
+                if (p == this->exec_interval) {
+                    typename base_engine::memshard_t * dm = delta_memshards[k];
+                    if (!dm->loaded()) {
+                        dm->load();
+                    }
+                    dm->load_vertices(this->sub_interval_st, this->sub_interval_en, vertices, true, !this->disable_outedges);
+                } else {
+                    if (this->randomization) {
+                        delta_shards[p][k]->set_disable_async_writes(true);
+                    }
+                    delta_shards[p][k]->read_next_vertices((int) vertices.size(), this->sub_interval_st, vertices,
+                                                           (this->randomization || this->scheduler != NULL) && this->chicontext.iteration == 0);
+                }
+            }
+            this->iomgr->wait_for_reads();
+            this->m.stop_time(me, "load_delta_runs");
+        }
+        
+#ifdef SUPPORT_DELETIONS
+        virtual void record_removed_edges(std::vector<svertex_t> &vertices) {
+            /* The edge buffers must not grow while the values are looked up */
+            ingest_lock.writelock();
+            base_engine::record_removed_edges(vertices);
+            ingest_lock.wrunlock();
+        }
+        
+        /**
+         * Besides the base runs, a removed edge can be in a delta run, or still
+         * in the edge buffers. Buffered edges are just flagged, and are not written.
+         */
+        virtual bool mark_edge_deleted(EdgeDataType * ptr) {
+            if (base_engine::mark_edge_deleted(ptr)) return true;
+            for(int k=0; k < (int)delta_memshards.size(); k++) {
+                if (delta_memshards[k]->mark_deleted(ptr)) return true;
+            }
+            for(int p=0; p < this->nshards; p++) {
+                if (p == this->exec_interval) continue;
+                for(int k=0; k < (int)delta_shards[p].size(); k++) {
+                    if (delta_shards[p][k]->mark_deleted(ptr)) return true;
+                }
+            }
+            if (mark_buffered_edge_deleted(new_edge_buffers, ptr)) return true;
+            return next_generation != NULL && mark_buffered_edge_deleted(next_generation->buffers, ptr);
+        }
+        
+        bool mark_buffered_edge_deleted(std::vector< std::vector< edge_buffer * > > &buffers, EdgeDataType * ptr) {
+            for(int shard=0; shard < (int)buffers.size(); shard++) {
+                for(int w=0; w < (int)buffers[shard].size(); w++) {
+                    created_edge<EdgeDataType> * edge = buffers[shard][w]->find_by_data(ptr);
+                    if (edge != NULL) {
+                        edge->deleted = true;
+                        return true;
+                    }
+                }
+            }
+            return false;
         }
+#endif
         
+        /**
+         * Number of deleted edges in the runs of a shard, from their deletion bitmaps.
+         */
+        size_t deleted_edges(int shard) {
+            size_t ndeleted = this->sliding_shards[shard]->num_deleted_edges();
+            for(int k=0; k < (int)delta_shards[shard].size(); k++) {
+                ndeleted += delta_shards[shard][k]->num_deleted_edges();
+            }
+            return ndeleted;
+        }
         
         virtual void init_vertices(std::vector<svertex_t> &vertices, graphchi_edge<EdgeDataType> * &edata) {
             base_engine::init_vertices(vertices, edata);
+            ingest_lock.writelock();
             incorporate_buffered_edges(this->exec_interval, this->sub_interval_st, this->sub_interval_en, vertices);
+            ingest_lock.wrunlock();
         }
         
         
@@ -484,14 +1028,25 @@ namespace graphchi {
             this->intervals[this->nshards - 1].second = max_vertex_id;
             this->vertex_data_handler->check_size(max_vertex_id + 1);
             initialize_sliding_shards();
-            
-            /* Deleted edge tracking */
-            deletecounts.clear();
-            for(int p=0; p < this->nshards; p++) 
-                deletecounts.push_back(0);
+            /* Buffered edges count against the memory budget of the windows */
+            memory_tracker::instance().set(MEM_EDGE_BUFFERS, num_buffered_edges() * sizeof(created_edge<EdgeDataType>));
+        }
+        
+        /* The generation being built in the background reads the cached blocks */
+        virtual bool can_shrink_cache() {
+            return next_generation == NULL;
         }
         
         virtual void iteration_finished() {
+            /* The engine has restarted the base runs, do the same for the delta runs */
+            finish_delta_memshards();
+            for(int p=0; p < this->nshards; p++) {
+                for(int k=0; k < (int)delta_shards[p].size(); k++) {
+                    delta_shards[p][k]->flush();
+                    delta_shards[p][k]->set_offset(0, 0, 0);
+                }
+            }
+            
             if (this->iter < this->niters - 1) {
                 // Flush and restart stream shards before commiting edges
                 for(int p=0; p < this->nshards; p++) {
@@ -500,9 +1055,51 @@ namespace graphchi {
                 }
                 
                 this->iomgr->wait_for_writes();
-                
-                commit_graph_changes();
+
+                if (next_generation != NULL && next_generation->finished) {
+                    switch_generation();
+                }
+                if (next_generation == NULL) {
+                    commit_graph_changes();
+                }
+            } else if (next_generation != NULL) {
+                /* Last iteration: wait for the build to finish */
+                switch_generation();
             }
+            report_ingest_rate();
+            notify_ingest();
+        }
+        
+        virtual void add_live_metrics(live_metrics &lm) {
+            base_engine::add_live_metrics(lm);
+            lm.add("graphchi_edges", (double) num_edges_safe(), LIVE_GAUGE, "Edges in the graph, including buffered edges.");
+            lm.add("graphchi_ingest_edges_total", (double) added_edges, LIVE_COUNTER, "Edges ingested.");
+            lm.add("graphchi_ingest_edges_per_second", last_ingest_rate, LIVE_GAUGE,
+                   "Ingest rate over the previous iteration.");
+            lm.add("graphchi_ingest_buffer_occupancy", buffer_occupancy(), LIVE_GAUGE,
+                   "Buffered edges relative to max_edgebuffer_mb.");
+            lm.add("graphchi_ingest_lag_seconds", ingest_lag(), LIVE_GAUGE, "Age of the oldest uncommitted edge.");
+            lm.add("graphchi_commit_in_progress", (next_generation != NULL ? 1 : 0), LIVE_GAUGE,
+                   "Whether a generation of shards is being built.");
+        }
+        
+        void report_ingest_rate() {
+            timeval now;
+            gettimeofday(&now, NULL);
+            double secs = now.tv_sec - ingest_rate_time.tv_sec + ((double)(now.tv_usec - ingest_rate_time.tv_usec)) / 1.0E6;
+            size_t total = added_edges;
+            if (secs > 0) {
+                double rate = (total - ingest_rate_edges) / secs;
+                last_ingest_rate = rate;
+                this->m.set("ingest.edges", total);
+                this->m.add_to_vector("ingest.edges_per_sec", rate);
+                this->set_json("ingestrate", rate);
+                this->m.set("ingest.buffer_occupancy", buffer_occupancy());
+                this->m.set("ingest.lag", ingest_lag());
+                logstream(LOG_INFO) << "Ingest rate: " << rate << " edges/sec, total ingested: " << total << std::endl;
+            }
+            ingest_rate_edges = total;
+            ingest_rate_time = now;
         }
         
         virtual void initialize_before_run() {
@@ -532,416 +1129,771 @@ namespace graphchi {
         
 #define BBUF 32000000
         
-        size_t curadjfilepos;
-
         /**
          * Code for committing changes to disk.
+         * Decides whether to commit, freezes the buffers of the shards to be
+         * committed and starts building the next generation of shards.
          */
         void commit_graph_changes() {            
+            TRACE_SCOPE("commit_graph_changes", "lsm");
             // Count deleted
             size_t ndeleted = 0;
-            for(size_t i=0; i < deletecounts.size(); i++) {
-                ndeleted += deletecounts[i];
+            for(int p=0; p < this->nshards; p++) {
+                ndeleted += deleted_edges(p);
             }
             
-            // TODO: remove ad hoc limits, move to configuration.
-            // Perhaps do some cost estimation?
             logstream(LOG_DEBUG) << "Total deleted: " << ndeleted << " total edges: " << this->num_edges() << std::endl;
 
-            if (added_edges - last_commit < max_edge_buffer * 0.8 && ndeleted < this->num_edges() * 0.1) {
+            if (added_edges - last_commit < max_edge_buffer * commit_buffer_fraction && ndeleted < this->num_edges() * commit_deleted_fraction) {
                 std::cout << "==============================" << std::endl;
                 std::cout << "No time to commit yet.... Only " << (added_edges - last_commit) << " / " << max_edge_buffer
                 << " in buffers" << std::endl;
                 return;
             }
             
-            
-            bool rangeschanged = false;
             state = "commit-ingests";
-            vid_t maxwindow = 4000000; // FIXME: HARDCODE
-            size_t mem_budget = this->membudget_mb * 1024 * 1024;
+            metrics_entry me = this->m.start_time();
             this->modification_lock.lock();
+            ingest_lock.writelock();
+            shard_generation * gen = freeze_buffers();
+            ingest_lock.wrunlock();
+            this->modification_lock.unlock();
+            this->m.stop_time(me, "commit_freeze");
+            if (gen == NULL) return;
             
-            // Clean up sliding shards
-            // NOTE: there is a problem since this will waste
-            // io-sessions
-            std::vector<int> edgespershard;
-            for(int p=0; p < this->nshards; p++) {
-                edgespershard.push_back(this->sliding_shards[p]->num_edges());
+            next_generation = gen;
+            if (background_commit) {
+                logstream(LOG_INFO) << "Starting background commit of " << gen->nedges << " edges." << std::endl;
+                int ret = pthread_create(&gen->thread, NULL, build_generation_run, (void*)this);
+                assert(ret >= 0);
+            } else {
+                build_generation(gen);
+                switch_generation();
             }
-            
-            std::vector<std::pair<vid_t, vid_t> > newranges;
-            std::vector<std::string> newsuffices;
-            
-            char iterstr[128];
-            sprintf(iterstr, "%d", this->iter);
+        }
+        
+        static void * build_generation_run(void * _engine) {
+            graphchi_dynamicgraph_engine * engine = (graphchi_dynamicgraph_engine *) _engine;
+            tracer::instance().set_thread_name("commit");
+            engine->build_generation(engine->next_generation);
+            return NULL;
+        }
+        
+        /**
+         * Moves the buffers of the shards that have enough new (or deleted) edges
+         * to a new generation, and decides for each of them whether to write
+         * a delta run or to compact. Shards that the shard policy splits or
+         * merges are always compacted. Locks acquired.
+         * @return NULL if no shard needs to be committed
+         */
+        shard_generation * freeze_buffers() {
+            shard_generation * gen = new shard_generation();
+            gen->iter = this->iter;
+            gen->max_vertex_id = max_vertex_id;
+            gen->intervals = this->intervals;
+            gen->suffices = shard_suffices;
+            gen->deltasuffices = delta_suffices;
+            gen->nedges = 0;
+            gen->values_at_switch = background_commit && (this->modifies_outedges || this->modifies_inedges);
+            gen->rangeschanged = false;
+            gen->edges_written = 0;
+            gen->ncompactions = 0;
+            gen->ndeltaruns = 0;
+            gen->nsplits = 0;
+            gen->nmerges = 0;
+            gen->finished = false;
             
             size_t min_buffer_in_shard_to_commit = max_edge_buffer / this->nshards / 2;
+            bool any_committed = false;
             
-            std::vector<bool> was_commited(this->nshards, true);
-            
+            std::vector<shard_stats> stats;
+            std::vector<size_t> basecounts, deltacounts;
             for(int shard=0; shard < this->nshards; shard++) {
-                std::vector<edge_buffer*> &shard_buffer = new_edge_buffers[shard];
-                
-                // Check there are any new edges
                 size_t bufedges = 0;
                 for(int w=0; w < this->nshards; w++) {
-                    bufedges += shard_buffer[w]->size();
-                    
+                    bufedges += new_edge_buffers[shard][w]->size();
                 }
+                size_t baseedges = this->sliding_shards[shard]->num_edges();
+                size_t deltaedges = 0;
+                for(int k=0; k < (int)delta_shards[shard].size(); k++) {
+                    deltaedges += delta_shards[shard][k]->num_edges();
+                }
+                basecounts.push_back(baseedges);
+                deltacounts.push_back(deltaedges);
+                stats.push_back(shard_stats(baseedges + deltaedges, bufedges, deleted_edges(shard)));
+            }
+            gen->nparts = policy->plan(stats);
+            this->m.set("lsm.estimated_iteration_io_mb", policy->iteration_io_bytes(stats) / 1024.0 / 1024.0);
+            
+            for(int shard=0; shard < this->nshards; shard++) {
+                size_t bufedges = stats[shard].buffered;
+                size_t shardedges = stats[shard].edges;
+                size_t ndeleted = stats[shard].deleted;
+                double deleted_fraction = (shardedges > 0 ? ndeleted * 1.0 / shardedges : 0.0);
+                gen->shardedges.push_back(shardedges);
                 
-                if (bufedges < min_buffer_in_shard_to_commit && deletecounts[shard] * 1.0 / edgespershard[shard] < 0.2) {
-                    logstream(LOG_DEBUG) << shard << ": not enough edges for shard: " << bufedges << " deleted:" << deletecounts[shard] << "/" << edgespershard[shard] << std::endl;
-                    newranges.push_back(this->intervals[shard]);
-                    newsuffices.push_back(shard_suffices[shard]);
-                    was_commited[shard] = false;
+                bool merged = gen->nparts[shard] == 0 || (shard + 1 < this->nshards && gen->nparts[shard + 1] == 0);
+                bool reshaped = merged || gen->nparts[shard] > 1;
+                if (!reshaped && bufedges < min_buffer_in_shard_to_commit && deleted_fraction < compact_deleted_fraction) {
+                    logstream(LOG_DEBUG) << shard << ": not enough edges for shard: " << bufedges << " deleted:" << ndeleted << "/" << shardedges << std::endl;
+                    gen->buffers.push_back(std::vector<edge_buffer *>());
+                    gen->compact.push_back(false);
                     continue;
+                }
+                bool compact = reshaped || should_compact(basecounts[shard], deltacounts[shard], (int)delta_suffices[shard].size(), bufedges, ndeleted);
+                logstream(LOG_DEBUG) << shard << ": going to " << (compact ? "compact" : "write a delta run") << ", deleted:" << ndeleted << "/" << shardedges
+                    << " bufedges: " << bufedges << " delta runs: " << delta_suffices[shard].size() << " parts: " << gen->nparts[shard] << std::endl;
+                gen->buffers.push_back(new_edge_buffers[shard]);
+                gen->compact.push_back(compact);
+                gen->nedges += bufedges;
+                for(int w=0; w < this->nshards; w++) {
+                    new_edge_buffers[shard][w] = new edge_buffer();
+                }
+                any_committed = true;
+            }
+            if (!any_committed) {
+                delete gen;
+                return NULL;
+            }
+            
+            /* The builder reads degrees without taking locks, so the frozen
+               edges must be accounted for before it starts. */
+            account_degrees(gen->buffers);
+            return gen;
+        }
+        
+        /**
+         * Cost model for committing the buffered edges of a shard. A delta run
+         * writes only the new edges, but adds a reader to every window. Compaction
+         * rewrites the whole shard: amortized over the edges committed since the
+         * base run was written, it costs (base + delta + buffered) / (delta + buffered)
+         * writes per edge, plus one for the earlier write of the delta runs.
+         * Compacts when that is within lsm_write_amplification, when the shard already
+         * has lsm_max_delta_runs delta runs, or when the shard must be purged of
+         * deleted edges. With lsm_max_delta_runs 0, every commit rewrites the shard.
+         */
+        bool should_compact(size_t baseedges, size_t deltaedges, int ndeltaruns, size_t bufedges, size_t ndeleted) {
+            size_t shardedges = baseedges + deltaedges;
+            size_t totedges = shardedges + bufedges;
+            if (ndeltaruns >= lsm_max_delta_runs) return true;
+            if (shardedges > 0 && ndeleted >= shardedges * compact_deleted_fraction) return true;
+            if (deltaedges + bufedges == 0) return true;
+            double amplification = totedges * 1.0 / (deltaedges + bufedges) + (deltaedges > 0 ? 1.0 : 0.0);
+            return amplification <= lsm_write_amplification;
+        }
+        
+        void account_degrees(std::vector< std::vector< edge_buffer * > > &buffers) {
+            for(int window=0; window < this->nshards; window++) {
+                vid_t range_st = this->intervals[window].first;
+                vid_t range_en = (window == this->nshards - 1 ? max_vertex_id : this->intervals[window].second);
+                for(vid_t st=range_st; st <= range_en; st += commit_maxwindow) {
+                    vid_t en = std::min(range_en, st + commit_maxwindow - 1);
+                    this->degree_handler->load(st, en);
+                    if (incorporate_new_edge_degrees(buffers, window, st, en)) {
+                        this->degree_handler->save();
+                    }
+                }
+            }
+        }
+        
+        /**
+         * Writes the new runs of a generation. Runs in the commit thread (or inline, if
+         * background commits are disabled), and uses only the state captured in gen,
+         * its own degree reader and its own shard readers.
+         */
+        void build_generation(shard_generation * gen) {
+            TRACE_SCOPE("build_generation", "lsm");
+            metrics_entry me = this->m.start_time();
+            int nsh = (int) gen->intervals.size();
+            degree_data * degrees = new degree_data(dynamic_degree_basefilename(), this->iomgr);
+            
+            for(int shard=0; shard < nsh; shard++) {
+                if (gen->buffers[shard].empty()) {
+                    gen->newranges.push_back(gen->intervals[shard]);
+                    gen->newsuffices.push_back(gen->suffices[shard]);
+                    gen->newdeltasuffices.push_back(gen->deltasuffices[shard]);
+                } else if (gen->compact[shard]) {
+                    /* Shards merged to this one follow it */
+                    int last = shard;
+                    while(last + 1 < nsh && gen->nparts[last + 1] == 0) last++;
+                    compact_shards(gen, shard, last, degrees);
+                    gen->ncompactions++;
+                    shard = last;
                 } else {
-                    logstream(LOG_DEBUG) << shard << ": going to rewrite, deleted:" << deletecounts[shard] << "/" << edgespershard[shard] << " bufedges: " << bufedges << std::endl;
-                    shardlock.lock();
-                    delete this->sliding_shards[shard];
-                    this->sliding_shards[shard] = NULL;
-                    shardlock.unlock();
+                    std::string suffix = generation_suffix(gen, shard, "delta");
+                    write_delta_run(gen, shard, suffix);
+                    gen->newranges.push_back(gen->intervals[shard]);
+                    gen->newsuffices.push_back(gen->suffices[shard]);
+                    gen->newdeltasuffices.push_back(gen->deltasuffices[shard]);
+                    gen->newdeltasuffices.back().push_back(suffix);
+                    gen->ndeltaruns++;
+                }
+            }
+            delete degrees;
+            this->m.stop_time(me, "commit_build");
+            __sync_synchronize();
+            gen->finished = true;
+        }
+        
+        std::string generation_suffix(shard_generation * gen, int shard, std::string kind) {
+            std::stringstream ss;
+            ss << shard;
+            if (kind != "") ss << "." << kind;
+            ss << ".i" << gen->iter;
+            return ss.str();
+        }
+        
+        static bool created_edge_less(const created_edge<EdgeDataType> * a, const created_edge<EdgeDataType> * b) {
+            return a->src < b->src || (a->src == b->src && a->dst < b->dst);
+        }
+        
+        /**
+         * Writes the frozen buffers of a shard as a new delta run,
+         * sorted by source and destination.
+         */
+        void write_delta_run(shard_generation * gen, int shard, std::string suffix) {
+            std::vector<created_edge<EdgeDataType> *> edges;
+            for(int w=0; w < (int)gen->buffers[shard].size(); w++) {
+                edge_buffer &buffer_for_window = *gen->buffers[shard][w];
+                for(unsigned int ebi=0; ebi < buffer_for_window.size(); ebi++) {
+                    if (!buffer_for_window[ebi]->deleted) edges.push_back(buffer_for_window[ebi]);
+                }
+            }
+            std::sort(edges.begin(), edges.end(), created_edge_less);
+            
+            run_writer w;
+            open_run(w, suffix, gen->values_at_switch);
+            generation_part part;
+            part.new_edata = w.edatafile;
+            
+            vid_t nextvid = 0;
+            for(size_t i=0; i < edges.size(); ) {
+                vid_t src = edges[i]->src;
+                size_t j = i;
+                while(j < edges.size() && edges[j]->src == src) j++;
+                w.pending_zeros += src - nextvid;
+                begin_vertex(w, src, (int) (j - i));
+                for(; i < j; i++) {
+                    if (gen->values_at_switch) {
+                        add_edata_run(part, w.edgecounter, -1, 0);
+                        part.bufvalues.push_back(&edges[i]->data);
+                    }
+                    write_edge(w, edges[i]->dst, &edges[i]->data);
+                }
+                nextvid = src + 1;
+            }
+            close_run(w);
+            logstream(LOG_INFO) << "Wrote delta run " << suffix << " with " << w.edgecounter << " edges." << std::endl;
+            gen->edges_written += w.edgecounter;
+            gen->parts.push_back(part);
+        }
+        
+        /**
+         * Vertex positions that split the interval of a shard into nparts parts
+         * with about the same number of in-edges. Fewer parts if the interval
+         * is too small.
+         * @return the last vertex of each part but the last one
+         */
+        std::vector<vid_t> split_positions(vid_t first, vid_t last, size_t totedges, int nparts, degree_data * degrees) {
+            std::vector<vid_t> splitpos;
+            size_t nedges = 0;
+            int part = 1;
+            for(vid_t st=first; st <= last && part < nparts; ) {
+                vid_t en = std::min(st + commit_maxwindow, last);
+                degrees->load(st, en);
+                for(vid_t v=st; v <= en && part < nparts; v++) {
+                    nedges += degrees->get_degree(v).indegree;
+                    if (nedges >= totedges * part / nparts && v < last && (splitpos.empty() || v > splitpos.back())) {
+                        splitpos.push_back(v);
+                        part++;
+                    }
+                }
+                if (en == last) break;
+                st = en + 1;
+            }
+            return splitpos;
+        }
+        
+        /**
+         * Merges the base runs, the delta runs and the frozen buffers of shards
+         * first..last (more than one when the shard policy merges them) into new
+         * base runs. The out-edges of each vertex are written sorted by
+         * destination. The shard is split in gen->nparts[first] parts.
+         */
+        void compact_shards(shard_generation * gen, int first, int last, degree_data * degrees) {
+            int nsh = (int) gen->intervals.size();
+            size_t mem_budget = this->membudget_mb * 1024 * 1024;
+            
+            /* Runs to merge, base run of each shard first */
+            std::vector<std::string> runsuffices;
+            std::vector<int> runshards;
+            size_t totedges = 0;
+            for(int shard=first; shard <= last; shard++) {
+                runsuffices.push_back(gen->suffices[shard]);
+                runsuffices.insert(runsuffices.end(), gen->deltasuffices[shard].begin(), gen->deltasuffices[shard].end());
+                runshards.resize(runsuffices.size(), shard);
+                totedges += gen->shardedges[shard];
+                for(int w=0; w < nsh; w++) {
+                    totedges += gen->buffers[shard][w]->size();
+                }
+            }
+            int nruns = (int) runsuffices.size();
+            
+            vid_t rangest = gen->intervals[first].first;
+            vid_t rangeen = (last == nsh - 1 ? gen->max_vertex_id : gen->intervals[last].second);
+            std::vector<vid_t> splitpos;
+            if (gen->nparts[first] > 1) {
+                splitpos = split_positions(rangest, rangeen, totedges, gen->nparts[first], degrees);
+            }
+            int outparts = (int) splitpos.size() + 1;
+            if (outparts > 1 || last > first) {
+                gen->rangeschanged = true;
+            }
+            if (outparts > 1) gen->nsplits++;
+            if (last > first) gen->nmerges++;
+            logstream(LOG_INFO) << "Compacting shards " << first << "-" << last << ": " << nruns << " runs, " << totedges << " edges into "
+                << outparts << " parts, target size: " << policy->target_size() << std::endl;
+            
+            for(int splits=0; splits<outparts; splits++) { // Note: this is not super-efficient because we read the runs for each part
+                std::vector<typename base_engine::slidingshard_t *> runs;
+                generation_part part;
+                for(int r=0; r < nruns; r++) {
+                    int shard = runshards[r];
+                    runs.push_back(new typename base_engine::slidingshard_t(this->iomgr, shard_edata_filename(runsuffices[r]), shard_adj_filename(runsuffices[r]),
+                                                                            gen->intervals[shard].first, gen->intervals[shard].second,
+                                                                            base_engine::blocksize, this->m, true, gen->values_at_switch));
+                    runs.back()->set_shard_id(shard);
+                    runs.back()->set_adj_readsize(this->adj_readsize);
+                    part.old_edata.push_back(shard_edata_filename(runsuffices[r]));
                 }
-                std::string origshardfile = filename_shard_edata<EdgeDataType>(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[shard];
-                std::string origadjfile = filename_shard_adj(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[shard];
                 
-                // Get file size
-                off_t sz = get_shard_edata_filesize<EdgeDataType>(origshardfile);
+                std::stringstream kind;
+                if (splits > 0) kind << "split" << splits;
+                std::string suffix = generation_suffix(gen, first, kind.str());
+                gen->newsuffices.push_back(suffix);
+                gen->newdeltasuffices.push_back(std::vector<std::string>());
+                run_writer w;
+                open_run(w, suffix, gen->values_at_switch);
+                part.new_edata = w.edatafile;
                 
-                int outparts = ( sz >= (off_t) maxshardsize ? 2 : 1);
+                vid_t splitstart = (splits == 0 ? rangest : splitpos[splits - 1] + 1);
+                vid_t splitend = (splits == outparts - 1 ? rangeen : splitpos[splits]);
+                gen->newranges.push_back(std::pair<vid_t,vid_t>(splitstart, splitend));
                 
-                vid_t splitpos = 0;
-                std::cout << "Size: " << sz << " vs. maxshardsize: " << maxshardsize << std::endl;
-                if (sz > (off_t)maxshardsize) {
-                    rangeschanged = true;
-                    // Compute number edges (not including ingested ones!)
-                    size_t halfedges = (sz / sizeof(EdgeDataType)) / 2;
-                    // Correct to include estimate of ingested ones
-                    for(int w=0; w < this->nshards; w++) {
-                        halfedges += new_edge_buffers[shard][w]->size() / 2;
-                    }
-                    size_t nedges = 0;
+                // Edges read so far from each run
+                std::vector<size_t> old_edgecounters(nruns, 0);
+                std::vector<merged_edge> vedges;
+                
+                // Now create a new shard file window by window
+                for(int window=0; window < nsh; window++) {
+                    vid_t range_st = gen->intervals[window].first;
+                    vid_t range_en = gen->intervals[window].second;
+                    if (window == nsh - 1) range_en = gen->max_vertex_id;
                     
-                    vid_t st = this->intervals[shard].first;
-                    splitpos = st + (this->intervals[shard].second - st) / 2;
-                    bool found = false;
-                    while(st < this->intervals[shard].second) {
-                        vid_t en = std::min(st + maxwindow, this->intervals[shard].second);
-                        this->degree_handler->load(st, en);
-                        int nv = en - st + 1;
+                    for(vid_t window_st=range_st; window_st<=range_en; ) {
+                        // Check how much we can read
+                        vid_t maxvid = std::min(range_en, window_st + commit_maxwindow);
+                        degrees->load(window_st, maxvid);
+                        vid_t window_en = last_vertex_in_budget(degrees, window_st, maxvid, mem_budget);
+                        // Create vertices
+                        int nvertices = window_en-window_st+1;
+                        std::vector< svertex_t > vertices(nvertices, svertex_t());
+                        /* Allocate edge data: to do this, need to compute sum of in & out edges */
+                        graphchi_edge<EdgeDataType> * edata = NULL;
+                        size_t num_edges=0;
+                        for(int i=0; i<nvertices; i++) {
+                            degree d = degrees->get_degree(i + window_st);
+                            num_edges += d.indegree+d.outdegree;
+                        }
+                        size_t ecounter = 0;
+                        edata = (graphchi_edge<EdgeDataType>*)malloc(num_edges * sizeof(graphchi_edge<EdgeDataType>));
+                        for(int i=0; i<(int)nvertices; i++) {
+                            degree d = degrees->get_degree(i + window_st);
+                            int outc = d.outdegree;
+                            vertices[i] = svertex_t(window_st+i, &edata[ecounter], 
+                                                    &edata[ecounter+0], 0, outc);
+                            vertices[i].scheduled = true; // guarantee that shard will read it
+                            ecounter += 0 + outc;
+                        }
                         
-                        for(int i=0; i<nv; i++) {
-                            nedges += this->degree_handler->get_degree(st + i).indegree;
-                            if (nedges >= halfedges) {
-                                splitpos = i+st-1;
-                                found = true;
-                                break;
+                        // Read the runs one after another, and record where the
+                        // edges of each run start in each vertex and in the run
+                        std::vector< std::vector<int> > run_end(nruns, std::vector<int>(nvertices, 0));
+                        std::vector< std::vector<size_t> > run_offset(nruns, std::vector<size_t>(nvertices, 0));
+                        for(int r=0; r < nruns; r++) {
+                            runs[r]->read_next_vertices(nvertices, window_st, vertices, false, true);
+                            for(int iv=0; iv < nvertices; iv++) {
+                                int st = (r == 0 ? 0 : run_end[r - 1][iv]);
+                                run_end[r][iv] = vertices[iv].outc;
+                                run_offset[r][iv] = old_edgecounters[r];
+                                old_edgecounters[r] += vertices[iv].outc - st;
                             }
                         }
-                        if (found) break;
-                        st = en+1;
-                    }
-                    assert(splitpos > this->intervals[shard].first && splitpos < this->intervals[shard].second);
-                }
-                
-                for(int splits=0; splits<outparts; splits++) { // Note: this is not super-efficient because we do the operation twice in case of split
-                    typename base_engine::slidingshard_t * curshard = 
-                    new typename base_engine::slidingshard_t(this->iomgr, origshardfile, origadjfile, 
-                                                             this->intervals[shard].first, this->intervals[shard].second, 
-                                                             base_engine::blocksize, this->m, true);
-                    
-                    
-                    std::string suffix = "";
-                    char partstr[128];
-                    sprintf(partstr, "%d", shard);
-                    if (splits == 0) {
-                        suffix = std::string(partstr);
-                    } else {
-                        suffix = std::string(partstr) + ".split";  
-                    }
-                    suffix = suffix + ".i" + std::string(iterstr);
-                    newsuffices.push_back(suffix);
-                    curadjfilepos = 0;
-                    std::string outfile_edata = filename_shard_edata<EdgeDataType>(this->base_filename, 0, 0) + ".dyngraph" + suffix;
-                    std::string outfile_edata_dirname = dirname_shard_edata_block(outfile_edata, base_engine::blocksize);
-                    mkdir(outfile_edata_dirname.c_str(), 0777);
-                    std::string outfile_adj = filename_shard_adj(this->base_filename, 0, 0) + ".dyngraph" + suffix;
-                    
-                    vid_t splitstart = this->intervals[shard].first;
-                    vid_t splitend = this->intervals[shard].second;
-                    if (shard == this->nshards - 1) splitend = max_vertex_id;
-                    
-                    // This is looking more and more hacky
-                    if (outparts == 2) {
-                        if (splits==0) splitend = splitpos;
-                        else splitstart = splitpos+1;
-                    }
-                    newranges.push_back(std::pair<vid_t,vid_t>(splitstart, splitend)); 
-                    
-                    // Create the adj file
-                    int f = open(outfile_adj.c_str(), O_WRONLY | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
-                    int err = ftruncate(f, 0);
-                    if (err != 0) {
-                        logstream(LOG_ERROR) << "Error truncating " << outfile_adj << ", error: " << strerror(errno) << std::endl;
-                    }
-                    assert(err == 0);
-                    /* Create edge data file */
-                    int ef = open(outfile_edata.c_str(), O_WRONLY | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
-                    err = ftruncate(ef, 0);
-                    if (err != 0) {
-                        logstream(LOG_ERROR) << "Error truncating " << outfile_edata << ", error: " << strerror(errno) << std::endl;
-                    }
-                    assert(err == 0);
-                    char * buf = (char*) malloc(BBUF); 
-                    char * bufptr = buf;
-                    char * ebuf = (char*) malloc(BBUF);
-                    char * ebufptr = ebuf;
-                    size_t tot_edatabytes = 0;
-                    
-                    // Index file
-                    std::string indexfile = filename_shard_adjidx(outfile_adj);
-                    int idxf = open(indexfile.c_str(),  O_WRONLY | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
-                    size_t last_index_output = 0;
-                    size_t index_interval_edges = 1024 * 1024;
-                    size_t edgecounter = 0;
-                    assert(idxf>0);
-
-                    
-                    // Now create a new shard file window by window
-                    for(int window=0; window < this->nshards; window++) {
-                        vid_t range_st = this->intervals[window].first;
-                        vid_t range_en = this->intervals[window].second;
-                        if (window == this->nshards - 1) range_en = max_vertex_id;
-                        edge_buffer &buffer_for_window = *new_edge_buffers[shard][window];
                         
-                        for(vid_t window_st=range_st; window_st<range_en; ) {
-                            // Check how much we can read
-                            vid_t window_en = determine_next_window(window, window_st, 
-                                                                    std::min(range_en, window_st + (vid_t)maxwindow), mem_budget);
-                            // Create vertices
-                            int nvertices = window_en-window_st+1;
-                            std::vector< svertex_t > vertices(nvertices, svertex_t());
-                            /* Allocate edge data: to do this, need to compute sum of in & out edges */
-                            graphchi_edge<EdgeDataType> * edata = NULL;
-                            size_t num_edges=0;
-                            for(int i=0; i<nvertices; i++) {
-                                degree d = this->degree_handler->get_degree(i + window_st);
-                                num_edges += d.indegree+d.outdegree;
-                            }
-                            size_t ecounter = 0;
-                            edata = (graphchi_edge<EdgeDataType>*)malloc(num_edges * sizeof(graphchi_edge<EdgeDataType>));
-                            for(int i=0; i<(int)nvertices; i++) {
-                                //  int inc = degrees[i].indegree;
-                                degree d = this->degree_handler->get_degree(i + window_st);
-                                int outc = d.outdegree;
-                                vertices[i] = svertex_t(window_st+i, &edata[ecounter], 
-                                                        &edata[ecounter+0], 0, outc);
-                                vertices[i].scheduled = true; // guarantee that shard will read it
-                                ecounter += 0 + outc;
-                            }
-                            
-                            // Read vertices in
-                            curshard->read_next_vertices(nvertices, window_st, vertices, false, true);
-                            
-                            // Incorporate buffered edges
+                        // Incorporate buffered edges
+                        for(int shard=first; shard <= last; shard++) {
+                            edge_buffer &buffer_for_window = *gen->buffers[shard][window];
                             for(unsigned int ebi=0; ebi<buffer_for_window.size(); ebi++) {
                                 created_edge<EdgeDataType> * edge = buffer_for_window[ebi];
-                                if (edge->src >= window_st && edge->src <= window_en) {
+                                if (edge->src >= window_st && edge->src <= window_en && !edge->deleted) {
                                     vertices[edge->src-window_st].add_outedge(edge->dst, &edge->data, false);
-                                    
                                 }
                             }
-                            this->iomgr->wait_for_reads();
-                            
-                            // If we are splitting, need to adjust counts
-                            std::vector<int> adjusted_counts(vertices.size(), 0);
-                            for(int iv=0; iv< (int)vertices.size(); iv++) adjusted_counts[iv] = vertices[iv].outc;
-                            
-                            if (outparts == 2) {
-                                // do actual counts by removing the edges not in this split
-                                for(int iv=0; iv< (int)vertices.size(); iv++) {
-                                    svertex_t &vertex = vertices[iv];
-                                    for(int i=0; i<vertex.outc; i++) {
-                                        if (!(vertex.outedge(i)->vertexid >= splitstart && vertex.outedge(i)->vertexid <= splitend)) {
-                                            adjusted_counts[iv]--;  
-                                        }
-                                    }
-                                }
-                            }   
-                            
-#ifdef SUPPORT_DELETIONS
-                            // Adjust counts to remove deleted edges
-                            for(int iv=0; iv< (int)vertices.size(); iv++) {
-                                svertex_t &vertex = vertices[iv];
-                                for(int i=0; i<vertex.outc; i++) {
-                                    if (is_deleted_edge_value(vertex.outedge(i)->get_data())) {
-                                        adjusted_counts[iv]--;  
-                                        assert(false);
-                                    }
+                        }
+                        this->iomgr->wait_for_reads();
+                        
+                        for(int iv=0; iv < nvertices; iv++) {
+                            svertex_t &vertex = vertices[iv];
+                            vedges.clear();
+                            int r = 0;
+                            for(int i=0; i < vertex.outc; i++) {
+                                while(r < nruns && i >= run_end[r][iv]) r++;
+                                graphchi_edge<EdgeDataType> * e = vertex.outedge(i);
+                                if (!(e->vertexid >= splitstart && e->vertexid <= splitend)) {
+                                    assert(outparts > 1);
+                                    continue;
                                 }
+                                merged_edge medge;
+                                medge.dst = e->vertexid;
+                                medge.ptr = e->data_ptr;
+                                medge.source = (r < nruns ? r : -1);
+                                medge.oldidx = (r < nruns ? run_offset[r][iv] + i - (r == 0 ? 0 : run_end[r - 1][iv]) : 0);
+                                vedges.push_back(medge);
                             }
-                            
-                            // Adjust degrees
-                            //   adjust_degrees_for_deleted(vertices, window_st); // Double counting problem, that is why commented out.
-#endif
-                            
-                            size_t ne = 0;
-                            for(vid_t curvid=window_st; curvid<=window_en;) {
-                                int iv = curvid - window_st;
-                                svertex_t &vertex = vertices[iv];
-                                int count = adjusted_counts[iv];                            
-                                if (count == 0) {
-                                    // Check how many next ones are zeros
-                                    int nz=0;
-                                    curvid++;
-                                    for(; curvid <= window_en && nz<254; curvid++) {
-                                        if (adjusted_counts[curvid - window_st] == 0) {
-                                            nz++;
-                                        } else {
-                                            break;
-                                        }
-                                    }
-                                    uint8_t nnz = (uint8_t)nz;
-                                    // Write zero
-                                    bwrite<uint8_t>(f, buf, bufptr, 0);
-                                    bwrite<uint8_t>(f, buf, bufptr, nnz);
-                                } else {
-                                    
-                                    // Write index
-                                    if (edgecounter - last_index_output >= index_interval_edges) {
-                                        size_t curfpos = curadjfilepos;
-                                        shard_index sidx(curvid, curfpos, edgecounter);
-                                        size_t a = write(idxf, &sidx, sizeof(shard_index));
-                                        assert(a>0);
-                                        last_index_output = edgecounter;
-                                    }
-
-                                    
-                                    if (count < 255) {
-                                        uint8_t x = (uint8_t)count;
-                                        bwrite<uint8_t>(f, buf, bufptr, x);
-                                    } else {
-                                        bwrite<uint8_t>(f, buf, bufptr, 0xff);
-                                        bwrite<uint32_t>(f, buf, bufptr, (uint32_t)count);
-                                    }
-                                    
-                                    for(int i=0; i<vertex.outc; i++) {
-                                        if (vertex.outedge(i)->vertexid >= splitstart && vertex.outedge(i)->vertexid <= splitend) {
-#ifdef SUPPORT_DELETIONS
-                                            if (is_deleted_edge_value(vertex.outedge(i)->get_data())) {
-                                                assert(false);
-                                                
-                                            } 
-#endif
-                                            bwrite(f, buf, bufptr,  vertex.outedge(i)->vertexid);
-                                            bwrite_edata<EdgeDataType>(ebuf, ebufptr, vertex.outedge(i)->get_data(), tot_edatabytes, outfile_edata);
-                                            ne++;
-                                            edgecounter++;
-                                        } else assert(outparts == 2);
-                                    }
-                                    curvid++;
+                            if (vedges.empty()) {
+                                w.pending_zeros++;
+                                continue;
+                            }
+                            std::sort(vedges.begin(), vedges.end());
+                            begin_vertex(w, window_st + iv, (int) vedges.size());
+                            for(size_t i=0; i < vedges.size(); i++) {
+                                if (gen->values_at_switch) {
+                                    // Values are written when switching to the generation
+                                    add_edata_run(part, w.edgecounter, vedges[i].source, vedges[i].oldidx);
+                                    if (vedges[i].source < 0) part.bufvalues.push_back(vedges[i].ptr);
                                 }
-                            } 
-                            free(edata);
-                            window_st = window_en+1;
+                                write_edge(w, vedges[i].dst, vedges[i].ptr);
+                            }
                         }
-                        
-                    } // end window
-                    
-                    // Flush buffers
-                    writea(f, buf, bufptr-buf);
-                    
-                    edata_flush<EdgeDataType>(ebuf, ebufptr, outfile_edata, tot_edatabytes);
-                    
-                    // Write .size file for the edata firectory
-                    std::string sizefilename = outfile_edata + ".size";
-                    std::ofstream ofs(sizefilename.c_str());
-                    ofs << tot_edatabytes;
-                    ofs.close();
-
-                    // Release
-                    free(buf); 
-                    free(ebuf);
-                    
-                    delete curshard;
-                    close(f);
-                    close(ef);
-                    close(idxf);
+                        free(edata);
+                        window_st = window_en+1;
+                    }
                     
-                    this->iomgr->wait_for_writes();
-                } // splits
+                } // end window
                 
-                // Delete old shard
-                std::string old_file_adj = filename_shard_adj(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[shard];          
-                std::string old_file_edata = filename_shard_edata<EdgeDataType>(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[shard];
-                std::string old_blockdir =  dirname_shard_edata_block(old_file_edata, base_engine::blocksize);
-                std::string old_file_adj_idx = filename_shard_adjidx(old_file_adj);
-                remove(old_file_adj.c_str());
-                remove(old_blockdir.c_str());
-                remove(old_file_adj_idx.c_str());
-
-                std::string old_sizefilename = old_file_edata + ".size";
-                remove(old_sizefilename.c_str());
+                close_run(w);
+                for(int r=0; r < nruns; r++) {
+                    delete runs[r];
+                }
+                gen->edges_written += w.edgecounter;
+                gen->parts.push_back(part);
+            } // splits
+        }
+        
+        int open_truncated(std::string filename) {
+            int f = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+            if (f < 0) {
+                logstream(LOG_ERROR) << "Could not open " << filename << " error: " << strerror(errno) << std::endl;
+            }
+            assert(f >= 0);
+            return f;
+        }
+        
+        void open_run(run_writer &w, std::string suffix, bool values_at_switch) {
+            w.adjfile = shard_adj_filename(suffix);
+            w.edatafile = shard_edata_filename(suffix);
+            std::string dirname = dirname_shard_edata_block(w.edatafile, base_engine::blocksize);
+            mkdir(dirname.c_str(), 0777);
+            w.f = open_truncated(w.adjfile);
+            close(open_truncated(w.edatafile));
+            w.idxf = open_truncated(filename_shard_adjidx(w.adjfile));
+            w.buf = w.bufptr = (char*) malloc(BBUF);
+            w.ebuf = w.ebufptr = (char*) malloc(base_engine::blocksize);
+            w.adjpos = 0;
+            w.tot_edatabytes = 0;
+            w.edgecounter = 0;
+            w.last_index_output = 0;
+            w.pending_zeros = 0;
+            w.values_at_switch = values_at_switch;
+        }
+        
+        /**
+         * A run of vertices without edges is stored as a zero followed
+         * by the number of vertices in the run minus one.
+         */
+        void write_pending_zeros(run_writer &w) {
+            while(w.pending_zeros > 0) {
+                size_t n = std::min(w.pending_zeros, (size_t)255);
+                rwrite<uint8_t>(w, 0);
+                rwrite<uint8_t>(w, (uint8_t) (n - 1));
+                w.pending_zeros -= n;
             }
+        }
+        
+        void begin_vertex(run_writer &w, vid_t vid, int count) {
+            write_pending_zeros(w);
             
-            // Clear buffers
-            for(int shard=0; shard < this->nshards; shard++) {
-                if (was_commited[shard]) {
-                    for (int win=0; win < this->nshards; win++) {
-                        edge_buffer &buffer_for_window = *new_edge_buffers[shard][win];
-                        for(unsigned int ebi=0; ebi<buffer_for_window.size(); ebi++) {
-                            created_edge<EdgeDataType> * edge = buffer_for_window[ebi];                            
-                            if (!edge->accounted_for_outc) {
-                                std::cout << "Edge not accounted (out)! " << edge->src << " -- " << edge->dst << std::endl;
-                            }
-                            if (!edge->accounted_for_inc) {
-                                std::cout << "Edge not accounted (in)! " << edge->src << " -- " << edge->dst << std::endl;
-                            }
-                            
-                            assert(edge->accounted_for_inc);
-                            assert(edge->accounted_for_outc);
-                        }
-                        buffer_for_window.clear();
-                    }
+            // Write index
+            if (w.edgecounter - w.last_index_output >= 1024 * 1024) {
+                shard_index sidx(vid, w.adjpos, w.edgecounter);
+                writea(w.idxf, &sidx, sizeof(shard_index));
+                w.last_index_output = w.edgecounter;
+            }
+            if (count < 255) {
+                rwrite<uint8_t>(w, (uint8_t)count);
+            } else {
+                rwrite<uint8_t>(w, 0xff);
+                rwrite<uint32_t>(w, (uint32_t)count);
+            }
+        }
+        
+        void write_edge(run_writer &w, vid_t dst, EdgeDataType * value) {
+            rwrite<vid_t>(w, dst);
+            if (w.values_at_switch) {
+                w.tot_edatabytes += sizeof(EdgeDataType);
+            } else {
+                bwrite_edata<EdgeDataType>(w.ebuf, w.ebufptr, *value, w.tot_edatabytes, w.edatafile);
+            }
+            w.edgecounter++;
+        }
+        
+        void close_run(run_writer &w) {
+            write_pending_zeros(w);
+            writea(w.f, w.buf, w.bufptr - w.buf);
+            if (!w.values_at_switch && w.tot_edatabytes > 0) {
+                edata_flush<EdgeDataType>(w.ebuf, w.ebufptr, w.edatafile, w.tot_edatabytes);
+            }
+            
+            // Write .size file for the edata directory
+            std::string sizefilename = w.edatafile + ".size";
+            std::ofstream ofs(sizefilename.c_str());
+            ofs << w.tot_edatabytes;
+            ofs.close();
+            remove(filename_shard_deletions(w.edatafile).c_str());
+            
+            free(w.buf);
+            free(w.ebuf);
+            close(w.f);
+            close(w.idxf);
+            this->iomgr->wait_for_writes();
+        }
+        
+        void add_edata_run(generation_part &part, size_t newidx, int source, size_t oldidx) {
+            if (!part.runs.empty()) {
+                edata_run &r = part.runs.back();
+                if (r.source == source && r.newidx + r.len == newidx && (source < 0 || r.oldidx + r.len == oldidx)) {
+                    r.len++;
+                    return;
                 }
             }
+            edata_run r;
+            r.newidx = newidx;
+            r.oldidx = oldidx;
+            r.len = 1;
+            r.source = source;
+            part.runs.push_back(r);
+        }
+        
+        /**
+         * Switches to the new generation of shards. Called at an iteration boundary;
+         * waits for the build if it has not finished.
+         */
+        void switch_generation() {
+            TRACE_SCOPE("switch_generation", "lsm");
+            shard_generation * gen = next_generation;
+            if (background_commit) {
+                if (!gen->finished) logstream(LOG_INFO) << "Waiting for the background commit to finish..." << std::endl;
+                pthread_join(gen->thread, NULL);
+            }
+            metrics_entry me = this->m.start_time();
+            state = "switch-generation";
             
-            // Update number of shards:
-            last_commit = added_edges;
-            this->intervals = newranges;
-            shard_suffices = newsuffices;
-            this->nshards = (int) this->intervals.size();
+            if (gen->values_at_switch) {
+                this->iomgr->commit_cached_blocks();
+                for(int i=0; i < (int)gen->parts.size(); i++) {
+                    write_generation_edata(gen->parts[i]);
+                }
+            }
+            
+            this->modification_lock.lock();
+            ingest_lock.writelock();
             
+            /* Compacted runs are replaced, delta runs are only added */
+            shardlock.lock();
+            for(int shard=0; shard < (int)gen->buffers.size(); shard++) {
+                if (gen->buffers[shard].empty() || !gen->compact[shard]) continue;
+                delete this->sliding_shards[shard];
+                this->sliding_shards[shard] = NULL;
+                remove_shard_files(gen->suffices[shard]);
+                for(int k=0; k < (int)gen->deltasuffices[shard].size(); k++) {
+                    delete delta_shards[shard][k];
+                    remove_shard_files(gen->deltasuffices[shard][k]);
+                }
+                delta_shards[shard].clear();
+            }
             /* If the vertex intervals change, need to recreate the shard objects. */
-            if (rangeschanged) {
-                shardlock.lock();
+            if (gen->rangeschanged) {
                 for (int i=0; i<(int)this->sliding_shards.size(); i++) {
                     if (this->sliding_shards[i] != NULL) delete this->sliding_shards[i];
                 }
                 this->sliding_shards.clear();
-                shardlock.unlock();
+                for(int p=0; p < (int)delta_shards.size(); p++) {
+                    for(int k=0; k < (int)delta_shards[p].size(); k++) delete delta_shards[p][k];
+                }
+                delta_shards.clear();
             }
+            shardlock.unlock();
+            
+            // Update number of shards:
+            last_commit += gen->nedges;
+            retire_ingest_marks();
+            this->intervals = gen->newranges;
+            shard_suffices = gen->newsuffices;
+            delta_suffices = gen->newdeltasuffices;
+            this->nshards = (int) this->intervals.size();
+            this->intervals[this->nshards - 1].second = max_vertex_id;
+            
             /* Write meta-file with the number of vertices */
             std::string numv_filename = base_engine::base_filename + ".numvertices";
             FILE * f = fopen(numv_filename.c_str(), "w");
             fprintf(f, "%lu\n", base_engine::num_vertices());
             fclose(f);
             
-            init_buffers();
+            /* Edges buffered during the build were bucketed by the old intervals */
+            if (gen->rangeschanged) {
+                init_buffers();
+            }
+            next_generation = NULL;
+            ingest_lock.wrunlock();
             this->modification_lock.unlock();
+            
+            /* Edges written by commits per committed edge */
+            lsm_edges_written += gen->edges_written;
+            size_t ndeltaruns = 0;
+            for(int p=0; p < this->nshards; p++) ndeltaruns += delta_suffices[p].size();
+            this->m.add("lsm.compactions", gen->ncompactions);
+            this->m.add("lsm.delta_runs_written", gen->ndeltaruns);
+            if (gen->nsplits > 0) this->m.add("lsm.splits", gen->nsplits);
+            if (gen->nmerges > 0) this->m.add("lsm.merges", gen->nmerges);
+            this->m.set("lsm.delta_runs", ndeltaruns);
+            this->m.set("lsm.write_amplification", lsm_edges_written * 1.0 / std::max((size_t)1, last_commit));
+            logstream(LOG_INFO) << "Commit wrote " << gen->ndeltaruns << " delta runs and compacted " << gen->ncompactions
+                << " shards, write amplification: " << lsm_edges_written * 1.0 / std::max((size_t)1, last_commit) << std::endl;
+            
+            release_generation(gen);
+            initialize_sliding_shards();
+            this->m.stop_time(me, "commit_switch");
+            logstream(LOG_INFO) << "Switched to shard generation of iteration " << this->iter << ", nshards: " << this->nshards << std::endl;
+        }
+        
+        void release_generation(shard_generation * gen) {
+            for(int shard=0; shard < (int)gen->buffers.size(); shard++) {
+                for(int w=0; w < (int)gen->buffers[shard].size(); w++) {
+                    delete gen->buffers[shard][w];
+                }
+            }
+            delete gen;
+        }
+        
+        void remove_shard_files(std::string suffix) {
+            std::string old_file_adj = shard_adj_filename(suffix);
+            std::string old_file_edata = shard_edata_filename(suffix);
+            std::string old_blockdir =  dirname_shard_edata_block(old_file_edata, base_engine::blocksize);
+            std::string old_file_adj_idx = filename_shard_adjidx(old_file_adj);
+            
+            size_t edatasize = get_shard_edata_filesize<EdgeDataType>(old_file_edata);
+            int nblocks = (int) ((edatasize / base_engine::blocksize) + (edatasize % base_engine::blocksize == 0 ? 0 : 1));
+            for(int i=0; i < nblocks; i++) {
+                std::string blockname = filename_shard_edata_block(old_file_edata, i, base_engine::blocksize);
+                remove(blockname.c_str());
+            }
+            remove(old_file_adj.c_str());
+            remove(old_blockdir.c_str());
+            remove(old_file_adj_idx.c_str());
+            remove(old_file_edata.c_str());
+
+            std::string old_sizefilename = old_file_edata + ".size";
+            remove(old_sizefilename.c_str());
+            remove(filename_shard_deletions(old_file_edata).c_str());
+        }
+        
+        /**
+         * Writes the edge data blocks of a new run from the current values
+         * in the previous runs and in the frozen buffers.
+         */
+        void write_generation_edata(generation_part &part) {
+            size_t blocksize = base_engine::blocksize;
+            assert(blocksize % sizeof(EdgeDataType) == 0);
+            size_t block_edges = blocksize / sizeof(EdgeDataType);
+            size_t new_nedges = get_shard_edata_filesize<EdgeDataType>(part.new_edata) / sizeof(EdgeDataType);
+            int nsources = (int) part.old_edata.size();
+            std::vector<size_t> old_nedges(nsources);
+            std::vector<EdgeDataType *> oldblocks(nsources);
+            std::vector<int> oldblockids(nsources, -1);
+            for(int s=0; s < nsources; s++) {
+                old_nedges[s] = get_shard_edata_filesize<EdgeDataType>(part.old_edata[s]) / sizeof(EdgeDataType);
+                oldblocks[s] = (EdgeDataType *) malloc(blocksize);
+            }
+            EdgeDataType * newblock = (EdgeDataType *) malloc(blocksize);
+            size_t nbuffered = 0;
+            
+            for(int ri=0; ri < (int)part.runs.size(); ri++) {
+                edata_run &r = part.runs[ri];
+                for(size_t k=0; k < r.len; ) {
+                    size_t dst = r.newidx + k;
+                    size_t n = std::min(r.len - k, block_edges - dst % block_edges);
+                    if (r.source < 0) {
+                        for(size_t j=0; j < n; j++) {
+                            newblock[dst % block_edges + j] = *part.bufvalues[nbuffered++];
+                        }
+                    } else {
+                        size_t src = r.oldidx + k;
+                        int blockid = (int) (src / block_edges);
+                        if (blockid != oldblockids[r.source]) {
+                            edata_block_io(part.old_edata[r.source], blockid, oldblocks[r.source],
+                                           std::min(block_edges, old_nedges[r.source] - blockid * block_edges), false);
+                            oldblockids[r.source] = blockid;
+                        }
+                        n = std::min(n, block_edges - src % block_edges);
+                        memcpy(&newblock[dst % block_edges], &oldblocks[r.source][src % block_edges], n * sizeof(EdgeDataType));
+                    }
+                    k += n;
+                    
+                    size_t end = dst + n;
+                    if (end % block_edges == 0 || end == new_nedges) {
+                        edata_block_io(part.new_edata, (int) ((end - 1) / block_edges), newblock, (end - 1) % block_edges + 1, true);
+                    }
+                }
+            }
+            for(int s=0; s < nsources; s++) free(oldblocks[s]);
+            free(newblock);
+        }
+        
+        void edata_block_io(std::string &shard_filename, int blockid, EdgeDataType * buf, size_t nedges, bool write) {
+            std::string block_filename = filename_shard_edata_block(shard_filename, blockid, base_engine::blocksize);
+            int f = open(block_filename.c_str(), write ? (O_RDWR | O_CREAT) : O_RDONLY, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+            if (f < 0) {
+                logstream(LOG_ERROR) << "Could not open " << block_filename << " error: " << strerror(errno) << std::endl;
+            }
+            assert(f >= 0);
+            if (write) {
+                write_compressed(f, buf, nedges * sizeof(EdgeDataType));
+            } else {
+                read_compressed(f, buf, nedges * sizeof(EdgeDataType));
+            }
+            close(f);
         }
         
         
         template <typename T>
-        void bwrite(int f, char * buf, char * &bufptr, T val) {
-            curadjfilepos += sizeof(T);
-            if (bufptr+sizeof(T)-buf>=BBUF) {
-                writea(f, buf, bufptr-buf);
-                bufptr = buf;
+        void rwrite(run_writer &w, T val) {
+            w.adjpos += sizeof(T);
+            if (w.bufptr+sizeof(T)-w.buf>=BBUF) {
+                writea(w.f, w.buf, w.bufptr-w.buf);
+                w.bufptr = w.buf;
             }
-            *((T*)bufptr) = val;
-            bufptr += sizeof(T);
+            *((T*)w.bufptr) = val;
+            w.bufptr += sizeof(T);
         }
         
         
@@ -995,6 +1947,10 @@ namespace graphchi {
             json << "\"edges\": " << num_edges_safe() << ",\n";
 
             json << "\"edgesInBuffers\": " << added_edges << ",\n";
+            json << "\"commitInProgress\": " << (next_generation != NULL ? 1 : 0) << ",\n";
+            json << "\"bufferOccupancy\": " << buffer_occupancy() << ",\n";
+            json << "\"ingestLag\": " << ingest_lag() << ",\n";
+            json << "\"progress\": " << this->progress.to_json() << ",\n";
 
             json << "\"interval\":" << this->exec_interval << ",\n";
             json << "\"windowStart\":" << this->sub_interval_st << ",";
@@ -1010,6 +1966,7 @@ namespace graphchi {
                 if (shard != NULL) {
                     json << "{";
                     json << "\"p\": " << p << ", ";
+                    json << "\"deltaRuns\": " << (p < (int)delta_shards.size() ? delta_shards[p].size() : 0) << ", ";
                     json << shard->get_info_json();
                     json << "}";
                 } else {
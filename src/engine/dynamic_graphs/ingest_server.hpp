@@ -0,0 +1,505 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Streaming ingest front end for the dynamic graph engine. The server listens
+ * on a Unix-domain socket (option ingest_socket) or on a loopback TCP port
+ * (option ingest_port), and adds the edge batches sent by clients to the
+ * buffers of the engine.
+ *
+ * Protocol, in host byte order (the socket is local):
+ *    request: ingest_batch_header, followed by nedges records of
+ *             (vid_t src, vid_t dst, EdgeDataType value), packed.
+ *    reply:   ingest_ack, after the batch has been added to the buffers.
+ * A batch with zero edges is a ping, and is acknowledged immediately.
+ * Flow control: the server reads the next batch of a connection only after
+ * the previous one has been acknowledged, and adding a batch blocks while the
+ * engine's buffers are full, so a client that waits for the acks (or keeps
+ * a bounded number of batches in flight) is throttled to the commit rate.
+ * See ingest_client for a client.
+ */
+
+#ifndef DEF_GRAPHCHI_INGEST_SERVER
+#define DEF_GRAPHCHI_INGEST_SERVER
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+
+#include "engine/dynamic_graphs/graphchi_dynamicgraph_engine.hpp"
+#include "logger/logger.hpp"
+#include "metrics/metrics.hpp"
+#include "util/cmdopts.hpp"
+#include "util/pthread_tools.hpp"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace graphchi {
+
+#define INGEST_MAGIC 0x42494347 // "GCIB"
+
+    enum ingest_status {INGEST_OK = 0, INGEST_BAD_REQUEST = 1, INGEST_CLOSED = 2};
+
+    struct ingest_batch_header {
+        uint32_t magic;
+        uint32_t nedges;
+    };
+
+    struct ingest_ack {
+        uint32_t magic;
+        uint32_t status;
+        uint32_t accepted;           // Edges added from the batch (self-edges are dropped)
+        uint32_t occupancy_permille; // Buffer occupancy after the batch, see buffer_occupancy()
+        uint64_t total_edges;        // Edges added through the engine so far
+    };
+
+    /**
+     * Reads or writes exactly len bytes.
+     * @return false on end of stream or error
+     */
+    static bool ingest_recv_all(int fd, void * buf, size_t len) {
+        char * p = (char *) buf;
+        while (len > 0) {
+            ssize_t n = recv(fd, p, len, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    static bool ingest_send_all(int fd, const void * buf, size_t len) {
+        const char * p = (const char *) buf;
+        while (len > 0) {
+            ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    /**
+     * Opens a listening Unix-domain socket, or a TCP socket on 127.0.0.1
+     * if socketpath is empty.
+     * @return the socket, or -1 on failure
+     */
+    static int ingest_listen(std::string socketpath, int port) {
+        int fd;
+        if (!socketpath.empty()) {
+            struct sockaddr_un addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            if (socketpath.size() >= sizeof(addr.sun_path)) {
+                logstream(LOG_ERROR) << "Ingest socket path is too long: " << socketpath << std::endl;
+                return -1;
+            }
+            strncpy(addr.sun_path, socketpath.c_str(), sizeof(addr.sun_path) - 1);
+            unlink(socketpath.c_str()); // Stale socket of a previous run
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd >= 0 && bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        } else {
+            struct sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons((uint16_t) port);
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            fd = socket(AF_INET, SOCK_STREAM, 0);
+            int one = 1;
+            if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (fd >= 0 && bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        if (fd < 0 || listen(fd, 16) != 0) {
+            logstream(LOG_ERROR) << "Could not listen on " << (socketpath.empty() ? "port" : socketpath) << " "
+                << (socketpath.empty() ? port : 0) << " error: " << strerror(errno) << std::endl;
+            if (fd >= 0) close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    template <typename VertexDataType, typename EdgeDataType, typename svertex_t = graphchi_vertex<VertexDataType, EdgeDataType> >
+    class ingest_server {
+
+        typedef graphchi_dynamicgraph_engine<VertexDataType, EdgeDataType, svertex_t> engine_t;
+
+        struct connection {
+            ingest_server * server;
+            int fd;
+            pthread_t thread;
+            volatile bool finished;  // Set by the connection thread when it exits
+        };
+
+        engine_t * engine;
+        metrics &m;
+        std::string socketpath;
+        int port;
+        size_t max_batch;
+        bool schedule_sources;
+
+        int listenfd;
+        volatile bool running;  // Polled by the listener and connection threads
+        pthread_t listener;
+        mutex connlock;
+        std::vector<connection *> connections;
+        size_t ingested;
+        metrics_handle batches_counter, edges_counter, latency_timer;
+
+    public:
+
+        /**
+         * @param schedule_sources if true, the sources of the added edges are scheduled for update
+         */
+        ingest_server(engine_t * engine, metrics &_m, bool schedule_sources = false) : engine(engine), m(_m),
+        schedule_sources(schedule_sources), listenfd(-1), running(false), ingested(0) {
+            socketpath = get_option_string("ingest_socket", "");
+            port = get_option_int("ingest_port", 0);
+            max_batch = get_option_long("ingest_max_batch", 1 << 20);
+            assert(!socketpath.empty() || port > 0);
+            batches_counter = m.register_metric("ingest.server.batches", INTEGER);
+            edges_counter = m.register_metric("ingest.server.edges", INTEGER);
+            latency_timer = m.register_timer("ingest.server.batch_latency");
+        }
+
+        ~ingest_server() {
+            stop();
+        }
+
+        /**
+         * Starts listening in a background thread.
+         * @return false if the socket could not be opened or the thread started
+         */
+        bool start() {
+            assert(!running);
+            listenfd = ingest_listen(socketpath, port);
+            if (listenfd < 0) return false;
+            running = true;
+            int ret = pthread_create(&listener, NULL, listener_run, (void *) this);
+            if (ret != 0) {
+                logstream(LOG_ERROR) << "Could not start the ingest server thread: " << strerror(ret) << std::endl;
+                running = false;
+                close(listenfd);
+                if (!socketpath.empty()) unlink(socketpath.c_str());
+                return false;
+            }
+            logstream(LOG_INFO) << "Ingest server listening on " << (socketpath.empty() ? "127.0.0.1" : socketpath);
+            if (socketpath.empty()) logstream(LOG_INFO) << ":" << port;
+            logstream(LOG_INFO) << std::endl;
+            return true;
+        }
+
+        /**
+         * Closes the listening socket and the connections. If the engine has
+         * finished, call engine->close_ingest() first, so that connections
+         * waiting for buffer space are released.
+         */
+        void stop() {
+            if (!running) return;
+            running = false;
+            __sync_synchronize();
+            shutdown(listenfd, SHUT_RDWR);
+            close(listenfd);
+            pthread_join(listener, NULL);
+
+            connlock.lock();
+            for(int i=0; i < (int)connections.size(); i++) {
+                shutdown(connections[i]->fd, SHUT_RDWR);
+            }
+            connlock.unlock();
+            for(int i=0; i < (int)connections.size(); i++) {
+                pthread_join(connections[i]->thread, NULL);
+                close(connections[i]->fd);
+                delete connections[i];
+            }
+            connections.clear();
+            if (!socketpath.empty()) unlink(socketpath.c_str());
+            logstream(LOG_INFO) << "Ingest server stopped, ingested " << ingested << " edges." << std::endl;
+        }
+
+        size_t num_ingested() {
+            return ingested;
+        }
+
+    protected:
+
+        static void * listener_run(void * _server) {
+            ((ingest_server *) _server)->accept_loop();
+            return NULL;
+        }
+
+        static void * connection_run(void * _conn) {
+            connection * conn = (connection *) _conn;
+            conn->server->serve(conn);
+            return NULL;
+        }
+
+        void accept_loop() {
+            while (running) {
+                int fd = accept(listenfd, NULL, NULL);
+                if (fd < 0) {
+                    if (errno == EINTR || errno == ECONNABORTED) continue;
+                    break; // Listening socket closed
+                }
+                if (socketpath.empty()) {
+                    int one = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                }
+                connection * conn = new connection();
+                conn->server = this;
+                conn->fd = fd;
+                conn->finished = false;
+
+                connlock.lock();
+                reap_connections();
+                int ret = pthread_create(&conn->thread, NULL, connection_run, (void *) conn);
+                if (ret != 0) {
+                    connlock.unlock();
+                    logstream(LOG_ERROR) << "Could not start an ingest connection thread: " << strerror(ret) << std::endl;
+                    close(fd);
+                    delete conn;
+                    continue;
+                }
+                connections.push_back(conn);
+                m.add("ingest.server.connections", 1, INTEGER);
+                engine->set_json("ingestConnections", connections.size());
+                connlock.unlock();
+            }
+        }
+
+        /* Joins the threads of closed connections. connlock acquired. */
+        void reap_connections() {
+            std::vector<connection *> open;
+            for(int i=0; i < (int)connections.size(); i++) {
+                if (connections[i]->finished) {
+                    pthread_join(connections[i]->thread, NULL);
+                    close(connections[i]->fd);
+                    delete connections[i];
+                } else {
+                    open.push_back(connections[i]);
+                }
+            }
+            connections = open;
+        }
+
+        void serve(connection * conn) {
+            const size_t recsize = 2 * sizeof(vid_t) + sizeof(EdgeDataType);
+            std::vector<char> records;
+            std::vector< created_edge<EdgeDataType> > batch;
+
+            ingest_batch_header header;
+            while (running && ingest_recv_all(conn->fd, &header, sizeof(header))) {
+                ingest_ack ack;
+                ack.magic = INGEST_MAGIC;
+                ack.status = INGEST_OK;
+                ack.accepted = 0;
+
+                if (header.magic != INGEST_MAGIC || header.nedges > max_batch) {
+                    logstream(LOG_ERROR) << "Invalid ingest batch: magic " << header.magic << " nedges " << header.nedges
+                        << ", closing connection." << std::endl;
+                    ack.status = INGEST_BAD_REQUEST;
+                    fill_ack(ack);
+                    ingest_send_all(conn->fd, &ack, sizeof(ack));
+                    break;
+                }
+
+                metrics_timer me = m.start_timer();
+                if (header.nedges > 0) {
+                    records.resize(header.nedges * recsize);
+                    if (!ingest_recv_all(conn->fd, &records[0], records.size())) break;
+
+                    batch.clear();
+                    for(size_t i=0; i < header.nedges; i++) {
+                        const char * r = &records[i * recsize];
+                        vid_t src, dst;
+                        EdgeDataType value;
+                        memcpy(&src, r, sizeof(vid_t));
+                        memcpy(&dst, r + sizeof(vid_t), sizeof(vid_t));
+                        memcpy(&value, r + 2 * sizeof(vid_t), sizeof(EdgeDataType));
+                        batch.push_back(created_edge<EdgeDataType>(src, dst, value));
+                    }
+
+                    /* Blocks while the buffers are full */
+                    ack.accepted = (uint32_t) engine->add_edges(&batch[0], batch.size());
+                    if (engine->is_ingest_closed()) {
+                        ack.status = INGEST_CLOSED;
+                    } else if (schedule_sources) {
+                        for(size_t i=0; i < batch.size(); i++) engine->add_task(batch[i].src);
+                    }
+                    __sync_add_and_fetch(&ingested, (size_t) ack.accepted);
+                    m.add(batches_counter, 1);
+                    m.add(edges_counter, ack.accepted);
+                }
+                fill_ack(ack);
+                if (!ingest_send_all(conn->fd, &ack, sizeof(ack))) break;
+                m.stop_timer(me, latency_timer);
+                if (ack.status == INGEST_CLOSED) break;
+            }
+            __sync_synchronize();
+            conn->finished = true;
+        }
+
+        void fill_ack(ingest_ack &ack) {
+            ack.occupancy_permille = (uint32_t) (engine->buffer_occupancy() * 1000);
+            ack.total_edges = ingested;
+        }
+    };
+
+    /**
+     * Client of the ingest server. Sends batches of edges and waits for
+     * the acknowledgements. At most max_inflight batches are unacknowledged.
+     */
+    template <typename EdgeDataType>
+    class ingest_client {
+
+        int fd;
+        int max_inflight;
+        int inflight;
+        std::vector<char> sendbuf;
+        ingest_ack lastack;
+
+    public:
+
+        ingest_client(int max_inflight = 4) : fd(-1), max_inflight(max_inflight), inflight(0) {
+            memset(&lastack, 0, sizeof(lastack));
+        }
+
+        ~ingest_client() {
+            disconnect();
+        }
+
+        /**
+         * Connects to a Unix-domain socket, or to a TCP port on 127.0.0.1 if
+         * socketpath is empty.
+         * @return false if the server could not be reached
+         */
+        bool connect_to(std::string socketpath, int port = 0) {
+            if (!socketpath.empty()) {
+                struct sockaddr_un addr;
+                memset(&addr, 0, sizeof(addr));
+                addr.sun_family = AF_UNIX;
+                strncpy(addr.sun_path, socketpath.c_str(), sizeof(addr.sun_path) - 1);
+                fd = socket(AF_UNIX, SOCK_STREAM, 0);
+                if (fd >= 0 && connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+                    close(fd);
+                    fd = -1;
+                }
+            } else {
+                struct sockaddr_in addr;
+                memset(&addr, 0, sizeof(addr));
+                addr.sin_family = AF_INET;
+                addr.sin_port = htons((uint16_t) port);
+                addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                fd = socket(AF_INET, SOCK_STREAM, 0);
+                if (fd >= 0 && connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+                    close(fd);
+                    fd = -1;
+                }
+                if (fd >= 0) {
+                    int one = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                }
+            }
+            return fd >= 0;
+        }
+
+        /**
+         * Sends a batch. Blocks for acknowledgements if max_inflight batches
+         * are unacknowledged.
+         * @return false if the connection failed or the server refused the batch
+         */
+        bool send_batch(const created_edge<EdgeDataType> * edges, size_t n) {
+            assert(fd >= 0);
+            while (inflight >= max_inflight) {
+                if (!wait_ack()) return false;
+            }
+            const size_t recsize = 2 * sizeof(vid_t) + sizeof(EdgeDataType);
+            ingest_batch_header header;
+            header.magic = INGEST_MAGIC;
+            header.nedges = (uint32_t) n;
+            sendbuf.resize(sizeof(header) + n * recsize);
+            memcpy(&sendbuf[0], &header, sizeof(header));
+            char * r = &sendbuf[sizeof(header)];
+            for(size_t i=0; i < n; i++, r += recsize) {
+                memcpy(r, &edges[i].src, sizeof(vid_t));
+                memcpy(r + sizeof(vid_t), &edges[i].dst, sizeof(vid_t));
+                memcpy(r + 2 * sizeof(vid_t), &edges[i].data, sizeof(EdgeDataType));
+            }
+            if (!ingest_send_all(fd, &sendbuf[0], sendbuf.size())) return false;
+            inflight++;
+            return true;
+        }
+
+        /**
+         * Waits for all batches to be acknowledged.
+         */
+        bool flush() {
+            while (inflight > 0) {
+                if (!wait_ack()) return false;
+            }
+            return true;
+        }
+
+        const ingest_ack &last_ack() {
+            return lastack;
+        }
+
+        void disconnect() {
+            if (fd < 0) return;
+            flush();
+            close(fd);
+            fd = -1;
+        }
+
+    protected:
+
+        bool wait_ack() {
+            if (!ingest_recv_all(fd, &lastack, sizeof(lastack))) return false;
+            inflight--;
+            return lastack.magic == INGEST_MAGIC && lastack.status == INGEST_OK;
+        }
+    };
+
+}
+
+#endif
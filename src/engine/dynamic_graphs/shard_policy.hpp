@@ -0,0 +1,163 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Split and merge policy for the shards of the dynamic graph engine.
+ *
+ * Cost model: the memory shard of a shard holds all its live edges, so its
+ * footprint is about live edges * (sizeof(EdgeDataType) + sizeof(vid_t)).
+ * In an iteration every shard is read once as a memory shard and once through
+ * the sliding windows of the other intervals, and each of the nshards windows
+ * costs at least a block; so the I/O of an iteration is about
+ *    sum(2 * footprint) + nshards^2 * blocksize,
+ * and grows with the number of shards. The policy therefore keeps the number
+ * of shards as small as possible while the memory shards stay near the target size:
+ *  - a shard over shard_split_factor * shard_target_mb (or over maxshardsize_mb)
+ *    is split into the smallest number of parts that are at most the target;
+ *  - a run of neighboring shards is merged if one of them is under
+ *    shard_merge_factor * shard_target_mb and the result is at most the target.
+ * The gap between the factors keeps split shards from being merged back.
+ * At least two shards are kept, as a single shard would put the engine in
+ * the in-memory mode, which does not read the edge buffers.
+ */
+
+#ifndef DEF_GRAPHCHI_SHARD_POLICY
+#define DEF_GRAPHCHI_SHARD_POLICY
+
+#include <assert.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include "graphchi_types.hpp"
+#include "logger/logger.hpp"
+#include "util/cmdopts.hpp"
+
+namespace graphchi {
+
+    struct shard_stats {
+        size_t edges;      // Edges in the base and delta runs
+        size_t buffered;   // Edges in the buffers
+        size_t deleted;
+
+        shard_stats(size_t edges, size_t buffered, size_t deleted) : edges(edges), buffered(buffered), deleted(deleted) {}
+
+        size_t live_edges() const {
+            return edges + buffered - std::min(deleted, edges);
+        }
+    };
+
+    class shard_policy {
+
+        size_t bytes_per_edge;
+        size_t blocksize;
+        size_t target_bytes;
+        size_t max_bytes;
+        double split_factor;
+        double merge_factor;
+        int max_parts;
+
+    public:
+
+        /**
+         * @param maxshardsize hard limit of the shard size in bytes (maxshardsize_mb)
+         */
+        shard_policy(size_t bytes_per_edge, size_t blocksize, size_t maxshardsize) : bytes_per_edge(bytes_per_edge),
+        blocksize(blocksize), max_bytes(maxshardsize) {
+            target_bytes = (size_t) (get_option_float("shard_target_mb", maxshardsize / 1024.0f / 1024.0f / 2) * 1024 * 1024);
+            split_factor = get_option_float("shard_split_factor", 2.0f);
+            merge_factor = get_option_float("shard_merge_factor", 0.25f);
+            max_parts = get_option_int("shard_max_parts", 8);
+            target_bytes = std::max(target_bytes, (size_t) 1);
+            assert(split_factor >= 1.0 && merge_factor < 1.0 && max_parts >= 2);
+        }
+
+        size_t memshard_bytes(const shard_stats &s) const {
+            return s.live_edges() * bytes_per_edge;
+        }
+
+        /**
+         * Estimated bytes read by an iteration over the given shards.
+         */
+        double iteration_io_bytes(const std::vector<shard_stats> &shards) const {
+            double io = 0.0;
+            for(int p=0; p < (int)shards.size(); p++) {
+                io += 2.0 * memshard_bytes(shards[p]) + (double)shards.size() * blocksize;
+            }
+            return io;
+        }
+
+        /**
+         * Number of parts the shard should be split into, 1 if none.
+         */
+        int parts_for(const shard_stats &s) const {
+            size_t bytes = memshard_bytes(s);
+            if (bytes <= target_bytes * split_factor && bytes <= max_bytes) return 1;
+            int parts = (int) ceil(bytes * 1.0 / target_bytes);
+            return std::max(2, std::min(parts, max_parts));
+        }
+
+        /**
+         * Plans the shards of the next generation.
+         * @return for each shard the number of parts it is written as: k > 1 splits
+         *         the shard, 0 merges it to the preceding shard with a nonzero entry
+         */
+        std::vector<int> plan(const std::vector<shard_stats> &shards) const {
+            int nshards = (int) shards.size();
+            std::vector<int> parts(nshards, 1);
+            for(int p=0; p < nshards; p++) {
+                parts[p] = parts_for(shards[p]);
+            }
+            size_t small = (size_t) (target_bytes * merge_factor);
+            int total = 0;
+            for(int p=0; p < nshards; p++) total += parts[p];
+            for(int p=0; p < nshards; ) {
+                if (parts[p] != 1) {
+                    p++;
+                    continue;
+                }
+                size_t bytes = memshard_bytes(shards[p]);
+                size_t minbytes = bytes;
+                int q = p + 1;
+                while(q < nshards && parts[q] == 1 && total > 2 && bytes + memshard_bytes(shards[q]) <= target_bytes) {
+                    size_t b = memshard_bytes(shards[q]);
+                    if (std::min(minbytes, b) >= small) break;
+                    bytes += b;
+                    minbytes = std::min(minbytes, b);
+                    parts[q] = 0;
+                    total--;
+                    q++;
+                }
+                p = q;
+            }
+            return parts;
+        }
+
+        size_t target_size() const {
+            return target_bytes;
+        }
+    };
+
+}
+
+#endif
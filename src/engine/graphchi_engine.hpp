@@ -48,11 +48,15 @@
 #include "engine/auxdata/degree_data.hpp"
 #include "engine/auxdata/vertex_data.hpp"
 #include "engine/bitset_scheduler.hpp"
+#include "io/io_autotune.hpp"
 #include "io/stripedio.hpp"
 #include "logger/logger.hpp"
+#include "metrics/live_metrics.hpp"
 #include "metrics/metrics.hpp"
+#include "metrics/trace.hpp"
 #include "shards/memoryshard.hpp"
 #include "shards/slidingshard.hpp"
+#include "util/memory_tracker.hpp"
 #include "util/pthread_tools.hpp"
 #include "output/output.hpp"
 
@@ -103,6 +107,7 @@ namespace graphchi {
         bool initialize_edges_before_run;
         
         size_t blocksize;
+        size_t adj_readsize;
         int membudget_mb;
         int load_threads;
         int exec_threads;
@@ -122,6 +127,15 @@ namespace graphchi {
         bool reset_vertexdata;
         bool save_edgesfiles_after_inmemmode;
         
+        /* Previous publish of the live metrics, for the rates */
+        double live_published_time;
+        size_t live_published_updates;
+        
+        /* Progress and ETA, see api/progress.hpp */
+        engine_progress progress;
+        double progress_log_interval;
+        double progress_logged_time;
+        
         /* Outputs */
         std::vector<ioutput<VertexDataType, EdgeDataType> *> outputs;
         
@@ -134,6 +148,7 @@ namespace graphchi {
             logstream(LOG_INFO) << " load_threads = " << load_threads << std::endl;
             logstream(LOG_INFO) << " membudget_mb = " << membudget_mb << std::endl;
             logstream(LOG_INFO) << " blocksize = " << blocksize << std::endl;
+            logstream(LOG_INFO) << " adj_readsize = " << adj_readsize << std::endl;
             logstream(LOG_INFO) << " scheduler = " << use_selective_scheduling << std::endl;
         }
         
@@ -146,10 +161,9 @@ namespace graphchi {
          * @param selective_scheduling if true, uses selective scheduling 
          */
         graphchi_engine(std::string _base_filename, int _nshards, bool _selective_scheduling, metrics &_m) : base_filename(_base_filename), nshards(_nshards), use_selective_scheduling(_selective_scheduling), m(_m) {
-            /* Initialize IO */
-            m.start_time("iomgr_init");
-            iomgr = new stripedio(m);
-            m.stop_time("iomgr_init");
+            tracer::instance().configure();
+            tracer::instance().set_thread_name("engine");
+
 #ifndef DYNAMICEDATA
             logstream(LOG_INFO) << "Initializing graphchi_engine. This engine expects " << sizeof(EdgeDataType)
             << "-byte edge data. " << std::endl;
@@ -167,6 +181,16 @@ namespace graphchi {
                 }
             }
             
+            /* Choose the I/O parameters for the storage of the graph, see io_autotune.hpp */
+            if (get_option_int("autotune", 0) > 0) {
+                io_autotune(base_filename, graph_edata_bytes(), m).run();
+            }
+            
+            /* Initialize IO */
+            m.start_time("iomgr_init");
+            iomgr = new stripedio(m);
+            m.stop_time("iomgr_init");
+            
             /* Initialize a plenty of fields */
             memoryshard = NULL;
             modifies_outedges = true;
@@ -181,6 +205,7 @@ namespace graphchi {
 #ifndef DYNAMICEDATA
             while (blocksize % sizeof(EdgeDataType) != 0) blocksize++;
 #endif
+            adj_readsize = get_option_long("io.blocksize", blocksize);
             
             disable_vertexdata_storage = false;
 
@@ -197,6 +222,10 @@ namespace graphchi {
             load_threads = get_option_int("loadthreads", 2);
             exec_threads = get_option_int("execthreads", omp_get_max_threads());
             maxwindow = 40000000;
+            live_published_time = 0;
+            live_published_updates = 0;
+            progress_log_interval = get_option_float("progress_log_interval", 30.0f);
+            progress_logged_time = 0;
 
             /* Load graph shard interval information */
             _load_vertex_intervals();
@@ -234,6 +263,23 @@ namespace graphchi {
         
         
             
+        /**
+         * Size of the edge data of all shards, for sizing the block cache.
+         */
+        size_t graph_edata_bytes() {
+            size_t total = 0;
+            for(int p=0; p < nshards; p++) {
+#ifndef DYNAMICEDATA
+                std::string fname = filename_shard_edata<EdgeDataType>(base_filename, p, nshards);
+                if (file_exists(fname + ".size")) total += get_shard_edata_filesize<EdgeDataType>(fname);
+#else
+                std::string fname = filename_shard_edata<int>(base_filename, p, nshards);
+                if (file_exists(fname + ".size")) total += get_shard_edata_filesize<int>(fname);
+#endif
+            }
+            return total;
+        }
+        
         /**
          * Try to find suitable shards by trying with different
          * shard numbers. Looks up to shard number 2000.
@@ -276,6 +322,8 @@ namespace graphchi {
                                                             m, 
                                                             !modifies_outedges, 
                                                             only_adjacency));
+                sliding_shards.back()->set_shard_id(p);
+                sliding_shards.back()->set_adj_readsize(adj_readsize);
                 if (!only_adjacency) 
                     nedges += sliding_shards[sliding_shards.size() - 1]->num_edges();
             }
@@ -323,7 +371,7 @@ namespace graphchi {
                     memreq += sizeof(svertex_t) + (sizeof(EdgeDataType) + sizeof(vid_t) + sizeof(graphchi_edge<EdgeDataType>))*(outc + inc);
                     if (memreq > membudget) {
                         logstream(LOG_DEBUG) << "Memory budget exceeded with " << memreq << " bytes." << std::endl;
-                        return fromvid + i - 1;  // Previous was enough
+                        return (i == 0 ? fromvid : fromvid + i - 1);  // Previous was enough, but take at least one vertex
                     }
                 }
                 return maxvid;
@@ -509,6 +557,9 @@ namespace graphchi {
                 m.start_time("inmem-exec");
                 
                 exec_updates(userprogram, vertices);
+#ifdef SUPPORT_DELETIONS
+                record_removed_edges(vertices);
+#endif
                 
                 m.stop_time("inmem-exec");
                 
@@ -538,6 +589,7 @@ namespace graphchi {
             
             /* Allocate edge buffer */
             edata = (graphchi_edge<EdgeDataType>*) malloc(num_edges * sizeof(graphchi_edge<EdgeDataType>));
+            memory_tracker::instance().track(MEM_VERTICES, edata, num_edges * sizeof(graphchi_edge<EdgeDataType>));
             
             /* Assign vertex edge array pointers */
             size_t ecounter = 0;
@@ -590,6 +642,43 @@ namespace graphchi {
             // Do nothing.
         }   
         
+#ifdef SUPPORT_DELETIONS
+        /**
+         * Records the edges removed by the update functions in the deletion
+         * bitmaps of the shards that store them. The edge values are still
+         * in memory, so the value pointers identify the shards.
+         */
+        virtual void record_removed_edges(std::vector<svertex_t> &vertices) {
+            metrics_entry me = m.start_time();
+            size_t nremoved = 0;
+#pragma omp parallel for schedule(dynamic, 1024) reduction(+:nremoved)
+            for(int i=0; i < (int)vertices.size(); i++) {
+                svertex_t &v = vertices[i];
+                if (!v.scheduled || !v.edges_removed) continue;
+                for(int j=0; j < v.num_edges(); j++) {
+                    graphchi_edge<EdgeDataType> * e = v.edge(j);
+                    if (e->is_deleted() && e->data_ptr != NULL) {
+                        if (mark_edge_deleted(e->data_ptr)) nremoved++;
+                    }
+                }
+            }
+            m.add("removed_edges", (double) nremoved);
+            m.stop_time(me, "record_removed_edges");
+        }
+        
+        /**
+         * Marks the edge with value at ptr deleted in the shard that stores it.
+         * @return false if the value is not in any shard
+         */
+        virtual bool mark_edge_deleted(EdgeDataType * ptr) {
+            if (memoryshard->mark_deleted(ptr)) return true;
+            for(int p=0; p < nshards; p++) {
+                if (p != exec_interval && sliding_shards[p]->mark_deleted(ptr)) return true;
+            }
+            return false;
+        }
+#endif
+        
         virtual void write_delta_log() {
             // Write delta log
             std::string deltafname = iomgr->multiplexprefix(0) + base_filename + ".deltalog";
@@ -720,6 +809,7 @@ namespace graphchi {
             if (degree_handler == NULL)
                 degree_handler = create_degree_handler();
             iomgr->set_cache_budget(get_option_long("cachesize_mb", 0) * 1024L * 1024L);
+            memory_tracker::instance().set_budget(size_t(membudget_mb) * 1024 * 1024);
 
             m.set("cachesize_mb", get_option_int("cachesize_mb", 0));
             m.set("membudget_mb", get_option_int("membudget_mb", 0));
@@ -775,9 +865,15 @@ namespace graphchi {
             print_config();
             
             
+            progress.reset(niters, nshards, only_adjacency ? 0 : num_edges());
+            chicontext.progress = &progress;
+            
             /* Main loop */
             for(iter=0; iter < niters; iter++) {
+                TRACE_SCOPE("iteration", "engine");
                 logstream(LOG_INFO) << "Start iteration: " << iter << std::endl;
+                iomgr->get_io_accounting().begin_iteration(iter);
+                progress.begin_iteration(iter, niters, nshards, only_adjacency ? 0 : num_edges());
                 
                 initialize_iter();
                 
@@ -823,6 +919,7 @@ namespace graphchi {
                 
                 /* Interval loop */
                 for(int interval_idx=0; interval_idx < nshards; ++interval_idx) {
+                    TRACE_SCOPE("interval", "engine");
                     exec_interval = interval_idx;
                     
                     if (randomization && iter > 0) { // NOTE: only randomize shard order after first iteration so we can compute indices
@@ -840,7 +937,11 @@ namespace graphchi {
                     vid_t interval_st = get_interval_start(exec_interval);
                     vid_t interval_en = get_interval_end(exec_interval);
                     
-                    if (interval_st > interval_en) continue; // Can happen on very very small graphs.
+                    if (interval_st > interval_en) { // Can happen on very very small graphs.
+                        progress.interval_done();
+                        continue;
+                    }
+                    size_t interval_work_start = work;
 
                     if (!is_inmemory_mode())
                         userprogram.before_exec_interval(interval_st, interval_en, chicontext);
@@ -854,19 +955,25 @@ namespace graphchi {
                     memoryshard = create_memshard(interval_st, interval_en);
                     memoryshard->only_adjacency = only_adjacency;
                     memoryshard->set_disable_async_writes(randomization);
+                    memoryshard->set_shard_id(exec_interval);
+#ifdef SUPPORT_DELETIONS
+                    memoryshard->set_deletion_bitmap(sliding_shards[exec_interval]->get_deletion_bitmap());
+#endif
                     
                     sub_interval_st = interval_st;
                     logstream(LOG_INFO) << chicontext.runtime() << "s: Starting: " 
                     << sub_interval_st << " -- " << interval_en << std::endl;
                     
                     while (sub_interval_st <= interval_en) {
+                        TRACE_SCOPE("subinterval", "engine");
                         
                         modification_lock.lock();
                         /* Determine the sub interval */
                         sub_interval_en = determine_next_window(exec_interval,
                                                                 sub_interval_st, 
                                                                 std::min(interval_en, (is_inmemory_mode() ? interval_en : sub_interval_st + maxwindow)), 
-                                                                size_t(membudget_mb) * 1024 * 1024);
+                                                                memory_tracker::instance().window_budget(size_t(membudget_mb) * 1024 * 1024,
+                                                                                                         size_t(membudget_mb) * 1024 * 1024 / 10));
                         assert(sub_interval_en >= sub_interval_st);
                         
                         logstream(LOG_INFO) << "Iteration " << iter << "/" << (niters - 1) << ", subinterval: " << sub_interval_st << " - " << sub_interval_en << std::endl;
@@ -874,6 +981,7 @@ namespace graphchi {
                         bool any_vertex_scheduled = is_any_vertex_scheduled(sub_interval_st, sub_interval_en);
                         if (!any_vertex_scheduled) {
                             logstream(LOG_INFO) << "No vertices scheduled, skip." << std::endl;
+                            progress.subinterval_done((sub_interval_en - interval_st + 1) / (double) (interval_en - interval_st + 1), 0);
                             sub_interval_st = sub_interval_en + 1;
                             modification_lock.unlock();
                             continue;
@@ -886,42 +994,68 @@ namespace graphchi {
                         std::vector<svertex_t> vertices(nvertices, svertex_t());
                         logstream(LOG_DEBUG) << "Allocation " << nvertices << " vertices, sizeof:" << sizeof(svertex_t)
                         << " total:" << nvertices * sizeof(svertex_t) << std::endl;
+                        memory_tracker::instance().allocated(MEM_VERTICES, nvertices * sizeof(svertex_t));
+                        size_t window_work_start = work;
+                        double phase_start = chicontext.runtime();
                         init_vertices(vertices, edata);
+                        size_t window_edges = work - window_work_start;
                         
                         /* Load data */
-                        load_before_updates(vertices);                        
+                        {
+                            TRACE_SCOPE("load_before_updates", "engine");
+                            load_before_updates(vertices);
+                        }
+                        end_memory_phase("load");
+                        progress.record_phase(PHASE_LOAD, window_edges, chicontext.runtime() - phase_start);
                         
                         modification_lock.unlock();
                         
                         logstream(LOG_INFO) << "Start updates" << std::endl;
+                        phase_start = chicontext.runtime();
                         /* Execute updates */
                         if (!is_inmemory_mode()) {
+                            TRACE_SCOPE("exec_updates", "engine");
                             exec_updates(userprogram, vertices);
+#ifdef SUPPORT_DELETIONS
+                            record_removed_edges(vertices);
+#endif
                             /* Load phase after updates (used by the functional engine) */
                             load_after_updates(vertices);
                         } else {
-
+                            TRACE_SCOPE("exec_updates", "engine");
                             exec_updates_inmemory_mode(userprogram, vertices); 
                         }
                         logstream(LOG_INFO) << "Finished updates" << std::endl;
-                        
+                        end_memory_phase("updates");
+                        progress.record_phase(PHASE_UPDATES, window_edges, chicontext.runtime() - phase_start);
                         
                         /* Save vertices */
                         if (!disable_vertexdata_storage) {
+                            TRACE_SCOPE("save_vertices", "engine");
+                            phase_start = chicontext.runtime();
                             save_vertices(vertices);
+                            progress.record_phase(PHASE_SAVE, window_edges, chicontext.runtime() - phase_start);
                         }
+                        progress.subinterval_done((sub_interval_en - interval_st + 1) / (double) (interval_en - interval_st + 1), window_edges);
                         sub_interval_st = sub_interval_en + 1;
                         
                         /* Delete edge buffer. TODO: reuse. */
                         if (edata != NULL) {
+                            memory_tracker::instance().untrack(edata);
                             delete edata;
                             edata = NULL;
                         }
+                        memory_tracker::instance().released(MEM_VERTICES, nvertices * sizeof(svertex_t));
+                        publish_live_metrics();
+                        log_progress();
                        
                     } // while subintervals
 
                     if (memoryshard->loaded() && (save_edgesfiles_after_inmemmode || !is_inmemory_mode())) {
+                        TRACE_SCOPE("interval_commit", "engine");
+                        double commit_start = chicontext.runtime();
                         memoryshard->commit(modifies_inedges, modifies_outedges & !disable_outedges);
+                        progress.record_phase(PHASE_COMMIT, work - interval_work_start, chicontext.runtime() - commit_start);
                         
                         if (!randomization) {
                             sliding_shards[exec_interval]->set_offset(memoryshard->offset_for_stream_cont(), memoryshard->offset_vid_for_stream_cont(),
@@ -929,9 +1063,11 @@ namespace graphchi {
                         }
                         delete memoryshard;
                         memoryshard = NULL;
+                        end_memory_phase("commit");
                     }     
                     if (!is_inmemory_mode())
                         userprogram.after_exec_interval(interval_st, interval_en, chicontext);
+                    progress.interval_done();
 
                 } // For exec_interval
                 
@@ -944,10 +1080,26 @@ namespace graphchi {
                     sliding_shards[p]->flush();
                     sliding_shards[p]->set_offset(0, 0, 0);
                 }
-                iomgr->wait_for_writes();
+                {
+                    TRACE_SCOPE("wait_for_writes", "io");
+                    iomgr->wait_for_writes();
+                }
+                iomgr->get_io_accounting().end_iteration(m, only_adjacency ? 0 : num_edges() * (sizeof(EdgeDataType) + sizeof(vid_t)));
+                enforce_memory_budget();
+                publish_live_metrics();
                 
                 /* Write progress log */
                 write_delta_log();
+                progress.end_iteration();
+                
+#if defined(DYNAMICEDATA) || defined(DYNAMICVERTEXDATA)
+                /* Allocations of the grown chivectors, counted when their blocks are released */
+                extension_pool_stats &poolstats = get_extension_pool_stats();
+                m.set("chivector.extension_allocations", (size_t) poolstats.allocations);
+                m.set("chivector.extension_bytes", (size_t) poolstats.bytes);
+                m.set("chivector.arena_bytes", (size_t) poolstats.arena_bytes);
+                m.set("chivector.pools_released", (size_t) poolstats.pools);
+#endif
                 
                 /* Check if user has defined a last iteration */
                 if (chicontext.last_iteration >= 0) {
@@ -959,6 +1111,7 @@ namespace graphchi {
             } // Iterations
             
             m.stop_time("runtime");
+            tracer::instance().write();
             
             m.set("updates", nupdates);
             m.set("work", work);
@@ -991,6 +1144,56 @@ namespace graphchi {
             }
         }
         
+        /**
+         * Whether the block cache can be shrunk at the end of an iteration
+         * when the engine is over its memory budget.
+         */
+        virtual bool can_shrink_cache() {
+            return true;
+        }
+
+        /**
+         * Records the peak memory of a phase, the maximum over the
+         * sub-intervals of the iteration, and starts the next phase.
+         */
+        void end_memory_phase(std::string phase) {
+            std::string key = "memory.peak_mb." + phase;
+            double peakmb = memory_tracker::instance().end_phase() / 1024.0 / 1024.0;
+            if (m.has(key)) {
+                metrics_entry e = m.get(key);
+                if ((int)e.v.size() > iter) peakmb = std::max(peakmb, e.v[iter]);
+            }
+            m.set_vector_entry(key, iter, peakmb);
+        }
+
+        /**
+         * Keeps the memory within membudget_mb: if the tracked memory is over
+         * the budget after an iteration, the block cache gives up the excess.
+         * When the memory is back under the budget, the cache budget is restored.
+         * The windows are sized by the remaining budget (see determine_next_window()).
+         */
+        virtual void enforce_memory_budget() {
+            memory_tracker &mt = memory_tracker::instance();
+            if (mt.over_budget() && can_shrink_cache()) {
+                size_t excess = mt.total_bytes() - mt.get_budget();
+                size_t freed = iomgr->shrink_cache(excess);
+                if (freed > 0) {
+                    logstream(LOG_INFO) << "Over memory budget by " << excess / 1024 / 1024 << " MB, shrunk block cache by "
+                        << freed / 1024 / 1024 << " MB." << std::endl;
+                    m.add("memory.cache_shrunk_mb", freed / 1024.0 / 1024.0);
+                }
+            } else if (!mt.over_budget()) {
+                iomgr->restore_cache_budget();
+            }
+            for(int c=0; c < MEM_NCOMPONENTS; c++) {
+                if (mt.peak_bytes(c) > 0) {
+                    m.set(std::string("memory.") + memory_tracker::component_name(c) + ".peak_mb", mt.peak_bytes(c) / 1024.0 / 1024.0);
+                }
+            }
+            m.set("memory.total_peak_mb", mt.total_peak_bytes() / 1024.0 / 1024.0);
+            m.set("memory.rss_mb", memory_tracker::rss_bytes() / 1024.0 / 1024.0);
+        }
+
         virtual void iteration_finished() {
             // Do nothing
         }
@@ -1185,6 +1388,7 @@ namespace graphchi {
             json << "\"interval\":" << exec_interval << ",\n";
             json << "\"windowStart\":" << sub_interval_st << ",";
             json << "\"windowEnd\": " << sub_interval_en << ",";
+            json << "\"progress\": " << progress.to_json() << ",\n";
             json << "\"shards\": [";
             
             for(int p=0; p < (int)nshards; p++) {
@@ -1201,6 +1405,92 @@ namespace graphchi {
             return json.str();
         }
         
+        /**
+         * Progress and ETA of the run, see api/progress.hpp.
+         */
+        engine_progress &get_progress() {
+            return progress;
+        }
+        
+        /**
+         * Publishes the live metrics served by the HTTP admin at /metrics.
+         */
+        void publish_live_metrics() {
+            live_metrics &lm = live_metrics::instance();
+            lm.begin();
+            add_live_metrics(lm);
+            lm.commit();
+        }
+        
+        /**
+         * Logs a progress line every progress_log_interval seconds (0 disables).
+         */
+        void log_progress() {
+            if (progress_log_interval <= 0) return;
+            double now = chicontext.runtime();
+            if (now - progress_logged_time < progress_log_interval) return;
+            progress_logged_time = now;
+            logstream(LOG_INFO) << "Progress: " << progress.summary() << std::endl;
+        }
+        
+    protected:
+        
+        /**
+         * Adds the samples of the live metrics. Engines that extend this
+         * should call the parent first.
+         */
+        virtual void add_live_metrics(live_metrics &lm) {
+            double now = chicontext.runtime();
+            double rate = 0.0;
+            if (now > live_published_time && nupdates >= live_published_updates) {
+                rate = (nupdates - live_published_updates) / (now - live_published_time);
+            }
+            live_published_time = now;
+            live_published_updates = nupdates;
+            
+            lm.add("graphchi_runtime_seconds", now, LIVE_GAUGE, "Time since the engine started.");
+            lm.add("graphchi_iteration", chicontext.iteration, LIVE_GAUGE, "Current iteration.");
+            lm.add("graphchi_iterations", chicontext.num_iterations, LIVE_GAUGE, "Number of iterations to run.");
+            lm.add("graphchi_interval", exec_interval, LIVE_GAUGE, "Current execution interval (shard).");
+            lm.add("graphchi_window_start", sub_interval_st, LIVE_GAUGE, "First vertex of the current sub-interval.");
+            lm.add("graphchi_window_end", sub_interval_en, LIVE_GAUGE, "Last vertex of the current sub-interval.");
+            lm.add("graphchi_updates_total", (double) nupdates, LIVE_COUNTER, "Vertex updates executed.");
+            lm.add("graphchi_updates_per_second", rate, LIVE_GAUGE, "Vertex updates per second since the previous publish.");
+            lm.add("graphchi_edges_processed_total", (double) work, LIVE_COUNTER, "Edges of the updated vertices.");
+            lm.add("graphchi_progress_ratio", progress.iteration_fraction(), LIVE_GAUGE, "Fraction of the current iteration done.", "scope=\"iteration\"");
+            lm.add("graphchi_progress_ratio", progress.run_fraction(), LIVE_GAUGE, "", "scope=\"run\"");
+            lm.add("graphchi_eta_seconds", progress.eta_iteration(), LIVE_GAUGE, "Estimated time to finish, -1 if not known yet.", "scope=\"iteration\"");
+            lm.add("graphchi_eta_seconds", progress.eta_run(), LIVE_GAUGE, "", "scope=\"run\"");
+            for(int p=0; p < PHASE_NPHASES; p++) {
+                lm.add("graphchi_phase_edges_per_second", progress.phase_throughput(p), LIVE_GAUGE,
+                       "Moving average of the edges per second of each phase.", std::string("phase=\"") + engine_progress::phase_name(p) + "\"");
+            }
+            
+            io_accounting &acc = iomgr->get_io_accounting();
+            io_counters total = acc.totals();
+            for(int c=0; c < IO_NCATEGORIES; c++) {
+                io_counters ct = acc.category_totals(c);
+                lm.add("graphchi_io_read_bytes_total", (double) ct.disk_bytes_read, LIVE_COUNTER,
+                       "Bytes read from the disk.", std::string("category=\"") + io_accounting::category_name(c) + "\"");
+            }
+            for(int c=0; c < IO_NCATEGORIES; c++) {
+                io_counters ct = acc.category_totals(c);
+                lm.add("graphchi_io_written_bytes_total", (double) ct.disk_bytes_written, LIVE_COUNTER,
+                       "Bytes written to the disk.", std::string("category=\"") + io_accounting::category_name(c) + "\"");
+            }
+            lm.add("graphchi_cache_hit_bytes_total", (double) total.cache_hit_bytes, LIVE_COUNTER, "Bytes served from the block cache.");
+            size_t requested = total.cache_hit_bytes + total.bytes_read;
+            lm.add("graphchi_cache_hit_ratio", (requested == 0 ? 0.0 : total.cache_hit_bytes / (double) requested), LIVE_GAUGE,
+                   "Share of the bytes read that were served from the block cache.");
+            
+            memory_tracker &mt = memory_tracker::instance();
+            for(int c=0; c < MEM_NCOMPONENTS; c++) {
+                lm.add("graphchi_memory_bytes", (double) mt.live_bytes(c), LIVE_GAUGE, "Tracked live memory by component.",
+                       std::string("component=\"") + memory_tracker::component_name(c) + "\"");
+            }
+            lm.add("graphchi_memory_budget_bytes", (double) mt.get_budget(), LIVE_GAUGE, "Memory budget (membudget_mb).");
+        }
+        
     };
     
     
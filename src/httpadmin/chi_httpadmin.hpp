@@ -17,12 +17,27 @@
 #include <string>
 
 #include "external/vpiotr-mongoose-cpp/mongoose.h"
+#include "metrics/live_metrics.hpp"
 
+/* mongoose.c sets its own feature macros, and is not warning-clean as C++ */
+#undef _XOPEN_SOURCE
+#undef _LARGEFILE_SOURCE
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wregister"
+#pragma GCC diagnostic ignored "-Wunused-but-set-variable"
 extern "C" {
 #include "external/vpiotr-mongoose-cpp/mongoose.c"
 }
+#pragma GCC diagnostic pop
+
 namespace graphchi {
     
+#ifdef __GNUC__
+#define VARIABLE_IS_NOT_USED __attribute__ ((unused))
+#else
+#define VARIABLE_IS_NOT_USED
+#endif
+    
     class custom_request_handler {
         
         public:
@@ -32,7 +47,7 @@ namespace graphchi {
     
     static std::vector<custom_request_handler *> reqhandlers;
     
-    static void register_http_request_handler(custom_request_handler * rh) {
+    static void VARIABLE_IS_NOT_USED register_http_request_handler(custom_request_handler * rh) {
         reqhandlers.push_back(rh);
     }
     
@@ -43,6 +58,12 @@ namespace graphchi {
     "Content-Type: application/x-javascript\r\n"
     "\r\n";
     
+    static const char *prometheus_reply_start =
+    "HTTP/1.1 200 OK\r\n"
+    "Cache: no-cache\r\n"
+    "Content-Type: text/plain; version=0.0.4\r\n"
+    "\r\n";
+    
     static const char *options[] = {
         "document_root", "conf/adminhtml",
         "listening_ports", "3333",
@@ -95,6 +116,16 @@ namespace graphchi {
 
     }
     
+    /**
+      * Serves the live metrics in the Prometheus text format. Reads the
+      * published snapshot only, so does not touch the engine.
+      */
+    static void send_prometheus_metrics(struct mg_connection *conn) {
+        std::string text = live_metrics::instance().prometheus_text();
+        mg_printf(conn, "%s", prometheus_reply_start);
+        mg_write(conn, text.c_str(), text.size());
+    }
+    
     template <typename ENGINE>
     static void ajax_send_message(struct mg_connection *conn,
                                   const struct mg_request_info *request_info) {        
@@ -116,6 +147,8 @@ namespace graphchi {
         if (event == MG_NEW_REQUEST) {
             if (strcmp(request_info->uri, "/ajax/getinfo") == 0) {
                 ajax_send_message<ENGINE>(conn, request_info);
+            } else if (strcmp(request_info->uri, "/metrics") == 0) {
+                send_prometheus_metrics(conn);
             } else {
                 bool found = false;
                 for(std::vector<custom_request_handler *>::iterator it=reqhandlers.begin();
@@ -0,0 +1,248 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Accounting of the bytes moved by the I/O manager. Each session of stripedio
+ * is tagged with a category (adjacency, edge data, vertex data, degrees) and
+ * the shard it belongs to, and each read, write and block cache hit is
+ * counted to its tag. Both the logical (uncompressed) bytes and the bytes
+ * on disk (compressed) are counted.
+ *
+ * The engine closes the accounting of each iteration with end_iteration(),
+ * which writes per-category totals of the iteration into metrics as vectors
+ * indexed by the iteration, and the ratio of the bytes moved to the size
+ * of the graph. With the option io_stats_file, the per-shard table of
+ * each iteration is appended to the file as tab-separated rows.
+ *
+ * Reads and writes through memory mapped files (option mmap) are not counted.
+ */
+
+#ifndef DEF_GRAPHCHI_IO_ACCOUNTING
+#define DEF_GRAPHCHI_IO_ACCOUNTING
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "logger/logger.hpp"
+#include "metrics/metrics.hpp"
+#include "util/cmdopts.hpp"
+
+#define IO_ACCOUNTING_MAX_SHARDS 1024  // Shards over this, and untagged sessions, are counted together
+
+namespace graphchi {
+
+    enum io_category {
+        IO_ADJ, IO_EDATA, IO_VERTEXDATA, IO_DEGREE, IO_OTHER,
+        IO_NCATEGORIES
+    };
+
+    struct io_tag {
+        int category;
+        int shard;   // -1 if the data does not belong to a shard
+
+        io_tag(int category = IO_OTHER, int shard = -1) : category(category), shard(shard) {}
+    };
+
+    struct io_counters {
+        size_t bytes_read;
+        size_t disk_bytes_read;
+        size_t bytes_written;
+        size_t disk_bytes_written;
+        size_t cache_hit_bytes;
+        size_t reads;
+        size_t writes;
+    };
+
+    class io_accounting {
+
+        std::vector<io_counters> counters;   // [category][shard], the last shard slot for the rest
+        std::vector<io_counters> iteration_start;
+        int iteration;
+        std::string statsfile;
+
+        inline io_counters &slot(const io_tag &tag) {
+            int shard = (tag.shard < 0 || tag.shard >= IO_ACCOUNTING_MAX_SHARDS ? IO_ACCOUNTING_MAX_SHARDS : tag.shard);
+            return counters[tag.category * (IO_ACCOUNTING_MAX_SHARDS + 1) + shard];
+        }
+
+        static void add_delta(io_counters &total, const io_counters &end, const io_counters &start) {
+            total.bytes_read += end.bytes_read - start.bytes_read;
+            total.disk_bytes_read += end.disk_bytes_read - start.disk_bytes_read;
+            total.bytes_written += end.bytes_written - start.bytes_written;
+            total.disk_bytes_written += end.disk_bytes_written - start.disk_bytes_written;
+            total.cache_hit_bytes += end.cache_hit_bytes - start.cache_hit_bytes;
+            total.reads += end.reads - start.reads;
+            total.writes += end.writes - start.writes;
+        }
+
+    public:
+
+        io_accounting() : iteration(0) {
+            io_counters zero;
+            memset(&zero, 0, sizeof(zero));
+            counters.resize(IO_NCATEGORIES * (IO_ACCOUNTING_MAX_SHARDS + 1), zero);
+            iteration_start = counters;
+            statsfile = get_option_string("io_stats_file", "");
+        }
+
+        static const char * category_name(int category) {
+            switch(category) {
+                case IO_ADJ: return "adj";
+                case IO_EDATA: return "edata";
+                case IO_VERTEXDATA: return "vertexdata";
+                case IO_DEGREE: return "degree";
+                case IO_OTHER: return "other";
+            }
+            return "unknown";
+        }
+
+        /**
+         * Counts a read. Thread-safe.
+         * @param nbytes uncompressed bytes
+         * @param diskbytes bytes read from the disk
+         */
+        inline void record_read(const io_tag &tag, size_t nbytes, size_t diskbytes) {
+            io_counters &c = slot(tag);
+            __sync_add_and_fetch(&c.bytes_read, nbytes);
+            __sync_add_and_fetch(&c.disk_bytes_read, diskbytes);
+            __sync_add_and_fetch(&c.reads, 1);
+        }
+
+        inline void record_write(const io_tag &tag, size_t nbytes, size_t diskbytes) {
+            io_counters &c = slot(tag);
+            __sync_add_and_fetch(&c.bytes_written, nbytes);
+            __sync_add_and_fetch(&c.disk_bytes_written, diskbytes);
+            __sync_add_and_fetch(&c.writes, 1);
+        }
+
+        /**
+         * Counts a block that was found in the block cache instead of read.
+         */
+        inline void record_cache_hit(const io_tag &tag, size_t nbytes) {
+            __sync_add_and_fetch(&slot(tag).cache_hit_bytes, nbytes);
+        }
+
+        /**
+         * Totals over all tags since the start. Counters are read without
+         * synchronization, so concurrent I/O may be partially included.
+         */
+        io_counters totals() {
+            io_counters total, zero;
+            memset(&total, 0, sizeof(total));
+            memset(&zero, 0, sizeof(zero));
+            for(size_t i=0; i < counters.size(); i++) {
+                add_delta(total, counters[i], zero);
+            }
+            return total;
+        }
+
+        /**
+         * Totals of a category since the start.
+         */
+        io_counters category_totals(int category) {
+            io_counters total, zero;
+            memset(&total, 0, sizeof(total));
+            memset(&zero, 0, sizeof(zero));
+            for(int p=0; p <= IO_ACCOUNTING_MAX_SHARDS; p++) {
+                add_delta(total, counters[category * (IO_ACCOUNTING_MAX_SHARDS + 1) + p], zero);
+            }
+            return total;
+        }
+
+        void begin_iteration(int iter) {
+            iteration = iter;
+            iteration_start = counters;
+        }
+
+        /**
+         * Aggregates the I/O since begin_iteration() into the metrics
+         * of the iteration.
+         * @param graph_bytes size of the graph, which the amplification is relative to
+         */
+        void end_iteration(metrics &m, size_t graph_bytes) {
+            io_counters total;
+            memset(&total, 0, sizeof(total));
+            std::vector<io_counters> bycategory(IO_NCATEGORIES, total);
+            std::vector<io_counters> delta(counters.size(), total);
+            for(size_t i=0; i < counters.size(); i++) {
+                add_delta(delta[i], counters[i], iteration_start[i]);
+                add_delta(bycategory[i / (IO_ACCOUNTING_MAX_SHARDS + 1)], counters[i], iteration_start[i]);
+                add_delta(total, counters[i], iteration_start[i]);
+            }
+
+            for(int c=0; c < IO_NCATEGORIES; c++) {
+                io_counters &ct = bycategory[c];
+                if (ct.reads + ct.writes + ct.cache_hit_bytes == 0) continue;
+                std::string prefix = std::string("io.") + category_name(c);
+                m.set_vector_entry(prefix + ".bytes_read", iteration, (double) ct.bytes_read);
+                m.set_vector_entry(prefix + ".disk_bytes_read", iteration, (double) ct.disk_bytes_read);
+                m.set_vector_entry(prefix + ".bytes_written", iteration, (double) ct.bytes_written);
+                m.set_vector_entry(prefix + ".disk_bytes_written", iteration, (double) ct.disk_bytes_written);
+                m.set_vector_entry(prefix + ".cache_hit_bytes", iteration, (double) ct.cache_hit_bytes);
+            }
+            m.set_vector_entry("io.disk_bytes_read", iteration, (double) total.disk_bytes_read);
+            m.set_vector_entry("io.disk_bytes_written", iteration, (double) total.disk_bytes_written);
+            if (graph_bytes > 0) {
+                double read_amplification = total.disk_bytes_read / (double) graph_bytes;
+                double amplification = (total.disk_bytes_read + total.disk_bytes_written) / (double) graph_bytes;
+                m.set_vector_entry("io.read_amplification", iteration, read_amplification);
+                m.set_vector_entry("io.amplification", iteration, amplification);
+                logstream(LOG_INFO) << "I/O of iteration " << iteration << ": read " << total.disk_bytes_read / 1024.0 / 1024.0
+                    << " MB (" << total.bytes_read / 1024.0 / 1024.0 << " MB uncompressed, "
+                    << total.cache_hit_bytes / 1024.0 / 1024.0 << " MB from cache), wrote "
+                    << total.disk_bytes_written / 1024.0 / 1024.0 << " MB, amplification " << amplification << std::endl;
+            }
+
+            if (!statsfile.empty()) {
+                FILE * f = fopen(statsfile.c_str(), (iteration == 0 ? "w" : "a"));
+                if (f == NULL) {
+                    logstream(LOG_ERROR) << "Could not write I/O statistics: " << statsfile << std::endl;
+                    return;
+                }
+                if (iteration == 0) {
+                    fprintf(f, "iteration\tcategory\tshard\tbytes_read\tdisk_bytes_read\tbytes_written\tdisk_bytes_written\tcache_hit_bytes\treads\twrites\n");
+                }
+                for(size_t i=0; i < delta.size(); i++) {
+                    io_counters &d = delta[i];
+                    if (d.reads + d.writes + d.cache_hit_bytes == 0) continue;
+                    int shard = (int) (i % (IO_ACCOUNTING_MAX_SHARDS + 1));
+                    fprintf(f, "%d\t%s\t%d\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\n", iteration,
+                            category_name((int) (i / (IO_ACCOUNTING_MAX_SHARDS + 1))),
+                            (shard == IO_ACCOUNTING_MAX_SHARDS ? -1 : shard),
+                            (unsigned long long) d.bytes_read, (unsigned long long) d.disk_bytes_read,
+                            (unsigned long long) d.bytes_written, (unsigned long long) d.disk_bytes_written,
+                            (unsigned long long) d.cache_hit_bytes, (unsigned long long) d.reads,
+                            (unsigned long long) d.writes);
+                }
+                fclose(f);
+            }
+        }
+    };
+
+}
+
+#endif
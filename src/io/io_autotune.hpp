@@ -0,0 +1,438 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Auto-tuning of the I/O parameters (option autotune). At startup the engine
+ * briefly measures the storage of the graph: sequential read bandwidth with
+ * a few request sizes and random read bandwidth with a few thread counts in
+ * each multiplex directory, the speed of decompressing edge data blocks, and
+ * the number of cores. From these it chooses
+ *
+ *   io.blocksize  the smallest read size that gets 90% of the best sequential bandwidth,
+ *   niothreads    the fewest I/O threads that get 90% of the best random read bandwidth,
+ *   loadthreads   enough threads to decompress the blocks as fast as the disk reads them,
+ *   cachesize_mb  the edge data of the graph, if it fits in half of the free memory
+ *                 left over by membudget_mb.
+ *
+ * The profile is written next to the graph files (filename_iotune_profile())
+ * in the configuration file format, and later runs reuse it. With autotune 2
+ * the storage is measured again. Options given on the command line override
+ * the profile, and the profile overrides the configuration file.
+ *
+ * The block size of the edge data files is fixed when the graph is sharded,
+ * so io.blocksize only sets the size of the reads of the adjacency files.
+ */
+
+#ifndef DEF_GRAPHCHI_IO_AUTOTUNE
+#define DEF_GRAPHCHI_IO_AUTOTUNE
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <omp.h>
+#include <zlib.h>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "api/chifilenames.hpp"
+#include "logger/logger.hpp"
+#include "metrics/metrics.hpp"
+#include "util/cmdopts.hpp"
+#include "util/configfile.hpp"
+
+namespace graphchi {
+
+    struct io_profile {
+        /* Choices */
+        size_t blocksize;
+        int niothreads;
+        int loadthreads;
+        size_t cachesize_mb;
+
+        /* Measurements */
+        int ncores;
+        double seq_read_mbps;      // Slowest of the multiplex directories
+        double rand_read_mbps;
+        double decompress_mbps;    // Uncompressed bytes per second of one thread
+        size_t graph_edata_bytes;
+
+        io_profile() : blocksize(1024 * 1024), niothreads(1), loadthreads(2), cachesize_mb(0), ncores(1),
+        seq_read_mbps(0), rand_read_mbps(0), decompress_mbps(0), graph_edata_bytes(0) {}
+    };
+
+    class io_autotune {
+
+        std::string base_filename;
+        size_t graph_edata_bytes;
+        size_t testfile_bytes;
+        metrics &m;
+
+        static double now() {
+            timeval tv;
+            gettimeofday(&tv, NULL);
+            return tv.tv_sec + tv.tv_usec * 1e-6;
+        }
+
+        static std::string dirname_of(std::string filename) {
+            size_t slash = filename.find_last_of('/');
+            if (slash == std::string::npos) return "./";
+            return filename.substr(0, slash + 1);
+        }
+
+        /**
+         * Directories to measure: the multiplex directories if the I/O is
+         * multiplexed (see stripedio::multiplexprefix()), otherwise the
+         * directory of the graph.
+         */
+        std::vector<std::string> directories() {
+            std::vector<std::string> dirs;
+            int multiplex = get_option_int("multiplex", 1);
+            if (multiplex > 1) {
+                std::string root = get_option_string("multiplex_root", "<not-set>");
+                for(int i=0; i < multiplex; i++) {
+                    std::stringstream ss;
+                    ss << root << (i + 1) << "/" << dirname_of(base_filename);
+                    dirs.push_back(ss.str());
+                }
+            } else {
+                dirs.push_back(dirname_of(base_filename));
+            }
+            return dirs;
+        }
+
+        /* Drops the file from the page cache, so that the reads hit the disk.
+           Best effort: not all file systems support it. */
+        static void drop_cache(int fd) {
+            fsync(fd);
+#ifdef POSIX_FADV_DONTNEED
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+        }
+
+        bool write_testfile(std::string fname) {
+            int fd = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+            if (fd < 0) {
+                logstream(LOG_WARNING) << "Could not create " << fname << ": " << strerror(errno) << std::endl;
+                return false;
+            }
+            size_t chunk = 4 * 1024 * 1024;
+            char * buf = (char *) malloc(chunk);
+            for(size_t i=0; i < chunk; i++) buf[i] = (char) (i * 2654435761u >> 13);
+            bool ok = true;
+            for(size_t off=0; off < testfile_bytes && ok; off += chunk) {
+                ok = (write(fd, buf, chunk) == (ssize_t) chunk);
+            }
+            free(buf);
+            drop_cache(fd);
+            close(fd);
+            return ok;
+        }
+
+        /**
+         * Sequential read bandwidth (MB/s) of the file with reads of the given size.
+         */
+        double sequential_read(std::string fname, size_t readsize) {
+            int fd = open(fname.c_str(), O_RDONLY);
+            if (fd < 0) return 0;
+            drop_cache(fd);
+            char * buf = (char *) malloc(readsize);
+            double t0 = now();
+            size_t total = 0;
+            while(total < testfile_bytes) {
+                ssize_t a = pread(fd, buf, readsize, total);
+                if (a <= 0) break;
+                total += a;
+            }
+            double t = now() - t0;
+            free(buf);
+            close(fd);
+            return (t > 0 ? total / t / 1024.0 / 1024.0 : 0);
+        }
+
+        /**
+         * Bandwidth (MB/s) of block-sized reads at random offsets of the file,
+         * issued by the given number of threads.
+         */
+        double random_read(std::string fname, size_t readsize, int nthreads) {
+            size_t nblocks = testfile_bytes / readsize;
+            if (nblocks == 0) return 0;
+            int fd = open(fname.c_str(), O_RDONLY);
+            if (fd < 0) return 0;
+            drop_cache(fd);
+            int nreads = (int) std::min(nblocks, (size_t) 64);
+            size_t total = 0;
+            double t0 = now();
+#pragma omp parallel for num_threads(nthreads) reduction(+:total)
+            for(int i=0; i < nreads; i++) {
+                char * buf = (char *) malloc(readsize);
+                size_t blockid = (size_t) ((uint64_t) (i + 1) * 11400714819323198485ull % nblocks);
+                ssize_t a = pread(fd, buf, readsize, blockid * readsize);
+                if (a > 0) total += a;
+                free(buf);
+            }
+            double t = now() - t0;
+            close(fd);
+            return (t > 0 ? total / t / 1024.0 / 1024.0 : 0);
+        }
+
+        /**
+         * Speed (MB/s of uncompressed data) of inflating a 1 MB block of
+         * edge data, compressed the same way as the shards (write_compressed()).
+         */
+        static double decompression_speed() {
+            size_t len = 1024 * 1024;
+            unsigned char * data = (unsigned char *) malloc(len);
+            unsigned int * words = (unsigned int *) data;
+            uint64_t x = 88172645463325252ull;
+            for(size_t i=0; i < len / sizeof(unsigned int); i++) {
+                // Edge values with some repetition, like real edge data
+                x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+                words[i] = (unsigned int) (x % 1024);
+            }
+            uLongf clen = compressBound(len);
+            unsigned char * cdata = (unsigned char *) malloc(clen);
+            int ret = compress2(cdata, &clen, data, len, Z_BEST_SPEED);
+            assert(ret == Z_OK);
+            int rounds = 0;
+            double t0 = now();
+            double t = 0;
+            while(t < 0.1 || rounds < 4) {
+                uLongf outlen = len;
+                ret = uncompress(data, &outlen, cdata, clen);
+                assert(ret == Z_OK);
+                rounds++;
+                t = now() - t0;
+            }
+            free(data);
+            free(cdata);
+            return rounds * (len / 1024.0 / 1024.0) / t;
+        }
+
+        /* Smallest index whose value is within 90% of the best */
+        static int first_near_best(const std::vector<double> &values) {
+            double best = 0;
+            for(size_t i=0; i < values.size(); i++) best = std::max(best, values[i]);
+            for(size_t i=0; i < values.size(); i++) {
+                if (values[i] >= 0.9 * best) return (int) i;
+            }
+            return 0;
+        }
+
+        static size_t free_memory_mb() {
+            long pages = sysconf(_SC_AVPHYS_PAGES);
+            long pagesize = sysconf(_SC_PAGESIZE);
+            if (pages <= 0 || pagesize <= 0) return 0;
+            return (size_t) pages / 1024 * (size_t) pagesize / 1024;
+        }
+
+        /* Sets an option of the profile, unless it was given on the command line */
+        template <typename T>
+        void apply_option(const char * key, T value) {
+            if (is_cmdline_option(key)) {
+                logstream(LOG_INFO) << "Option " << key << " given on the command line, not using the tuned value " << value << std::endl;
+                return;
+            }
+            std::stringstream ss;
+            ss << value;
+            set_conf(key, ss.str());
+        }
+
+    public:
+
+        /**
+         * @param base_filename graph to tune for
+         * @param graph_edata_bytes size of the edge data of all shards, for the block cache
+         */
+        io_autotune(std::string base_filename, size_t graph_edata_bytes, metrics &_m) : base_filename(base_filename),
+        graph_edata_bytes(graph_edata_bytes), m(_m) {
+            testfile_bytes = get_option_long("autotune.testfile_mb", 64) * 1024 * 1024;
+        }
+
+        /**
+         * Measures the storage and chooses the parameters.
+         */
+        io_profile measure() {
+            io_profile p;
+            p.ncores = (int) sysconf(_SC_NPROCESSORS_ONLN);
+            if (p.ncores < 1) p.ncores = 1;
+            p.graph_edata_bytes = graph_edata_bytes;
+
+            size_t sizes[] = {256 * 1024, 512 * 1024, 1024 * 1024, 2 * 1024 * 1024, 4 * 1024 * 1024};
+            int nsizes = (int) (sizeof(sizes) / sizeof(size_t));
+            std::vector<int> threadcounts;
+            for(int t=1; t <= std::min(8, p.ncores); t *= 2) threadcounts.push_back(t);
+
+            /* Each directory is measured separately; the slowest one decides,
+               as the shards are striped over all of them. */
+            std::vector<double> seq(nsizes, 0.0);
+            std::vector<double> rnd(threadcounts.size(), 0.0);
+            std::vector<std::string> dirs = directories();
+            bool measured = false;
+            for(size_t d=0; d < dirs.size(); d++) {
+                std::string fname = dirs[d] + ".graphchi_iotune.tmp";
+                if (!write_testfile(fname)) {
+                    unlink(fname.c_str());
+                    continue;
+                }
+                for(int i=0; i < nsizes; i++) {
+                    double mbps = sequential_read(fname, sizes[i]);
+                    seq[i] = (measured ? std::min(seq[i], mbps) : mbps);
+                    logstream(LOG_DEBUG) << dirs[d] << ": sequential reads of " << sizes[i] << " bytes: " << mbps << " MB/s" << std::endl;
+                }
+                int s = first_near_best(seq);
+                for(size_t i=0; i < threadcounts.size(); i++) {
+                    double mbps = random_read(fname, sizes[s], threadcounts[i]);
+                    rnd[i] = (measured ? std::min(rnd[i], mbps) : mbps);
+                    logstream(LOG_DEBUG) << dirs[d] << ": random reads with " << threadcounts[i] << " threads: " << mbps << " MB/s" << std::endl;
+                }
+                unlink(fname.c_str());
+                measured = true;
+            }
+
+            if (measured) {
+                int s = first_near_best(seq);
+                int t = first_near_best(rnd);
+                p.blocksize = sizes[s];
+                p.seq_read_mbps = seq[s];
+                p.niothreads = threadcounts[t];
+                p.rand_read_mbps = rnd[t];
+            } else {
+                logstream(LOG_WARNING) << "Could not measure the storage, using the default I/O parameters." << std::endl;
+            }
+
+            /* Loading keeps up with the disk if the threads together decompress
+               as fast as it reads. Not more than half of the cores, the rest execute
+               the updates. */
+            p.decompress_mbps = decompression_speed();
+            int maxload = std::max(1, p.ncores / 2);
+            int needed = (p.decompress_mbps > 0 ? (int) (p.seq_read_mbps / p.decompress_mbps) + 1 : 2);
+            p.loadthreads = std::max(std::min(2, maxload), std::min(needed, maxload));
+
+            /* Cache the edge data if it fits in half of the memory left after the budget */
+            size_t freemb = free_memory_mb();
+            size_t membudget = (size_t) get_option_int("membudget_mb", 1024);
+            size_t headroom = (freemb > membudget ? (freemb - membudget) / 2 : 0);
+            size_t edatamb = graph_edata_bytes / 1024 / 1024 + 1;
+            p.cachesize_mb = std::min(edatamb, headroom);
+            return p;
+        }
+
+        /**
+         * Loads the persisted profile. Returns false if there is none, or if
+         * it was measured on a machine with a different number of cores.
+         */
+        bool load(io_profile &p) {
+            std::string fname = filename_iotune_profile(base_filename);
+            if (!file_exists(fname)) return false;
+            std::map<std::string, std::string> c = loadconfig(fname, fname);
+            if (c.find("blocksize") == c.end()) return false;
+            p.blocksize = (size_t) atol(c["blocksize"].c_str());
+            p.niothreads = atoi(c["niothreads"].c_str());
+            p.loadthreads = atoi(c["loadthreads"].c_str());
+            p.cachesize_mb = (size_t) atol(c["cachesize_mb"].c_str());
+            p.ncores = atoi(c["ncores"].c_str());
+            p.seq_read_mbps = atof(c["seq_read_mbps"].c_str());
+            p.rand_read_mbps = atof(c["rand_read_mbps"].c_str());
+            p.decompress_mbps = atof(c["decompress_mbps"].c_str());
+            p.graph_edata_bytes = (size_t) atol(c["graph_edata_bytes"].c_str());
+            if (p.ncores != (int) sysconf(_SC_NPROCESSORS_ONLN)) {
+                logstream(LOG_INFO) << "I/O profile " << fname << " was measured with " << p.ncores << " cores, measuring again." << std::endl;
+                return false;
+            }
+            return p.blocksize > 0 && p.niothreads > 0 && p.loadthreads > 0;
+        }
+
+        void save(const io_profile &p) {
+            std::string fname = filename_iotune_profile(base_filename);
+            FILE * f = fopen(fname.c_str(), "w");
+            if (f == NULL) {
+                logstream(LOG_WARNING) << "Could not write the I/O profile " << fname << ": " << strerror(errno) << std::endl;
+                return;
+            }
+            fprintf(f, "# I/O profile measured by GraphChi (option autotune). Remove to measure again.\n");
+            fprintf(f, "blocksize = %lu\n", (unsigned long) p.blocksize);
+            fprintf(f, "niothreads = %d\n", p.niothreads);
+            fprintf(f, "loadthreads = %d\n", p.loadthreads);
+            fprintf(f, "cachesize_mb = %lu\n", (unsigned long) p.cachesize_mb);
+            fprintf(f, "# Measurements\n");
+            fprintf(f, "ncores = %d\n", p.ncores);
+            fprintf(f, "seq_read_mbps = %.1f\n", p.seq_read_mbps);
+            fprintf(f, "rand_read_mbps = %.1f\n", p.rand_read_mbps);
+            fprintf(f, "decompress_mbps = %.1f\n", p.decompress_mbps);
+            fprintf(f, "graph_edata_bytes = %lu\n", (unsigned long) p.graph_edata_bytes);
+            fclose(f);
+        }
+
+        /**
+         * Loads or measures the profile, depending on the option autotune
+         * (1: reuse the persisted profile, 2: measure again), and sets the
+         * options. Must be called before the I/O manager is created.
+         */
+        io_profile run() {
+            io_profile p;
+            bool remeasure = get_option_int("autotune", 0) >= 2;
+            m.start_time("autotune");
+            if (remeasure || !load(p)) {
+                p = measure();
+                save(p);
+                logstream(LOG_INFO) << "Measured the I/O profile, saved to " << filename_iotune_profile(base_filename) << std::endl;
+            } else {
+                logstream(LOG_INFO) << "Using the I/O profile " << filename_iotune_profile(base_filename) << std::endl;
+            }
+            m.stop_time("autotune");
+            apply(p);
+            return p;
+        }
+
+        /**
+         * Sets the options of the profile, except those given on the command line.
+         */
+        void apply(const io_profile &p) {
+            apply_option("io.blocksize", p.blocksize);
+            apply_option("niothreads", p.niothreads);
+            apply_option("loadthreads", p.loadthreads);
+            apply_option("cachesize_mb", p.cachesize_mb);
+
+            logstream(LOG_INFO) << "I/O profile: sequential " << p.seq_read_mbps << " MB/s, random " << p.rand_read_mbps
+                << " MB/s, decompression " << p.decompress_mbps << " MB/s, " << p.ncores << " cores => io.blocksize="
+                << get_option_long("io.blocksize", 0) << " niothreads=" << get_option_int("niothreads", 0)
+                << " loadthreads=" << get_option_int("loadthreads", 0) << " cachesize_mb=" << get_option_long("cachesize_mb", 0) << std::endl;
+
+            m.set("autotune.seq_read_mbps", p.seq_read_mbps);
+            m.set("autotune.rand_read_mbps", p.rand_read_mbps);
+            m.set("autotune.decompress_mbps", p.decompress_mbps);
+            m.set("autotune.ncores", (size_t) p.ncores);
+        }
+    };
+
+}
+
+#endif
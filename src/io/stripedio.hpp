@@ -44,11 +44,14 @@
 
 #include <vector>
 
+#include "io/io_accounting.hpp"
 #include "logger/logger.hpp"
 #include "metrics/metrics.hpp"
+#include "metrics/trace.hpp"
 #include "util/synchronized_queue.hpp"
 #include "util/ioutil.hpp"
 #include "util/cmdopts.hpp"
+#include "util/memory_tracker.hpp"
 
 #define CACHED_SESSION_ID (-1)
 
@@ -68,6 +71,8 @@ namespace graphchi {
         int start_mplex;
         bool open;
         bool compressed;
+        io_tag tag;
+        int memcomponent;   // Component the blocks of managed_malloc() are counted to, see memory_tracker
     };
     
     struct mmap_info {
@@ -102,6 +107,7 @@ namespace graphchi {
         bool compressed;
         bool closefd;
         volatile int * doneptr;
+        io_tag tag;
         
         iotask() : action(READ), fd(0), session(0), ptr(NULL), length(0), offset(0), ptroffset(0), free_after(false), iomgr(NULL), compressed(false), closefd(false), doneptr(NULL) {}
         iotask(stripedio * iomgr, BLOCK_ACTION act, int fd, int session,  refcountptr * ptr, size_t length, size_t offset, size_t ptroffset, bool free_after, bool compressed, bool closefd=false) :
@@ -118,6 +124,7 @@ namespace graphchi {
         
         bool running;
         metrics * m;
+        metrics_handle commit_timer;
         volatile int pending_writes;
         volatile int pending_reads;
         int mplex;
@@ -141,6 +148,7 @@ namespace graphchi {
         cached_block(size_t len, void * data, bool was_compressed) : len(len), data(data), was_compressed(was_compressed) {}
         
         ~cached_block() {
+            memory_tracker::instance().untrack(data);
             free(data);
             data = NULL;
         }
@@ -152,6 +160,7 @@ namespace graphchi {
       */
     class block_cache {
         size_t cache_budget_bytes;
+        size_t configured_budget_bytes;  // Budget before any shrinking
         size_t cache_size;
         mutex lock;  // TODO: read-write-lock
         bool full;
@@ -161,7 +170,8 @@ namespace graphchi {
         
     public:
     
-        block_cache(size_t cache_budget_bytes) : cache_budget_bytes(cache_budget_bytes), cache_size(0), full(false) {
+        block_cache(size_t cache_budget_bytes) : cache_budget_bytes(cache_budget_bytes), configured_budget_bytes(cache_budget_bytes),
+        cache_size(0), full(false) {
             hits = misses = 0;
         }
         
@@ -180,11 +190,12 @@ namespace graphchi {
         
         bool consider_caching(std::string filename, void * data, size_t len, bool was_compresssed) {
             bool did_cache = false;
-            if (!full && len + cache_size <= cache_budget_bytes) {
+            if (!full && len + cache_size <= cache_budget_bytes && !memory_tracker::instance().over_budget()) {
                 lock.lock();
                 if (len + cache_size <= cache_budget_bytes) {
                     cache_size += len;
                     did_cache = true;
+                    memory_tracker::instance().transfer(data, MEM_BLOCK_CACHE);
                     if (cachemap.size() % 40 == 0) {
                         logstream(LOG_DEBUG) << "Cache size: " << cache_size << " / " << cache_budget_bytes << std::endl;
                     }
@@ -210,6 +221,7 @@ namespace graphchi {
             if (lookup != cachemap.end()) {
                 ret =  lookup->second->data;
                 hits++;
+                trace_instant("cache_hit", "io");
             } else {
                 misses++;
             }
@@ -238,11 +250,13 @@ namespace graphchi {
         std::vector< pthread_t > threads;
         std::vector< thrinfo * > thread_infos;
         metrics &m;        
+        metrics_handle preada_timer, pwritea_timer, waitreads_timer, waitwrites_timer;
         
         int niothreads; // threads per mplex
         
         block_cache cache;
         
+        io_accounting accounting;
         
     private:
         // MMAP 
@@ -251,6 +265,10 @@ namespace graphchi {
         
     public:
         stripedio( metrics &_m) : m(_m), cache(0) {
+            preada_timer = m.register_timer("preada_now");
+            pwritea_timer = m.register_timer("pwritea_now");
+            waitreads_timer = m.register_timer("stripedio_wait_for_reads");
+            waitwrites_timer = m.register_timer("stripedio_wait_for_writes");
             stripesize = get_option_int("io.stripesize", 1024 * 1024 / 2);
 
             multiplex = get_option_int("multiplex", 1);
@@ -287,6 +305,7 @@ namespace graphchi {
                     cthreadinfo->pending_reads = 0;
                     cthreadinfo->mplex = i;
                     cthreadinfo->m = &m;
+                    cthreadinfo->commit_timer = m.register_timer("commit_thr");
                     thread_infos.push_back(cthreadinfo);
                     
                     pthread_t iothread;
@@ -331,6 +350,7 @@ namespace graphchi {
         
         void set_cache_budget(size_t c) {
             cache.cache_budget_bytes = c;
+            cache.configured_budget_bytes = c;
             cache.full = false;
         }
         
@@ -338,6 +358,10 @@ namespace graphchi {
             return cache;
         }
         
+        io_accounting & get_io_accounting() {
+            return accounting;
+        }
+        
         /**
           * Write to disk cached blocks.
           */
@@ -354,6 +378,46 @@ namespace graphchi {
 
         }
         
+        /**
+          * Writes blocks of the cache to disk and drops them, until at least
+          * the given number of bytes is freed, and lowers the cache budget by
+          * the same amount. The blocks must not be in use, so this may only be
+          * called between iterations.
+          * @return bytes freed
+          */
+        size_t shrink_cache(size_t bytes) {
+            size_t freed = 0;
+            cache.lock.lock();
+            std::map<std::string, cached_block *>::iterator it = cache.cachemap.begin();
+            while(it != cache.cachemap.end() && freed < bytes) {
+                cached_block * block = it->second;
+                int session = open_session(it->first, false, block->was_compressed);
+                pwritea_now(session, block->data, block->len, 0);
+                close_session(session);
+                freed += block->len;
+                cache.cache_size -= block->len;
+                delete block;
+                cache.cachemap.erase(it++);
+            }
+            cache.cache_budget_bytes = (cache.cache_budget_bytes > bytes ? cache.cache_budget_bytes - bytes : 0);
+            cache.full = (cache.cache_size >= cache.cache_budget_bytes);
+            cache.lock.unlock();
+            return freed;
+        }
+        
+        /**
+          * Restores the configured cache budget after shrink_cache(), once the
+          * memory is back under the budget, so that caching resumes.
+          */
+        void restore_cache_budget() {
+            cache.lock.lock();
+            if (cache.cache_budget_bytes < cache.configured_budget_bytes) {
+                cache.cache_budget_bytes = cache.configured_budget_bytes;
+                cache.full = false;
+            }
+            cache.lock.unlock();
+        }
+        
         bool multiplexed() {
             return multiplex>1;
         }
@@ -383,13 +447,19 @@ namespace graphchi {
             return std::abs(hash);
         }
         
-        int open_session(std::string filename, bool readonly=false, bool compressed=false) {
+        /**
+         * @param tag category and shard the I/O of the session is counted to, see io_accounting
+         * @param memcomponent component the blocks allocated for the session are counted to, see memory_tracker
+         */
+        int open_session(std::string filename, bool readonly=false, bool compressed=false, io_tag tag=io_tag(), int memcomponent=MEM_OTHER) {
             mlock.lock();
             // FIXME: known memory leak: sessions table is never shrunk
             int session_id = (int) sessions.size();
             io_descriptor * iodesc = new io_descriptor();
             iodesc->open = true;
             iodesc->compressed = compressed;
+            iodesc->tag = tag;
+            iodesc->memcomponent = memcomponent;
             iodesc->filename = filename;
             iodesc->start_mplex = hash(filename) % multiplex;
             sessions.push_back(iodesc);
@@ -444,6 +514,12 @@ namespace graphchi {
             }
         }
         
+        void set_session_tag(int session, io_tag tag) {
+            mlock.lock();
+            sessions[session]->tag = tag;
+            mlock.unlock();
+        }
+        
         void first_pass_finished() {
             // Optimization
             cache.full = true;
@@ -476,6 +552,19 @@ namespace graphchi {
             return stripelist;
         }
         
+        /**
+         * Number of stripe chunks a read is split into. An asynchronous read
+         * decrements its doneptr once for each chunk.
+         */
+        int num_stripe_chunks(int session, size_t nbytes, size_t off) {
+            int n = 0;
+            size_t end = off + nbytes;
+            for(size_t idx = off; idx < end; n++) {
+                idx += std::min(stripesize - idx % stripesize, end - idx);
+            }
+            return n;
+        }
+        
         template <typename T>
         void preada_async(int session,  T * tbuf, size_t nbytes, size_t off, volatile int * doneptr = NULL) {
             std::vector<stripe_chunk> stripelist = stripe_offsets(session, nbytes, off);
@@ -492,6 +581,7 @@ namespace graphchi {
                                      refptr, chunk.len, chunk.offset+off, chunk.offset, false,
                                      compressed_session(session));
                 task.doneptr = doneptr;
+                task.tag = sessions[session]->tag;
                 mplex_readtasks[chunk.mplex_thread].push(task);
             }
         }
@@ -511,6 +601,10 @@ namespace graphchi {
         template <typename T>
         void pwritea_async(int session, T * tbuf, size_t nbytes, size_t off, bool free_after, bool close_fd=false) {
             std::vector<stripe_chunk> stripelist = stripe_offsets(session, nbytes, off);
+            if (free_after) {
+                // Owned by the write queue until written
+                memory_tracker::instance().transfer(tbuf, MEM_IO_BUFFERS);
+            }
             refcountptr * refptr = new refcountptr((char*)tbuf, (int) stripelist.size());
             if (compressed_session(session)) {
                 assert(stripelist.size() == 1);
@@ -519,20 +613,25 @@ namespace graphchi {
             for(int i=0; i<(int)stripelist.size(); i++) {
                 stripe_chunk chunk = stripelist[i];
                 __sync_add_and_fetch(&thread_infos[chunk.mplex_thread]->pending_writes, 1);
-                mplex_writetasks[chunk.mplex_thread].push(iotask(this, WRITE, sessions[session]->writedescs[chunk.mplex_thread], session,
-                                                                 refptr, chunk.len, chunk.offset+off, chunk.offset, free_after, compressed_session(session),
-                                                                        close_fd));
+                iotask task = iotask(this, WRITE, sessions[session]->writedescs[chunk.mplex_thread], session,
+                                     refptr, chunk.len, chunk.offset+off, chunk.offset, free_after, compressed_session(session),
+                                     close_fd);
+                task.tag = sessions[session]->tag;
+                mplex_writetasks[chunk.mplex_thread].push(task);
             }
         }
         
         template <typename T>
         void preada_now(int session,  T * tbuf, size_t nbytes, size_t off, bool dupfd=false) {
-            metrics_entry me = m.start_time();
+            TRACE_IO_SCOPE("read");
+            metrics_timer me = m.start_timer();
             if (compressed_session(session)) {
                 // Compressed sessions do not support multiplexing for now
                 assert(off == 0);
-                read_compressed(sessions[session]->readdescs[0], tbuf, nbytes);
-                m.stop_time(me, "preada_now", false);
+                TRACE_SCOPE("decompress", "io");
+                size_t diskbytes = read_compressed(sessions[session]->readdescs[0], tbuf, nbytes);
+                accounting.record_read(sessions[session]->tag, nbytes, diskbytes);
+                m.stop_timer(me, preada_timer);
                 return;
             }
 
@@ -568,18 +667,21 @@ namespace graphchi {
 
                 }
             }
-            m.stop_time(me, "preada_now", false);
+            accounting.record_read(sessions[session]->tag, nbytes, nbytes);
+            m.stop_timer(me, preada_timer);
         }
         
         template <typename T>
         void pwritea_now(int session, T * tbuf, size_t nbytes, size_t off) {
-            metrics_entry me = m.start_time();
+            TRACE_IO_SCOPE("write");
+            metrics_timer me = m.start_timer();
 
             if (compressed_session(session)) {
                 // Compressed sessions do not support multiplexing for now
                 assert(off == 0);
-                write_compressed(sessions[session]->writedescs[0], tbuf, nbytes);
-                m.stop_time(me, "pwritea_now", false);
+                size_t diskbytes = write_compressed(sessions[session]->writedescs[0], tbuf, nbytes);
+                accounting.record_write(sessions[session]->tag, nbytes, diskbytes);
+                m.stop_timer(me, pwritea_timer);
 
                 return;
             }
@@ -592,7 +694,8 @@ namespace graphchi {
                 checklen += chunk.len;
             }
             assert(checklen == nbytes);
-            m.stop_time(me, "pwritea_now", false);
+            accounting.record_write(sessions[session]->tag, nbytes, nbytes);
+            m.stop_timer(me, pwritea_timer);
             
         }
         
@@ -621,6 +724,7 @@ namespace graphchi {
         template<typename T>
         void managed_malloc(int session, T ** tbuf, size_t nbytes, size_t noff) {
             *tbuf = (T*) malloc(nbytes);
+            memory_tracker::instance().track(sessions[session]->memcomponent, *tbuf, nbytes);
         }
         
         /**
@@ -634,6 +738,7 @@ namespace graphchi {
         template <typename T>
         void managed_release(int session, T ** ptr) {
             assert(*ptr != NULL);
+            memory_tracker::instance().untrack(*ptr);
             free(*ptr);
             *ptr = NULL;
         }
@@ -650,7 +755,7 @@ namespace graphchi {
         }
         
         void wait_for_reads() {
-            metrics_entry me = m.start_time();
+            metrics_timer me = m.start_timer();
             int loops = 0;
             int mplex = (int) thread_infos.size();
             for(int i=0; i<mplex; i++) {
@@ -659,18 +764,18 @@ namespace graphchi {
                     loops++;
                 }
             }
-            m.stop_time(me, "stripedio_wait_for_reads", false);
+            m.stop_timer(me, waitreads_timer);
         }
         
         void wait_for_writes() {
-            metrics_entry me = m.start_time();
+            metrics_timer me = m.start_timer();
             int mplex = (int) thread_infos.size();
             for(int i=0; i<mplex; i++) {
                 while(thread_infos[i]->pending_writes>0) {
                     usleep(10000);
                 }
             }
-            m.stop_time(me, "stripedio_wait_for_writes", false);
+            m.stop_timer(me, waitwrites_timer);
         }
         
         
@@ -725,6 +830,7 @@ namespace graphchi {
         iotask task;
         thrinfo * info = (thrinfo*)_info;
         int ntasks = 0;
+        tracer::instance().set_thread_name("io");
         // logstream(LOG_INFO) << "Thread for multiplex :" << info->mplex << " starting." << std::endl;
         while(info->running) {
             bool success;
@@ -739,17 +845,21 @@ namespace graphchi {
             if (success) {
                 ++ntasks;
                 if (task.action == WRITE) {  // Write
-                    metrics_entry me = info->m->start_time();
+                    TRACE_IO_SCOPE("write");
+                    metrics_timer me = info->m->start_timer();
                     
                     if (task.compressed) {
                         assert(task.offset == 0);
-                        write_compressed(task.fd, task.ptr->ptr, task.length);
+                        size_t diskbytes = write_compressed(task.fd, task.ptr->ptr, task.length);
+                        task.iomgr->get_io_accounting().record_write(task.tag, task.length, diskbytes);
                     } else {
                         pwritea(task.fd, task.ptr->ptr + task.ptroffset, task.length, task.offset);
+                        task.iomgr->get_io_accounting().record_write(task.tag, task.length, task.length);
                     }
                     if (task.free_after) {
                         // Threead-safe method of memory managment - ugly!
                         if (__sync_sub_and_fetch(&task.ptr->count, 1) == 0) {
+                            memory_tracker::instance().untrack(task.ptr->ptr);
                             free(task.ptr->ptr);
                             delete task.ptr;
                             if (task.closefd) {
@@ -759,14 +869,17 @@ namespace graphchi {
                     }
                    
                     __sync_sub_and_fetch(&info->pending_writes, 1);
-                    info->m->stop_time(me, "commit_thr");
+                    info->m->stop_timer(me, info->commit_timer);
                 } else {
+                    TRACE_IO_SCOPE("read");
                     if (task.compressed) {
                         assert(task.offset == 0);
-                        read_compressed(task.fd, task.ptr->ptr, task.length);
-
+                        TRACE_SCOPE("decompress", "io");
+                        size_t diskbytes = read_compressed(task.fd, task.ptr->ptr, task.length);
+                        task.iomgr->get_io_accounting().record_read(task.tag, task.length, diskbytes);
                     } else {
                         preada(task.fd, task.ptr->ptr+task.ptroffset, task.length, task.offset);
+                        task.iomgr->get_io_accounting().record_read(task.tag, task.length, task.length);
                     }
                     __sync_sub_and_fetch(&info->pending_reads, 1);
                     if (__sync_sub_and_fetch(&task.ptr->count, 1) == 0) {
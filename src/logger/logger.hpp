@@ -35,7 +35,18 @@
  *
  * The difference between the hard level and the soft level is that the
  * soft level can be changed at runtime, while the hard level optimizes away
- * logging calls at compile time.
+ * logging calls at compile time. The hard level can be set with
+ * -DOUTPUTLEVEL=LOG_INFO, for example; logstream statements below either
+ * level do not evaluate their arguments.
+ *
+ * Logging is asynchronous after set_async(true) (graphchi_init() enables
+ * it unless the option log_async is 0): each thread appends its formatted
+ * lines to its own lock-free ring buffer, and a background thread writes
+ * them to the log file and the console. Warnings and errors are written
+ * synchronously, after the lines buffered before them.
+ *
+ * Log sites on hot paths can be limited with logstream_every_n(lvl, n)
+ * and logstream_ratelimited(lvl, max_per_sec).
  *
  * @author Yucheng Low (ylow)
  */
@@ -55,7 +66,11 @@
 #include <cassert>
 #include <cstring>
 #include <cstdarg>
+#include <vector>
+#include <algorithm>
 #include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
 /**
  * \def LOG_FATAL
  *   Used for fatal and probably irrecoverable conditions
@@ -102,6 +117,8 @@
 #define logger(lvl,fmt,...)
 #define logbuf(lvl,fmt,...)
 #define logstream
+#define logstream_every_n(lvl, n) logstream(lvl)
+#define logstream_ratelimited(lvl, max_per_sec) logstream(lvl)
 #else
 
 #define logger(lvl,fmt,...)                 \
@@ -113,9 +130,26 @@
                         __func__ ,__LINE__,buf,len))
 
 #define logstream(lvl)                      \
-    (log_stream_dispatch<(lvl >= OUTPUTLEVEL)>::exec(lvl,__FILE__, __func__ ,__LINE__) )
+    (!(lvl >= OUTPUTLEVEL) || lvl < global_logger().get_log_level()) ? (void) 0 : \
+    log_voidify() & (log_stream_dispatch<(lvl >= OUTPUTLEVEL)>::exec(lvl,__FILE__, __func__ ,__LINE__) )
+
+/**
+ * \def logstream_every_n(lvl, n)
+ *    logstream that writes only every n'th time the site is reached.
+ * \def logstream_ratelimited(lvl, max_per_sec)
+ *    logstream that writes at most max_per_sec times a second from the site,
+ *    and tells how many lines were suppressed since the previous one.
+ */
+#define logstream_every_n(lvl, n)           \
+    (__extension__ ({ static volatile size_t _log_site_count = 0;  \
+            __sync_fetch_and_add(&_log_site_count, 1) % (n) != 0; })) ? (void) 0 : logstream(lvl)
+
+#define logstream_ratelimited(lvl, max_per_sec)        \
+    (!__extension__ ({ static log_rate_limiter _log_site_limiter;  \
+            _log_site_limiter.check(max_per_sec); })) ? (void) 0 : logstream(lvl) << log_rate_limiter::last_result()
 #endif
 
+
 static const char* messages[] = {  "DEBUG:    ",
     "INFO:     ",
     "WARNING:  ",
@@ -123,12 +157,107 @@ static const char* messages[] = {  "DEBUG:    ",
     "FATAL:    "};
 
 namespace logger_impl {
+
+/**
+ * Buffer of the formatted lines of one thread. The thread is the only
+ * producer and the flusher the only consumer, so head and tail are
+ * each written by one side only.
+ */
+struct log_ring {
+  static const size_t capacity = 1 << 16;
+  char buf[capacity];
+  volatile size_t head;      // Bytes appended, written by the producer
+  volatile size_t tail;      // Bytes consumed, written by the consumer
+  volatile bool orphaned;    // The thread has exited
+
+  log_ring() : head(0), tail(0), orphaned(false) {}
+
+  void copy_in(size_t pos, const char * src, size_t len) {
+    size_t off = pos % capacity;
+    size_t first = std::min(len, capacity - off);
+    memcpy(buf + off, src, first);
+    memcpy(buf, src + first, len - first);
+  }
+
+  void copy_out(size_t pos, char * dst, size_t len) const {
+    size_t off = pos % capacity;
+    size_t first = std::min(len, capacity - off);
+    memcpy(dst, buf + off, first);
+    memcpy(dst + first, buf, len - first);
+  }
+
+  /** Appends a record of [length, level, bytes]. Returns false if there is no room. */
+  bool push(int level, const char * data, int len) {
+    int header[2] = {len, level};
+    size_t need = sizeof(header) + len;
+    if (need > capacity - (head - tail)) return false;
+    copy_in(head, (const char *) header, sizeof(header));
+    copy_in(head + sizeof(header), data, len);
+    __sync_synchronize();
+    head += need;
+    return true;
+  }
+};
+
 struct streambuff_tls_entry {
   std::stringstream streambuffer;
   bool streamactive;
+  int streamloglevel;
+  log_ring * ring;
+
+  streambuff_tls_entry() : streamactive(false), streamloglevel(0), ring(NULL) {}
 };
 }
 
+/**
+ * Result of the last check of a rate limited log site by a thread. Written
+ * to the log line, it tells how many lines were suppressed before it.
+ */
+struct log_rate_result {
+  size_t nsuppressed;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const log_rate_result& r) {
+  if (r.nsuppressed > 0) os << "(" << r.nsuppressed << " similar lines suppressed) ";
+  return os;
+}
+
+class log_rate_limiter {
+  volatile long second;
+  volatile size_t count;
+  volatile size_t suppressed;
+
+ public:
+  log_rate_limiter() : second(0), count(0), suppressed(0) {}
+
+  static log_rate_result & last_result() {
+    static __thread log_rate_result r = {0};
+    return r;
+  }
+
+  /**
+   * Returns true if the line may be written, and stores the number of
+   * lines suppressed before it into last_result() of the calling thread.
+   */
+  bool check(size_t max_per_sec) {
+    timeval now;
+    gettimeofday(&now, NULL);
+    long cursecond = second;
+    if (now.tv_sec != cursecond) {
+      /* Only the thread that moves the window resets the count */
+      if (__sync_bool_compare_and_swap(&second, cursecond, (long) now.tv_sec)) {
+        __sync_lock_test_and_set(&count, 0);
+      }
+    }
+    if (__sync_fetch_and_add(&count, 1) >= max_per_sec) {
+      __sync_fetch_and_add(&suppressed, 1);
+      return false;
+    }
+    last_result().nsuppressed = __sync_lock_test_and_set(&suppressed, 0);
+    return true;
+  }
+};
+
  
 /**
   logging class.
@@ -212,7 +341,7 @@ class file_logger{
         if (endltype(f) == endltype(std::endl)) {
           streambuffer << "\n";
           stream_flush();
-          if(streamloglevel == LOG_FATAL) {
+          if(streambufentry->streamloglevel == LOG_FATAL) {
               throw "log fatal";
             // exit(EXIT_FAILURE);
           }
@@ -239,9 +368,62 @@ class file_logger{
     static void streambuffdestructor(void* v){
         logger_impl::streambuff_tls_entry* t = 
         reinterpret_cast<logger_impl::streambuff_tls_entry*>(v);
+        /* The flusher releases the ring after writing out its lines */
+        if (t->ring != NULL) t->ring->orphaned = true;
         delete t;
     }
     
+    /**
+     * Switches asynchronous logging on or off. When off, the buffered
+     * lines are written out first.
+     */
+    void set_async(bool async) {
+        pthread_mutex_lock(&asyncmut);
+        if (async && !async_enabled) {
+            stop_flusher = false;
+            async_enabled = true;
+            pthread_create(&flusher, NULL, flusher_main, this);
+        } else if (!async && async_enabled) {
+            async_enabled = false;
+            stop_flusher = true;
+            pthread_join(flusher, NULL);
+            flush();
+        }
+        pthread_mutex_unlock(&asyncmut);
+    }
+    
+    bool is_async() {
+        return async_enabled;
+    }
+    
+    /**
+     * Writes out the lines buffered by all threads.
+     * @param last ring written after the others, so that the lines of the
+     *        calling thread follow what the other threads logged before them
+     */
+    void flush(logger_impl::log_ring* last = NULL) {
+        pthread_mutex_lock(&ringmut);
+        std::vector<logger_impl::log_ring*>::iterator it = rings.begin();
+        while (it != rings.end()) {
+            logger_impl::log_ring* ring = *it;
+            if (ring == last) {
+                ++it;
+                continue;
+            }
+            bool orphaned = ring->orphaned;
+            drain(ring);
+            if (orphaned) {
+                delete ring;
+                it = rings.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (last != NULL) drain(last);
+        if (fout.good()) fout.flush();
+        pthread_mutex_unlock(&ringmut);
+    }
+    
    
     
     /** Default constructor. By default, log_to_console is off,
@@ -251,11 +433,16 @@ class file_logger{
         log_file = "";
         log_to_console = true;
         log_level = LOG_DEBUG; 
+        async_enabled = false;
+        stop_flusher = false;
         pthread_mutex_init(&mut, NULL);
+        pthread_mutex_init(&ringmut, NULL);
+        pthread_mutex_init(&asyncmut, NULL);
         pthread_key_create(&streambuffkey, streambuffdestructor);
     }
     
     ~file_logger() {
+        set_async(false);
         if (fout.good()) {
             fout.flush();
             fout.close();
@@ -265,6 +452,7 @@ class file_logger{
     }
     
     bool set_log_file(std::string file) {
+        flush();
         // close the file if it is open
         if (fout.good()) {
             fout.flush();
@@ -332,33 +520,14 @@ class file_logger{
                                         messages[lineloglevel],file,function,line);
             // write the actual logger
             
-            byteswritten += vsnprintf(str + byteswritten,1024 - byteswritten,fmt,ap);
+            byteswritten = std::min(byteswritten, 1022);
+            byteswritten += vsnprintf(str + byteswritten,1023 - byteswritten,fmt,ap);
+            byteswritten = std::min(byteswritten, 1022);
             
             str[byteswritten] = '\n';
             str[byteswritten+1] = 0;
             // write the output
-            if (fout.good()) {
-                pthread_mutex_lock(&mut);
-                fout << str;;
-                pthread_mutex_unlock(&mut);
-            }
-            if (log_to_console) {
-#ifdef COLOROUTPUT
-                if (lineloglevel == LOG_FATAL) {
-                    textcolor(stderr, BRIGHT, RED);
-                }
-                else if (lineloglevel == LOG_ERROR) {
-                    textcolor(stderr, BRIGHT, RED);
-                }
-                else if (lineloglevel == LOG_WARNING) {
-                    textcolor(stderr, BRIGHT, GREEN);
-                }
-#endif
-                std::cerr << str;;
-#ifdef COLOROUTPUT
-                reset_color(stderr);
-#endif
-            }
+            _lograw(lineloglevel, str, byteswritten + 1);
         }
     }
     
@@ -392,7 +561,53 @@ class file_logger{
         }
     }
     
+    /**
+     * Writes a line, or a part of it. In asynchronous mode the bytes go
+     * to the ring of the thread, and warnings and errors are written
+     * out at once.
+     */
     void _lograw(int lineloglevel, const char* buf, int len) {
+        if (!async_enabled) {
+            write_out(lineloglevel, buf, len);
+            return;
+        }
+        logger_impl::streambuff_tls_entry* entry = tls_entry();
+        if (entry->ring == NULL) {
+            entry->ring = new logger_impl::log_ring();
+            pthread_mutex_lock(&ringmut);
+            rings.push_back(entry->ring);
+            pthread_mutex_unlock(&ringmut);
+        }
+        if (!entry->ring->push(lineloglevel, buf, len)) {
+            // Full: write out the lines before this one, then this one
+            flush(entry->ring);
+            if (!entry->ring->push(lineloglevel, buf, len)) {
+                pthread_mutex_lock(&ringmut);
+                write_out(lineloglevel, buf, len);
+                pthread_mutex_unlock(&ringmut);
+            }
+        }
+        if (lineloglevel >= LOG_WARNING) flush(entry->ring);
+    }
+    
+    /** Writes out the lines of a ring. Under ringmut. */
+    void drain(logger_impl::log_ring* ring) {
+        size_t head = ring->head;
+        __sync_synchronize();
+        while (ring->tail < head) {
+            int header[2];
+            ring->copy_out(ring->tail, (char*) header, sizeof(header));
+            if (header[0] > 0) {
+                if ((int) flushbuf.size() < header[0]) flushbuf.resize(header[0]);
+                ring->copy_out(ring->tail + sizeof(header), &flushbuf[0], header[0]);
+                write_out(header[1], &flushbuf[0], header[0]);
+            }
+            __sync_synchronize();
+            ring->tail += sizeof(header) + header[0];
+        }
+    }
+    
+    void write_out(int lineloglevel, const char* buf, int len) {
         if (fout.good()) {
             pthread_mutex_lock(&mut);
             fout.write(buf,len);
@@ -421,15 +636,19 @@ class file_logger{
         }
     }
     
-    file_logger& start_stream(int lineloglevel,const char* file,const char* function, int line) {
-        // get the stream buffer
+    /** Returns the stream buffer of the thread, creating it if it does not exist */
+    logger_impl::streambuff_tls_entry* tls_entry() {
         logger_impl::streambuff_tls_entry* streambufentry = reinterpret_cast<logger_impl::streambuff_tls_entry*>(
                                                                                                                  pthread_getspecific(streambuffkey));
-        // create the key if it doesn't exist
         if (streambufentry == NULL) {
             streambufentry = new logger_impl::streambuff_tls_entry;
             pthread_setspecific(streambuffkey, streambufentry);
         }
+        return streambufentry;
+    }
+    
+    file_logger& start_stream(int lineloglevel,const char* file,const char* function, int line) {
+        logger_impl::streambuff_tls_entry* streambufentry = tls_entry();
         std::stringstream& streambuffer = streambufentry->streambuffer;
         bool& streamactive = streambufentry->streamactive;
         
@@ -441,7 +660,7 @@ class file_logger{
                 << "(" << function << ":" <<line<<"): ";
             }
             streamactive = true;
-            streamloglevel = lineloglevel;
+            streambufentry->streamloglevel = lineloglevel;
         }
         else {
             streamactive = false;
@@ -459,9 +678,8 @@ class file_logger{
       std::stringstream& streambuffer = streambufentry->streambuffer;
 
       streambuffer.flush();
-      _lograw(streamloglevel,
-              streambuffer.str().c_str(),
-              (int)(streambuffer.str().length()));
+      std::string line = streambuffer.str();
+      _lograw(streambufentry->streamloglevel, line.c_str(), (int)line.length());
       streambuffer.str("");
     }
   }
@@ -471,12 +689,37 @@ class file_logger{
   
   pthread_key_t streambuffkey;
   
-  int streamloglevel;
   pthread_mutex_t mut;
   
   bool log_to_console;
   int log_level;
 
+  /* Asynchronous logging */
+  volatile bool async_enabled;
+  volatile bool stop_flusher;
+  pthread_t flusher;
+  pthread_mutex_t asyncmut;
+  pthread_mutex_t ringmut;   // Guards the rings and the consumer side of them
+  std::vector<logger_impl::log_ring*> rings;
+  std::vector<char> flushbuf;
+
+  static void* flusher_main(void* arg) {
+    file_logger* l = reinterpret_cast<file_logger*>(arg);
+    while (!l->stop_flusher) {
+      usleep(5000);
+      l->flush();
+    }
+    return NULL;
+  }
+
+};
+
+/**
+ * Discards the value of a log stream expression, see logstream().
+ */
+struct log_voidify {
+  template <typename T>
+  inline void operator&(const T&) {}
 };
 
 
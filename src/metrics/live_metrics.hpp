@@ -0,0 +1,179 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Live metrics: a snapshot of the counters of a running engine, which the
+ * HTTP admin serves at /metrics in the Prometheus text format.
+ *
+ * The engine publishes the snapshot after each sub-interval and iteration
+ * (see graphchi_engine::publish_live_metrics()). The snapshot is a fixed
+ * buffer guarded by a sequence number: the publisher makes it odd while it
+ * writes, and readers copy the buffer and retry if the sequence changed.
+ * So scraping never takes a lock of the engine, and never blocks it.
+ */
+
+#ifndef DEF_GRAPHCHI_LIVE_METRICS
+#define DEF_GRAPHCHI_LIVE_METRICS
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <string>
+#include <vector>
+
+#include "util/pthread_tools.hpp"
+
+#define LIVE_METRICS_MAX_SAMPLES 256
+
+namespace graphchi {
+
+    enum live_metric_type {
+        LIVE_GAUGE, LIVE_COUNTER
+    };
+
+    struct live_sample {
+        char family[64];   // Metric name, e.g. graphchi_updates_total
+        char labels[64];   // Label set without braces, e.g. category="adj", or empty
+        char help[96];
+        int type;
+        double value;
+    };
+
+    class live_metrics {
+
+        volatile uint64_t seq;
+        int nsamples;
+        live_sample samples[LIVE_METRICS_MAX_SAMPLES];
+
+        /* Samples being built by the publisher, see begin() and commit() */
+        std::vector<live_sample> pending;
+        mutex publisher_lock;
+
+        live_metrics() : seq(0), nsamples(0) {}
+
+        static void copy_str(char * dst, size_t len, const std::string &s) {
+            strncpy(dst, s.c_str(), len - 1);
+            dst[len - 1] = '\0';
+        }
+
+    public:
+
+        static live_metrics &instance() {
+            static live_metrics lm;
+            return lm;
+        }
+
+        /**
+         * Starts a new snapshot. Only one publisher builds a snapshot at a
+         * time; the lock is not taken by readers.
+         */
+        void begin() {
+            publisher_lock.lock();
+            pending.clear();
+        }
+
+        void add(std::string family, double value, int type = LIVE_GAUGE, std::string help = "", std::string labels = "") {
+            if (pending.size() >= LIVE_METRICS_MAX_SAMPLES) return;
+            live_sample s;
+            copy_str(s.family, sizeof(s.family), family);
+            copy_str(s.labels, sizeof(s.labels), labels);
+            copy_str(s.help, sizeof(s.help), help);
+            s.type = type;
+            s.value = value;
+            pending.push_back(s);
+        }
+
+        /**
+         * Replaces the published snapshot with the samples added since begin().
+         */
+        void commit() {
+            __sync_add_and_fetch(&seq, 1);
+            __sync_synchronize();
+            nsamples = (int) pending.size();
+            if (nsamples > 0) memcpy(samples, &pending[0], nsamples * sizeof(live_sample));
+            __sync_synchronize();
+            __sync_add_and_fetch(&seq, 1);
+            publisher_lock.unlock();
+        }
+
+        bool empty() const {
+            return seq == 0;
+        }
+
+        /**
+         * Copies the published snapshot. Does not block the publisher.
+         */
+        std::vector<live_sample> read() {
+            std::vector<live_sample> out;
+            while(true) {
+                uint64_t s0 = seq;
+                if (s0 % 2 == 1) {
+                    sched_yield();
+                    continue;
+                }
+                __sync_synchronize();
+                int n = nsamples;
+                if (n < 0 || n > LIVE_METRICS_MAX_SAMPLES) continue;
+                out.resize(n);
+                if (n > 0) memcpy(&out[0], samples, n * sizeof(live_sample));
+                __sync_synchronize();
+                if (seq == s0) break;
+            }
+            return out;
+        }
+
+        /**
+         * The snapshot in the Prometheus text exposition format (version 0.0.4).
+         * Samples of a family must be added consecutively.
+         */
+        std::string prometheus_text() {
+            std::vector<live_sample> snapshot = read();
+            std::string out;
+            char buf[512];
+            std::string lastfamily;
+            for(size_t i=0; i < snapshot.size(); i++) {
+                live_sample &s = snapshot[i];
+                if (lastfamily != s.family) {
+                    if (s.help[0] != '\0') {
+                        snprintf(buf, sizeof(buf), "# HELP %s %s\n", s.family, s.help);
+                        out += buf;
+                    }
+                    snprintf(buf, sizeof(buf), "# TYPE %s %s\n", s.family, (s.type == LIVE_COUNTER ? "counter" : "gauge"));
+                    out += buf;
+                    lastfamily = s.family;
+                }
+                if (s.labels[0] != '\0') {
+                    snprintf(buf, sizeof(buf), "%s{%s} %.17g\n", s.family, s.labels, s.value);
+                } else {
+                    snprintf(buf, sizeof(buf), "%s %.17g\n", s.family, s.value);
+                }
+                out += buf;
+            }
+            return out;
+        }
+    };
+
+}
+
+#endif
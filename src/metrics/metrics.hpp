@@ -24,6 +24,17 @@
  * @section DESCRIPTION
  *
  * Metrics. 
+ *
+ * Metrics can be updated by key, which takes a lock and looks the key up,
+ * or by a handle returned by register_metric() or register_timer(). Updates
+ * through handles go to counters of the calling thread without locking,
+ * and are merged into the entries when the metrics are reported, so hot
+ * paths (I/O threads, update functions) should use handles. Timers
+ * registered by handle also keep a histogram of the durations.
+ *
+ * With the option metrics.perf_counters=1, the phases timed with
+ * start_time() and stop_time() also record hardware performance counters
+ * (see perf_counters.hpp), reported as <key>.perf.* entries.
  */
 
   
@@ -35,8 +46,12 @@
 #include <vector>
 #include <limits>
 #include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <sys/time.h>
 
+#include "metrics/perf_counters.hpp"
 #include "util/pthread_tools.hpp"
 #include "util/cmdopts.hpp"
 
@@ -60,6 +75,7 @@ namespace graphchi {
     std::vector<double> v;
     timeval start_time;
       double lasttime;
+      perf_counter_values perfstart;
         
     metrics_entry() {} 
         
@@ -141,6 +157,9 @@ namespace graphchi {
     
     inline void timer_start() {
         gettimeofday(&start_time, NULL);
+        if (perf_counters::instance().is_enabled()) {
+            perf_counters::instance().read(perfstart);
+        }
 
     }
     inline void timer_stop() {
@@ -151,6 +170,75 @@ namespace graphchi {
     }
   };
  
+  /**
+   * Per-thread metrics state. Each thread gets a small id, which is
+   * returned for reuse when the thread exits. With more than
+   * METRICS_MAX_THREADS live threads, ids are shared and some updates
+   * may be lost.
+   */
+#define METRICS_MAX_THREADS 256
+#define METRICS_MAX_HANDLES 128
+#define METRICS_HISTOGRAM_BUCKETS 32  // Bucket i: durations of [2^i, 2^(i+1)) microseconds
+
+  typedef int metrics_handle;
+
+  /* Padded to whole cache lines, so that slots never share a line */
+  struct metrics_slot {
+    size_t count;
+    double sum;
+    double minvalue;
+    double maxvalue;
+    uint32_t histogram[METRICS_HISTOGRAM_BUCKETS];
+  } __attribute__((aligned(64)));
+
+  struct metrics_timer {
+    timeval start_time;
+  };
+
+  class metrics_thread_ids {
+    mutex lock;
+    std::vector<int> freeids;
+    int nextid;
+    pthread_key_t key;
+
+    static void release(void * id) {
+      metrics_thread_ids &ids = instance();
+      ids.lock.lock();
+      ids.freeids.push_back((int) (size_t) id - 1);
+      ids.lock.unlock();
+    }
+
+    metrics_thread_ids() : nextid(0) {
+      pthread_key_create(&key, release);
+    }
+
+  public:
+    static metrics_thread_ids &instance() {
+      static metrics_thread_ids ids;
+      return ids;
+    }
+
+    int acquire() {
+      lock.lock();
+      int id;
+      if (!freeids.empty()) {
+        id = freeids.back();
+        freeids.pop_back();
+      } else {
+        id = (nextid++) % METRICS_MAX_THREADS;
+      }
+      lock.unlock();
+      pthread_setspecific(key, (void *) (size_t) (id + 1));
+      return id;
+    }
+  };
+
+  inline int metrics_thread_id() {
+    static __thread int id = -1;
+    if (id < 0) id = metrics_thread_ids::instance().acquire();
+    return id;
+  }
+
   class imetrics_reporter {
         
     public:
@@ -167,11 +255,192 @@ namespace graphchi {
     std::string name, ident;
     std::map<std::string, metrics_entry> entries;
       mutex mlock;
+      
+      /* Registered handles, and the slots of each thread */
+      std::vector<std::string> handle_keys;
+      std::vector<metrictype> handle_types;
+      metrics_slot * volatile thread_slots[METRICS_MAX_THREADS];
+      
+      /* Performance counters of the timed phases */
+      std::map<std::string, perf_counter_values> perf_totals;
+      
+      /**
+       * Adds the counters since the start of the timer to the totals of
+       * the key. Under the lock.
+       */
+      void add_perf_counters(const metrics_entry &me, std::string key) {
+          if (!perf_counters::instance().is_enabled()) return;
+          perf_counter_values now;
+          perf_counters::instance().read(now);
+          perf_totals[key].add_delta(me.perfstart, now);
+      }
+      
+      metrics_slot * slots_of_thread() {
+          int tid = metrics_thread_id();
+          metrics_slot * slots = thread_slots[tid];
+          if (slots == NULL) {
+              void * p = NULL;
+              int err = posix_memalign(&p, 64, METRICS_MAX_HANDLES * sizeof(metrics_slot));
+              assert(err == 0);
+              slots = (metrics_slot *) p;
+              for(int h=0; h < METRICS_MAX_HANDLES; h++) {
+                  memset(&slots[h], 0, sizeof(metrics_slot));
+                  slots[h].minvalue = std::numeric_limits<double>::max();
+                  slots[h].maxvalue = -std::numeric_limits<double>::max();
+              }
+              if (!__sync_bool_compare_and_swap(&thread_slots[tid], (metrics_slot *) NULL, slots)) {
+                  free(slots);
+                  slots = thread_slots[tid];
+              }
+          }
+          return slots;
+      }
+      
+      static inline void accumulate(metrics_slot &slot, double value) {
+          slot.count++;
+          slot.sum += value;
+          if (value < slot.minvalue) slot.minvalue = value;
+          if (value > slot.maxvalue) slot.maxvalue = value;
+      }
+      
+      metrics(const metrics &); // Not copyable
         
   public: 
     inline metrics(std::string _name = "", std::string _id = "") : name(_name), ident (_id) {
+        for(int i=0; i < METRICS_MAX_THREADS; i++) thread_slots[i] = NULL;
+        perf_counters::instance().configure();
         this->set("app", _name);
     }
+      
+    ~metrics() {
+        for(int i=0; i < METRICS_MAX_THREADS; i++) free(thread_slots[i]);
+    }
+      
+    /**
+     * Registers a metric updated through a handle. Registering the same
+     * key again returns the same handle. The key should not be updated
+     * by name, as the merged value replaces its entry.
+     */
+    metrics_handle register_metric(std::string key, metrictype type = REAL) {
+        mlock.lock();
+        metrics_handle h = 0;
+        while(h < (int)handle_keys.size() && handle_keys[h] != key) h++;
+        if (h == (int)handle_keys.size()) {
+            assert(h < METRICS_MAX_HANDLES);
+            handle_keys.push_back(key);
+            handle_types.push_back(type);
+        }
+        mlock.unlock();
+        return h;
+    }
+      
+    metrics_handle register_timer(std::string key) {
+        return register_metric(key, TIME);
+    }
+      
+    /**
+     * Adds to a registered metric. Does not lock.
+     */
+    inline void add(metrics_handle h, double value) {
+        accumulate(slots_of_thread()[h], value);
+    }
+      
+    inline metrics_timer start_timer() {
+        metrics_timer t;
+        gettimeofday(&t.start_time, NULL);
+        return t;
+    }
+      
+    /**
+     * Adds the time since start_timer() to a registered timer. Does not lock.
+     * @return the time in seconds
+     */
+    inline double stop_timer(const metrics_timer &t, metrics_handle h) {
+        timeval end;
+        gettimeofday(&end, NULL);
+        double secs = end.tv_sec - t.start_time.tv_sec + ((double)(end.tv_usec - t.start_time.tv_usec)) / 1.0E6;
+        metrics_slot &slot = slots_of_thread()[h];
+        accumulate(slot, secs);
+        unsigned long long usecs = (unsigned long long) (secs * 1.0E6);
+        int bucket = (usecs == 0 ? 0 : 63 - __builtin_clzll(usecs));
+        slot.histogram[std::min(bucket, METRICS_HISTOGRAM_BUCKETS - 1)]++;
+        return secs;
+    }
+      
+    /**
+     * Merges the thread counters of the registered metrics into the entries.
+     * Called when reporting.
+     */
+    void merge_handles() {
+        mlock.lock();
+        for(int h=0; h < (int)handle_keys.size(); h++) {
+            metrics_entry ent(handle_types[h]);
+            std::vector<double> histogram(METRICS_HISTOGRAM_BUCKETS, 0);
+            int nbuckets = 0;
+            for(int i=0; i < METRICS_MAX_THREADS; i++) {
+                metrics_slot * slots = thread_slots[i];
+                if (slots == NULL || slots[h].count == 0) continue;
+                metrics_slot &slot = slots[h];
+                ent.minvalue = (ent.count == 0 ? slot.minvalue : std::min(ent.minvalue, slot.minvalue));
+                ent.maxvalue = (ent.count == 0 ? slot.maxvalue : std::max(ent.maxvalue, slot.maxvalue));
+                ent.count += slot.count;
+                ent.value += slot.sum;
+                ent.cumvalue += slot.sum;
+                for(int b=0; b < METRICS_HISTOGRAM_BUCKETS; b++) {
+                    histogram[b] += slot.histogram[b];
+                    if (slot.histogram[b] > 0) nbuckets = std::max(nbuckets, b + 1);
+                }
+            }
+            if (ent.count == 0) continue;
+            entries[handle_keys[h]] = ent;
+            if (nbuckets > 0) {
+                metrics_entry hist(VECTOR);
+                for(int b=0; b < nbuckets; b++) hist.add_vector_entry(b, histogram[b]);
+                entries[handle_keys[h] + ".histogram_log2_us"] = hist;
+            }
+        }
+        mlock.unlock();
+    }
+
+    /**
+     * Writes the performance counters of the timed phases, and the ratios
+     * derived from them, into the entries. Called when reporting.
+     */
+    void merge_perf_counters() {
+        perf_counters &pc = perf_counters::instance();
+        if (!pc.is_enabled()) return;
+        mlock.lock();
+        for(std::map<std::string, perf_counter_values>::iterator it = perf_totals.begin(); it != perf_totals.end(); ++it) {
+            const std::string &key = it->first;
+            const uint64_t * v = it->second.v;
+            for(int c=0; c < PERF_NCOUNTERS; c++) {
+                if (pc.is_supported(c) && c != PERF_TASK_CLOCK) {
+                    entries[key + ".perf." + perf_counters::counter_name(c)] = metrics_entry((double) v[c], INTEGER);
+                }
+            }
+            if (v[PERF_CYCLES] > 0) {
+                double cycles = (double) v[PERF_CYCLES];
+                if (pc.is_supported(PERF_INSTRUCTIONS))
+                    entries[key + ".perf.ipc"] = metrics_entry(v[PERF_INSTRUCTIONS] / cycles, REAL);
+                if (pc.is_supported(PERF_STALLED_FRONTEND))
+                    entries[key + ".perf.stalled_frontend_ratio"] = metrics_entry(v[PERF_STALLED_FRONTEND] / cycles, REAL);
+                if (pc.is_supported(PERF_STALLED_BACKEND))
+                    entries[key + ".perf.stalled_backend_ratio"] = metrics_entry(v[PERF_STALLED_BACKEND] / cycles, REAL);
+            }
+            if (v[PERF_CACHE_REFERENCES] > 0 && pc.is_supported(PERF_CACHE_MISSES)) {
+                entries[key + ".perf.cache_miss_ratio"] = metrics_entry(v[PERF_CACHE_MISSES] / (double) v[PERF_CACHE_REFERENCES], REAL);
+            }
+            if (pc.is_supported(PERF_TASK_CLOCK)) {
+                // CPU time of all threads, and its ratio to the wall time: the parallelism of the phase
+                double cpusecs = v[PERF_TASK_CLOCK] / 1.0E9;
+                entries[key + ".perf.cpu_time"] = metrics_entry(cpusecs, TIME);
+                if (entries.count(key) > 0 && entries[key].cumvalue > 0) {
+                    entries[key + ".perf.cpu_utilization"] = metrics_entry(cpusecs / entries[key].cumvalue, REAL);
+                }
+            }
+        }
+        mlock.unlock();
+    }
 
     inline void clear() {
       entries.clear();
@@ -286,6 +555,7 @@ namespace graphchi {
             entries[key] = metrics_entry(TIME);
         } 
         entries[key].add(me.lasttime); // not thread safe
+        add_perf_counters(me, key);
         if (show) 
             std::cout << key << ": " << me.lasttime << " secs." << std::endl;
         mlock.unlock();
@@ -301,6 +571,7 @@ namespace graphchi {
               entries[key] = metrics_entry(TIME);
           } 
           entries[key].add(t); // not thread safe
+          add_perf_counters(me, key);
           if (show) 
               std::cout << key << ": " << me.lasttime << " secs." << std::endl;
           
@@ -319,6 +590,11 @@ namespace graphchi {
       
       inline void stop_time(std::string key, bool show = false) {
           entries[key].timer_stop();
+          if (perf_counters::instance().is_enabled()) {
+              mlock.lock();
+              add_perf_counters(entries[key], key);
+              mlock.unlock();
+          }
           if (show) 
               std::cout << key << ": " << entries[key].lasttime << " secs." << std::endl;
       }
@@ -327,8 +603,17 @@ namespace graphchi {
       return entries[key];
     }
       
+    inline bool has(std::string key) {
+        mlock.lock();
+        bool b = entries.count(key) > 0;
+        mlock.unlock();
+        return b;
+    }
+      
       
     void report(imetrics_reporter & reporter) {
+          merge_handles();
+          merge_perf_counters();
           if (name != "") {
               reporter.do_report(name, ident, entries);
           }
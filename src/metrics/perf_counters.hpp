@@ -0,0 +1,298 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Hardware performance counters of the process, read with perf_event_open(2).
+ * Enabled with the option metrics.perf_counters=1; metrics then records the
+ * counters over each timed phase (see metrics::start_time()).
+ *
+ * Counters are opened for each thread of the process, found from
+ * /proc/self/task when the counters are read, and summed over the threads.
+ * So a phase counts the work of all threads during it, including the
+ * execution threads, and phases that run concurrently count the same work.
+ * Threads started during a phase are counted from the next read on.
+ * Counters that the kernel or the CPU does not support are skipped; if none
+ * can be opened (for example perf_event_paranoid forbids them, or in a
+ * virtual machine), the collector disables itself with a warning.
+ */
+
+#ifndef DEF_GRAPHCHI_PERF_COUNTERS
+#define DEF_GRAPHCHI_PERF_COUNTERS
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "logger/logger.hpp"
+#include "util/cmdopts.hpp"
+#include "util/pthread_tools.hpp"
+
+#define PERF_MAX_THREADS 1024
+
+namespace graphchi {
+
+    enum perf_counter_id {
+        PERF_CYCLES, PERF_INSTRUCTIONS, PERF_CACHE_REFERENCES, PERF_CACHE_MISSES,
+        PERF_STALLED_FRONTEND, PERF_STALLED_BACKEND, PERF_TASK_CLOCK,
+        PERF_NCOUNTERS
+    };
+
+    struct perf_counter_values {
+        uint64_t v[PERF_NCOUNTERS];
+
+        perf_counter_values() {
+            clear();
+        }
+
+        void clear() {
+            for(int c=0; c < PERF_NCOUNTERS; c++) v[c] = 0;
+        }
+
+        /**
+         * Adds the difference end - start, counter by counter.
+         */
+        void add_delta(const perf_counter_values &start, const perf_counter_values &end) {
+            for(int c=0; c < PERF_NCOUNTERS; c++) {
+                if (end.v[c] > start.v[c]) v[c] += end.v[c] - start.v[c];
+            }
+        }
+    };
+
+    class perf_counters {
+
+        bool configured;
+        volatile bool enabled;
+        bool supported[PERF_NCOUNTERS];
+        std::map<pid_t, std::vector<int> > threadfds;
+        perf_counter_values retired;   // Final counts of the threads that have exited
+        bool warned_threads;
+        mutex lock;
+
+        perf_counters() : configured(false), enabled(false), warned_threads(false) {
+            for(int c=0; c < PERF_NCOUNTERS; c++) supported[c] = false;
+        }
+
+#ifdef __linux__
+        static int open_counter(int counter, pid_t tid) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            switch(counter) {
+                case PERF_CYCLES: attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+                case PERF_INSTRUCTIONS: attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+                case PERF_CACHE_REFERENCES: attr.config = PERF_COUNT_HW_CACHE_REFERENCES; break;
+                case PERF_CACHE_MISSES: attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+                case PERF_STALLED_FRONTEND: attr.config = PERF_COUNT_HW_STALLED_CYCLES_FRONTEND; break;
+                case PERF_STALLED_BACKEND: attr.config = PERF_COUNT_HW_STALLED_CYCLES_BACKEND; break;
+                case PERF_TASK_CLOCK:
+                    attr.type = PERF_TYPE_SOFTWARE;
+                    attr.config = PERF_COUNT_SW_TASK_CLOCK;
+                    break;
+                default: assert(false);
+            }
+            // User space only, which is allowed with perf_event_paranoid <= 2
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            // The kernel multiplexes counters if there are not enough of them,
+            // so read the times to scale the counts.
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            return (int) syscall(__NR_perf_event_open, &attr, tid, -1, -1, 0);
+        }
+
+        static uint64_t read_counter(int fd) {
+            uint64_t buf[3];
+            if (::read(fd, buf, sizeof(buf)) != (ssize_t) sizeof(buf)) return 0;
+            if (buf[2] == 0) return 0;
+            if (buf[2] == buf[1]) return buf[0];
+            return (uint64_t) ((double) buf[0] * buf[1] / buf[2]);
+        }
+
+        static void close_all(std::vector<int> &fds) {
+            for(int c=0; c < (int)fds.size(); c++) {
+                if (fds[c] >= 0) close(fds[c]);
+            }
+        }
+
+        std::vector<int> attach(pid_t tid) {
+            std::vector<int> fds(PERF_NCOUNTERS, -1);
+            for(int c=0; c < PERF_NCOUNTERS; c++) {
+                if (supported[c]) fds[c] = open_counter(c, tid);
+            }
+            return fds;
+        }
+
+        /**
+         * Opens the counters of new threads, and retires the counters
+         * of threads that have exited. Under the lock.
+         */
+        void scan_threads() {
+            std::set<pid_t> live;
+            DIR * dir = opendir("/proc/self/task");
+            if (dir == NULL) return;
+            struct dirent * ent;
+            while((ent = readdir(dir)) != NULL) {
+                if (ent->d_name[0] == '.') continue;
+                live.insert((pid_t) atoi(ent->d_name));
+            }
+            closedir(dir);
+
+            std::map<pid_t, std::vector<int> >::iterator it = threadfds.begin();
+            while(it != threadfds.end()) {
+                if (live.count(it->first) == 0) {
+                    for(int c=0; c < PERF_NCOUNTERS; c++) {
+                        if (it->second[c] >= 0) retired.v[c] += read_counter(it->second[c]);
+                    }
+                    close_all(it->second);
+                    threadfds.erase(it++);
+                } else {
+                    ++it;
+                }
+            }
+            for(std::set<pid_t>::iterator t = live.begin(); t != live.end(); ++t) {
+                if (threadfds.count(*t) > 0) continue;
+                if (threadfds.size() >= PERF_MAX_THREADS) {
+                    if (!warned_threads) {
+                        logstream(LOG_WARNING) << "Over " << PERF_MAX_THREADS << " threads, perf counters do not count new threads." << std::endl;
+                        warned_threads = true;
+                    }
+                    break;
+                }
+                threadfds[*t] = attach(*t);
+            }
+        }
+#endif
+
+    public:
+
+        static perf_counters &instance() {
+            static perf_counters pc;
+            return pc;
+        }
+
+        static const char * counter_name(int counter) {
+            switch(counter) {
+                case PERF_CYCLES: return "cycles";
+                case PERF_INSTRUCTIONS: return "instructions";
+                case PERF_CACHE_REFERENCES: return "cache_references";
+                case PERF_CACHE_MISSES: return "cache_misses";
+                case PERF_STALLED_FRONTEND: return "stalled_cycles_frontend";
+                case PERF_STALLED_BACKEND: return "stalled_cycles_backend";
+                case PERF_TASK_CLOCK: return "task_clock";
+            }
+            return "unknown";
+        }
+
+        /**
+         * Reads the option metrics.perf_counters and probes which counters
+         * can be opened. Later calls have no effect.
+         */
+        void configure() {
+            lock.lock();
+            if (configured) {
+                lock.unlock();
+                return;
+            }
+            configured = true;
+            if (get_option_int("metrics.perf_counters", 0) == 0) {
+                lock.unlock();
+                return;
+            }
+#ifdef __linux__
+            std::string names;
+            int firsterrno = 0;
+            for(int c=0; c < PERF_NCOUNTERS; c++) {
+                int fd = open_counter(c, 0);
+                if (fd >= 0) {
+                    supported[c] = true;
+                    close(fd);
+                    names += std::string(names.empty() ? "" : ", ") + counter_name(c);
+                } else if (firsterrno == 0) {
+                    firsterrno = errno;
+                }
+            }
+            if (names.empty()) {
+                logstream(LOG_WARNING) << "Performance counters are not available (" << strerror(firsterrno)
+                    << "), check /proc/sys/kernel/perf_event_paranoid. Continuing without them." << std::endl;
+            } else {
+                if (!supported[PERF_CYCLES]) {
+                    logstream(LOG_WARNING) << "Hardware performance counters are not available (" << strerror(firsterrno)
+                        << "), only software counters are recorded." << std::endl;
+                }
+                logstream(LOG_INFO) << "Performance counters: " << names << std::endl;
+                scan_threads();
+                __sync_synchronize();
+                enabled = true;
+            }
+#else
+            logstream(LOG_WARNING) << "Performance counters are only supported on Linux." << std::endl;
+#endif
+            lock.unlock();
+        }
+
+        inline bool is_enabled() const {
+            return enabled;
+        }
+
+        inline bool is_supported(int counter) const {
+            return supported[counter];
+        }
+
+        /**
+         * Reads the counters, summed over the threads of the process
+         * since they were first seen.
+         */
+        void read(perf_counter_values &out) {
+            out.clear();
+            if (!enabled) return;
+#ifdef __linux__
+            lock.lock();
+            scan_threads();
+            out = retired;
+            for(std::map<pid_t, std::vector<int> >::iterator it = threadfds.begin(); it != threadfds.end(); ++it) {
+                for(int c=0; c < PERF_NCOUNTERS; c++) {
+                    if (it->second[c] >= 0) out.v[c] += read_counter(it->second[c]);
+                }
+            }
+            lock.unlock();
+#endif
+        }
+    };
+
+}
+
+#endif
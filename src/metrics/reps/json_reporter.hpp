@@ -0,0 +1,136 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * JSON metrics reporter, for tools that process the metrics (see bench/).
+ * Each entry is written with its type, value and statistics; vectors
+ * with all their values.
+ */
+
+
+#ifndef DEF_GRAPHCHI_JSON_REPORTER
+#define DEF_GRAPHCHI_JSON_REPORTER
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+#include "metrics/metrics.hpp"
+
+namespace graphchi {
+
+  class json_reporter : public imetrics_reporter {
+  private:
+    json_reporter() {}
+
+    std::string filename;
+    FILE * f;
+
+    static std::string escape(std::string s) {
+        std::string out;
+        for(size_t i=0; i < s.size(); i++) {
+            char c = s[i];
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if ((unsigned char)c < 0x20) {
+                char buf[8];
+                sprintf(buf, "\\u%04x", (int)c);
+                out += buf;
+            } else {
+                out += c;
+            }
+        }
+        return out;
+    }
+
+    /* JSON has no infinities or NaNs */
+    void write_number(double x) {
+        if (std::isfinite(x)) fprintf(f, "%.17g", x);
+        else fprintf(f, "null");
+    }
+
+  public:
+
+    json_reporter(std::string fname) : filename(fname) {
+        f = fopen(fname.c_str(), "w");
+        assert(f != NULL);
+    }
+
+    virtual ~json_reporter() {}
+
+    virtual void do_report(std::string name, std::string ident, std::map<std::string, metrics_entry> & entries) {
+        fprintf(f, "{\"name\": \"%s\", \"ident\": \"%s\", \"metrics\": {", escape(name).c_str(), escape(ident).c_str());
+        std::map<std::string, metrics_entry>::iterator it;
+        bool first = true;
+        for(it = entries.begin(); it != entries.end(); ++it) {
+            metrics_entry &ent = it->second;
+            fprintf(f, "%s\n  \"%s\": {", (first ? "" : ","), escape(it->first).c_str());
+            first = false;
+            switch(ent.valtype) {
+                case STRING:
+                    fprintf(f, "\"type\": \"string\", \"value\": \"%s\"}", escape(ent.stringval).c_str());
+                    continue;
+                case INTEGER:
+                    fprintf(f, "\"type\": \"integer\"");
+                    break;
+                case REAL:
+                    fprintf(f, "\"type\": \"real\"");
+                    break;
+                case TIME:
+                    fprintf(f, "\"type\": \"time\"");
+                    break;
+                case VECTOR:
+                    fprintf(f, "\"type\": \"vector\", \"values\": [");
+                    for(size_t i=0; i < ent.v.size(); i++) {
+                        if (i > 0) fprintf(f, ", ");
+                        write_number(ent.v[i]);
+                    }
+                    fprintf(f, "]");
+                    break;
+            }
+            fprintf(f, ", \"value\": ");
+            write_number(ent.value);
+            fprintf(f, ", \"count\": %lu", (unsigned long) ent.count);
+            if (ent.count > 0) {
+                fprintf(f, ", \"min\": ");
+                write_number(ent.minvalue);
+                fprintf(f, ", \"max\": ");
+                write_number(ent.maxvalue);
+                fprintf(f, ", \"avg\": ");
+                write_number(ent.cumvalue / ent.count);
+            }
+            fprintf(f, "}");
+        }
+        fprintf(f, "\n}}\n");
+        fflush(f);
+        fclose(f);
+    };
+
+  };
+
+};
+
+
+
+#endif
@@ -0,0 +1,264 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Timeline tracing. When the option trace_file is set, the engine records
+ * the begin and end of its phases (iterations, intervals, sub-intervals,
+ * loading, updates, commits, I/O) per thread, and writes them at the end
+ * of the run as Chrome trace-event JSON, which can be opened in
+ * chrome://tracing or ui.perfetto.dev.
+ *
+ * Options:
+ *    trace_file         output file, tracing is disabled if not set
+ *    trace_max_events   events recorded at most, later events are dropped (default 1000000)
+ *    trace_io_sample    record every n'th I/O event of a thread (default 1)
+ *
+ * Usage: TRACE_SCOPE("name", "category") records the enclosing block.
+ * Names and categories must be string literals. When tracing is disabled,
+ * a scope costs one branch.
+ */
+
+#ifndef DEF_GRAPHCHI_TRACE
+#define DEF_GRAPHCHI_TRACE
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+#include "logger/logger.hpp"
+#include "util/cmdopts.hpp"
+#include "util/pthread_tools.hpp"
+
+namespace graphchi {
+
+    struct trace_event {
+        const char * name;
+        const char * cat;
+        char phase;        // 'X': complete event, 'i': instant event
+        uint64_t ts;       // Microseconds since the start of the trace
+        uint64_t dur;
+    };
+
+    struct trace_thread_buffer {
+        int tid;
+        std::string threadname;
+        mutex lock;        // Taken by the owner and by the writer, so uncontended
+        std::vector<trace_event> events;
+        size_t iocounter;
+    };
+
+    class tracer {
+
+        bool configured;
+        bool enabled;
+        std::string filename;
+        size_t max_events;
+        size_t nevents;
+        size_t dropped;
+        int io_sample;
+        timeval t0;
+        mutex lock;
+        std::vector<trace_thread_buffer *> buffers;
+
+        tracer() : configured(false), enabled(false), max_events(0), nevents(0), dropped(0), io_sample(1) {
+            gettimeofday(&t0, NULL);
+        }
+
+        trace_thread_buffer * thread_buffer() {
+            static __thread trace_thread_buffer * buf = NULL;
+            if (buf == NULL) {
+                buf = new trace_thread_buffer();
+                buf->iocounter = 0;
+                lock.lock();
+                buf->tid = (int) buffers.size();
+                buffers.push_back(buf);
+                lock.unlock();
+            }
+            return buf;
+        }
+
+        void record(trace_thread_buffer * buf, const char * name, const char * cat, char phase, uint64_t ts, uint64_t dur) {
+            if (__sync_fetch_and_add(&nevents, 1) >= max_events) {
+                __sync_fetch_and_add(&dropped, 1);
+                return;
+            }
+            trace_event ev;
+            ev.name = name;
+            ev.cat = cat;
+            ev.phase = phase;
+            ev.ts = ts;
+            ev.dur = dur;
+            buf->lock.lock();
+            buf->events.push_back(ev);
+            buf->lock.unlock();
+        }
+
+    public:
+
+        static tracer &instance() {
+            static tracer t;
+            return t;
+        }
+
+        /**
+         * Reads the options. Called by the engine; later calls have no effect.
+         */
+        void configure() {
+            lock.lock();
+            if (!configured) {
+                configured = true;
+                filename = get_option_string("trace_file", "");
+                max_events = get_option_long("trace_max_events", 1000000);
+                io_sample = std::max(1, get_option_int("trace_io_sample", 1));
+                gettimeofday(&t0, NULL);
+                __sync_synchronize();
+                enabled = !filename.empty();
+                if (enabled) {
+                    logstream(LOG_INFO) << "Tracing to " << filename << ", at most " << max_events << " events." << std::endl;
+                }
+            }
+            lock.unlock();
+        }
+
+        inline bool is_enabled() const {
+            return enabled;
+        }
+
+        inline uint64_t now() const {
+            timeval t;
+            gettimeofday(&t, NULL);
+            return (uint64_t) (t.tv_sec - t0.tv_sec) * 1000000 + (t.tv_usec - t0.tv_usec);
+        }
+
+        /**
+         * Whether the calling thread should trace its next I/O event, see trace_io_sample.
+         */
+        inline bool sample_io() {
+            return io_sample == 1 || (thread_buffer()->iocounter++ % io_sample) == 0;
+        }
+
+        void complete(const char * name, const char * cat, uint64_t start) {
+            uint64_t end = now();
+            record(thread_buffer(), name, cat, 'X', start, end - start);
+        }
+
+        void instant(const char * name, const char * cat) {
+            record(thread_buffer(), name, cat, 'i', now(), 0);
+        }
+
+        /**
+         * Names the calling thread in the trace.
+         */
+        void set_thread_name(std::string name) {
+            if (!enabled) return;
+            trace_thread_buffer * buf = thread_buffer();
+            buf->lock.lock();
+            buf->threadname = name;
+            buf->lock.unlock();
+        }
+
+        /**
+         * Writes the events recorded so far. Can be called again, the file
+         * is rewritten with all events.
+         */
+        void write() {
+            if (!enabled) return;
+            FILE * f = fopen(filename.c_str(), "w");
+            if (f == NULL) {
+                logstream(LOG_ERROR) << "Could not write trace: " << filename << std::endl;
+                return;
+            }
+            fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+            fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"graphchi\"}}");
+            size_t written = 0;
+            lock.lock();
+            for(int i=0; i < (int)buffers.size(); i++) {
+                trace_thread_buffer * buf = buffers[i];
+                buf->lock.lock();
+                if (!buf->threadname.empty()) {
+                    fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                            buf->tid, buf->threadname.c_str());
+                }
+                for(size_t j=0; j < buf->events.size(); j++) {
+                    trace_event &ev = buf->events[j];
+                    if (ev.phase == 'X') {
+                        fprintf(f, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %llu, \"dur\": %llu}",
+                                ev.name, ev.cat, buf->tid, (unsigned long long) ev.ts, (unsigned long long) ev.dur);
+                    } else {
+                        fprintf(f, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"pid\": 1, \"tid\": %d, \"ts\": %llu}",
+                                ev.name, ev.cat, buf->tid, (unsigned long long) ev.ts);
+                    }
+                }
+                written += buf->events.size();
+                buf->lock.unlock();
+            }
+            lock.unlock();
+            fprintf(f, "\n]}\n");
+            fclose(f);
+            logstream(LOG_INFO) << "Wrote " << written << " trace events to " << filename << std::endl;
+            if (dropped > 0) {
+                logstream(LOG_WARNING) << "Dropped " << dropped << " trace events over trace_max_events." << std::endl;
+            }
+        }
+    };
+
+    /**
+     * Records the lifetime of the object as a complete event.
+     */
+    class trace_scope {
+        const char * name;
+        const char * cat;
+        uint64_t start;
+        bool active;
+
+    public:
+        /**
+         * @param io if true, the event is subject to trace_io_sample
+         */
+        inline trace_scope(const char * name, const char * cat, bool io = false) : name(name), cat(cat), start(0) {
+            tracer &t = tracer::instance();
+            active = t.is_enabled() && (!io || t.sample_io());
+            if (active) start = t.now();
+        }
+
+        inline ~trace_scope() {
+            if (active) tracer::instance().complete(name, cat, start);
+        }
+    };
+
+    static inline void trace_instant(const char * name, const char * cat) {
+        tracer &t = tracer::instance();
+        if (t.is_enabled()) t.instant(name, cat);
+    }
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name, cat) graphchi::trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(name, cat)
+#define TRACE_IO_SCOPE(name) graphchi::trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(name, "io", true)
+
+}
+
+#endif
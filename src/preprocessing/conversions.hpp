@@ -540,21 +540,7 @@ namespace graphchi {
             if (inputfile.find(prefix) == 0 && inputfile.find(".tmp") == inputfile.npos) {
                 inputfile = dirname + "/" + inputfile;
                 std::cout << "Process: " << inputfile << std::endl;
-                FILE * inf = fopen(inputfile.c_str(), "r");
-                
-                while(!feof(inf)) {
-                    vid_t from;
-                    vid_t to;
-                    
-                    size_t res1 = fread(&from, sizeof(vid_t), 1, inf);
-                    size_t res2 = fread(&to, sizeof(vid_t), 1, inf);
-                    
-                    assert(res1 > 0 && res2 > 0);
-                    if (from != to) {
-                        sharderobj.preprocessing_add_edge(from, to, EdgeDataType());
-                    }
-                }
-                fclose(inf);
+                sharderobj.preprocessing_add_binary_file(inputfile, false);
             }
         }
     }
@@ -581,22 +567,7 @@ namespace graphchi {
             if (inputfile.find(prefix) == 0 && inputfile.find(".tmp") == inputfile.npos) {
                 inputfile = dirname + "/" + inputfile;
                 std::cout << "Process: " << inputfile << std::endl;
-                FILE * inf = fopen(inputfile.c_str(), "r");
-                
-                while(!feof(inf)) {
-                    vid_t from;
-                    vid_t to;
-                    EdgeDataType edgeval;
-                    
-                    size_t res1 = fread(&from, sizeof(vid_t), 1, inf);
-                    size_t res2 = fread(&to, sizeof(vid_t), 1, inf);
-                    size_t res3 = fread(&edgeval, sizeof(EdgeDataType), 1, inf);
-                    assert(res1 > 0 && res2 > 0 && res3 > 0);
-                    if (from != to) {
-                        sharderobj.preprocessing_add_edge(from, to, edgeval);
-                    }
-                }
-                fclose(inf);
+                sharderobj.preprocessing_add_binary_file(inputfile, true);
             }
         }
     }
@@ -37,10 +37,13 @@
 
 
 #include <iostream>
+#include <fstream>
 #include <cstdio>
+#include <cstring>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <vector>
 #include <omp.h>
@@ -59,6 +62,7 @@
 #include "shards/memoryshard.hpp"
 #include "shards/slidingshard.hpp"
 #include "output/output.hpp"
+#include "preprocessing/shovelfile.hpp"
 #include "util/ioutil.hpp"
 #include "util/radixSort.hpp"
 #include "util/kwaymerge.hpp"
@@ -73,12 +77,49 @@ namespace graphchi {
     
     enum ProcPhase  { COMPUTE_INTERVALS=1, SHOVEL=2 };
     
+    /**
+     * Decides which of two edges with same source and destination is kept.
+     * If acceptFirst() returns true, the edge with value "first" replaces the
+     * edge with value "second". The filter may also modify "first" to combine
+     * the two values.
+     */
     template <typename EdgeDataType>
     class DuplicateEdgeFilter {
     public:
         virtual bool acceptFirst(EdgeDataType& first, EdgeDataType& second) = 0;
     };
     
+    /* Keeps the edge that was added first */
+    template <typename EdgeDataType>
+    class KeepFirstEdgeFilter : public DuplicateEdgeFilter<EdgeDataType> {
+    public:
+        bool acceptFirst(EdgeDataType& first, EdgeDataType& second) { return false; }
+    };
+    
+    /* Keeps the edge that was added last */
+    template <typename EdgeDataType>
+    class KeepLastEdgeFilter : public DuplicateEdgeFilter<EdgeDataType> {
+    public:
+        bool acceptFirst(EdgeDataType& first, EdgeDataType& second) { return true; }
+    };
+    
+    /* Keeps the edge with the largest value */
+    template <typename EdgeDataType>
+    class MaxEdgeFilter : public DuplicateEdgeFilter<EdgeDataType> {
+    public:
+        bool acceptFirst(EdgeDataType& first, EdgeDataType& second) { return second < first; }
+    };
+    
+    /* Combines duplicate edges into one edge with the sum of the values */
+    template <typename EdgeDataType>
+    class SumEdgeFilter : public DuplicateEdgeFilter<EdgeDataType> {
+    public:
+        bool acceptFirst(EdgeDataType& first, EdgeDataType& second) {
+            first += second;
+            return true;
+        }
+    };
+    
     
     template <typename EdgeDataType>
     struct edge_with_value {
@@ -147,6 +188,76 @@ namespace graphchi {
     
   
     
+    /**
+     * Removes duplicates from a buffer where edges with same (src, dst) are
+     * adjacent. Works in place and returns the new number of edges.
+     */
+    template <typename EdgeDataType>
+    size_t remove_duplicate_edges(edge_with_value<EdgeDataType> * buffer, size_t numedges, DuplicateEdgeFilter<EdgeDataType> * filter) {
+        if (numedges == 0) return 0;
+        size_t i = 1;
+        for(size_t j=1; j<numedges; j++) {
+            edge_with_value<EdgeDataType> cur = buffer[j];
+            edge_with_value<EdgeDataType> &prev = buffer[i - 1];
+            if (prev.src == cur.src && prev.dst == cur.dst) {
+                if (filter->acceptFirst(cur.value, prev.value)) {
+                    // Replace the edge with the newer one
+                    prev = cur;
+                }
+            } else {
+                buffer[i++] = cur;
+            }
+        }
+        return i;
+    }
+    
+    /**
+     * Hash index from (src, dst) to the position of the edge in the
+     * current shovel buffer. Used for combining duplicate edges while
+     * they are added, before the shovel is written to disk.
+     * Open addressing with linear probing; capacity is twice the
+     * shovel size.
+     */
+    struct shovel_hash_index {
+        uint32_t * slots;  // Position in shovel + 1, zero if empty
+        size_t capacity;
+        
+        shovel_hash_index(size_t maxentries) {
+            assert(maxentries < (size_t)0xffffffffu);
+            capacity = 2 * maxentries + 1;
+            slots = (uint32_t *) calloc(capacity, sizeof(uint32_t));
+            assert(slots != NULL);
+        }
+        
+        ~shovel_hash_index() {
+            free(slots);
+        }
+        
+        static size_t bytes_per_entry() {
+            return 2 * sizeof(uint32_t);
+        }
+        
+        void clear() {
+            memset(slots, 0, capacity * sizeof(uint32_t));
+        }
+        
+        /**
+         * Returns the slot for the edge. If the slot is non-zero, the edge
+         * is already in the shovel at position *slot - 1.
+         */
+        template <typename EdgeDataType>
+        inline uint32_t * find(vid_t src, vid_t dst, edge_with_value<EdgeDataType> * shovel) {
+            uint64_t h = (((uint64_t)src << 32) | dst) * 0x9E3779B97F4A7C15ull;
+            size_t i = (size_t) (((h >> 32) * capacity) >> 32);
+            while(slots[i] != 0) {
+                edge_with_value<EdgeDataType> &e = shovel[slots[i] - 1];
+                if (e.src == src && e.dst == dst) break;
+                if (++i == capacity) i = 0;
+            }
+            return &slots[i];
+        }
+    };
+    
     template <typename EdgeDataType>
     struct shard_flushinfo {
         std::string shovelname;
@@ -154,50 +265,37 @@ namespace graphchi {
         edge_with_value<EdgeDataType> * buffer;
         vid_t max_vertex;
         DuplicateEdgeFilter<EdgeDataType> *  duplicate_filter;
+        bool preaggregated;
+        size_t shovel_bytes;
         
-        shard_flushinfo(std::string shovelname, vid_t max_vertex, size_t numedges, edge_with_value<EdgeDataType> * buffer, DuplicateEdgeFilter<EdgeDataType> * duplicate_filter) :
-        shovelname(shovelname), numedges(numedges), buffer(buffer), max_vertex(max_vertex), duplicate_filter(duplicate_filter) {}
+        shard_flushinfo(std::string shovelname, vid_t max_vertex, size_t numedges, edge_with_value<EdgeDataType> * buffer, DuplicateEdgeFilter<EdgeDataType> * duplicate_filter,
+                        bool preaggregated=false) :
+        shovelname(shovelname), numedges(numedges), buffer(buffer), max_vertex(max_vertex), duplicate_filter(duplicate_filter), preaggregated(preaggregated),
+        shovel_bytes(0) {}
         
         void flush() {
             /* Sort */
-            // TODO: remove duplicates here!
-    
-            if (duplicate_filter != NULL) {
+            if (duplicate_filter != NULL && !preaggregated) {
                 // Sort by dst, then by src so can effectively remove duplicates
-                logstream(LOG_INFO) << "Sorting shovel: " << shovelname << ", max:" << max_vertex << std::endl;
+                logstream_ratelimited(LOG_INFO, 5) << "Sorting shovel: " << shovelname << ", max:" << max_vertex << std::endl;
                 iSort(buffer, (intT)numedges, intT(max_vertex)*intT(max_vertex)+intT(max_vertex), dstSrcF<EdgeDataType>(max_vertex));
-                logstream(LOG_INFO) << "Sort done." << shovelname << std::endl;
+                logstream_ratelimited(LOG_INFO, 5) << "Sort done." << shovelname << std::endl;
            
-                edge_with_value<EdgeDataType> * tmpbuf = (edge_with_value<EdgeDataType> *) calloc(sizeof(edge_with_value<EdgeDataType>), numedges);
-                size_t i = 1;
-                tmpbuf[0] = buffer[0];
-                for(size_t j=1; j<numedges; j++) {
-                    edge_with_value<EdgeDataType> prev = tmpbuf[i - 1];
-                    edge_with_value<EdgeDataType> cur = buffer[j];
-                    if (prev.src == cur.src && prev.dst == cur.dst) {
-                        if (duplicate_filter->acceptFirst(cur.value, prev.value)) {
-                            // Replace the edge with the newer one
-                            tmpbuf[i - 1] = cur;
-                        }
-                    } else {
-                        tmpbuf[i++] = cur;
-                    }
-                }
-                std::cout << "Pre-duplicate filter while shoveling: " << numedges << " --> " << i << std::endl;
-                numedges = i;
-                free(buffer);
-                buffer = tmpbuf;
+                size_t n = remove_duplicate_edges(buffer, numedges, duplicate_filter);
+                logstream_ratelimited(LOG_INFO, 5) << "Pre-duplicate filter while shoveling: " << numedges << " --> " << n << std::endl;
+                numedges = n;
             } else {
-                logstream(LOG_INFO) << "Sorting shovel: " << shovelname << ", max:" << max_vertex << std::endl;
+                /* If duplicates were combined while adding edges, the shovel has none left */
+                logstream_ratelimited(LOG_INFO, 5) << "Sorting shovel: " << shovelname << ", max:" << max_vertex << std::endl;
                 iSort(buffer, (intT)numedges, (intT)max_vertex, dstF<EdgeDataType>());
-                logstream(LOG_INFO) << "Sort done." << shovelname << std::endl;
+                logstream_ratelimited(LOG_INFO, 5) << "Sort done." << shovelname << std::endl;
                 
             }
             
             
-            int f = open(shovelname.c_str(), O_WRONLY | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
-            writea(f, buffer, numedges * sizeof(edge_with_value<EdgeDataType>));
-            close(f);
+            shovel_bytes = write_shovel(shovelname, buffer, numedges);
+            logstream(LOG_DEBUG) << "Wrote shovel " << shovelname << ": " << numedges * sizeof(edge_with_value<EdgeDataType>) << " bytes raw, "
+                << shovel_bytes << " bytes compressed." << std::endl;
             free(buffer);
         }
     };
@@ -211,52 +309,138 @@ namespace graphchi {
     }
     
     
+    /**
+     * Streams a sorted shovel file into the k-way merge. The input buffer is
+     * split into two halves: while the blocks in one half are decoded and merged,
+     * the next run of blocks is read into the other half asynchronously by the
+     * I/O manager. See shovelfile.hpp for the file format.
+     */
     template <typename EdgeDataType>
     struct shovel_merge_source : public merge_source<edge_with_value<EdgeDataType> > {
         
-        size_t bufsize_bytes;
-        size_t bufsize_edges;
+        stripedio * iomgr;
         std::string shovelfile;
-        size_t idx;
-        size_t bufidx;
-        edge_with_value<EdgeDataType> * buffer;
-        int f;
+        int session;
+        size_t bufsize_bytes;   // Size of one half of the input buffer
         size_t numedges;
+        size_t idx;             // Number of edges returned so far
         
-        shovel_merge_source(size_t bufsize_bytes, std::string shovelfile) : bufsize_bytes(bufsize_bytes), 
-        shovelfile(shovelfile), idx(0), bufidx(0) {
-            assert(bufsize_bytes % sizeof(edge_with_value<EdgeDataType>) == 0);
-            f = open(shovelfile.c_str(), O_RDONLY);
-            
-            if (f < 0) {
-                logstream(LOG_ERROR) << "Could not open shovel file: " << shovelfile << std::endl;
-                printf("Error: %d, %s\n", errno, strerror(errno));
+        std::vector<shovel_block_info> blocks;
+        std::vector<size_t> block_offsets;
+        
+        /* Blocks [curblock, curend) are in the current input buffer, [curend, prefetchend) are being read */
+        size_t curblock, curend, prefetchend;
+        size_t curbufoff;
+        int cur;
+        volatile int pending;   // Decremented by the I/O threads
+        uint8_t * inbufs[2];
+        size_t inbuf_capacity[2];
+        
+        edge_with_value<EdgeDataType> * decoded;
+        uint8_t * scratch;
+        size_t bufidx;
+        size_t buflen;
+        
+        shovel_merge_source(stripedio * iomgr, size_t bufsize_bytes, std::string shovelfile) : iomgr(iomgr),
+        shovelfile(shovelfile), bufsize_bytes(bufsize_bytes / 2), idx(0), curblock(0), curend(0), prefetchend(0), curbufoff(0), cur(0), pending(0),
+        bufidx(0), buflen(0) {
+            session = iomgr->open_session(shovelfile, true);
+            
+            /* Read the block index from the end of the file */
+            size_t filesize = get_filesize(shovelfile);
+            assert(filesize >= sizeof(shovel_footer));
+            shovel_footer footer;
+            iomgr->preada_now(session, &footer, sizeof(shovel_footer), filesize - sizeof(shovel_footer));
+            numedges = footer.numedges;
+            blocks.resize(footer.numblocks);
+            size_t maxedges = 0, maxencoded = 0, off = 0;
+            if (footer.numblocks > 0) {
+                size_t indexsize = footer.numblocks * sizeof(shovel_block_info);
+                iomgr->preada_now(session, &blocks[0], indexsize, filesize - sizeof(shovel_footer) - indexsize);
+            }
+            for(size_t i=0; i < blocks.size(); i++) {
+                block_offsets.push_back(off);
+                off += blocks[i].stored_size;
+                maxedges = std::max(maxedges, (size_t) blocks[i].nedges);
+                maxencoded = std::max(maxencoded, (size_t) blocks[i].encoded_size);
             }
             
-            assert(f>=0);
+            decoded = (edge_with_value<EdgeDataType> *) malloc(std::max((size_t)1, maxedges) * sizeof(edge_with_value<EdgeDataType>));
+            scratch = (uint8_t *) malloc(std::max((size_t)1, maxencoded));
+            inbufs[0] = inbufs[1] = NULL;
+            inbuf_capacity[0] = inbuf_capacity[1] = 0;
             
-            buffer = (edge_with_value<EdgeDataType> *) malloc(bufsize_bytes);
-            numedges =   (get_filesize(shovelfile) / sizeof(edge_with_value<EdgeDataType> ));
-            bufsize_edges =   (bufsize_bytes / sizeof(edge_with_value<EdgeDataType>));
-            load_next();
+            prefetch();
+            if (numedges > 0) {
+                load_next();
+            } else {
+                finish(); // Nothing to merge, remove the shovel file right away
+            }
         }
         
         virtual ~shovel_merge_source() {
-            if (buffer != NULL) free(buffer);
-            buffer = NULL;
+            wait_prefetch();
+            if (decoded != NULL) {
+                free_buffers();
+                iomgr->close_session(session);
+            }
+        }
+        
+        void free_buffers() {
+            free(decoded);
+            free(scratch);
+            if (inbufs[0] != NULL) free(inbufs[0]);
+            if (inbufs[1] != NULL) free(inbufs[1]);
+            decoded = NULL;
+            scratch = NULL;
+            inbufs[0] = inbufs[1] = NULL;
         }
         
         void finish() {
-            close(f);
+            wait_prefetch();
+            iomgr->close_session(session);
             remove(shovelfile.c_str());
-
-            free(buffer);
-            buffer = NULL;
+            free_buffers();
+        }
+        
+        /* Starts reading the next run of blocks that fits into half of the buffer (at least one block) */
+        void prefetch() {
+            size_t st = prefetchend;
+            if (st >= blocks.size()) return;
+            size_t en = st + 1;
+            size_t len = blocks[st].stored_size;
+            while(en < blocks.size() && len + blocks[en].stored_size <= bufsize_bytes) {
+                len += blocks[en++].stored_size;
+            }
+            int b = 1 - cur;
+            if (inbuf_capacity[b] < len) {
+                inbufs[b] = (uint8_t *) realloc(inbufs[b], len);
+                inbuf_capacity[b] = len;
+            }
+            pending = iomgr->num_stripe_chunks(session, len, block_offsets[st]);
+            iomgr->preada_async(session, inbufs[b], len, block_offsets[st], &pending);
+            prefetchend = en;
+        }
+        
+        void wait_prefetch() {
+            while(pending > 0) { usleep(10); }
         }
         
         void load_next() {
-            size_t len = std::min(bufsize_bytes,  ((numedges - idx) * sizeof(edge_with_value<EdgeDataType>)));
-            preada(f, buffer, len, idx * sizeof(edge_with_value<EdgeDataType>));
+            if (curblock == curend) {
+                /* Current input buffer consumed, switch to the prefetched one */
+                wait_prefetch();
+                cur = 1 - cur;
+                curend = prefetchend;
+                curbufoff = 0;
+                prefetch();
+            }
+            assert(curblock < curend);
+            shovel_block_info &info = blocks[curblock];
+            shovel_read_block(shovelfile, curblock, info, inbufs[cur] + curbufoff, scratch, decoded);
+            curblock++;
+            curbufoff += info.stored_size;
+            buflen = info.nedges;
             bufidx = 0;
         }
         
@@ -265,19 +449,32 @@ namespace graphchi {
         }
         
         edge_with_value<EdgeDataType> next() {
-            if (bufidx == bufsize_edges) {
+            if (bufidx == buflen) {
                 load_next();
             }
             idx++;
+            edge_with_value<EdgeDataType> x = decoded[bufidx++];
             if (idx == numedges) {
-                edge_with_value<EdgeDataType> x = buffer[bufidx++];
                 finish();
-                return x;
             }
-            return buffer[bufidx++];
+            return x;
         }
     };
     
+    /**
+     * Statistics of one shard, collected for the sharding report.
+     */
+    struct shard_statistics {
+        int shard;
+        vid_t interval_st, interval_en;
+        size_t numedges;
+        size_t adj_bytes;
+        size_t edata_bytes;          // Uncompressed
+        size_t edata_stored_bytes;   // On disk
+        int edata_blocks;
+        double seconds;
+    };
+    
     template <typename EdgeDataType, typename FinalEdgeDataType=EdgeDataType>
     class sharder : public merge_sink<edge_with_value<EdgeDataType> > {
         
@@ -310,6 +507,11 @@ namespace graphchi {
         
         DuplicateEdgeFilter<EdgeDataType> * duplicate_edge_filter;
         
+        /* Combine duplicates in memory while edges are added */
+        bool preaggregate;
+        shovel_hash_index * shovel_index;
+        size_t preaggregated_edges;
+        
         bool no_edgevalues;
 #ifdef DYNAMICEDATA
         edge_t last_added_edge;
@@ -327,6 +529,12 @@ namespace graphchi {
         std::vector<pthread_t> shovelthreads;
         std::vector<shard_flushinfo<EdgeDataType> *> shoveltasks;
         
+        /* For the sharding report */
+        std::vector<shard_statistics> shardstats;
+        size_t shovel_raw_bytes;
+        size_t shovel_stored_bytes;
+        size_t edata_stored_bytes;
+        
     public:
         
         sharder(std::string basefilename) : basefilename(basefilename), m("sharder") {          
@@ -339,17 +547,31 @@ namespace graphchi {
             while (compressed_block_size % sizeof(FinalEdgeDataType) != 0) compressed_block_size++;
             edges_per_block = compressed_block_size / sizeof(FinalEdgeDataType);
             duplicate_edge_filter = NULL;
+            preaggregate = false;
+            shovel_index = NULL;
         }
         
         
         virtual ~sharder() {
             if (curshovel_buffer == NULL) free(curshovel_buffer);
+            if (shovel_index != NULL) delete shovel_index;
         }
         
         void set_duplicate_filter(DuplicateEdgeFilter<EdgeDataType> * filter) {
             this->duplicate_edge_filter = filter;
         }
         
+        /**
+         * If enabled, duplicate edges are combined with the duplicate filter
+         * already when they are added, using a hash index over the current shovel.
+         * The shovel is made smaller so that the index fits into the same
+         * memory budget. Must be called before start_preprocessing().
+         * Can also be enabled with the configuration option "preaggregate".
+         */
+        void set_preaggregation(bool b) {
+            preaggregate = b;
+        }
+        
         void set_max_vertex_id(vid_t maxid) {
             filter_max_vertex = maxid;
         }
@@ -364,10 +586,27 @@ namespace graphchi {
         void start_preprocessing() {
             m.start_time("preprocessing");
             numshovels = 0;
-            shovelsize = (1024l * 1024l * size_t(get_option_int("membudget_mb", 1024)) / 4l / sizeof(edge_with_value<EdgeDataType>));
+            size_t shovel_budget = 1024l * 1024l * size_t(get_option_int("membudget_mb", 1024)) / 4l;
+            shovelsize = shovel_budget / sizeof(edge_with_value<EdgeDataType>);
             curshovel_idx = 0;
+            preaggregated_edges = 0;
             
-            logstream(LOG_INFO) << "Starting preprocessing, shovel size: " << shovelsize << std::endl;
+            preaggregate = preaggregate || get_option_int("preaggregate", 0) != 0;
+#ifdef DYNAMICEDATA
+            // Duplicate edges carry the values of the edge vector
+            preaggregate = false;
+#endif
+            if (preaggregate && duplicate_edge_filter == NULL) {
+                logstream(LOG_WARNING) << "Pre-aggregation requires a duplicate edge filter, disabling." << std::endl;
+                preaggregate = false;
+            }
+            if (preaggregate) {
+                shovelsize = shovel_budget / (sizeof(edge_with_value<EdgeDataType>) + shovel_hash_index::bytes_per_entry());
+                if (shovel_index != NULL) delete shovel_index;
+                shovel_index = new shovel_hash_index(shovelsize);
+            }
+            
+            logstream(LOG_INFO) << "Starting preprocessing, shovel size: " << shovelsize << (preaggregate ? " (pre-aggregating duplicates)" : "") << std::endl;
             
             curshovel_buffer = (edge_with_value<EdgeDataType> *) calloc(shovelsize, sizeof(edge_with_value<EdgeDataType>));
             
@@ -386,12 +625,20 @@ namespace graphchi {
         void end_preprocessing() {
             m.stop_time("preprocessing");
             flush_shovel(false);
+            if (shovel_index != NULL) {
+                delete shovel_index;
+                shovel_index = NULL;
+                logstream(LOG_INFO) << "Combined " << preaggregated_edges << " duplicate edges while shoveling." << std::endl;
+                m.set("preaggregated_edges", preaggregated_edges);
+            }
         }
         
         void flush_shovel(bool async=true) {
             /* Flush in separate thread unless the last one */
-            shard_flushinfo<EdgeDataType> * flushinfo = new shard_flushinfo<EdgeDataType>(shovel_filename(numshovels), max_vertex_id, curshovel_idx, curshovel_buffer, duplicate_edge_filter);
+            shard_flushinfo<EdgeDataType> * flushinfo = new shard_flushinfo<EdgeDataType>(shovel_filename(numshovels), max_vertex_id, curshovel_idx, curshovel_buffer, duplicate_edge_filter,
+                                                                                           preaggregate);
             shoveltasks.push_back(flushinfo);
+            if (shovel_index != NULL) shovel_index->clear();
 
             if (!async) {
                 curshovel_buffer = NULL;
@@ -437,12 +684,23 @@ namespace graphchi {
             }
             last_added_edge = e;
 #endif
+            max_vertex_id = std::max(std::max(from, to), max_vertex_id);
+            if (shovel_index != NULL) {
+                uint32_t * slot = shovel_index->find(from, to, curshovel_buffer);
+                if (*slot != 0) {
+                    edge_with_value<EdgeDataType> &prev = curshovel_buffer[*slot - 1];
+                    if (duplicate_edge_filter->acceptFirst(e.value, prev.value)) {
+                        prev = e;
+                    }
+                    preaggregated_edges++;
+                    return;
+                }
+                *slot = (uint32_t) (curshovel_idx + 1);
+            }
             curshovel_buffer[curshovel_idx++] = e;
             if (curshovel_idx == shovelsize) {
                 flush_shovel();
             }
-            
-            max_vertex_id = std::max(std::max(from, to), max_vertex_id);
         }
         
 #ifdef DYNAMICEDATA
@@ -463,6 +721,113 @@ namespace graphchi {
             preprocessing_add_edge(from, to, EdgeDataType());
         }
         
+        /**
+         * Adds a batch of packed binary edge records: (src, dst) pairs of vid_t,
+         * followed by an EdgeDataType value if has_values is set. Records need not
+         * be aligned. Edges are copied into the shovel in large parallel batches;
+         * self-edges are dropped.
+         */
+        void preprocessing_add_edges(const void * records, size_t nrecords, bool has_values) {
+            const size_t stride = 2 * sizeof(vid_t) + (has_values ? sizeof(EdgeDataType) : 0);
+            const uint8_t * data = (const uint8_t *) records;
+            
+#ifndef DYNAMICEDATA
+            if (shovel_index == NULL) {
+                size_t done = 0;
+                while(done < nrecords) {
+                    size_t n = std::min(nrecords - done, shovelsize - curshovel_idx);
+                    edge_with_value<EdgeDataType> * out = curshovel_buffer + curshovel_idx;
+                    const uint8_t * in = data + done * stride;
+                    vid_t maxid = max_vertex_id;
+                    size_t selfedges = 0;
+                    
+#pragma omp parallel for reduction(max:maxid) reduction(+:selfedges)
+                    for(size_t i=0; i < n; i++) {
+                        const uint8_t * rec = in + i * stride;
+                        edge_with_value<EdgeDataType> &e = out[i];
+                        memcpy(&e.src, rec, sizeof(vid_t));
+                        memcpy(&e.dst, rec + sizeof(vid_t), sizeof(vid_t));
+                        if (has_values) {
+                            memcpy(&e.value, rec + 2 * sizeof(vid_t), sizeof(EdgeDataType));
+                        } else {
+                            e.value = EdgeDataType();
+                        }
+                        if (e.src == e.dst) {
+                            selfedges++; // Does not count for the number of vertices, as in preprocessing_add_edge()
+                        } else {
+                            maxid = std::max(maxid, std::max(e.src, e.dst));
+                        }
+                    }
+                    
+                    if (selfedges > 0) {
+                        /* Self-edges are not allowed: compact them away */
+                        size_t j = 0;
+                        for(size_t i=0; i < n; i++) {
+                            if (out[i].src != out[i].dst) out[j++] = out[i];
+                        }
+                        assert(j == n - selfedges);
+                    }
+                    max_vertex_id = maxid;
+                    curshovel_idx += n - selfedges;
+                    done += n;
+                    if (curshovel_idx == shovelsize) {
+                        flush_shovel();
+                    }
+                }
+                return;
+            }
+#endif
+            /* Edges need to go through the duplicate combiner (or dynamic edge data), one by one */
+            for(size_t i=0; i < nrecords; i++) {
+                const uint8_t * rec = data + i * stride;
+                vid_t from, to;
+                EdgeDataType val = EdgeDataType();
+                memcpy(&from, rec, sizeof(vid_t));
+                memcpy(&to, rec + sizeof(vid_t), sizeof(vid_t));
+                if (has_values) memcpy(&val, rec + 2 * sizeof(vid_t), sizeof(EdgeDataType));
+                preprocessing_add_edge(from, to, val);
+            }
+        }
+        
+        /**
+         * Adds all edges of a binary edge list file (see preprocessing_add_edges()
+         * for the record format). The file is memory mapped and read sequentially.
+         */
+        void preprocessing_add_binary_file(std::string filename, bool has_values) {
+            const size_t stride = 2 * sizeof(vid_t) + (has_values ? sizeof(EdgeDataType) : 0);
+            int f = open(filename.c_str(), O_RDONLY);
+            if (f < 0) {
+                logstream(LOG_FATAL) << "Could not open " << filename << " error: " << strerror(errno) << std::endl;
+            }
+            assert(f >= 0);
+            size_t filesize = get_filesize(filename);
+            if (filesize % stride != 0) {
+                logstream(LOG_WARNING) << "Size of " << filename << " is not a multiple of the record size " << stride
+                    << ", ignoring the last " << (filesize % stride) << " bytes." << std::endl;
+            }
+            size_t nrecords = filesize / stride;
+            if (nrecords == 0) {
+                close(f);
+                return;
+            }
+            uint8_t * data = (uint8_t *) mmap(NULL, filesize, PROT_READ, MAP_SHARED, f, 0);
+            assert(data != MAP_FAILED);
+            madvise(data, filesize, MADV_SEQUENTIAL);
+            
+            /* Process in pieces so that pages already consumed can be dropped */
+            size_t chunk_records = std::max((size_t)1, (size_t)(256 * 1024 * 1024) / stride);
+            size_t pagesize = (size_t) sysconf(_SC_PAGESIZE);
+            for(size_t st=0; st < nrecords; st += chunk_records) {
+                size_t n = std::min(chunk_records, nrecords - st);
+                preprocessing_add_edges(data + st * stride, n, has_values);
+                size_t consumed = (st + n) * stride / pagesize * pagesize;
+                madvise(data, consumed, MADV_DONTNEED);
+                logstream(LOG_DEBUG) << "Read " << (st + n) << " / " << nrecords << " edges from " << filename << std::endl;
+            }
+            munmap(data, filesize);
+            close(f);
+        }
+        
         size_t curadjfilepos;
         
         /** Buffered write function */
@@ -489,6 +854,7 @@ namespace graphchi {
             int f = open(block_filename.c_str(), O_RDWR | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
             write_compressed(f, buf, len);
             close(f);
+            edata_stored_bytes += get_filesize(block_filename);
             
             m.stop_time("edata_flush");
             
@@ -539,6 +905,7 @@ namespace graphchi {
             write_shards();
             
             m.stop_time("execute_sharding");
+            write_sharding_report();
             
             /* Print metrics */
             basic_reporter basicrep;
@@ -555,8 +922,11 @@ namespace graphchi {
         virtual void determine_number_of_shards(std::string nshards_string) {
             /* Count shoveled edges */
             shoveled_edges = 0;
+            shovel_raw_bytes = shovel_stored_bytes = 0;
             for(int i=0; i<(int)shoveltasks.size(); i++) {
                 shoveled_edges += shoveltasks[i]->numedges;
+                shovel_raw_bytes += shoveltasks[i]->numedges * sizeof(edge_with_value<EdgeDataType>);
+                shovel_stored_bytes += shoveltasks[i]->shovel_bytes;
                 delete shoveltasks[i];
             }
             
@@ -619,7 +989,9 @@ namespace graphchi {
         
         virtual void finish_shard(int shard, edge_t * shovelbuf, size_t shovelsize) {
             m.start_time("shard_final");
+            metrics_entry shard_timer = m.start_time();
             blockid = 0;
+            edata_stored_bytes = 0;
             size_t edgecounter = 0;
             curadjfilepos = 0;
             logstream(LOG_INFO) << "Starting final processing for shard: " << shard << std::endl;
@@ -645,26 +1017,8 @@ namespace graphchi {
 
             // Remove duplicates
             if (duplicate_edge_filter != NULL && numedges > 0) {
-                edge_t * tmpbuf = (edge_t*) calloc(numedges, sizeof(edge_t));
-                size_t i = 1;
-                tmpbuf[0] = shovelbuf[0];
-                for(size_t j=1; j<numedges; j++) {
-                    edge_t prev = tmpbuf[i - 1];
-                    edge_t cur = shovelbuf[j];
-                    
-                    if (prev.src == cur.src && prev.dst == cur.dst) {
-                        if (duplicate_edge_filter->acceptFirst(cur.value, prev.value)) {
-                            // Replace the edge with the newer one
-                            tmpbuf[i - 1] = cur;
-                        }
-                    } else {
-                        tmpbuf[i++] = cur;
-                    }
-                }
-                numedges = i;
+                numedges = remove_duplicate_edges(shovelbuf, numedges, duplicate_edge_filter);
                 logstream(LOG_DEBUG) << "After duplicate elimination: " << numedges << " edges" << std::endl;
-                free(shovelbuf);
-                shovelbuf = tmpbuf; tmpbuf = NULL;
             }
             
             // Index file
@@ -841,9 +1195,25 @@ namespace graphchi {
 #endif
                 
                 ofs.close();
+                
+                /* Deletions of an earlier version of the shard do not apply */
+                remove(filename_shard_deletions(edfname).c_str());
             }
             free(ebuf);
             
+            shard_timer.timer_stop();
+            shard_statistics st;
+            st.shard = shard;
+            st.interval_st = intervals[shard].first;
+            st.interval_en = intervals[shard].second;
+            st.numedges = numedges;
+            st.adj_bytes = curadjfilepos;
+            st.edata_bytes = no_edgevalues ? 0 : tot_edatabytes;
+            st.edata_stored_bytes = no_edgevalues ? 0 : edata_stored_bytes;
+            st.edata_blocks = no_edgevalues ? 0 : blockid;
+            st.seconds = shard_timer.lasttime;
+            shardstats.push_back(st);
+            
             m.stop_time("shard_final");
         }
         
@@ -875,6 +1245,12 @@ namespace graphchi {
             sharded_edges++;
         }
         
+        virtual void add_batch(edge_with_value<EdgeDataType> * vals, size_t n) {
+            for(size_t i=0; i < n; i++) {
+                sharder<EdgeDataType, FinalEdgeDataType>::add(vals[i]);
+            }
+        }
+        
         void createnextshard() {
             assert(shardnum < nshards);
             intervals.push_back(std::pair<vid_t, vid_t>(this_interval_start, (shardnum == nshards - 1 ? max_vertex_id : prevvid)));
@@ -969,21 +1345,24 @@ namespace graphchi {
             
             /* Initialize kway merge sources */
             size_t B = membudget_mb * 1024 * 1024 / 2 / numshovels;
-            while (B % sizeof(edge_with_value<EdgeDataType>) != 0) B++;
             logstream(LOG_INFO) << "Buffer size in merge phase: " << B << std::endl;
             prevvid = (-1);
+            stripedio * merge_iomgr = new stripedio(m);
             std::vector< merge_source<edge_with_value<EdgeDataType> > *> sources;
             for(int i=0; i < numshovels; i++) {
-                sources.push_back(new shovel_merge_source<EdgeDataType>(B, shovel_filename(i)));
+                sources.push_back(new shovel_merge_source<EdgeDataType>(merge_iomgr, B, shovel_filename(i)));
             }
             
+            m.start_time("merge");
             kway_merge<edge_with_value<EdgeDataType> > merger(sources, this);
             merger.merge();
+            m.stop_time("merge");
             
             // Delete sources
             for(int i=0; i < (int)sources.size(); i++) {
                 delete (shovel_merge_source<EdgeDataType> *)sources[i];
             }
+            delete merge_iomgr;
             
             
             if (!count_degrees_inmem) {
@@ -1008,6 +1387,132 @@ namespace graphchi {
         }
         
         
+        /**
+         * Writes a JSON report of the shards: sizes, compression, degree
+         * distribution, memory needed for the largest memory shard and an
+         * estimate of the I/O of one engine iteration. Use it to tune nshards
+         * and the block size before running expensive computations.
+         */
+        void write_sharding_report() {
+            std::string reportfile = filename_sharding_report(basefilename, nshards);
+            size_t membudget = 1024l * 1024l * size_t(get_option_int("membudget_mb", 1024));
+            
+            std::stringstream json;
+            json << "{" << std::endl;
+            json << "  \"numVertices\": " << (max_vertex_id + 1) << "," << std::endl;
+            json << "  \"numEdges\": " << sharded_edges << "," << std::endl;
+            json << "  \"nshards\": " << nshards << "," << std::endl;
+            json << "  \"compressedBlockSize\": " << compressed_block_size << "," << std::endl;
+            json << "  \"membudgetBytes\": " << membudget << "," << std::endl;
+            json << "  \"shovels\": {\"count\": " << numshovels << ", \"rawBytes\": " << shovel_raw_bytes
+                << ", \"storedBytes\": " << shovel_stored_bytes << "}," << std::endl;
+            
+            /* Shards */
+            size_t tot_adj = 0, tot_edata = 0, tot_stored = 0, max_memshard = 0;
+            int max_memshard_idx = 0;
+            json << "  \"shards\": [" << std::endl;
+            for(int i=0; i < (int)shardstats.size(); i++) {
+                shard_statistics &st = shardstats[i];
+                tot_adj += st.adj_bytes;
+                tot_edata += st.edata_bytes;
+                tot_stored += st.edata_stored_bytes;
+                /* The memory shard holds the adjacency and the uncompressed edge data */
+                size_t memshard = st.adj_bytes + st.edata_bytes;
+                if (memshard > max_memshard) {
+                    max_memshard = memshard;
+                    max_memshard_idx = st.shard;
+                }
+                json << "    {\"shard\": " << st.shard << ", \"intervalStart\": " << st.interval_st
+                    << ", \"intervalEnd\": " << st.interval_en << ", \"edges\": " << st.numedges
+                    << ", \"adjBytes\": " << st.adj_bytes << ", \"edataBytes\": " << st.edata_bytes
+                    << ", \"edataStoredBytes\": " << st.edata_stored_bytes << ", \"edataBlocks\": " << st.edata_blocks
+                    << ", \"compressionRatio\": " << (st.edata_stored_bytes > 0 ? (double)st.edata_bytes / st.edata_stored_bytes : 1.0)
+                    << ", \"seconds\": " << st.seconds << "}" << (i + 1 < (int)shardstats.size() ? "," : "") << std::endl;
+            }
+            json << "  ]," << std::endl;
+            json << "  \"totals\": {\"adjBytes\": " << tot_adj << ", \"edataBytes\": " << tot_edata
+                << ", \"edataStoredBytes\": " << tot_stored
+                << ", \"compressionRatio\": " << (tot_stored > 0 ? (double)tot_edata / tot_stored : 1.0) << "}," << std::endl;
+            json << "  \"memoryShard\": {\"maxBytes\": " << max_memshard << ", \"shard\": " << max_memshard_idx
+                << ", \"fractionOfMembudget\": " << (double)max_memshard / membudget << "}," << std::endl;
+            
+            /* During one iteration each shard is loaded once as the memory shard and streamed
+               once through the sliding windows, except for the window of its own interval.
+               Edge data is written back the same way. Vertex data is not included. */
+            double sliding_fraction = 1.0 - 1.0 / std::max(1, nshards);
+            size_t est_read = (size_t) ((tot_adj + tot_stored) * (1.0 + sliding_fraction));
+            size_t est_write = (size_t) (tot_stored * (1.0 + sliding_fraction));
+            json << "  \"iterationEstimate\": {\"readBytes\": " << est_read << ", \"writeBytes\": " << est_write << "}," << std::endl;
+            
+            json << "  \"degrees\": " << degree_summary_json() << "," << std::endl;
+            
+            /* Phase times */
+            const char * phases[] = {"preprocessing", "merge", "finish_shard.sort", "edata_flush", "shard_final", "degrees.runtime", "execute_sharding"};
+            json << "  \"phaseSeconds\": {";
+            bool first = true;
+            for(int i=0; i < (int) (sizeof(phases) / sizeof(phases[0])); i++) {
+                if (!m.has(phases[i])) continue;
+                json << (first ? "" : ", ") << "\"" << phases[i] << "\": " << m.get(phases[i]).value;
+                first = false;
+            }
+            json << "}" << std::endl;
+            json << "}" << std::endl;
+            
+            std::ofstream ofs(reportfile.c_str());
+            ofs << json.str();
+            ofs.close();
+            logstream(LOG_INFO) << "Wrote sharding report: " << reportfile << std::endl;
+        }
+        
+        /**
+         * Summary of the degree distribution, read from the degree file.
+         * The histogram has log2-sized buckets of the total degree.
+         */
+        std::string degree_summary_json() {
+            std::string degreefname = filename_degree_data(basefilename);
+            int f = open(degreefname.c_str(), O_RDONLY);
+            if (f < 0) return "null";
+            size_t nverts = get_filesize(degreefname) / sizeof(degree);
+            size_t bufverts = 1024 * 1024;
+            degree * buf = (degree *) malloc(bufverts * sizeof(degree));
+            size_t maxin = 0, maxout = 0, isolated = 0, totin = 0;
+            std::vector<size_t> histogram(33, 0);
+            for(size_t st=0; st < nverts; st += bufverts) {
+                size_t n = std::min(bufverts, nverts - st);
+                preada(f, buf, n * sizeof(degree), st * sizeof(degree));
+                for(size_t i=0; i < n; i++) {
+                    size_t in = buf[i].indegree, out = buf[i].outdegree;
+                    maxin = std::max(maxin, in);
+                    maxout = std::max(maxout, out);
+                    totin += in;
+                    size_t d = in + out;
+                    if (d == 0) {
+                        isolated++;
+                        continue;
+                    }
+                    int b = 0;
+                    while(d >>= 1) b++;
+                    histogram[b]++;
+                }
+            }
+            free(buf);
+            close(f);
+            
+            int lastbucket = 0;
+            for(int b=0; b < (int)histogram.size(); b++) if (histogram[b] > 0) lastbucket = b;
+            
+            std::stringstream json;
+            json << "{\"maxIndegree\": " << maxin << ", \"maxOutdegree\": " << maxout
+                << ", \"avgDegree\": " << (nverts > 0 ? (double)totin / nverts : 0.0)
+                << ", \"isolatedVertices\": " << isolated << ", \"log2Histogram\": [";
+            for(int b=0; b <= lastbucket; b++) {
+                json << (b > 0 ? ", " : "") << histogram[b];
+            }
+            json << "]}";
+            return json.str();
+        }
+        
+        
         typedef char dummy_t;
         
         typedef sliding_shard<int, dummy_t> slidingshard_t;
@@ -0,0 +1,226 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Compressed format for the shovel files the sharder spills to disk.
+ * A shovel is sorted by destination, so it is stored as blocks where
+ * vertex ids are delta-encoded as varints, and each block is then compressed
+ * with zlib (fastest level). Layout of the file:
+ *
+ *   [block 0][block 1]...[block n-1][n x shovel_block_info][shovel_footer]
+ *
+ * The block index at the end allows the reader to fetch many blocks
+ * with one large read.
+ */
+
+#ifndef DEF_GRAPHCHI_SHOVELFILE
+#define DEF_GRAPHCHI_SHOVELFILE
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "graphchi_types.hpp"
+#include "logger/logger.hpp"
+#include "util/ioutil.hpp"
+
+namespace graphchi {
+
+    /* Uncompressed size of a shovel block */
+#define SHOVEL_BLOCKSIZE (1024 * 1024)
+
+    struct shovel_block_info {
+        uint32_t nedges;
+        uint32_t encoded_size;   // Size of the delta-encoded data
+        uint32_t stored_size;    // Size on disk. Equals encoded_size if stored uncompressed.
+        uint32_t reserved;
+    };
+
+    struct shovel_footer {
+        uint64_t numblocks;
+        uint64_t numedges;
+    };
+
+    inline uint8_t * varint_encode(uint64_t x, uint8_t * out) {
+        while(x >= 0x80) {
+            *(out++) = (uint8_t) (x | 0x80);
+            x >>= 7;
+        }
+        *(out++) = (uint8_t) x;
+        return out;
+    }
+
+    inline const uint8_t * varint_decode(const uint8_t * in, uint64_t &x) {
+        x = 0;
+        int shift = 0;
+        while(*in & 0x80) {
+            x |= (uint64_t)(*(in++) & 0x7f) << shift;
+            shift += 7;
+        }
+        x |= (uint64_t)(*(in++)) << shift;
+        return in;
+    }
+
+    /* Upper bound for the encoded size of one edge */
+    template <typename edge_t>
+    size_t shovel_max_encoded_edge_size() {
+        return 10 + 10 + sizeof(edge_t);
+    }
+
+    /**
+     * Encodes edges sorted by destination: the destination as a delta to
+     * the previous destination, the source as a zig-zag encoded delta to the
+     * previous source, followed by the raw edge value.
+     */
+    template <typename edge_t>
+    size_t shovel_encode_block(edge_t * edges, size_t n, uint8_t * out) {
+        uint8_t * ptr = out;
+        int64_t prevsrc = 0, prevdst = 0;
+        for(size_t i=0; i < n; i++) {
+            edge_t &e = edges[i];
+            assert((int64_t)e.dst >= prevdst);
+            ptr = varint_encode((uint64_t) ((int64_t)e.dst - prevdst), ptr);
+            int64_t d = (int64_t)e.src - prevsrc;
+            ptr = varint_encode((uint64_t) ((d << 1) ^ (d >> 63)), ptr);
+            prevsrc = e.src;
+            prevdst = e.dst;
+            memcpy(ptr, &e.value, sizeof(e.value));
+            ptr += sizeof(e.value);
+#ifdef DYNAMICEDATA
+            *(ptr++) = (uint8_t) e.is_chivec_value;
+            memcpy(ptr, &e.valindex, sizeof(e.valindex));
+            ptr += sizeof(e.valindex);
+#endif
+        }
+        return ptr - out;
+    }
+
+    template <typename edge_t>
+    void shovel_decode_block(const uint8_t * in, size_t n, edge_t * edges) {
+        int64_t prevsrc = 0, prevdst = 0;
+        for(size_t i=0; i < n; i++) {
+            edge_t &e = edges[i];
+            uint64_t x;
+            in = varint_decode(in, x);
+            prevdst += (int64_t) x;
+            in = varint_decode(in, x);
+            prevsrc += (int64_t) ((x >> 1) ^ (~(x & 1) + 1));
+            e.dst = (vid_t) prevdst;
+            e.src = (vid_t) prevsrc;
+            memcpy(&e.value, in, sizeof(e.value));
+            in += sizeof(e.value);
+#ifdef DYNAMICEDATA
+            e.is_chivec_value = *(in++) != 0;
+            memcpy(&e.valindex, in, sizeof(e.valindex));
+            in += sizeof(e.valindex);
+#endif
+        }
+    }
+
+    /**
+     * Writes a sorted shovel. Returns the number of bytes written.
+     */
+    template <typename edge_t>
+    size_t write_shovel(std::string filename, edge_t * edges, size_t numedges) {
+        int f = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+        if (f < 0) {
+            logstream(LOG_ERROR) << "Could not open shovel file: " << filename << " error: " << strerror(errno) << std::endl;
+        }
+        assert(f >= 0);
+
+        size_t block_edges = std::max((size_t)1, (size_t) SHOVEL_BLOCKSIZE / sizeof(edge_t));
+        size_t encbufsize = block_edges * shovel_max_encoded_edge_size<edge_t>();
+        uint8_t * encbuf = (uint8_t *) malloc(encbufsize);
+        uLongf zbufsize = compressBound((uLong) encbufsize);
+        uint8_t * zbuf = (uint8_t *) malloc(zbufsize);
+
+        std::vector<shovel_block_info> index;
+        size_t totbytes = 0;
+        for(size_t st=0; st < numedges; st += block_edges) {
+            size_t n = std::min(block_edges, numedges - st);
+            shovel_block_info info;
+            info.nedges = (uint32_t) n;
+            info.encoded_size = (uint32_t) shovel_encode_block(edges + st, n, encbuf);
+            info.reserved = 0;
+
+            uint8_t * out = encbuf;
+            info.stored_size = info.encoded_size;
+#ifndef GRAPHCHI_DISABLE_COMPRESSION
+            uLongf zlen = zbufsize;
+            int ret = compress2(zbuf, &zlen, encbuf, info.encoded_size, Z_BEST_SPEED);
+            if (ret != Z_OK) {
+                logstream(LOG_FATAL) << "Could not compress block " << index.size() << " of shovel file " << filename
+                    << ", zlib error: " << ret << std::endl;
+            }
+            if (zlen < info.encoded_size) {
+                out = zbuf;
+                info.stored_size = (uint32_t) zlen;
+            }
+#endif
+            writea(f, out, info.stored_size);
+            totbytes += info.stored_size;
+            index.push_back(info);
+        }
+
+        shovel_footer footer;
+        footer.numblocks = index.size();
+        footer.numedges = numedges;
+        if (!index.empty()) writea(f, &index[0], index.size() * sizeof(shovel_block_info));
+        writea(f, &footer, sizeof(shovel_footer));
+        close(f);
+        free(encbuf);
+        free(zbuf);
+        return totbytes + index.size() * sizeof(shovel_block_info) + sizeof(shovel_footer);
+    }
+
+    /**
+     * Decodes a stored block into edges. Scratch buffer must hold
+     * encoded_size bytes. The file name and block number are for the error messages.
+     */
+    template <typename edge_t>
+    void shovel_read_block(const std::string &filename, size_t blockidx, const shovel_block_info &info,
+                           uint8_t * stored, uint8_t * scratch, edge_t * edges) {
+        const uint8_t * encoded = stored;
+        if (info.stored_size != info.encoded_size) {
+            uLongf len = info.encoded_size;
+            int ret = uncompress(scratch, &len, stored, info.stored_size);
+            if (ret != Z_OK || len != info.encoded_size) {
+                logstream(LOG_FATAL) << "Corrupt block " << blockidx << " of shovel file " << filename << ": zlib error " << ret
+                    << ", decompressed " << len << " of " << info.encoded_size << " bytes." << std::endl;
+            }
+            encoded = scratch;
+        }
+        shovel_decode_block(encoded, info.nedges, edges);
+    }
+
+}
+
+#endif
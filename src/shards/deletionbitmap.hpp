@@ -0,0 +1,134 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Deletion bitmap of a shard: one bit for each edge of the shard, in the
+ * order of the edge data file. Set bits denote deleted edges, which the
+ * shards skip when they create the edges of the vertices. The bitmap is
+ * stored next to the edge data (see filename_shard_deletions()), so edge
+ * values never need to encode the deleted status, and edge data can be
+ * loaded asynchronously also when deletions are supported.
+ */
+
+#ifndef DEF_GRAPHCHI_DELETIONBITMAP
+#define DEF_GRAPHCHI_DELETIONBITMAP
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "api/chifilenames.hpp"
+#include "io/stripedio.hpp"
+#include "logger/logger.hpp"
+#include "util/ioutil.hpp"
+
+namespace graphchi {
+
+    class deletion_bitmap {
+
+        std::string filename;
+        size_t nedges;
+        std::vector<uint32_t> words;
+        size_t ndeleted;
+        bool dirty;
+
+    public:
+
+        /**
+         * Loads the bitmap of the shard with given edge data file, if it exists.
+         * @param nedges number of edges in the shard
+         */
+        deletion_bitmap(std::string edata_filename, size_t nedges) : filename(filename_shard_deletions(edata_filename)),
+        nedges(nedges), words((nedges + 31) / 32, 0), ndeleted(0), dirty(false) {
+            if (!file_exists(filename)) return;
+            size_t sz = get_filesize(filename);
+            if (sz != words.size() * sizeof(uint32_t)) {
+                logstream(LOG_WARNING) << "Ignoring deletion bitmap of wrong size: " << filename << " " << sz
+                    << " != " << words.size() * sizeof(uint32_t) << std::endl;
+                return;
+            }
+            if (sz > 0) {
+                int f = open(filename.c_str(), O_RDONLY);
+                assert(f >= 0);
+                preada(f, &words[0], sz, 0);
+                close(f);
+            }
+            for(size_t i=0; i < words.size(); i++) {
+                ndeleted += __builtin_popcount(words[i]);
+            }
+        }
+
+        ~deletion_bitmap() {
+            save();
+        }
+
+        inline bool is_deleted(size_t edgeidx) const {
+            return ndeleted > 0 && ((words[edgeidx >> 5] >> (edgeidx & 31)) & 1);
+        }
+
+        /**
+         * Marks an edge deleted. Thread-safe.
+         * @return true if the edge was not deleted before
+         */
+        bool mark_deleted(size_t edgeidx) {
+            assert(edgeidx < nedges);
+            uint32_t bit = 1u << (edgeidx & 31);
+            uint32_t old = __sync_fetch_and_or(&words[edgeidx >> 5], bit);
+            if (old & bit) return false;
+            __sync_add_and_fetch(&ndeleted, 1);
+            dirty = true;
+            return true;
+        }
+
+        size_t num_deleted() const {
+            return ndeleted;
+        }
+
+        size_t num_edges() const {
+            return nedges;
+        }
+
+        /**
+         * Writes the bitmap, if edges have been deleted since it was loaded.
+         */
+        void save() {
+            if (!dirty) return;
+            int f = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+            if (f < 0) {
+                logstream(LOG_ERROR) << "Could not write deletion bitmap: " << filename << " error: " << strerror(errno) << std::endl;
+            }
+            assert(f >= 0);
+            if (!words.empty()) pwritea(f, &words[0], words.size() * sizeof(uint32_t), 0);
+            close(f);
+            dirty = false;
+        }
+    };
+
+}
+
+#endif
+
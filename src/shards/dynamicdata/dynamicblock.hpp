@@ -31,6 +31,8 @@
 
 #include <stdint.h>
 
+#include "api/dynamicdata/chivector.hpp"
+
 namespace graphchi {
     
     int get_block_uncompressed_size(std::string blockfilename, int defaultsize);
@@ -70,22 +72,32 @@ namespace graphchi {
     }
     
     
+    /**
+     * Block of chivectors. The block is a sequence of slots: a size word
+     * (size and capacity of the slot) followed by capacity elements. Slot
+     * capacities are size classes (see chivector::size_class()), so that
+     * vectors can usually grow within their slot. The chivectors are
+     * edited in place in the loaded data, and if all of them still fit in
+     * their slots, writing the block only updates the sizes.
+     */
     template <typename ET>
     struct dynamicdata_block {
         int nitems;
         uint8_t * data;
+        int datasize;
         ET * chivecs;
+        extension_pool<typename ET::element_type_t> pool; // Grown chivectors, released with the block
         
         dynamicdata_block() : data(NULL), chivecs(NULL) {}
         
-        dynamicdata_block(int nitems, uint8_t * data, int datasize) : nitems(nitems){
+        dynamicdata_block(int nitems, uint8_t * data, int datasize) : nitems(nitems), data(data), datasize(datasize) {
             chivecs = new ET[nitems];
             uint8_t * ptr = data;
             for(int i=0; i < nitems; i++) {
                 assert(ptr - data <= datasize);
                 typename ET::sizeword_t * sz = ((typename ET::sizeword_t *) ptr);
                 ptr += sizeof(typename ET::sizeword_t);
-                chivecs[i] = ET(((uint16_t *)sz)[0], ((uint16_t *)sz)[1], (typename ET::element_type_t *) ptr);
+                chivecs[i] = ET(((uint16_t *)sz)[0], ((uint16_t *)sz)[1], (typename ET::element_type_t *) ptr, &pool);
                 ptr += (int) ((uint16_t *)sz)[1] * sizeof(typename ET::element_type_t);
             }
         }
@@ -96,6 +108,46 @@ namespace graphchi {
             return &chivecs[i];
         }
         
+        /**
+         * Returns true if any of the chivectors has been modified. Blocks
+         * that are not dirty do not need to be written.
+         */
+        bool is_dirty() {
+            for(int i=0; i < nitems; i++) {
+                if (chivecs[i].is_modified()) return true;
+            }
+            return false;
+        }
+        
+        /**
+         * Encodes the block for writing. If every chivector fits in its
+         * slot, the values are already in the loaded data: only the sizes are
+         * updated, and the loaded data is returned. Otherwise the block is laid
+         * out again into a new buffer, which the caller must free.
+         * @param size size of the encoded block
+         * @param allocated set true if a new buffer was allocated
+         */
+        uint8_t * encode(int &size, bool &allocated) {
+            bool inplace = (data != NULL);
+            for(int i=0; i < nitems && inplace; i++) {
+                inplace = chivecs[i].fits_slot();
+            }
+            if (inplace) {
+                uint8_t * ptr = data;
+                for(int i=0; i < nitems; i++) {
+                    ((uint16_t *) ptr)[0] = chivecs[i].size();
+                    ptr += sizeof(typename ET::sizeword_t) + (int) ((uint16_t *) ptr)[1] * sizeof(typename ET::element_type_t);
+                }
+                size = datasize;
+                allocated = false;
+                return data;
+            }
+            uint8_t * outdata = NULL;
+            write(&outdata, size);
+            allocated = true;
+            return outdata;
+        }
+        
         void write(uint8_t ** outdata, int & size) {
             // First compute size
             size = 0;
@@ -103,8 +155,8 @@ namespace graphchi {
                 size += chivecs[i].capacity() * sizeof(typename ET::element_type_t) + sizeof(typename ET::sizeword_t);
             }
             
-            *outdata = (uint8_t *) malloc(size);
-            uint8_t * ptr = *outdata;
+            uint8_t * out = (uint8_t *) malloc(size);
+            uint8_t * ptr = out;
             for(int i=0; i < nitems; i++) {
                 ET & vec = chivecs[i];
                 ((uint16_t *) ptr)[0] = vec.size();
@@ -114,6 +166,7 @@ namespace graphchi {
                 vec.write((typename ET::element_type_t *)  ptr);
                 ptr += vec.capacity() * sizeof(typename ET::element_type_t);
             }
+            *outdata = out;
         }
         
         ~dynamicdata_block() {
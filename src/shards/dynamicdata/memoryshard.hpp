@@ -42,6 +42,7 @@
 
 #include "api/graph_objects.hpp"
 #include "metrics/metrics.hpp"
+#include "metrics/trace.hpp"
 #include "io/stripedio.hpp"
 #include "graphchi_types.hpp"
 #include "shards/dynamicdata/dynamicblock.hpp"
@@ -80,6 +81,7 @@ namespace graphchi {
         bool is_loaded;
         size_t blocksize;
         metrics &m;
+        int shard_id;
 
         bool disable_async_writes;
 
@@ -97,6 +99,7 @@ namespace graphchi {
                      metrics &_m) : iomgr(iomgr), filename_edata(_filename_edata),
         filename_adj(_filename_adj),
         range_st(_range_start), range_end(_range_end), blocksize(_blocksize),  m(_m) {
+            shard_id = -1;
             adjdata = NULL;
             only_adjacency = false;
             is_loaded = false;
@@ -134,20 +137,29 @@ namespace graphchi {
             disable_async_writes = b;
         }
         
+        /**
+         * Sets the shard the I/O of this shard is counted to, see io_accounting.
+         */
+        void set_shard_id(int p) {
+            shard_id = p;
+        }
+        
         /* Dynamic edata */ 
         void write_and_release_block(int i) {
             std::string block_filename = filename_shard_edata_block(filename_edata, i, blocksize);
 
             dynamicdata_block<ET> * dynblock = dynamicblocks[i];
             if (dynblock != NULL) {
-                uint8_t * outdata;
-                int outsize;
-                dynblock->write(&outdata, outsize);
-                write_block_uncompressed_size(block_filename, outsize);
-                iomgr->managed_pwritea_now(block_edatasessions[i], &outdata, outsize, 0);
+                if (dynblock->is_dirty()) {
+                    int outsize;
+                    bool allocated;
+                    uint8_t * outdata = dynblock->encode(outsize, allocated);
+                    if (allocated) write_block_uncompressed_size(block_filename, outsize);
+                    iomgr->managed_pwritea_now(block_edatasessions[i], &outdata, outsize, 0);
+                    if (allocated) free(outdata);
+                }
                 iomgr->managed_release(block_edatasessions[i], &edgedata[i]);
                 iomgr->close_session(block_edatasessions[i]);
-                free(outdata);
                 delete dynblock;
             }
             dynamicblocks[i] = NULL;
@@ -155,6 +167,7 @@ namespace graphchi {
         
         /* Dynamic edata */ 
         void commit(bool commit_inedges, bool commit_outedges) {
+            TRACE_SCOPE("memshard_commit", "shard");
             if (block_edatasessions.size() == 0 || only_adjacency) return;
             assert(is_loaded);
             metrics_entry cm = m.start_time();
@@ -168,6 +181,8 @@ namespace graphchi {
             int nblocks = (int) block_edatasessions.size();
 
             if (commit_inedges) {
+                /* Blocks are encoded and compressed in parallel */
+#pragma omp parallel for schedule(dynamic, 1)
                 for(int i=0; i < nblocks; i++) {
                     /* NOTE: WRITE ALL BLOCKS SYNCHRONOUSLY */
                     write_and_release_block(i);
@@ -182,6 +197,7 @@ namespace graphchi {
                 //char * bufp = ((char*)edgedata + range_start_edge_ptr);
                 int startblock = (int) (range_start_edge_ptr / blocksize);
                 int endblock = (int) (last / blocksize);
+#pragma omp parallel for schedule(dynamic, 1)
                 for(int i=0; i < nblocks; i++) {
                     if (i >= startblock && i <= endblock) {
                         write_and_release_block(i);
@@ -213,6 +229,7 @@ namespace graphchi {
         
         /* Dynamic edata */ 
         void load_edata() {
+            TRACE_SCOPE("memshard_load_edata", "shard");
             bool async_inedgedata_loading = false; // Not supported with dynamic edgedata
             assert(blocksize % sizeof(int) == 0);
             int nblocks = (int) (edatafilesize / blocksize + (edatafilesize % blocksize != 0));
@@ -226,7 +243,7 @@ namespace graphchi {
                 if (file_exists(block_filename)) {
                     size_t fsize = get_block_uncompressed_size(block_filename, std::min(edatafilesize - blocksize * blockid, blocksize)); //std::min(edatafilesize - blocksize * blockid, blocksize);
                     compressedsize += get_filesize(block_filename);
-                    int blocksession = iomgr->open_session(block_filename, false, true); // compressed
+                    int blocksession = iomgr->open_session(block_filename, false, true, io_tag(IO_EDATA, shard_id), MEM_MEMSHARD); // compressed
                     block_edatasessions.push_back(blocksession);
                     blocksizes.push_back(fsize);
                     edgedata[blockid] = NULL;
@@ -267,18 +284,14 @@ namespace graphchi {
         
         /* Dynamic edata */ 
         void load() {
+            TRACE_SCOPE("memshard_load", "shard");
             is_loaded = true;
             adjfilesize = get_filesize(filename_adj);
             edatafilesize = get_shard_edata_filesize<ET>(filename_edata);            
             
-#ifdef SUPPORT_DELETIONS
-            async_inedgedata_loading = false;  // Currently we encode the deleted status of an edge into the edge value (should be changed!),
-            // so we need the edge data while loading
-#endif
-            
             //preada(adjf, adjdata, adjfilesize, 0);
             
-            adj_session = iomgr->open_session(filename_adj, true);
+            adj_session = iomgr->open_session(filename_adj, true, false, io_tag(IO_ADJ, shard_id), MEM_MEMSHARD);
             iomgr->managed_malloc(adj_session, &adjdata, adjfilesize, 0);
             
             size_t bufsize = 16 * 1204 * 1024;
@@ -42,6 +42,7 @@
 
 #include "api/graph_objects.hpp"
 #include "metrics/metrics.hpp"
+#include "metrics/trace.hpp"
 #include "logger/logger.hpp"
 #include "io/stripedio.hpp"
 #include "graphchi_types.hpp"
@@ -89,12 +90,13 @@ namespace graphchi {
                 size_t len = ptr-data;
                 if (len > end-offset) len = end-offset;
                 if (is_edata_block) {
-                    uint8_t * outdata = NULL;
+                    if (!dynblock->is_dirty()) return;
                     int realsize;
-                    dynblock->write(&outdata, realsize);
-                    write_block_uncompressed_size(blockfilename, realsize);
+                    bool allocated;
+                    uint8_t * outdata = dynblock->encode(realsize, allocated);
+                    if (allocated) write_block_uncompressed_size(blockfilename, realsize);
                     iomgr->managed_pwritea_now(writedesc, &outdata, realsize, 0); /* Need to write whole block in the compressed regime */
-                    free(outdata);
+                    if (allocated) free(outdata);
                 } else {
                     iomgr->managed_pwritea_now(writedesc, &data, len, offset);
                 }
@@ -150,6 +152,7 @@ namespace graphchi {
         std::string filename_adj;
         vid_t range_st, range_end;
         size_t blocksize;
+        size_t adj_readsize;  // Size of the reads of the adjacency file
         
         vid_t curvid;
         size_t adjoffset, edataoffset, adjfilesize, edatafilesize;
@@ -161,11 +164,13 @@ namespace graphchi {
         sblock<ET> * curblock;
         sblock<ET> * curadjblock;
         metrics &m;
+        metrics_handle blockload_timer;
         
         std::map<int, indexentry> sparse_index; // Sparse index that can be created in the fly
         bool disable_writes;
         bool disable_async_writes;
         bool async_edata_loading;
+        int shard_id;
         // bool need_read_outedges; // Disabled - does not work with compressed data: whole block needs to be read.
         
         
@@ -180,8 +185,10 @@ namespace graphchi {
         range_st(_range_st),
         range_end(_range_en),
         blocksize(_blocksize),
+        adj_readsize(_blocksize),
         m(_m),
         disable_writes(_disable_writes) {
+            blockload_timer = m.register_timer("blockload");
             curvid = 0;
             adjoffset = 0;
             edataoffset = 0;
@@ -191,6 +198,7 @@ namespace graphchi {
             curadjblock = NULL;
             window_start_edataoffset = 0;
             disable_async_writes = false;
+            shard_id = -1;
             
             while(blocksize % sizeof(int) != 0) blocksize++;
             assert(blocksize % sizeof(int)==0);
@@ -203,7 +211,7 @@ namespace graphchi {
                 // Nothing
             }
             
-            adjfile_session = iomgr->open_session(filename_adj, true);
+            adjfile_session = iomgr->open_session(filename_adj, true, false, io_tag(IO_ADJ), MEM_SLIDING_BLOCKS);
             save_offset();
             
             async_edata_loading = false; // With dynamic edge data size, do not load
@@ -277,7 +285,7 @@ namespace graphchi {
                 }
                 // Load next
                 std::string blockfilename = filename_shard_edata_block(filename_edata, (int) (edataoffset / blocksize), blocksize);
-                int edata_session = iomgr->open_session(blockfilename, false, true);
+                int edata_session = iomgr->open_session(blockfilename, false, true, io_tag(IO_EDATA, shard_id), MEM_SLIDING_BLOCKS);
                 sblock<ET> newblock(edata_session, edata_session, true, blockfilename);
                 
                 // We align blocks always to the blocksize, even if that requires
@@ -305,14 +313,14 @@ namespace graphchi {
                 }
                 sblock<ET> * newblock = new sblock<ET>(0, adjfile_session);
                 newblock->offset = adjoffset;
-                newblock->end = std::min(adjfilesize, adjoffset+blocksize);
+                newblock->end = std::min(adjfilesize, adjoffset+adj_readsize);
                 assert(newblock->end > 0);
                 assert(newblock->end >= newblock->offset);
                 iomgr->managed_malloc(adjfile_session, &newblock->data, newblock->end - newblock->offset, adjoffset);
                 newblock->ptr = newblock->data;
-                metrics_entry me = m.start_time();
+                metrics_timer me = m.start_timer();
                 iomgr->managed_preada_now(adjfile_session, &newblock->data, newblock->end - newblock->offset, adjoffset);
-                m.stop_time(me, "blockload");
+                m.stop_timer(me, blockload_timer);
                 curadjblock = newblock;
             }
         }
@@ -434,6 +442,7 @@ namespace graphchi {
          * Commit modifications.
          */
         void commit(sblock<ET> &b, bool synchronously, bool disable_writes=false) {
+            TRACE_SCOPE("slidingshard_commit", "shard");
             if (disable_async_writes) synchronously = true;
             if (synchronously) {
                 metrics_entry me = m.start_time();
@@ -495,6 +504,22 @@ namespace graphchi {
             disable_async_writes = b;
         }
         
+        /**
+         * Sets the shard the I/O of this shard is counted to, see io_accounting.
+         */
+        void set_shard_id(int p) {
+            shard_id = p;
+            iomgr->set_session_tag(adjfile_session, io_tag(IO_ADJ, p));
+        }
+        
+        /**
+         * Sets the size of the reads of the adjacency file (option io.blocksize).
+         * The edge data is read in the blocks of the shard files.
+         */
+        void set_adj_readsize(size_t readsize) {
+            adj_readsize = std::max(readsize, (size_t) 4096);
+        }
+        
         
         std::string get_info_json() {
             std::stringstream json;
@@ -45,8 +45,10 @@
 
 #include "api/graph_objects.hpp"
 #include "metrics/metrics.hpp"
+#include "metrics/trace.hpp"
 #include "io/stripedio.hpp"
 #include "graphchi_types.hpp"
+#include "shards/deletionbitmap.hpp"
 
 
 namespace graphchi {
@@ -86,7 +88,9 @@ namespace graphchi {
         bool enable_parallel_loading;
         size_t blocksize;
         metrics &m;
+        int shard_id;
         std::vector<shard_index> index;
+        deletion_bitmap * deletions;
         
     public:
         bool only_adjacency;
@@ -100,6 +104,7 @@ namespace graphchi {
                      metrics &_m) : iomgr(iomgr), filename_edata(_filename_edata),
         filename_adj(_filename_adj),
         range_st(_range_start), range_end(_range_end), blocksize(_blocksize),  m(_m) {
+            shard_id = -1;
             adjdata = NULL;
             only_adjacency = false;
             is_loaded = false;
@@ -109,9 +114,7 @@ namespace graphchi {
             enable_parallel_loading = true;
             disable_async_writes = false;
             async_edata_loading = !svertex_t().computational_edges();
-#ifdef SUPPORT_DELETIONS
-            async_edata_loading = false; // See comment above for memshard, async_edata_loading = false;
-#endif
+            deletions = NULL;
         }
         
         ~memory_shard() {
@@ -139,11 +142,43 @@ namespace graphchi {
             disable_async_writes = b;
         }
         
+        /**
+         * Sets the shard the I/O of this shard is counted to, see io_accounting.
+         */
+        void set_shard_id(int p) {
+            shard_id = p;
+        }
+        
         void disable_parallel_loading() {
             enable_parallel_loading = false;
         }
         
+        /**
+         * Sets the deletion bitmap of the shard, owned by its sliding shard.
+         */
+        void set_deletion_bitmap(deletion_bitmap * _deletions) {
+            deletions = _deletions;
+        }
+        
+        /**
+         * Marks the edge with value at ptr deleted, if the value is in
+         * the edge data of this shard.
+         * @return true if the edge belongs to this shard
+         */
+        bool mark_deleted(ET * ptr) {
+            if (deletions == NULL || !is_loaded || edgedata == NULL) return false;
+            char * p = (char *) ptr;
+            for(int i=0; i < (int)blocksizes.size(); i++) {
+                if (edgedata[i] != NULL && p >= edgedata[i] && p < edgedata[i] + blocksizes[i]) {
+                    deletions->mark_deleted((i * blocksize + (p - edgedata[i])) / sizeof(ET));
+                    return true;
+                }
+            }
+            return false;
+        }
+        
         void commit(bool commit_inedges, bool commit_outedges) {
+            TRACE_SCOPE("memshard_commit", "shard");
             if (block_edatasessions.size() == 0 || only_adjacency) return;
             assert(is_loaded);
             metrics_entry cm = m.start_time();
@@ -270,6 +305,7 @@ namespace graphchi {
         }
         
         void load_edata() {
+            TRACE_SCOPE("memshard_load_edata", "shard");
             assert(blocksize % sizeof(ET) == 0);
             int nblocks = (int) (edatafilesize / blocksize + (edatafilesize % blocksize != 0));
             edgedata = (char **) calloc(nblocks, sizeof(char*));
@@ -295,11 +331,12 @@ namespace graphchi {
                         // Cached
                         block_edatasessions.push_back(CACHED_SESSION_ID);
                         edgedata[blockid] = (char*)cachedblock;
+                        iomgr->get_io_accounting().record_cache_hit(io_tag(IO_EDATA, shard_id), fsize);
                         if (!async_edata_loading) {
                             doneptr[blockid] = 0;
                         }
                     } else {
-                        int blocksession = iomgr->open_session(block_filename, false, true); // compressed
+                        int blocksession = iomgr->open_session(block_filename, false, true, io_tag(IO_EDATA, shard_id), MEM_MEMSHARD); // compressed
                         block_edatasessions.push_back(blocksession);
                         
                         edgedata[blockid] = NULL;
@@ -335,17 +372,13 @@ namespace graphchi {
         
         // TODO: recycle ptr!
         void load() {
+            TRACE_SCOPE("memshard_load", "shard");
             is_loaded = true;
             adjfilesize = get_filesize(filename_adj);
             
-#ifdef SUPPORT_DELETIONS
-            async_edata_loading = false;  // Currently we encode the deleted status of an edge into the edge value (should be changed!),
-            // so we need the edge data while loading
-#endif
-            
             //preada(adjf, adjdata, adjfilesize, 0);
             
-            adj_session = iomgr->open_session(filename_adj, true);
+            adj_session = iomgr->open_session(filename_adj, true, false, io_tag(IO_ADJ, shard_id), MEM_MEMSHARD);
             iomgr->managed_malloc(adj_session, &adjdata, adjfilesize, 0);
             
             /* Load in parallel: replaces older stream solution */
@@ -477,6 +510,16 @@ namespace graphchi {
                        
                         vid_t target = *((vid_t*) ptr);
                         ptr += sizeof(vid_t);
+#ifdef SUPPORT_DELETIONS
+                        if (deletions != NULL && deletions->is_deleted(edgeptr / sizeof(ET))) {
+                            if (vertex != NULL && outedges) vertex->add_deleted_outedge();
+                            if (inedges && target >= window_st && target <= window_en && prealloc[target - window_st].scheduled) {
+                                prealloc[target - window_st].add_deleted_inedge();
+                            }
+                            edgeptr += sizeof(ET);
+                            continue;
+                        }
+#endif
                         if (vertex != NULL && outedges)
                         {
                             char * eptr = (only_adjacency ? NULL  : &(edgedata[blockid][edgeptr % blocksize]));
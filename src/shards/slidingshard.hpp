@@ -46,9 +46,11 @@
 
 #include "api/graph_objects.hpp"
 #include "metrics/metrics.hpp"
+#include "metrics/trace.hpp"
 #include "logger/logger.hpp"
 #include "io/stripedio.hpp"
 #include "graphchi_types.hpp"
+#include "shards/deletionbitmap.hpp"
 
 
 namespace graphchi {
@@ -162,6 +164,7 @@ namespace graphchi {
         std::string filename_adj;
         vid_t range_st, range_end;
         size_t blocksize;
+        size_t adj_readsize;  // Size of the reads of the adjacency file
         
         vid_t curvid;
         size_t adjoffset, edataoffset, adjfilesize, edatafilesize;
@@ -173,11 +176,14 @@ namespace graphchi {
         sblock * curblock;
         sblock * curadjblock;
         metrics &m;
+        metrics_handle blockload_timer;
         
         std::map<int, indexentry> sparse_index; // Sparse index that can be created in the fly
+        deletion_bitmap * deletions;
         bool disable_writes;
         bool async_edata_loading;
         bool disable_async_writes;
+        int shard_id;
         // bool need_read_outedges; // Disabled - does not work with compressed data: whole block needs to be read.
         
         
@@ -192,8 +198,10 @@ namespace graphchi {
         range_st(_range_st),
         range_end(_range_en),
         blocksize(_blocksize),
+        adj_readsize(_blocksize),
         m(_m),
         disable_writes(_disable_writes) {
+            blockload_timer = m.register_timer("blockload");
             curvid = 0;
             adjoffset = 0;
             edataoffset = 0;
@@ -203,6 +211,8 @@ namespace graphchi {
             curadjblock = NULL;
             window_start_edataoffset = 0;
             disable_async_writes = false;
+            deletions = NULL;
+            shard_id = -1;
             
             while(blocksize % sizeof(ET) != 0) blocksize++;
             assert(blocksize % sizeof(ET)==0);
@@ -216,12 +226,14 @@ namespace graphchi {
                 // Nothing
             }
             
-            adjfile_session = iomgr->open_session(filename_adj, true);
+            adjfile_session = iomgr->open_session(filename_adj, true, false, io_tag(IO_ADJ), MEM_SLIDING_BLOCKS);
             save_offset();
             
             async_edata_loading = !svertex_t().computational_edges();
 #ifdef SUPPORT_DELETIONS
-            async_edata_loading = false; // See comment above for memshard, async_edata_loading = false;
+            if (!only_adjacency) {
+                deletions = new deletion_bitmap(filename_edata, edatafilesize / sizeof(ET));
+            }
 #endif
         }
         
@@ -238,6 +250,10 @@ namespace graphchi {
                 curadjblock = NULL;
             }
             iomgr->close_session(adjfile_session);
+            if (deletions != NULL) {
+                delete deletions;
+                deletions = NULL;
+            }
         }
         
         
@@ -245,6 +261,36 @@ namespace graphchi {
             return edatafilesize / sizeof(ET);
         }
         
+        /**
+         * Deletion bitmap of the shard, shared with the memory shard of the
+         * same shard. NULL if deletions are not supported.
+         */
+        deletion_bitmap * get_deletion_bitmap() {
+            return deletions;
+        }
+        
+        size_t num_deleted_edges() {
+            return (deletions == NULL ? 0 : deletions->num_deleted());
+        }
+        
+        /**
+         * Marks the edge with value at ptr deleted, if the value is in
+         * one of the edge data blocks of the current window.
+         * @return true if the edge belongs to this shard
+         */
+        bool mark_deleted(ET * ptr) {
+            if (deletions == NULL) return false;
+            uint8_t * p = (uint8_t *) ptr;
+            for(int i=0; i < (int)activeblocks.size(); i++) {
+                sblock &b = activeblocks[i];
+                if (b.data != NULL && p >= b.data && p < b.data + (b.end - b.offset)) {
+                    deletions->mark_deleted((b.offset + (p - b.data)) / sizeof(ET));
+                    return true;
+                }
+            }
+            return false;
+        }
+        
         // Init edge data blocks
         void initdata() {
             logstream(LOG_DEBUG) << "Initialize edge data: " << filename_edata << std::endl;
@@ -314,7 +360,7 @@ namespace graphchi {
                 void * cachedblock = iomgr->get_block_cache().get_cached(blockfilename);
                 
                 
-                int edata_session = (cachedblock == NULL ? iomgr->open_session(blockfilename, false, true) : CACHED_SESSION_ID);
+                int edata_session = (cachedblock == NULL ? iomgr->open_session(blockfilename, false, true, io_tag(IO_EDATA, shard_id), MEM_SLIDING_BLOCKS) : CACHED_SESSION_ID);
                 sblock newblock(edata_session, edata_session, true);
                 
                 // We align blocks always to the blocksize, even if that requires
@@ -327,6 +373,7 @@ namespace graphchi {
                     iomgr->managed_malloc(edata_session, &newblock.data, newblock.end - newblock.offset, newblock.offset);
                 } else {
                     newblock.data = (uint8_t*)cachedblock;
+                    iomgr->get_io_accounting().record_cache_hit(io_tag(IO_EDATA, shard_id), newblock.end - newblock.offset);
                 }
                 newblock.ptr = newblock.data + correction;
                 activeblocks.push_back(newblock);
@@ -343,14 +390,14 @@ namespace graphchi {
                 }
                 sblock * newblock = new sblock(0, adjfile_session);
                 newblock->offset = adjoffset;
-                newblock->end = std::min(adjfilesize, adjoffset+blocksize);
+                newblock->end = std::min(adjfilesize, adjoffset+adj_readsize);
                 assert(newblock->end > 0);
                 assert(newblock->end >= newblock->offset);
                 iomgr->managed_malloc(adjfile_session, &newblock->data, newblock->end - newblock->offset, adjoffset);
                 newblock->ptr = newblock->data;
-                metrics_entry me = m.start_time();
+                metrics_timer me = m.start_timer();
                 iomgr->managed_preada_now(adjfile_session, &newblock->data, newblock->end - newblock->offset, adjoffset);
-                m.stop_time(me, "blockload");
+                m.stop_timer(me, blockload_timer);
                 curadjblock = newblock;
             }
         }
@@ -442,6 +489,13 @@ namespace graphchi {
                         while(--n >= 0) {
                             bool special_edge = false;
                             vid_t target = (sizeof(ET) == sizeof(ETspecial) ? read_val<vid_t>() : translate_edge(read_val<vid_t>(), special_edge));
+#ifdef SUPPORT_DELETIONS
+                            if (deletions != NULL && deletions->is_deleted(edataoffset / sizeof(ET))) {
+                                vertex.add_deleted_outedge();
+                                skip(1, 0);  // Skips the edge value
+                                continue;
+                            }
+#endif
                             ET * evalue = (special_edge ? (ET*)read_edgeptr<ETspecial>(): read_edgeptr<ET>());
                             
                             if (!only_adjacency) {
@@ -480,6 +534,7 @@ namespace graphchi {
          * Commit modifications.
          */
         void commit(sblock &b, bool synchronously, bool disable_writes=false) {
+            TRACE_SCOPE("slidingshard_commit", "shard");
             if (disable_async_writes) synchronously = true;
             if (synchronously) {
                 metrics_entry me = m.start_time();
@@ -497,6 +552,7 @@ namespace graphchi {
          */
         void flush() {
             release_prior_to_offset(true);
+            if (deletions != NULL) deletions->save();
             if (curadjblock != NULL) {
                 curadjblock->release(iomgr);
                 delete curadjblock;
@@ -535,6 +591,22 @@ namespace graphchi {
             disable_async_writes = b;
         }
         
+        /**
+         * Sets the shard the I/O of this shard is counted to, see io_accounting.
+         */
+        void set_shard_id(int p) {
+            shard_id = p;
+            iomgr->set_session_tag(adjfile_session, io_tag(IO_ADJ, p));
+        }
+        
+        /**
+         * Sets the size of the reads of the adjacency file (option io.blocksize).
+         * The edge data is read in the blocks of the shard files.
+         */
+        void set_adj_readsize(size_t readsize) {
+            adj_readsize = std::max(readsize, (size_t) 4096);
+        }
+        
         std::string get_info_json() {
             std::stringstream json;
             json << "\"size\": ";
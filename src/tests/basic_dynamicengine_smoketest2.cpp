@@ -45,6 +45,8 @@ using namespace graphchi;
 typedef vid_t VertexDataType;
 typedef vid_t EdgeDataType;
 
+graphchi_dynamicgraph_engine<VertexDataType, EdgeDataType> * dyngraph_engine;
+
 /**
  * Smoke test. On every iteration, each vertex sets its id to be
  * id + iteration number. Vertices check whether their neighbors were
@@ -54,6 +56,7 @@ typedef vid_t EdgeDataType;
 struct SmokeTestProgram2 : public GraphChiProgram<VertexDataType, EdgeDataType> {
     
     volatile size_t ndeleted;
+    size_t live_edges;
     
     /**
      *  Vertex update function.
@@ -77,11 +80,10 @@ struct SmokeTestProgram2 : public GraphChiProgram<VertexDataType, EdgeDataType>
                 graphchi_edge<vid_t> * edge = vertex.outedge(i);
                 vid_t outedgedata = edge->get_data();
                 vid_t expected = edge->vertex_id() + gcontext.iteration - (edge->vertex_id() > vertex.id());
-                if (!is_deleted_edge_value(edge->get_data())) {
-                    if (outedgedata != expected) {
-                        logstream(LOG_ERROR) << outedgedata << " != " << expected << std::endl;
-                        assert(false);
-                    }
+                // Edges deleted on earlier iterations are not loaded anymore.
+                if (outedgedata != expected) {
+                    logstream(LOG_ERROR) << outedgedata << " != " << expected << std::endl;
+                    assert(false);
                 }
             }
             for(int i=0; i < vertex.num_inedges(); i++) {
@@ -108,6 +110,7 @@ struct SmokeTestProgram2 : public GraphChiProgram<VertexDataType, EdgeDataType>
      */
     void before_iteration(int iteration, graphchi_context &gcontext) {
         ndeleted = 0;
+        live_edges = dyngraph_engine->num_edges() - dyngraph_engine->num_deleted_edges();
     }
     
     /**
@@ -117,6 +120,13 @@ struct SmokeTestProgram2 : public GraphChiProgram<VertexDataType, EdgeDataType>
         if (gcontext.iteration > 0)
             assert(ndeleted > 0);
         logstream(LOG_INFO) << "Deleted: " << ndeleted << std::endl;
+        
+        // Every removed edge must be recorded in the deletion bitmap of its shard
+        size_t now_live = dyngraph_engine->num_edges() - dyngraph_engine->num_deleted_edges();
+        if (live_edges - now_live != ndeleted) {
+            logstream(LOG_ERROR) << "Deletion discrepancy: " << (live_edges - now_live) << " != " << ndeleted << std::endl;
+        }
+        assert(live_edges - now_live == ndeleted);
     }
     
     /**
@@ -169,6 +179,7 @@ int main(int argc, const char ** argv) {
     /* Run */
     SmokeTestProgram2 program;
     graphchi_dynamicgraph_engine<VertexDataType, EdgeDataType> engine(filename, nshards, scheduler, m); 
+    dyngraph_engine = &engine;
     engine.run(program, niters);
     
     /* Check also the vertex data is ok */
@@ -0,0 +1,167 @@
+
+
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ 
+ *
+ * @section DESCRIPTION
+ *
+ * Smoketest for the ingest server of the dynamic graph engine. A client
+ * thread streams random edges to the server through a Unix-domain socket,
+ * and the program checks that all acknowledged edges are in the graph.
+ */
+
+
+
+#include <string>
+
+#include "graphchi_basic_includes.hpp"
+#include "engine/dynamic_graphs/graphchi_dynamicgraph_engine.hpp"
+#include "engine/dynamic_graphs/ingest_server.hpp"
+
+using namespace graphchi;
+
+typedef vid_t VertexDataType;
+typedef vid_t EdgeDataType;
+
+graphchi_dynamicgraph_engine<VertexDataType, EdgeDataType> * engine;
+std::string socketpath;
+size_t accepted = 0;
+bool client_done = false;
+
+/**
+ * Counts the in-edges on the first iteration, when no edges can have been
+ * added, and on the last iteration.
+ */
+struct CountEdgesProgram : public GraphChiProgram<VertexDataType, EdgeDataType> {
+    
+    size_t first_count;
+    size_t last_count;
+    
+    CountEdgesProgram() : first_count(0), last_count(0) {}
+    
+    void update(graphchi_vertex<VertexDataType, EdgeDataType> &vertex, graphchi_context &gcontext) {
+        if (gcontext.iteration == 0) {
+            __sync_add_and_fetch(&first_count, (size_t) vertex.num_inedges());
+        } else if (gcontext.iteration == gcontext.last_iteration) {
+            __sync_add_and_fetch(&last_count, (size_t) vertex.num_inedges());
+        }
+    }
+    
+    void before_iteration(int iteration, graphchi_context &gcontext) {
+    }
+    
+    /**
+     * When the client has finished, run one more iteration.
+     */
+    void after_iteration(int iteration, graphchi_context &gcontext) {
+        if (client_done && gcontext.last_iteration < 0) {
+            gcontext.set_last_iteration(iteration + 1);
+        }
+    }
+    
+    void before_exec_interval(vid_t window_st, vid_t window_en, graphchi_context &gcontext) {        
+    }
+    
+    void after_exec_interval(vid_t window_st, vid_t window_en, graphchi_context &gcontext) {        
+    }
+    
+};
+
+void * ingest_client_run(void * info) {
+    int nbatches = get_option_int("nbatches", 50);
+    int batchsize = get_option_int("batchsize", 1000);
+    vid_t maxvid = (vid_t) engine->num_vertices() + 100;
+    
+    ingest_client<EdgeDataType> client(4);
+    bool ok = client.connect_to(socketpath);
+    assert(ok);
+    
+    std::vector< created_edge<EdgeDataType> > batch;
+    size_t sent = 0;
+    for(int b=0; b < nbatches; b++) {
+        batch.clear();
+        for(int i=0; i < batchsize; i++) {
+            vid_t src = (vid_t) (random() % maxvid);
+            vid_t dst = (vid_t) (random() % maxvid);
+            if (src == dst) dst = (dst + 1) % maxvid;
+            batch.push_back(created_edge<EdgeDataType>(src, dst, 0));
+        }
+        ok = client.send_batch(&batch[0], batch.size());
+        assert(ok);
+        sent += batch.size();
+    }
+    ok = client.flush();
+    assert(ok);
+    /* Ping: acknowledged with the server's total */
+    ok = client.send_batch(NULL, 0) && client.flush();
+    assert(ok);
+    accepted = client.last_ack().total_edges;
+    assert(accepted == sent);
+    logstream(LOG_INFO) << "Client sent " << sent << " edges, buffer occupancy "
+        << client.last_ack().occupancy_permille / 10.0 << "%" << std::endl;
+    client.disconnect();
+    client_done = true;
+    return NULL;
+}
+
+int main(int argc, const char ** argv) {
+    graphchi_init(argc, argv);
+    metrics m("ingest-server-smoketest");
+    
+    std::string filename = get_option_string("file");  // Base filename
+    int niters           = get_option_int("niters", 1000); // Upper bound, ends when the client has finished
+    socketpath           = get_option_string("ingest_socket", "/tmp/graphchi_ingest_smoketest.sock");
+    set_conf("ingest_socket", socketpath);
+    
+    int nshards          = convert_if_notexists<EdgeDataType>(filename, 
+                                                              get_option_string("nshards", "auto"));
+    
+    engine = new graphchi_dynamicgraph_engine<VertexDataType, EdgeDataType>(filename, nshards, false, m);
+    ingest_server<VertexDataType, EdgeDataType> server(engine, m);
+    bool started = server.start();
+    assert(started);
+    
+    pthread_t clientthread;
+    int ret = pthread_create(&clientthread, NULL, ingest_client_run, NULL);
+    if (ret != 0) {
+        logstream(LOG_ERROR) << "Could not start the ingest client thread: " << strerror(ret) << std::endl;
+    }
+    assert(ret == 0);
+    
+    CountEdgesProgram program;
+    engine->run(program, niters);
+    pthread_join(clientthread, NULL);
+    
+    engine->close_ingest();
+    server.stop();
+    
+    logstream(LOG_INFO) << "Edges before: " << program.first_count << " after: " << program.last_count
+        << " ingested: " << accepted << std::endl;
+    assert(server.num_ingested() == accepted);
+    assert(program.last_count == program.first_count + accepted);
+    
+    metrics_report(m);
+    delete engine;
+    
+    logstream(LOG_INFO) << "Ingest server smoketest passed successfully!" << std::endl;
+    return 0;
+}
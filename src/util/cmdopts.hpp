@@ -32,6 +32,7 @@
 
 #include <string>
 #include <iostream>
+#include <set>
 #include <stdint.h>
 
 #include "api/chifilenames.hpp"
@@ -52,6 +53,7 @@ namespace graphchi {
     static int _argc;
     static char **_argv;
     static std::map<std::string, std::string> conf;
+    static std::set<std::string> cmdline_keys; // Keys of the --key=value arguments
     
     
     static void VARIABLE_IS_NOT_USED set_conf(std::string key, std::string value) {
@@ -130,6 +132,7 @@ namespace graphchi {
                     
                     std::cout << "[" << key << "]" << " => " << "[" << val << "]" << std::endl;
                     conf[key] = val;
+                    cmdline_keys.insert(key);
                 }
             }
         }
@@ -137,9 +140,18 @@ namespace graphchi {
     }
     
     static void graphchi_init(int argc, const char ** argv);
-    static void graphchi_init(int argc, const char ** argv) {
-        set_argc(argc, argv);
-            }
+    
+    /**
+     * Returns true if the option was given on the command line, either
+     * as --key=value or as a key value pair.
+     */
+    static bool VARIABLE_IS_NOT_USED is_cmdline_option(const char *option_name) {
+        if (cmdline_keys.find(option_name) != cmdline_keys.end()) return true;
+        for (int i = _argc - 2; i >= 0; i -= 1)
+            if (strcmp(_argv[i], option_name) == 0)
+                return true;
+        return false;
+    }
     
     static void check_cmd_init() {
         if (!_cmd_configured) {
@@ -248,6 +260,12 @@ namespace graphchi {
         return (float) get_config_option_double(option_name, default_value);
     }
     
+    static void graphchi_init(int argc, const char ** argv) {
+        set_argc(argc, argv);
+        /* Log lines are written by a background thread, see logger.hpp */
+        global_logger().set_async(get_option_int("log_async", 1) == 1);
+    }
+    
 } // End namespace
 
 
@@ -11,23 +11,127 @@
 
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <cstdio>
+#include <string>
+#include <vector>
+#include <algorithm>
 #include <sys/time.h>
 #include <time.h>
 
+/**
+ * Random numbers of the random graphs. Same sequence for the same seed
+ * on every platform, so the benchmark graphs are reproducible.
+ */
+class splitmix64 {
+    uint64_t state;
+public:
+    splitmix64(uint64_t seed) : state(seed) {}
+    
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+    
+    /* Uniform in [0, 1) */
+    double uniform() {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+};
+
 int main(int argc, const char ** argv) {
     if (argc < 3) {
-        printf("Usage: generate type n\n");
+        printf("Usage: generate type n [nedges] [seed] [outputfile]\n");
+        printf("  type: chain, grid, crossgrid, cubegrid, quadgrid (n per dimension),\n");
+        printf("        rmat (2^n vertices), erdosrenyi (n vertices),\n");
+        printf("        ratings (n users, n/4 items, matrix market)\n");
+        printf("  nedges: edges of the random graphs (default 16 per vertex)\n");
         return 1;
     }
     
     std::string type = argv[1];
     int n = atoi(argv[2]);
-    
+    uint64_t nvertices = (type == "rmat" ? (1ULL << n) : (uint64_t) n);
+    uint64_t nedges = (argc > 3 ? strtoull(argv[3], NULL, 10) : 16 * nvertices);
+    uint64_t seed = (argc > 4 ? strtoull(argv[4], NULL, 10) : 1);
+    splitmix64 rnd(seed);
     
     char filename[1024];
-    sprintf(filename, "%s_%d.edgelist", type.c_str(), n);
+    if (argc > 5) {
+        snprintf(filename, sizeof(filename), "%s", argv[5]);
+    } else {
+        sprintf(filename, "%s_%d.%s", type.c_str(), n, (type == "ratings" ? "mm" : "edgelist"));
+    }
     FILE * f = fopen(filename, "w");
+    if (f == NULL) {
+        printf("Could not open %s\n", filename);
+        return 1;
+    }
+    
+    std::vector<std::pair<uint64_t, uint64_t> > edges;
+    
+    /* Recursive matrix (Chakrabarti et al. 2004) with the Graph500 parameters */
+    if (type == "rmat") {
+        const double a = 0.57, b = 0.19, c = 0.19;
+        for(uint64_t e=0; e < nedges; e++) {
+            uint64_t src, dst;
+            do {
+                src = dst = 0;
+                for(int level=0; level < n; level++) {
+                    double r = rnd.uniform();
+                    src <<= 1;
+                    dst <<= 1;
+                    if (r < a) {
+                    } else if (r < a + b) {
+                        dst |= 1;
+                    } else if (r < a + b + c) {
+                        src |= 1;
+                    } else {
+                        src |= 1;
+                        dst |= 1;
+                    }
+                }
+            } while (src == dst);
+            edges.push_back(std::pair<uint64_t, uint64_t>(src, dst));
+        }
+    }
+    
+    /* G(n, m): m edges with uniformly random endpoints */
+    if (type == "erdosrenyi") {
+        for(uint64_t e=0; e < nedges; e++) {
+            uint64_t src, dst;
+            do {
+                src = rnd.next() % nvertices;
+                dst = rnd.next() % nvertices;
+            } while (src == dst);
+            edges.push_back(std::pair<uint64_t, uint64_t>(src, dst));
+        }
+    }
+    
+    /* Random graphs are written without duplicate edges, as the engines with
+       dynamic edge data do not accept them. So they may have slightly fewer
+       than nedges edges. */
+    if (!edges.empty()) {
+        std::sort(edges.begin(), edges.end());
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+        for(size_t i=0; i < edges.size(); i++) {
+            fprintf(f, "%llu %llu\n", (unsigned long long) edges[i].first, (unsigned long long) edges[i].second);
+        }
+    }
+    
+    /* Bipartite rating matrix for matrix factorization, ratings 1-5 */
+    if (type == "ratings") {
+        uint64_t nitems = (nvertices / 4 > 0 ? nvertices / 4 : 1);
+        fprintf(f, "%%%%MatrixMarket matrix coordinate real general\n");
+        fprintf(f, "%llu %llu %llu\n", (unsigned long long) nvertices, (unsigned long long) nitems, (unsigned long long) nedges);
+        for(uint64_t e=0; e < nedges; e++) {
+            uint64_t user = rnd.next() % nvertices;
+            uint64_t item = rnd.next() % nitems;
+            fprintf(f, "%llu %llu %d\n", (unsigned long long) user + 1, (unsigned long long) item + 1, (int) (1 + rnd.next() % 5));
+        }
+    }
     
     if (type == "chain") {
         for(int x=0; x<n - 1; x++) {
@@ -108,4 +212,6 @@ int main(int argc, const char ** argv) {
     }
     
     fclose(f);
+    printf("Wrote %s\n", filename);
+    return 0;
 }
\ No newline at end of file
@@ -0,0 +1,271 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Intersection of sorted lists of vertex ids, for example adjacency lists
+ * in triangle counting. The lists must be strictly increasing (no duplicates).
+ *
+ * Each function calls match(i, j) for every common id, where a[i] == b[j],
+ * in increasing order of the id, and returns the number of common ids.
+ *
+ *   intersect_merge     merge, with SSE2 block compares when available:
+ *                       blocks of four ids of both lists are compared
+ *                       all-against-all, and the block with the smaller
+ *                       last id is advanced.
+ *   intersect_gallop    for each id of the shorter list, exponential and
+ *                       binary search in the longer one. For lists of very
+ *                       different lengths.
+ *   intersect           chooses between the two by the ratio of the lengths.
+ *   sorted_id_bitmap    bitmap of one list, probed with the ids of the other.
+ *                       For a list that is intersected with many others.
+ */
+
+#ifndef DEF_GRAPHCHI_INTERSECTION
+#define DEF_GRAPHCHI_INTERSECTION
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "graphchi_types.hpp"
+
+#ifdef __GNUC__
+#define VARIABLE_IS_NOT_USED __attribute__ ((unused))
+#else
+#define VARIABLE_IS_NOT_USED
+#endif
+
+/* Merge when the longer list is at most this many times longer than the shorter */
+#define INTERSECTION_GALLOP_RATIO 32
+
+namespace graphchi {
+
+    struct null_match {
+        inline void operator()(size_t, size_t) {}
+    };
+
+    template <typename Match>
+    static size_t intersect_merge_scalar(const vid_t * a, size_t na, const vid_t * b, size_t nb, Match &match,
+                                         size_t i = 0, size_t j = 0) {
+        size_t count = 0;
+        while (i < na && j < nb) {
+            vid_t x = a[i], y = b[j];
+            if (x == y) {
+                match(i, j);
+                count++;
+                i++; j++;
+            } else {
+                i += x < y;
+                j += x > y;
+            }
+        }
+        return count;
+    }
+
+    template <typename Match>
+    static size_t intersect_merge(const vid_t * a, size_t na, const vid_t * b, size_t nb, Match &match) {
+#if defined(__SSE2__)
+        size_t i = 0, j = 0, count = 0;
+        if (na >= 4 && nb >= 4) {
+            size_t na4 = na & ~(size_t)3, nb4 = nb & ~(size_t)3;
+            while (i < na4 && j < nb4) {
+                __m128i va = _mm_loadu_si128((const __m128i *) (a + i));
+                __m128i vb = _mm_loadu_si128((const __m128i *) (b + j));
+                /* Compare with the four rotations of the block of b */
+                __m128i eq = _mm_cmpeq_epi32(va, vb);
+                eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1))));
+                eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))));
+                eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3))));
+                int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+                while (mask != 0) {
+                    int k = __builtin_ctz(mask);
+                    mask &= mask - 1;
+                    vid_t x = a[i + k];
+                    int l = 0;
+                    while (b[j + l] != x) l++;
+                    match(i + k, j + l);
+                    count++;
+                }
+                vid_t amax = a[i + 3], bmax = b[j + 3];
+                i += (amax <= bmax) ? 4 : 0;
+                j += (bmax <= amax) ? 4 : 0;
+            }
+        }
+        /* The ids before i and j are all compared, finish the tails */
+        return count + intersect_merge_scalar(a, na, b, nb, match, i, j);
+#else
+        return intersect_merge_scalar(a, na, b, nb, match);
+#endif
+    }
+
+    /**
+     * Index of the first id >= x in b[lo..nb), searching exponentially from lo.
+     */
+    static inline size_t gallop_lower_bound(const vid_t * b, size_t lo, size_t nb, vid_t x) {
+        size_t step = 1;
+        size_t hi = lo;
+        while (hi < nb && b[hi] < x) {
+            lo = hi + 1;
+            hi += step;
+            step *= 2;
+        }
+        if (hi > nb) hi = nb;
+        while (lo < hi) {
+            size_t m = lo + (hi - lo) / 2;
+            if (b[m] < x) lo = m + 1;
+            else hi = m;
+        }
+        return lo;
+    }
+
+    template <typename Match>
+    struct swapped_match {
+        Match &match;
+        swapped_match(Match &match) : match(match) {}
+        inline void operator()(size_t i, size_t j) { match(j, i); }
+    };
+
+    template <typename Match>
+    static size_t intersect_gallop_shorter(const vid_t * a, size_t na, const vid_t * b, size_t nb, Match &match) {
+        size_t count = 0;
+        size_t j = 0;
+        for(size_t i=0; i < na && j < nb; i++) {
+            j = gallop_lower_bound(b, j, nb, a[i]);
+            if (j < nb && b[j] == a[i]) {
+                match(i, j);
+                count++;
+                j++;
+            }
+        }
+        return count;
+    }
+
+    /**
+     * Galloping intersection: the ids of the shorter list are searched in the longer.
+     */
+    template <typename Match>
+    static size_t intersect_gallop(const vid_t * a, size_t na, const vid_t * b, size_t nb, Match &match) {
+        if (na > nb) {
+            swapped_match<Match> sm(match);
+            return intersect_gallop_shorter(b, nb, a, na, sm);
+        }
+        return intersect_gallop_shorter(a, na, b, nb, match);
+    }
+
+    template <typename Match>
+    static size_t intersect(const vid_t * a, size_t na, const vid_t * b, size_t nb, Match &match) {
+        if (na == 0 || nb == 0) return 0;
+        if (na * INTERSECTION_GALLOP_RATIO < nb || nb * INTERSECTION_GALLOP_RATIO < na) {
+            return intersect_gallop(a, na, b, nb, match);
+        }
+        return intersect_merge(a, na, b, nb, match);
+    }
+
+    static size_t VARIABLE_IS_NOT_USED intersection_size(const vid_t * a, size_t na, const vid_t * b, size_t nb) {
+        null_match nm;
+        return intersect(a, na, b, nb, nm);
+    }
+
+    /**
+     * Bitmap of a sorted list over the range of its ids. Probing costs one
+     * lookup per id of the other list, independent of the length of this
+     * one, so it pays off when the list is intersected with many others.
+     */
+    class sorted_id_bitmap {
+        const vid_t * ids;
+        size_t n;
+        vid_t first;
+        size_t nwords;
+        size_t capacity;  // Words allocated; the bitmap is reused across builds
+        uint64_t * bits;
+
+    public:
+        sorted_id_bitmap() : ids(NULL), n(0), first(0), nwords(0), capacity(0), bits(NULL) {}
+
+        ~sorted_id_bitmap() {
+            free(bits);
+        }
+
+        /**
+         * Bytes of the bitmap of a list, to decide whether to build one.
+         */
+        static size_t bytes_for(const vid_t * ids, size_t n) {
+            if (n == 0) return 0;
+            return ((size_t) (ids[n - 1] - ids[0]) / 64 + 1) * sizeof(uint64_t);
+        }
+
+        void build(const vid_t * _ids, size_t _n) {
+            ids = _ids;
+            n = _n;
+            if (n == 0) return;
+            first = ids[0];
+            size_t words = (size_t) (ids[n - 1] - first) / 64 + 1;
+            if (words > capacity) {
+                bits = (uint64_t *) realloc(bits, words * sizeof(uint64_t));
+                assert(bits != NULL);
+                capacity = words;
+            }
+            nwords = words;
+            memset(bits, 0, nwords * sizeof(uint64_t));
+            for(size_t i=0; i < n; i++) {
+                vid_t d = ids[i] - first;
+                bits[d / 64] |= (uint64_t)1 << (d % 64);
+            }
+        }
+
+        inline bool contains(vid_t x) const {
+            if (n == 0 || x < first) return false;
+            size_t d = x - first;
+            if (d / 64 >= nwords) return false;
+            return (bits[d / 64] >> (d % 64)) & 1;
+        }
+
+        /**
+         * Intersects the list of the bitmap, from index from on, with b.
+         * Calls match(i, j) with i the index in the list of the bitmap.
+         */
+        template <typename Match>
+        size_t intersect(size_t from, const vid_t * b, size_t nb, Match &match) const {
+            if (from >= n) return 0;
+            vid_t lo = ids[from];
+            size_t count = 0;
+            size_t i = from;
+            for(size_t j=0; j < nb; j++) {
+                vid_t x = b[j];
+                if (x < lo || !contains(x)) continue;
+                i = gallop_lower_bound(ids, i, n, x);
+                match(i, j);
+                count++;
+            }
+            return count;
+        }
+    };
+
+}
+
+#endif
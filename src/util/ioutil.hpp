@@ -198,9 +198,10 @@ size_t write_compressed(int f, T * tbuf, size_t nbytes) {
 
 }
 
-/* Zlib-inflated read. Assume tbuf is correctly sized memory block. */
+/* Zlib-inflated read. Assume tbuf is correctly sized memory block.
+   Returns the number of compressed bytes read. */
 template <typename T>
-void read_compressed(int f, T * tbuf, size_t nbytes) {
+size_t read_compressed(int f, T * tbuf, size_t nbytes) {
 #ifndef GRAPHCHI_DISABLE_COMPRESSION
     unsigned char * buf = (unsigned char*)tbuf;
     int ret;
@@ -259,8 +260,10 @@ void read_compressed(int f, T * tbuf, size_t nbytes) {
     /* clean up and return */
     (void)inflateEnd(&strm);
     free(in);
+    return fsize;
 #else
     preada(f, tbuf, nbytes, 0);
+    return nbytes;
 #endif
 }
 
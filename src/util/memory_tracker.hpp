@@ -0,0 +1,245 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Memory tracker: attributes the live bytes of the large allocations of
+ * the engine to components (block cache, sliding shard blocks, memory shard,
+ * vertex and degree chunks, the vertex objects of the window, chivector
+ * extensions, buffers of pending writes, edge buffers of the dynamic engine),
+ * and keeps the peak of their total. The engine compares the total to
+ * membudget_mb when it sizes the windows and the block cache.
+ *
+ * Blocks handed through the I/O manager are tracked by their pointers, so a
+ * block can move from one component to another (for example from a memory
+ * shard to the block cache, or to the queue of pending writes). Only large
+ * blocks are tracked this way, so the lock of the pointer table is cheap
+ * compared to the I/O.
+ */
+
+#ifndef DEF_GRAPHCHI_MEMORY_TRACKER
+#define DEF_GRAPHCHI_MEMORY_TRACKER
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <map>
+#include <string>
+
+#include "util/pthread_tools.hpp"
+
+namespace graphchi {
+
+    enum mem_component {
+        MEM_BLOCK_CACHE, MEM_SLIDING_BLOCKS, MEM_MEMSHARD, MEM_VERTEX_CHUNK, MEM_DEGREE_CHUNK,
+        MEM_VERTICES, MEM_CHIVECTOR, MEM_IO_BUFFERS, MEM_EDGE_BUFFERS, MEM_OTHER,
+        MEM_NCOMPONENTS
+    };
+
+    class memory_tracker {
+
+        volatile size_t live[MEM_NCOMPONENTS];
+        volatile size_t peak[MEM_NCOMPONENTS];
+        volatile size_t total;
+        volatile size_t total_peak;
+        volatile size_t phase_peak;
+        size_t budget;
+        mutex lock;
+        std::map<void *, std::pair<int, size_t> > blocks;
+
+        memory_tracker() : total(0), total_peak(0), phase_peak(0), budget(0) {
+            for(int c=0; c < MEM_NCOMPONENTS; c++) {
+                live[c] = 0;
+                peak[c] = 0;
+            }
+        }
+
+        static inline void update_max(volatile size_t * target, size_t value) {
+            size_t cur = *target;
+            while(value > cur) {
+                if (__sync_bool_compare_and_swap(target, cur, value)) break;
+                cur = *target;
+            }
+        }
+
+    public:
+
+        static memory_tracker &instance() {
+            static memory_tracker t;
+            return t;
+        }
+
+        static const char * component_name(int component) {
+            switch(component) {
+                case MEM_BLOCK_CACHE: return "block_cache";
+                case MEM_SLIDING_BLOCKS: return "sliding_blocks";
+                case MEM_MEMSHARD: return "memshard";
+                case MEM_VERTEX_CHUNK: return "vertex_chunk";
+                case MEM_DEGREE_CHUNK: return "degree_chunk";
+                case MEM_VERTICES: return "vertices";
+                case MEM_CHIVECTOR: return "chivector";
+                case MEM_IO_BUFFERS: return "io_buffers";
+                case MEM_EDGE_BUFFERS: return "edge_buffers";
+                case MEM_OTHER: return "other";
+            }
+            return "unknown";
+        }
+
+        /**
+         * Sets the memory budget in bytes, 0 for none.
+         */
+        void set_budget(size_t bytes) {
+            budget = bytes;
+        }
+
+        size_t get_budget() const {
+            return budget;
+        }
+
+        inline void allocated(int component, size_t bytes) {
+            size_t c = __sync_add_and_fetch(&live[component], bytes);
+            update_max(&peak[component], c);
+            size_t t = __sync_add_and_fetch(&total, bytes);
+            update_max(&total_peak, t);
+            update_max(&phase_peak, t);
+        }
+
+        inline void released(int component, size_t bytes) {
+            assert(live[component] >= bytes);
+            __sync_sub_and_fetch(&live[component], bytes);
+            __sync_sub_and_fetch(&total, bytes);
+        }
+
+        /**
+         * Sets the live bytes of a component that is measured rather than tracked.
+         */
+        void set(int component, size_t bytes) {
+            size_t old = live[component];
+            if (bytes > old) allocated(component, bytes - old);
+            else released(component, old - bytes);
+        }
+
+        /**
+         * Tracks an allocated block.
+         */
+        void track(int component, void * ptr, size_t bytes) {
+            if (ptr == NULL) return;
+            lock.lock();
+            std::pair<int, size_t> &b = blocks[ptr];
+            if (b.second > 0) released(b.first, b.second);  // Freed without untrack()
+            b = std::pair<int, size_t>(component, bytes);
+            allocated(component, bytes);
+            lock.unlock();
+        }
+
+        /**
+         * Stops tracking a block that is freed. Blocks that are not tracked are ignored.
+         */
+        void untrack(void * ptr) {
+            if (ptr == NULL) return;
+            lock.lock();
+            std::map<void *, std::pair<int, size_t> >::iterator it = blocks.find(ptr);
+            if (it != blocks.end()) {
+                released(it->second.first, it->second.second);
+                blocks.erase(it);
+            }
+            lock.unlock();
+        }
+
+        /**
+         * Moves a tracked block to another component.
+         */
+        void transfer(void * ptr, int component) {
+            if (ptr == NULL) return;
+            lock.lock();
+            std::map<void *, std::pair<int, size_t> >::iterator it = blocks.find(ptr);
+            if (it != blocks.end() && it->second.first != component) {
+                released(it->second.first, it->second.second);
+                allocated(component, it->second.second);
+                it->second.first = component;
+            }
+            lock.unlock();
+        }
+
+        size_t live_bytes(int component) const {
+            return live[component];
+        }
+
+        size_t peak_bytes(int component) const {
+            return peak[component];
+        }
+
+        size_t total_bytes() const {
+            return total;
+        }
+
+        size_t total_peak_bytes() const {
+            return total_peak;
+        }
+
+        bool over_budget() const {
+            return budget > 0 && total > budget;
+        }
+
+        /**
+         * Returns the peak of the total since the previous call, and
+         * starts a new phase.
+         */
+        size_t end_phase() {
+            size_t p = phase_peak;
+            phase_peak = total;
+            return p;
+        }
+
+        /**
+         * Memory for a window of vertices: the budget less the live bytes of
+         * the components that stay resident over the window. The memory shard
+         * and the vertices are not counted, as the window estimate includes them.
+         * @param minbytes the window is given at least this much
+         */
+        size_t window_budget(size_t membudget, size_t minbytes) const {
+            size_t excluded = live[MEM_MEMSHARD] + live[MEM_VERTICES];
+            size_t resident = (total > excluded ? total - excluded : 0);
+            if (resident + minbytes >= membudget) return minbytes;
+            return membudget - resident;
+        }
+
+        /**
+         * Resident set size of the process, from /proc/self/statm. Zero if
+         * not available.
+         */
+        static size_t rss_bytes() {
+            FILE * f = fopen("/proc/self/statm", "r");
+            if (f == NULL) return 0;
+            unsigned long pages = 0, resident = 0;
+            int n = fscanf(f, "%lu %lu", &pages, &resident);
+            fclose(f);
+            if (n != 2) return 0;
+            return (size_t) resident * (size_t) sysconf(_SC_PAGESIZE);
+        }
+    };
+
+}
+
+#endif
@@ -286,7 +286,7 @@ struct ItemDistanceProgram : public GraphChiProgram<VertexDataType, EdgeDataType
         double dist = adjcontainer->calc_distance(v, i, distance_metric);
         item_pairs_compared++;
         if (item_pairs_compared % 1000000 == 0)
-          logstream(LOG_INFO)<< std::setw(10) << mytimer.current_time() << ")  " << std::setw(10) << item_pairs_compared << " pairs compared " << std::endl;
+          logstream_ratelimited(LOG_INFO, 1)<< std::setw(10) << mytimer.current_time() << ")  " << std::setw(10) << item_pairs_compared << " pairs compared " << std::endl;
         if (debug)
           printf("comparing %d to pivot %d distance is %lg\n", i+ 1, v.id() + 1, dist);
         if (dist != 0){
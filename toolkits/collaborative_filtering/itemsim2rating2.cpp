@@ -290,7 +290,7 @@ struct ItemDistanceProgram : public GraphChiProgram<VertexDataType, edge_data> {
         item_pairs_compared++;
 
         if (item_pairs_compared % 1000000 == 0)
-          logstream(LOG_INFO)<< std::setw(10) << mytimer.current_time() << ")  " << std::setw(10) << item_pairs_compared << " pairs compared " << std::setw(10) << sum(written_pairs) << std::endl;
+          logstream_ratelimited(LOG_INFO, 1)<< std::setw(10) << mytimer.current_time() << ")  " << std::setw(10) << item_pairs_compared << " pairs compared " << std::setw(10) << sum(written_pairs) << std::endl;
       }
     }//end of iteration % 2 == 1 
   }//end of update function